@@ -0,0 +1,721 @@
+#define DOCTEST_CONFIG_IMPLEMENT
+
+#include "Batch.h"
+#include "CPU.h"
+#include "FrameChannel.h"
+#include "GameBoy.h"
+#include "IORegisters.h"
+#include "Opcodes.h"
+#include "SimpleMemory.h"
+#include "VecEnv.h"
+
+#include "doctest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Every result is the median of this many timed runs, after one untimed
+// warm-up run. Workloads are fixed, so runs are comparable across builds.
+#define BENCH_REPETITIONS 5
+
+#define PROGRAM_START INIT_VECTOR
+#define PROGRAM_END 0x4000
+#define SUBROUTINE_ADDRESS 0x5000
+
+struct BenchResult {
+    std::string name;
+    std::string unit;        // What operations counts.
+    uint64_t operations;     // Per run.
+    uint64_t machineCycles;  // Per run; 0 where it doesn't apply.
+    std::vector<double> seconds;
+
+    double median() const {
+        std::vector<double> sorted(seconds);
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+};
+
+static std::vector<BenchResult> g_results;
+
+template<typename Body>
+static void measure(BenchResult& result, Body body) {
+    typedef std::chrono::steady_clock Clock;
+
+    body();
+
+    for (int i = 0; i < BENCH_REPETITIONS; i++) {
+        const auto start = Clock::now();
+        body();
+        result.seconds.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+    }
+
+    g_results.push_back(result);
+}
+
+static std::string jsonEscape(const std::string& value) {
+    std::string escaped;
+    for (const char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+static void writeJSON(std::ostream& out) {
+    out << "{\n";
+    out << "  \"suite\": \"gameboy-emulator\",\n";
+    out << "  \"compiler\": \"" << jsonEscape(__VERSION__) << "\",\n";
+#ifdef __OPTIMIZE__
+    out << "  \"optimized\": true,\n";
+#else
+    out << "  \"optimized\": false,\n";
+#endif
+#ifdef GB_ALU_TABLES
+    out << "  \"alu_tables\": true,\n";
+#else
+    out << "  \"alu_tables\": false,\n";
+#endif
+    out << "  \"repetitions\": " << BENCH_REPETITIONS << ",\n";
+    out << "  \"benchmarks\": [\n";
+
+    for (size_t i = 0; i < g_results.size(); i++) {
+        const auto& result = g_results[i];
+        const double seconds = result.median();
+
+        out << "    {\n";
+        out << "      \"name\": \"" << jsonEscape(result.name) << "\",\n";
+        out << "      \"unit\": \"" << result.unit << "\",\n";
+        out << "      \"operations\": " << result.operations << ",\n";
+        out << "      \"machine_cycles\": " << result.machineCycles << ",\n";
+        out << "      \"median_seconds\": " << seconds << ",\n";
+        out << "      \"ns_per_operation\": " << seconds * 1e9 / result.operations << ",\n";
+        out << "      \"millions_per_second\": " << result.operations / seconds / 1e6 << ",\n";
+        out << "      \"samples\": [";
+        for (size_t j = 0; j < result.seconds.size(); j++) {
+            out << (j ? ", " : "") << result.seconds[j];
+        }
+        out << "]\n";
+        out << "    }" << (i + 1 < g_results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n";
+    out << "}\n";
+}
+
+// CPU Workloads //////////////////////////////////////////////////////////////
+
+// Fills PROGRAM_START..PROGRAM_END with copies of body and closes the block
+// with a JP back to the start. Returns the number of body copies.
+static unsigned layOutProgram(SimpleMemory& memory, const std::vector<uint8_t>& body) {
+    unsigned copies = 0;
+    uint16_t address = PROGRAM_START;
+    while (address + body.size() + 3 <= PROGRAM_END) {
+        memory.write(address, body);
+        address += body.size();
+        copies++;
+    }
+
+    memory.write(address, { Opcode::JP_NN, PROGRAM_START & 0xff, PROGRAM_START >> 8 });
+    memory.write(SUBROUTINE_ADDRESS, { Opcode::RET });
+    memory.write(0x0038, { Opcode::RET });
+    return copies;
+}
+
+static void primeRegisters(CPU& cpu) {
+    cpu._regA = 0x12;
+    cpu._regB = 0x34;
+    cpu._regC = 0x56;
+    cpu._regD = 0xc1;
+    cpu._regE = 0x00;
+    cpu.regHL(0xc000);
+    cpu._flags = 0x00;
+}
+
+// Clock ticks from one landing on PROGRAM_START to the next. Workloads are
+// straight-line, so this is the exact period of one block.
+template<typename Clock>
+static uint64_t blockPeriod(const uint16_t& programCounter, Clock clock) {
+    uint64_t landings[2] = { 0, 0 };
+    uint64_t ticks = 0;
+    uint16_t previous = programCounter;
+
+    for (int landing = 0; landing < 2; ticks++) {
+        clock();
+        if (programCounter == PROGRAM_START && previous != PROGRAM_START) {
+            landings[landing++] = ticks;
+        }
+        previous = programCounter;
+    }
+
+    return landings[1] - landings[0];
+}
+
+// The CPU's own clock, with its timing picked once rather than every tick, as
+// GameBoy::runFrame() does.
+template<class Timing>
+static void runTicks(CPU& cpu, uint64_t ticks) {
+    for (uint64_t i = 0; i < ticks; i++) {
+        cpu.clock<Timing>();
+    }
+}
+
+static void benchCPUWorkload(const char* name, const std::vector<uint8_t>& body, unsigned bodyInstructions) {
+    auto memory = std::make_shared<SimpleMemory>();
+    const unsigned copies = layOutProgram(*memory, body);
+    const uint64_t instructionsPerBlock = (uint64_t)copies * bodyInstructions + 1;
+
+    CPU calibration(memory);
+    primeRegisters(calibration);
+    const uint64_t ticksPerBlock = blockPeriod(calibration._programCounter, [&]() { calibration.clock(); });
+
+    // Roughly 2^24 ticks per run, in whole blocks.
+    const uint64_t blocks = std::max<uint64_t>(1, (1ULL << 24) / ticksPerBlock);
+    const uint64_t ticks = blocks * ticksPerBlock;
+
+    BenchResult result;
+    result.name = std::string("cpu/") + name;
+    result.unit = "instructions";
+    result.operations = blocks * instructionsPerBlock;
+    result.machineCycles = ticks / CLOCK_CYCLES_PER_MACHINE_CYCLE;
+
+    measure(result, [&]() {
+        auto runMemory = std::make_shared<SimpleMemory>(*memory);
+        CPU cpu(runMemory);
+        primeRegisters(cpu);
+        if (cpu.accurateTiming()) {
+            runTicks<AccurateTiming>(cpu, ticks);
+        } else {
+            runTicks<FastTiming>(cpu, ticks);
+        }
+        CHECK(cpu._stackPointer == INIT_STACK_POINTER);
+    });
+}
+
+TEST_CASE("cpu loads") {
+    benchCPUWorkload("loads", {
+        Opcode::LD_B_C,
+        Opcode::LD_A_aHL,
+        Opcode::LD_aHL_A,
+        Opcode::LD_D_n, 0xc1,
+        Opcode::LDH_A_afN, 0x80,
+        Opcode::LD_A_aDE,
+        Opcode::LD_BC_NN, 0x34, 0x12,
+    }, 7);
+}
+
+TEST_CASE("cpu alu") {
+    benchCPUWorkload("alu", {
+        Opcode::ADD_A_B,
+        Opcode::ADC_A_C,
+        Opcode::SUB_D,
+        Opcode::AND_E,
+        Opcode::XOR_H,
+        Opcode::OR_L,
+        Opcode::CP_N, 0x42,
+        Opcode::INC_A,
+        Opcode::DEC_B,
+        Opcode::ADD_HL_BC,
+        Opcode::INC_DE,
+    }, 11);
+}
+
+// Only the instructions whose flags come from the ALU tables when built with
+// ENABLE_ALU_TABLES; compare against a build without it.
+TEST_CASE("cpu alu flags") {
+    benchCPUWorkload("alu-flags", {
+        Opcode::ADD_A_B,
+        Opcode::ADC_A_D,
+        Opcode::DAA,
+        Opcode::SUB_C,
+        Opcode::SBC_A_E,
+        Opcode::CP_H,
+        Opcode::INC_L,
+        Opcode::DEC_C,
+        Opcode::DAA,
+    }, 9);
+}
+
+TEST_CASE("cpu cb bit ops") {
+    benchCPUWorkload("cb", {
+        Opcode::PREFIX_CB, 0x47, // BIT 0, A
+        Opcode::PREFIX_CB, 0xc0, // SET 0, B
+        Opcode::PREFIX_CB, 0x81, // RES 0, C
+        Opcode::PREFIX_CB, 0x11, // RL C
+        Opcode::PREFIX_CB, 0x37, // SWAP A
+        Opcode::PREFIX_CB, 0x3f, // SRL A
+        Opcode::PREFIX_CB, 0x46, // BIT 0, (HL)
+    }, 7);
+}
+
+TEST_CASE("cpu jumps and calls") {
+    benchCPUWorkload("jumps", {
+        Opcode::CALL_NN, SUBROUTINE_ADDRESS & 0xff, SUBROUTINE_ADDRESS >> 8,
+        Opcode::JR_N, 0x00,
+        Opcode::OR_N, 0x01, // Clears Z so the JR below is taken.
+        Opcode::JR_NZ_N, 0x00,
+        Opcode::RST_38,
+    }, 7); // Including the two RETs.
+}
+
+TEST_CASE("cpu stack") {
+    benchCPUWorkload("stack", {
+        Opcode::PUSH_BC,
+        Opcode::PUSH_DE,
+        Opcode::POP_HL,
+        Opcode::POP_BC,
+    }, 4);
+}
+
+// Memory Bus /////////////////////////////////////////////////////////////////
+
+#define BUS_ACCESSES (1 << 22)
+
+// Deterministic pseudo-random addresses within [base, base + size).
+static std::vector<uint16_t> addressPattern(uint16_t base, uint16_t size) {
+    std::vector<uint16_t> addresses(4096);
+    uint32_t state = 0x2545f491;
+    for (auto& address : addresses) {
+        state = state * 1664525 + 1013904223;
+        address = base + (uint16_t)((state >> 16) % size);
+    }
+    return addresses;
+}
+
+static void benchBusRead(const char* name, Memory& memory, uint16_t base, uint16_t size) {
+    const auto addresses = addressPattern(base, size);
+
+    BenchResult result;
+    result.name = std::string("bus/read/") + name;
+    result.unit = "accesses";
+    result.operations = BUS_ACCESSES;
+    result.machineCycles = 0;
+
+    measure(result, [&]() {
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < BUS_ACCESSES; i++) {
+            sum += memory.read(addresses[i & (addresses.size() - 1)]);
+        }
+        CHECK(sum <= 0xff * (uint32_t)BUS_ACCESSES);
+    });
+}
+
+static void benchBusWrite(const char* name, Memory& memory, uint16_t base, uint16_t size) {
+    const auto addresses = addressPattern(base, size);
+
+    BenchResult result;
+    result.name = std::string("bus/write/") + name;
+    result.unit = "accesses";
+    result.operations = BUS_ACCESSES;
+    result.machineCycles = 0;
+
+    measure(result, [&]() {
+        for (uint32_t i = 0; i < BUS_ACCESSES; i++) {
+            memory.write(addresses[i & (addresses.size() - 1)], (uint8_t)i);
+        }
+    });
+}
+
+TEST_CASE("bus simple memory") {
+    SimpleMemory memory;
+    benchBusRead("simple", memory, 0x0000, 0xffff);
+    benchBusWrite("simple", memory, 0x0000, 0xffff);
+}
+
+TEST_CASE("bus mmu") {
+    // LCD off, so VRAM and OAM stay accessible throughout.
+    MMU mmu(std::vector<uint8_t>(0x8000));
+
+    benchBusRead("rom", mmu, 0x0000, 0x8000);
+    benchBusRead("vram", mmu, 0x8000, 0x2000);
+    benchBusRead("wram", mmu, 0xc000, 0x2000);
+    benchBusRead("io", mmu, 0xff00, 0x0080);
+    benchBusRead("hram", mmu, 0xff80, 0x007f);
+    benchBusWrite("vram", mmu, 0x8000, 0x2000);
+    benchBusWrite("wram", mmu, 0xc000, 0x2000);
+    benchBusWrite("hram", mmu, 0xff80, 0x007f);
+}
+
+// PPU ////////////////////////////////////////////////////////////////////////
+
+#define BENCH_FRAMES 60
+
+// A background full of distinct tiles, with sprites on.
+static void drawBenchPicture(MMU& mmu) {
+    for (uint16_t i = 0; i < 0x1800; i++) {
+        mmu.write(0x8000 + i, (uint8_t)(i * 13));
+    }
+    for (uint16_t i = 0; i < 0x400; i++) {
+        mmu.write(0x9800 + i, (uint8_t)i);
+    }
+    for (uint16_t i = 0; i < OAM_SIZE; i++) {
+        mmu.write(0xfe00 + i, (uint8_t)(i * 29));
+    }
+    mmu.write(IO_LCDC, 0x93);
+}
+
+// Renders frames of the bench picture on the bus alone. The DMG and CGB runs
+// draw the same picture, so the difference is what the attribute lookups and
+// color palettes cost.
+static void benchFrames(const char* name, bool cgb) {
+    std::vector<uint8_t> rom(0x8000);
+    rom[CGB_FLAG_ADDRESS] = cgb ? 0x80 : 0x00;
+
+    BenchResult result;
+    result.name = std::string("ppu/") + name;
+    result.unit = "pixels";
+    result.operations = (uint64_t)BENCH_FRAMES * SCREEN_WIDTH * SCREEN_HEIGHT;
+    result.machineCycles = 0;
+
+    measure(result, [&]() {
+        MMU mmu(rom);
+        drawBenchPicture(mmu);
+
+        for (uint64_t i = 0; i < (uint64_t)BENCH_FRAMES * DOTS_PER_FRAME; i++) {
+            mmu.clock();
+        }
+    });
+}
+
+TEST_CASE("ppu frames") {
+    benchFrames("frame-dmg", false);
+    benchFrames("frame-cgb", true);
+}
+
+// Frame Channels /////////////////////////////////////////////////////////////
+
+#define BENCH_HANDOFFS (1 << 20)
+
+TEST_CASE("frame channel") {
+    std::vector<uint8_t> memory(sizeof(FrameChannelLayout) + FRAME_CHANNEL_ALIGNMENT);
+    void* aligned = memory.data();
+    size_t space = memory.size();
+    std::align(FRAME_CHANNEL_ALIGNMENT, sizeof(FrameChannelLayout), aligned, space);
+
+    // Publishing a frame and picking it up, without the pixels: the whole
+    // cost of the channel over composing into the PPU's own buffer.
+    BenchResult handoff;
+    handoff.name = "channel/handoff";
+    handoff.unit = "frames";
+    handoff.operations = BENCH_HANDOFFS;
+    handoff.machineCycles = 0;
+
+    measure(handoff, [&]() {
+        const auto channel = FrameChannel::attach(aligned, space);
+        const auto reader = FrameReader::attach(aligned, space);
+        uint64_t frames = 0;
+        FrameView view;
+
+        for (uint64_t i = 0; i < BENCH_HANDOFFS; i++) {
+            channel->beginFrame();
+            channel->publishFrame(i);
+            if (reader->latest(view) && reader->valid(view)) {
+                frames++;
+            }
+        }
+
+        REQUIRE(frames == BENCH_HANDOFFS);
+    });
+
+    // The bench picture composed into the channel and every pixel of every
+    // frame read back in place, as a consumer polling each frame would.
+    BenchResult frames;
+    frames.name = "channel/frames";
+    frames.unit = "frames";
+    frames.operations = BENCH_FRAMES;
+    frames.machineCycles = 0;
+
+    measure(frames, [&]() {
+        MMU mmu(std::vector<uint8_t>(0x8000));
+        const auto channel = FrameChannel::attach(aligned, space);
+        const auto reader = FrameReader::attach(aligned, space);
+        mmu.ppu().frameSink(channel);
+        drawBenchPicture(mmu);
+
+        uint32_t checksum = 0;
+        FrameView view;
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            const auto count = mmu.ppu().frameCount();
+            while (mmu.ppu().frameCount() == count) {
+                mmu.clock();
+            }
+
+            REQUIRE(reader->latest(view));
+            for (int i = 0; i < FRAME_PIXELS; i++) {
+                checksum += view.pixels[i];
+            }
+            REQUIRE(reader->valid(view));
+        }
+
+        REQUIRE(checksum != 0);
+    });
+}
+
+
+// Copies 256 bytes from 0xc000 to 0xd000, then sums them, forever. Runs on the
+// full machine with the LCD on, so PPU cost is included.
+static std::vector<uint8_t> syntheticLoopROM() {
+    std::vector<uint8_t> rom(0x8000);
+    const uint8_t program[] = {
+        0x3e, 0x91, 0xe0, 0x40, // LD A, 0x91; LDH (LCDC), A
+        0xc3, 0x50, 0x01,       // JP 0x0150
+    };
+    const uint8_t loop[] = {
+        0x21, 0x00, 0xc0,       // LD HL, 0xc000
+        0x11, 0x00, 0xd0,       // LD DE, 0xd000
+        0x06, 0x00,             // LD B, 0
+        0x2a,                   // copy: LD A, (HL+)
+        0x12,                   // LD (DE), A
+        0x13,                   // INC DE
+        0x05,                   // DEC B
+        0x20, 0xfa,             // JR NZ, copy
+        0x21, 0x00, 0xd0,       // LD HL, 0xd000
+        0xaf,                   // XOR A
+        0x86,                   // sum: ADD A, (HL)
+        0x2c,                   // INC L
+        0x20, 0xfc,             // JR NZ, sum
+        0xea, 0x00, 0xc1,       // LD (0xc100), A
+        0xc3, 0x50, 0x01,       // JP 0x0150
+    };
+
+    std::copy(program, program + sizeof(program), rom.begin() + 0x100);
+    std::copy(loop, loop + sizeof(loop), rom.begin() + 0x150);
+    return rom;
+}
+
+TEST_CASE("end to end synthetic loop") {
+    // 3 setup + 256 * 5 copy + 2 setup + 256 * 3 sum + 2 tail.
+    const uint64_t instructionsPerLoop = 3 + 256 * 5 + 2 + 256 * 3 + 2;
+    const auto rom = syntheticLoopROM();
+
+    // Time whole iterations of the outer loop, found the same way as
+    // blockPeriod but in machine cycles on the full machine.
+    GameBoy calibration(rom);
+    uint64_t landings[2] = { 0, 0 };
+    uint16_t previous = calibration.cpu()._programCounter;
+    for (uint64_t cycles = 0, landing = 0; landing < 2; cycles++) {
+        calibration.step();
+        const uint16_t pc = calibration.cpu()._programCounter;
+        if (pc == 0x0150 && previous != 0x0150) {
+            landings[landing++] = cycles;
+        }
+        previous = pc;
+    }
+
+    const uint64_t cyclesPerLoop = landings[1] - landings[0];
+    const uint64_t loops = std::max<uint64_t>(1, (1ULL << 22) / cyclesPerLoop);
+
+    BenchResult result;
+    result.name = "system/synthetic-loop";
+    result.unit = "instructions";
+    result.operations = loops * instructionsPerLoop;
+    result.machineCycles = loops * cyclesPerLoop;
+
+    measure(result, [&]() {
+        GameBoy gameBoy(rom);
+        for (uint64_t i = 0; i < result.machineCycles; i++) {
+            gameBoy.step();
+        }
+    });
+
+    // The same loop with the guest profiler attached at its default rate;
+    // the difference to the above is the sampling overhead.
+    BenchResult profiled = result;
+    profiled.name = "system/synthetic-loop-profiled";
+    profiled.seconds.clear();
+
+    measure(profiled, [&]() {
+        GameBoy gameBoy(rom);
+        Profiler profiler;
+        gameBoy.profiler(&profiler);
+        for (uint64_t i = 0; i < profiled.machineCycles; i++) {
+            gameBoy.step();
+        }
+    });
+}
+
+// Batches ////////////////////////////////////////////////////////////////////
+
+#define BENCH_BATCH_LANES 64
+#define BENCH_BATCH_FRAMES 4
+
+// The synthetic loop on many instances, as separate machines and as one
+// batch, all on this one core. Lanes run in step when they start together;
+// staggered, they are spread across the loop, and share instructions only
+// where their paths happen to cross.
+TEST_CASE("batch") {
+    const auto rom = syntheticLoopROM();
+
+    BenchResult scalar;
+    scalar.name = "batch/scalar-" + std::to_string(BENCH_BATCH_LANES);
+    scalar.unit = "frames";
+    scalar.operations = (uint64_t)BENCH_BATCH_LANES * BENCH_BATCH_FRAMES;
+    scalar.machineCycles = 0;
+
+    std::vector<std::unique_ptr<GameBoy>> machines;
+    for (int i = 0; i < BENCH_BATCH_LANES; i++) {
+        machines.emplace_back(new GameBoy(rom));
+    }
+
+    measure(scalar, [&]() {
+        for (auto& machine : machines) {
+            for (int frame = 0; frame < BENCH_BATCH_FRAMES; frame++) {
+                machine->runFrame();
+            }
+        }
+    });
+
+    BenchResult lockstep = scalar;
+    lockstep.name = "batch/lockstep-" + std::to_string(BENCH_BATCH_LANES);
+    lockstep.seconds.clear();
+
+    BatchEngine inStep(rom, BENCH_BATCH_LANES);
+    measure(lockstep, [&]() {
+        for (int frame = 0; frame < BENCH_BATCH_FRAMES; frame++) {
+            inStep.runFrame();
+        }
+    });
+
+    BenchResult staggered = scalar;
+    staggered.name = "batch/staggered-" + std::to_string(BENCH_BATCH_LANES);
+    staggered.seconds.clear();
+
+    BatchEngine spread(rom, BENCH_BATCH_LANES);
+    for (int i = 0; i < BENCH_BATCH_LANES; i++) {
+        GameBoy& lane = spread.lane(i);
+        for (int step = 0; step < i * 97; step++) {
+            lane.step();
+        }
+        while (!lane.cpu().atInstructionBoundary()) {
+            lane.step();
+        }
+    }
+    spread.reloadRegisters();
+
+    measure(staggered, [&]() {
+        for (int frame = 0; frame < BENCH_BATCH_FRAMES; frame++) {
+            spread.runFrame();
+        }
+    });
+
+    const auto& inStepStats = inStep.stats();
+    const auto& spreadStats = spread.stats();
+    std::cerr << "batch: in step " << inStepStats.vectorInstructions << " across lanes, "
+              << inStepStats.scalarInstructions << " alone; staggered " << spreadStats.vectorInstructions
+              << " across lanes, " << spreadStats.scalarInstructions << " alone\n";
+}
+
+// Vectorised Environments ////////////////////////////////////////////////////
+
+#define BENCH_VEC_ENV_COUNT 16
+#define BENCH_VEC_ENV_STEPS 4
+#define BENCH_VEC_ENV_EMPTY_STEPS 2000
+
+// Steps that run no frames at all, which is what a step costs on top of the
+// emulation: handing it out to the pool and waiting for it to come back.
+TEST_CASE("vec env") {
+    const auto rom = syntheticLoopROM();
+
+    VecEnvOptions options;
+    options.framesPerStep = 0;
+    VecEnv empty(rom, BENCH_VEC_ENV_COUNT, options);
+
+    std::vector<uint8_t> actions(BENCH_VEC_ENV_COUNT);
+
+    BenchResult overhead;
+    overhead.name = "vecenv/overhead-" + std::to_string(BENCH_VEC_ENV_COUNT) + "x" +
+        std::to_string(empty.threads());
+    overhead.unit = "steps";
+    overhead.operations = BENCH_VEC_ENV_EMPTY_STEPS;
+    overhead.machineCycles = 0;
+
+    measure(overhead, [&]() {
+        for (int step = 0; step < BENCH_VEC_ENV_EMPTY_STEPS; step++) {
+            empty.step(actions.data(), nullptr, nullptr);
+        }
+    });
+
+    options.framesPerStep = 1;
+    options.ramAddresses = { 0xc000, 0xc001, 0xff44 };
+    VecEnv env(rom, BENCH_VEC_ENV_COUNT, options);
+
+    std::vector<uint32_t> observations(BENCH_VEC_ENV_COUNT * VEC_ENV_OBSERVATION_PIXELS);
+    std::vector<uint8_t> ram(BENCH_VEC_ENV_COUNT * env.ramBytes());
+
+    BenchResult frames;
+    frames.name = "vecenv/frames-" + std::to_string(BENCH_VEC_ENV_COUNT) + "x" + std::to_string(env.threads());
+    frames.unit = "frames";
+    frames.operations = (uint64_t)BENCH_VEC_ENV_COUNT * BENCH_VEC_ENV_STEPS;
+    frames.machineCycles = 0;
+
+    measure(frames, [&]() {
+        for (int step = 0; step < BENCH_VEC_ENV_STEPS; step++) {
+            env.step(actions.data(), observations.data(), ram.data());
+        }
+    });
+}
+
+// Startup ////////////////////////////////////////////////////////////////////
+
+#define BENCH_STARTUP_MACHINES 200
+
+// Machines made ready to run, straight into the state the boot ROM would
+// leave. Each copies its cartridge, so bigger ones take longer in proportion.
+TEST_CASE("startup") {
+    std::vector<uint8_t> rom(0x8000);
+
+    BenchResult result;
+    result.name = "startup/post-boot";
+    result.unit = "machines";
+    result.operations = BENCH_STARTUP_MACHINES;
+    result.machineCycles = 0;
+
+    uint64_t sum = 0;
+    measure(result, [&]() {
+        for (int i = 0; i < BENCH_STARTUP_MACHINES; i++) {
+            GameBoy gameBoy(rom);
+            sum += gameBoy.cpu()._programCounter;
+        }
+    });
+
+    CHECK(sum > 0);
+}
+
+int main(int argc, char** argv) {
+    std::string outputPath = "bench.json";
+
+    std::vector<const char*> doctestArgs;
+    for (int i = 0; i < argc; i++) {
+        if (strncmp(argv[i], "--bench-out=", 12) == 0) {
+            outputPath = argv[i] + 12;
+        } else {
+            doctestArgs.push_back(argv[i]);
+        }
+    }
+
+    doctest::Context context;
+    context.applyCommandLine((int)doctestArgs.size(), doctestArgs.data());
+    const int status = context.run();
+
+    if (context.shouldExit() || status != 0) {
+        return status;
+    }
+
+    if (outputPath == "-") {
+        writeJSON(std::cout);
+    } else {
+        std::ofstream file(outputPath);
+        writeJSON(file);
+        std::cerr << "wrote " << g_results.size() << " results to " << outputPath << "\n";
+    }
+
+    return 0;
+}
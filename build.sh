@@ -1,7 +1,44 @@
 #!/bin/sh
-rm -rf out
-mkdir out
-cd out
-cmake ..
-make
-./tests
+# ./build.sh [profile] [cmake options...]
+#
+# Builds into out/<profile> and runs the tests: the unit tests, and with
+# -DENABLE_PYTHON=ON the Python module's smoke test. Profiles:
+#   release  optimised, with link-time optimisation, for any machine (default)
+#   native   release, tuned for this machine's CPU only
+#   pgo      release, then rebuilt with a profile of the benchmarks
+#   debug    unoptimised, with debug info
+#   asan     address and undefined behaviour sanitizers
+#   tsan     thread sanitizer
+#
+# Anything after the profile goes to cmake, e.g. ./build.sh pgo -DMARCH=native.
+set -e
+
+profile=${1:-release}
+[ $# -gt 0 ] && shift
+
+case $profile in
+    release) options="-DCMAKE_BUILD_TYPE=Release -DENABLE_LTO=ON" ;;
+    native) options="-DCMAKE_BUILD_TYPE=Release -DENABLE_LTO=ON -DMARCH=native" ;;
+    pgo) options="-DCMAKE_BUILD_TYPE=Release -DENABLE_LTO=ON" ;;
+    debug) options="-DCMAKE_BUILD_TYPE=Debug" ;;
+    asan) options="-DCMAKE_BUILD_TYPE=RelWithDebInfo -DSANITIZE=address,undefined" ;;
+    tsan) options="-DCMAKE_BUILD_TYPE=RelWithDebInfo -DSANITIZE=thread" ;;
+    *) echo "unknown profile $profile" >&2; exit 1 ;;
+esac
+
+jobs=$(nproc 2>/dev/null || echo 1)
+
+rm -rf out/$profile
+mkdir -p out/$profile
+cd out/$profile
+
+if [ $profile = pgo ]; then
+    cmake ../.. $options -DPGO=generate "$@"
+    make -j$jobs pgo-train
+    cmake ../.. -DPGO=use
+else
+    cmake ../.. $options "$@"
+fi
+
+make -j$jobs
+ctest --output-on-failure
@@ -0,0 +1,82 @@
+#ifndef __ALU_h__
+#define __ALU_h__
+
+#include <cstdint>
+
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_H 0x20
+#define FLAG_C 0x10
+
+// Flags produced by each ALU operation, as the high nibble of F. These are the
+// only definition of the ALU's flag behaviour: the CPU calls them per
+// instruction, or with GB_ALU_TABLES evaluates them once for every input to
+// fill lookup tables, and BatchEngine applies them across lanes.
+
+static inline uint8_t addFlags(uint8_t a, uint8_t operand) {
+    const uint8_t result = a + operand;
+
+    return (result == 0 ? FLAG_Z : 0) |
+        ((((a & 0x0f) + (operand & 0x0f)) & 0x10) != 0 ? FLAG_H : 0) |
+        (result < a || result < operand ? FLAG_C : 0);
+}
+
+static inline uint8_t subtractFlags(uint8_t a, uint8_t operand, uint8_t carry) {
+    const uint8_t result = a - operand - carry;
+
+    return FLAG_N | (result == 0 ? FLAG_Z : 0) |
+        (((a & 0x0f) - (operand & 0x0f) - carry) < 0 ? FLAG_H : 0) |
+        (result > a ? FLAG_C : 0);
+}
+
+static inline uint8_t compareFlags(uint8_t a, uint8_t operand) {
+    const uint8_t result = a - operand;
+
+    return FLAG_N | (result == 0 ? FLAG_Z : 0) |
+        (((a & 0x0f) - (operand & 0x0f)) < 0 ? FLAG_H : 0) |
+        (result > a || result > operand ? FLAG_C : 0);
+}
+
+// INC and DEC leave C alone, so these are Z, N and H only.
+static inline uint8_t incrementFlags(uint8_t original) {
+    const uint8_t result = original + 1;
+    return (result == 0 ? FLAG_Z : 0) | ((original & 0x0f) == 0x0f ? FLAG_H : 0);
+}
+
+static inline uint8_t decrementFlags(uint8_t original) {
+    const uint8_t result = original - 1;
+    return FLAG_N | (result == 0 ? FLAG_Z : 0) | ((original & 0x0f) == 0x00 ? FLAG_H : 0);
+}
+
+// Using implementation from
+// https://forums.nesdev.com/viewtopic.php?f=20&t=15944#p196282
+//
+// Returns the adjusted A in the low byte and the new high nibble of F in the
+// high byte.
+static inline uint16_t decimalAdjust(uint8_t a, uint8_t flags) {
+    bool carry = (flags & FLAG_C) != 0;
+
+    if ((flags & FLAG_N) == 0) {
+        if (carry || a > 0x99) {
+            a += 0x60;
+            carry = true;
+        }
+
+        if ((flags & FLAG_H) != 0 || (a & 0x0f) > 0x09) {
+            a += 0x6;
+        }
+    } else {
+        if (carry) {
+            a -= 0x60;
+        }
+
+        if ((flags & FLAG_H) != 0) {
+            a -= 0x6;
+        }
+    }
+
+    const uint8_t newFlags = (a == 0 ? FLAG_Z : 0) | (flags & FLAG_N) | (carry ? FLAG_C : 0);
+    return ((uint16_t)newFlags << 8) | a;
+}
+
+#endif // __ALU_h__
@@ -0,0 +1,99 @@
+#ifndef __Batch_h__
+#define __Batch_h__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "GameBoy.h"
+
+// Groups of lanes sharing an instruction that each round runs together, and
+// the fewest lanes worth running together. Lanes left over run alone.
+#define BATCH_MAX_GROUPS 4
+#define BATCH_MIN_GROUP 2
+
+/** How a batch's instructions were run.
+ */
+struct BatchStats {
+    uint64_t rounds;
+    uint64_t groups;
+    uint64_t vectorInstructions; // Lane instructions run as part of a group.
+    uint64_t scalarInstructions; // Run by a lane's own CPU, as are interrupts and HALT.
+};
+
+/** Many machines running the same ROM, stepped together.
+ *
+ * The CPU registers of every lane live here, one array per register, instead
+ * of in the lanes' CPUs. Each round, every lane runs one instruction. Lanes
+ * about to run the same instruction from the same address, which is most of
+ * them while the instances run the same code, have it decoded once and
+ * applied across all of them in loops over those arrays, which the compiler
+ * vectorises. Any other instruction, or one a lane would run alone, goes to
+ * the lane's own CPU with its registers copied in and back out.
+ *
+ * Only instructions that touch nothing but registers run across lanes: loads
+ * between registers and of immediates, 8-bit ALU operations and relative
+ * jumps. Each lane keeps its own bus, so its RAM, PPU and serial port are its
+ * own, and it runs exactly as a GameBoy stepped by itself would, instruction
+ * by instruction. Idle loop skipping, the profiler and the perf counters do
+ * not see instructions run across lanes.
+ */
+class BatchEngine {
+public:
+    BatchEngine(const std::vector<uint8_t>& rom, size_t lanes);
+
+    inline size_t lanes() const { return _count; }
+
+    /** A lane's machine, for input, frames and inspection. Its CPU registers
+     * are only current after flushRegisters().
+     */
+    inline GameBoy& lane(size_t index) { return *_lanes[index]; }
+
+    /** Runs until every lane finishes its current frame; lanes that get there
+     * first wait for the rest. A lane stops at the first instruction boundary
+     * after its frame ends, so up to a few machine cycles after
+     * GameBoy::runFrame() would.
+     */
+    void runFrame();
+
+    /** Copies every lane's registers out to its CPU, e.g. before hashing it.
+     */
+    void flushRegisters();
+
+    /** Copies every lane's registers in from its CPU, after changing them or
+     * stepping the lane there.
+     */
+    void reloadRegisters();
+
+    inline const BatchStats& stats() const { return _stats; }
+
+private:
+    std::vector<std::unique_ptr<GameBoy>> _lanes;
+    size_t _count;
+
+    // Registers in r-field order, one row of _count per register. Row 6,
+    // which would be (HL), holds F.
+    std::vector<uint8_t> _registers;
+    std::vector<uint16_t> _stackPointers;
+    std::vector<uint16_t> _programCounters;
+
+    // Per round: lanes still to run an instruction, what each is about to run
+    // (address, opcode and operand) or BATCH_NO_KEY, and the group being run.
+    std::vector<uint8_t> _pending;
+    std::vector<uint32_t> _keys;
+    std::vector<uint8_t> _mask;
+
+    BatchStats _stats;
+
+    inline uint8_t* row(int index) { return &_registers[index * _count]; }
+
+    void loadLane(size_t index);
+    void storeLane(size_t index);
+
+    void runRound(const std::vector<uint8_t>& active);
+    void runScalar(size_t index);
+    void runGroup(uint8_t opcode, uint8_t operand);
+};
+
+#endif // __Batch_h__
@@ -4,16 +4,43 @@
 #include <cstdint>
 
 #include "Memory.h"
+#include "PerfCounters.h"
 
 #define INIT_VECTOR 0x0100
 #define INIT_STACK_POINTER 0xfffe
 #define CLOCK_CYCLES_PER_MACHINE_CYCLE 4
 
-#define RET_COMBO_REGISTER(reg1, reg2) \
-    return ((uint16_t)reg1 << 8) | (0x00ff & reg2) \
+// Timing new CPUs start with; ENABLE_ACCURATE_TIMING in CMake picks accurate.
+#ifdef GB_ACCURATE_TIMING
+#define DEFAULT_ACCURATE_TIMING true
+#else
+#define DEFAULT_ACCURATE_TIMING false
+#endif
 
-#define SET_COMBO_REGISTER(reg1, reg2) \
-    reg1 = (uint8_t)(value >> 8); reg2 = (uint8_t)(value & 0x00ff); \
+// Register indices as encoded in opcodes: the r field (bits 0-2 or 3-5) and
+// the rr field (bits 4-5). Index 6 in the r field is (HL), and rr index 3 is
+// SP or AF depending on the instruction.
+#define REG_B 0
+#define REG_C 1
+#define REG_D 2
+#define REG_E 3
+#define REG_H 4
+#define REG_L 5
+#define REG_A 7
+
+#define PAIR_BC 0
+#define PAIR_DE 1
+#define PAIR_HL 2
+#define PAIR_AF 3
+
+// Byte offset of an r-field register within _registers. Pairs are stored
+// high byte first in memory order on big-endian hosts and low byte first on
+// little-endian ones, so each pair reads correctly as a native uint16_t.
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define REGISTER_OFFSET(index) ((index) == REG_A ? 7 : (index) ^ 1)
+#else
+#define REGISTER_OFFSET(index) ((index) == REG_A ? 6 : (index))
+#endif
 
 #define FLAG_TO_BOOL(mask) \
     return (_flags & mask) != 0 \
@@ -21,50 +48,125 @@
 #define SET_FLAG(value, mask) \
     _flags = value ? _flags | mask : _flags & (~mask)
 
+class Profiler;
+class StateReader;
+class StateWriter;
+
 class CPU {
 public:
     CPU(Memory::Ptr memory);
 
-    /** Zero out flags, reset the PC and SP.
+    /** Zero out registers and flags, reset the PC and SP.
      */
     void reset();
 
     /** Simulates an actual tick of the crystal.
      *
      * In practice, this means that every fourth invocation of this function
-     * leads to a single machine cycle execution.
+     * leads to a single machine cycle execution, with the timing
+     * accurateTiming() says at that point.
      */
     void clock();
 
+    /** As clock(), with the timing picked by the caller rather than looked up
+     * on every tick, e.g. once for a whole frame. It is used whatever
+     * accurateTiming() says.
+     */
+    template<class Timing>
+    inline void clock() {
+        if (--_awaitingClockCycles <= 0) {
+            _awaitingClockCycles = CLOCK_CYCLES_PER_MACHINE_CYCLE;
+            machineCycle<Timing>();
+        }
+    }
+
+    /** Snapshot of the CPU's counters; all zero unless built with
+     * GB_PERF_COUNTERS.
+     */
+    CPUCounters counters() const;
+    void resetCounters();
+
+    /** Registers and where the CPU is within the current instruction.
+     */
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+
+    /** Attaches a guest profiler, or detaches it with nullptr. The CPU does
+     * not own it.
+     */
+    inline void profiler(Profiler* profiler) { _profiler = profiler; }
+
+    /** Whether common instruction pairs run as one superinstruction.
+     *
+     * A pair is only fused when the memory can promise that nothing changes
+     * on its own before the second instruction would have started, and the
+     * second one doesn't write I/O, so the result is identical to running
+     * them separately; only the instruction boundary in between is gone.
+     *
+     * Accurate timing never fuses: each access there already waits for its
+     * own machine cycle, which leaves a pair nothing to save.
+     */
+    inline bool fusion() const { return _fusion; }
+    inline void fusion(bool enabled) { _fusion = enabled; }
+
+    /** Whether instructions run with AccurateTiming rather than FastTiming,
+     * from the next one on. Both are built in, so machines with either can
+     * run side by side; DEFAULT_ACCURATE_TIMING is what a CPU starts with.
+     */
+    inline bool accurateTiming() const { return _accurateTiming; }
+    inline void accurateTiming(bool enabled) { _accurateTiming = enabled; }
+
+    /** Whether the next machine cycle starts a new instruction, as opposed to
+     * finishing one or sitting in HALT.
+     */
+    inline bool atInstructionBoundary() const { return _awaitingMachineCycles == 0 && !_isHalted; }
+
     // IMPROVE: I would normally consider these to be private. However, for
     //          sake of tests and creating debug/observation tools, they are
     //          public for now.
-    uint8_t _regA;
-    uint8_t _regB;
-    uint8_t _regC;
-    uint8_t _regD;
-    uint8_t _regE;
-    uint8_t _regH;
-    uint8_t _regL;
+
+    // The register file is packed into 8 bytes, addressable as single
+    // registers by name, as r-field indices through reg8(), or as the four
+    // pairs in _pairs. Everything the interpreter touches per instruction
+    // sits together at the front of the object.
+    union {
+        uint8_t _registers[8];
+        uint16_t _pairs[4];
+        struct {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            uint8_t _regC, _regB;
+            uint8_t _regE, _regD;
+            uint8_t _regL, _regH;
+            uint8_t _flags, _regA;
+#else
+            uint8_t _regB, _regC;
+            uint8_t _regD, _regE;
+            uint8_t _regH, _regL;
+            uint8_t _regA, _flags;
+#endif
+        };
+    };
 
     uint16_t _stackPointer;
     uint16_t _programCounter;
 
-    uint8_t _flags;
-
     bool _interruptsEnabled;
     bool _isHalted;  // Stop until any interrupt.
     bool _isStopped; // Stop until button press.
 
-    inline uint16_t regAF() const { RET_COMBO_REGISTER(_regA, _flags); }
-    inline uint16_t regBC() const { RET_COMBO_REGISTER(_regB, _regC); }
-    inline uint16_t regDE() const { RET_COMBO_REGISTER(_regD, _regE); }
-    inline uint16_t regHL() const { RET_COMBO_REGISTER(_regH, _regL); }
+    inline uint16_t regAF() const { return _pairs[PAIR_AF]; }
+    inline uint16_t regBC() const { return _pairs[PAIR_BC]; }
+    inline uint16_t regDE() const { return _pairs[PAIR_DE]; }
+    inline uint16_t regHL() const { return _pairs[PAIR_HL]; }
 
-    inline void regAF(uint16_t value) { SET_COMBO_REGISTER(_regA, _flags); }
-    inline void regBC(uint16_t value) { SET_COMBO_REGISTER(_regB, _regC); }
-    inline void regDE(uint16_t value) { SET_COMBO_REGISTER(_regD, _regE); }
-    inline void regHL(uint16_t value) { SET_COMBO_REGISTER(_regH, _regL); }
+    inline void regAF(uint16_t value) { _pairs[PAIR_AF] = value; }
+    inline void regBC(uint16_t value) { _pairs[PAIR_BC] = value; }
+    inline void regDE(uint16_t value) { _pairs[PAIR_DE] = value; }
+    inline void regHL(uint16_t value) { _pairs[PAIR_HL] = value; }
+
+    /** Register by r-field index; index 6, (HL), is not a register.
+     */
+    inline uint8_t& reg8(uint8_t index) { return _registers[REGISTER_OFFSET(index)]; }
 
     inline bool zFlag() const { FLAG_TO_BOOL(0x80); }
     inline bool nFlag() const { FLAG_TO_BOOL(0x40); }
@@ -77,66 +179,166 @@ public:
     inline void cFlag(bool value) { SET_FLAG(value, 0x10); }
 
 private:
-    Memory::Ptr _memory;
     int8_t _awaitingClockCycles;
     int8_t _awaitingMachineCycles;
+    bool _fusion;
+    bool _accurateTiming;
+    Memory::Ptr _memory;
+    Profiler* _profiler;
+
+    uint8_t _accessCycle; // Machine cycle of the instruction the next access falls on.
+    uint8_t _busCycle;    // Machine cycles the bus has been run ahead within it.
+
+#ifdef GB_PERF_COUNTERS
+    CPUCounters _counters;
+#endif
+
+    /** Pair by rr-field index, where index 3 is SP.
+     */
+    inline uint16_t& pairOrSP(uint8_t index) { return index == PAIR_AF ? _stackPointer : _pairs[index]; }
+
+    // Memory accesses and internal cycles of an instruction, in the order the
+    // hardware makes them. With AccurateTiming, every access first runs the
+    // bus up to the machine cycle it falls on; with FastTiming, these are
+    // plain memory accesses.
+
+    template<class Timing>
+    inline void beginInstruction() {
+        if (Timing::accurate) {
+            _accessCycle = 0;
+            _busCycle = 0;
+        }
+    }
+
+    template<class Timing>
+    inline void syncBus() {
+        if (Timing::accurate) {
+            while (_busCycle < _accessCycle) {
+                _memory->advanceMachineCycle();
+                _busCycle++;
+            }
+
+            _accessCycle++;
+        }
+    }
+
+    template<class Timing>
+    inline uint8_t busRead(uint16_t addr) {
+        syncBus<Timing>();
+        return _memory->read(addr);
+    }
+
+    template<class Timing>
+    inline void busWrite(uint16_t addr, uint8_t value) {
+        syncBus<Timing>();
+        _memory->write(addr, value);
+    }
+
+    template<class Timing>
+    inline uint16_t busRead16(uint16_t addr) {
+        const uint8_t low = busRead<Timing>(addr);
+        return (uint16_t)(busRead<Timing>(addr + 1) << 8 | low);
+    }
 
+    template<class Timing>
+    inline void busWrite16(uint16_t addr, uint16_t value) {
+        busWrite<Timing>(addr, (uint8_t)value);
+        busWrite<Timing>(addr + 1, (uint8_t)(value >> 8));
+    }
+
+    /** A machine cycle spent inside the CPU, e.g. on 16-bit arithmetic.
+     */
+    template<class Timing>
+    inline void busIdle() {
+        if (Timing::accurate) {
+            _accessCycle++;
+        }
+    }
+
+    /** High byte first, as the hardware does.
+     */
+    template<class Timing>
+    inline void push16(uint16_t value) {
+        busWrite<Timing>(_stackPointer - 1, (uint8_t)(value >> 8));
+        busWrite<Timing>(_stackPointer - 2, (uint8_t)value);
+        _stackPointer -= 2;
+    }
+
+    template<class Timing>
+    inline uint16_t pop16() {
+        const uint16_t value = busRead16<Timing>(_stackPointer);
+        _stackPointer += 2;
+        return value;
+    }
+
+    template<class Timing>
     void machineCycle();
+
+    template<class Timing>
+    void startInstruction();
+
+    template<class Timing>
+    int8_t serviceInterrupts();
+
+    template<class Timing>
     int8_t decodeAndExecute();
 
+    int8_t executeFused(uint8_t opcode);
+
     // Instruction functions return the number of machine cycles they should
-    // take to execute.
-
-    int8_t I_LoadImmediate(uint8_t opcode);
-    int8_t I_TransferRegister(uint8_t opcode);
-    int8_t I_LoadAddressIntoRegister(uint8_t opcode);
-    int8_t I_StoreToAddress(uint8_t opcode);
-    int8_t I_LoadImmediate16(uint8_t opcode);
-    int8_t I_LoadHLWithSPN();
-    int8_t I_StoreStackPointer();
-    int8_t I_PushRegister(uint8_t opcode);
-    int8_t I_PopRegister(uint8_t opcode);
-    int8_t I_8BitAdd(uint8_t opcode);
-    int8_t I_8BitSubtract(uint8_t opcode);
-    int8_t I_And(uint8_t opcode);
-    int8_t I_Or(uint8_t opcode);
-    int8_t I_Xor(uint8_t opcode);
-    int8_t I_Compare(uint8_t opcode);
-    int8_t I_Increment(uint8_t opcode);
-    int8_t I_Decrement(uint8_t opcode);
-    int8_t I_16BitAdd(uint8_t opcode);
-    int8_t I_AddToSP();
-    int8_t I_16BitIncrement(uint8_t opcode);
-    int8_t I_16BitDecrement(uint8_t opcode);
+    // take to execute with FastTiming. Those that touch the bus are built
+    // once for each timing.
+
+    template<class Timing> int8_t I_LoadImmediate(uint8_t opcode);
+    template<class Timing> int8_t I_TransferRegister(uint8_t opcode);
+    template<class Timing> int8_t I_LoadAddressIntoRegister(uint8_t opcode);
+    template<class Timing> int8_t I_StoreToAddress(uint8_t opcode);
+    template<class Timing> int8_t I_LoadImmediate16(uint8_t opcode);
+    template<class Timing> int8_t I_LoadHLWithSPN();
+    template<class Timing> int8_t I_StoreStackPointer();
+    template<class Timing> int8_t I_PushRegister(uint8_t opcode);
+    template<class Timing> int8_t I_PopRegister(uint8_t opcode);
+    template<class Timing> int8_t I_8BitAdd(uint8_t opcode);
+    template<class Timing> int8_t I_8BitSubtract(uint8_t opcode);
+    template<class Timing> int8_t I_And(uint8_t opcode);
+    template<class Timing> int8_t I_Or(uint8_t opcode);
+    template<class Timing> int8_t I_Xor(uint8_t opcode);
+    template<class Timing> int8_t I_Compare(uint8_t opcode);
+    template<class Timing> int8_t I_Increment(uint8_t opcode);
+    template<class Timing> int8_t I_Decrement(uint8_t opcode);
+    template<class Timing> int8_t I_16BitAdd(uint8_t opcode);
+    template<class Timing> int8_t I_AddToSP();
+    template<class Timing> int8_t I_16BitIncrement(uint8_t opcode);
+    template<class Timing> int8_t I_16BitDecrement(uint8_t opcode);
     int8_t I_DecimalAdjust();
     int8_t I_ComplementA();
     int8_t I_ComplementCarry();
     int8_t I_SetCarry();
-    int8_t I_UnconditionalJump();
-    int8_t I_ConditionalJump(uint8_t opcode);
+    template<class Timing> int8_t I_UnconditionalJump();
+    template<class Timing> int8_t I_ConditionalJump(uint8_t opcode);
     int8_t I_JumpToHL();
-    int8_t I_UnconditionalRelativeJump();
-    int8_t I_ConditionalRelativeJump(uint8_t opcode);
-    int8_t I_Call();
-    int8_t I_ConditionalCall(uint8_t opcode);
-    int8_t I_RST(uint8_t opcode);
-    int8_t I_Return(uint8_t opcode);
-    int8_t I_ConditionalReturn(uint8_t opcode);
+    template<class Timing> int8_t I_UnconditionalRelativeJump();
+    template<class Timing> int8_t I_ConditionalRelativeJump(uint8_t opcode);
+    template<class Timing> int8_t I_Call();
+    template<class Timing> int8_t I_ConditionalCall(uint8_t opcode);
+    template<class Timing> int8_t I_RST(uint8_t opcode);
+    template<class Timing> int8_t I_Return(uint8_t opcode);
+    template<class Timing> int8_t I_ConditionalReturn(uint8_t opcode);
     int8_t I_Halt();
     int8_t I_Stop();
     int8_t I_SetInterruptEnable(uint8_t opcode);
-    int8_t I_ExecCBGroup();
+    template<class Timing> int8_t I_ExecCBGroup();
     int8_t I_RotateA(uint8_t opcode);
 
-    void RotateLeft(uint8_t* value, bool withCarry);
-    void RotateRight(uint8_t* value, bool withCarry);
-    void ShiftLeft(uint8_t* value);
-    void ShiftRight(uint8_t* value, bool preserveMSB);
-    void Swap(uint8_t* value);
+    // CB-prefixed instructions dispatch through a table with one specialised
+    // handler per opcode.
+    typedef int8_t (*CBHandler)(CPU& cpu);
+
+    template<class Timing, uint8_t OPCODE>
+    static int8_t CB_Op(CPU& cpu);
 
-    void TestBit(uint8_t* value, uint8_t bitIndex);
-    void SetBit(uint8_t* value, uint8_t bitIndex);
-    void ResetBit(uint8_t* value, uint8_t bitIndex);
+    static const CBHandler _fastCBHandlers[256];
+    static const CBHandler _accurateCBHandlers[256];
 };
 
 #endif // __CPU_h_
@@ -0,0 +1,71 @@
+#ifndef __Cartridge_h__
+#define __Cartridge_h__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define ROM_BANK_SIZE 0x4000
+#define RAM_BANK_SIZE 0x2000
+#define CGB_FLAG_ADDRESS 0x0143
+#define CARTRIDGE_TYPE_ADDRESS 0x0147
+
+class StateReader;
+class StateWriter;
+
+/** ROM and external RAM, plus whatever bank controller sits between them.
+ *
+ * Only ROM-only and MBC1 cartridges are understood. Anything else is treated
+ * as MBC1, which is enough to get most small titles and test ROMs running.
+ */
+class Cartridge {
+public:
+    Cartridge(const std::vector<uint8_t>& rom);
+
+    void reset();
+
+    /** External RAM and the bank controller; the ROM is left to the loader.
+     */
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+
+    // 0x0000-0x7fff
+    inline uint8_t readROM(uint16_t addr) const {
+        if (addr < ROM_BANK_SIZE) {
+            return _rom[addr];
+        }
+
+        return _rom[_romBankOffset + (addr - ROM_BANK_SIZE)];
+    }
+
+    void writeControl(uint16_t addr, uint8_t value);
+
+    // 0xa000-0xbfff
+    uint8_t readRAM(uint16_t addr) const;
+    void writeRAM(uint16_t addr, uint8_t value);
+
+    inline uint16_t romBank() const { return (uint16_t)(_romBankOffset / ROM_BANK_SIZE); }
+    inline bool hasBankController() const { return _hasMBC; }
+
+    /** Whether the header asks for CGB features, either alongside DMG
+     * support (0x80) or exclusively (0xc0).
+     */
+    inline bool supportsCGB() const { return (_rom[CGB_FLAG_ADDRESS] & 0x80) != 0; }
+
+    std::vector<uint8_t> _rom;
+    std::vector<uint8_t> _ram;
+
+    uint8_t _bankLow;
+    uint8_t _bankHigh;
+    bool _ramEnabled;
+    bool _advancedBanking;
+
+private:
+    bool _hasMBC;
+    size_t _romBankCount;
+    size_t _romBankOffset;
+
+    void updateBankOffset();
+};
+
+#endif // __Cartridge_h__
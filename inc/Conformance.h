@@ -0,0 +1,40 @@
+#ifndef __Conformance_h__
+#define __Conformance_h__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A minute of emulated time; the slowest common suites finish well inside it.
+#define DEFAULT_CONFORMANCE_FRAMES 3600
+
+enum ConformanceVerdict : uint8_t {
+    VERDICT_PASS,
+    VERDICT_FAIL,
+    VERDICT_TIMEOUT,
+};
+
+struct ConformanceResult {
+    ConformanceVerdict verdict;
+    std::string detector; // How the verdict was reached; empty on timeout.
+    std::string output;   // Whatever text the ROM reported, if any.
+    uint32_t frames;
+    double seconds;
+};
+
+/** Runs a test ROM headlessly until it reports a result or maxFrames pass.
+ *
+ * Three ways of reporting are understood:
+ *
+ *   serial:    text sent over the link port containing "Passed" or "Failed",
+ *              as blargg's suites print it;
+ *   signature: blargg's memory protocol, a status byte at 0xa000 behind the
+ *              signature de b0 61 and text from 0xa004;
+ *   registers: mooneye-gb's LD B,B breakpoint, with B C D E H L holding
+ *              3 5 8 13 21 34 on a pass and 0x42 on a failure.
+ */
+ConformanceResult runConformance(const std::vector<uint8_t>& rom, uint32_t maxFrames = DEFAULT_CONFORMANCE_FRAMES);
+
+const char* verdictName(ConformanceVerdict verdict);
+
+#endif // __Conformance_h__
@@ -0,0 +1,144 @@
+#ifndef __FrameChannel_h__
+#define __FrameChannel_h__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "PPU.h"
+
+#define FRAME_CHANNEL_MAGIC 0x43464247 // "GBFC"
+#define FRAME_CHANNEL_VERSION 1
+#define FRAME_CHANNEL_SLOTS 3
+#define FRAME_CHANNEL_ALIGNMENT 64
+#define FRAME_PIXELS (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+// Readers in other processes see the same atomics, so they must not be
+// implemented with a lock.
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+    "frame channels need lock-free atomics");
+
+/** One frame of a channel, guarded by a sequence lock: sequence is odd while
+ * the writer composes into pixels, and goes up by two for every frame.
+ */
+struct alignas(FRAME_CHANNEL_ALIGNMENT) FrameChannelSlot {
+    std::atomic<uint64_t> sequence;
+    uint64_t frameNumber; // PPU::frameCount() when the frame finished.
+    uint32_t pixels[FRAME_PIXELS];
+};
+
+/** What a channel's memory holds. Writer and readers share it as is, so it
+ * only changes along with FRAME_CHANNEL_VERSION.
+ */
+struct FrameChannelLayout {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    std::atomic<uint32_t> latest;    // Slot of the newest complete frame.
+    std::atomic<uint64_t> published; // Frames so far; latest means nothing at 0.
+    FrameChannelSlot slots[FRAME_CHANNEL_SLOTS];
+};
+
+/** Hands frames to readers in other processes, or anywhere else, without
+ * copying them: the PPU composes each frame straight into memory the readers
+ * map, and publishing it is a few stores.
+ *
+ * Frames rotate through three slots. The writer never composes into the
+ * newest complete frame, so a reader holding it has at least a frame's time,
+ * about 16 ms, before the writer comes round to its slot again. A reader that
+ * takes longer finds out through FrameReader::valid() rather than getting a
+ * torn frame unawares.
+ *
+ * One writer per channel.
+ */
+class FrameChannel : public FrameSink {
+public:
+    typedef std::shared_ptr<FrameChannel> Ptr;
+
+    ~FrameChannel();
+
+    /** Creates POSIX shared memory object name, e.g. "/gameboy0", replacing
+     * any left over, and removes it again when the channel goes. nullptr on
+     * failure.
+     */
+    static Ptr create(const std::string& name);
+
+    /** Publishes into size bytes of memory the caller owns, which must be at
+     * least sizeof(FrameChannelLayout) and FRAME_CHANNEL_ALIGNMENT aligned.
+     * nullptr otherwise.
+     */
+    static Ptr attach(void* memory, size_t size);
+
+    uint32_t* beginFrame() override;
+    void publishFrame(uint64_t frameNumber) override;
+
+    inline uint64_t published() const { return _layout->published.load(std::memory_order_relaxed); }
+
+private:
+    FrameChannelLayout* _layout;
+    std::string _name; // Of the shared memory object; empty for caller memory.
+    uint32_t _writeSlot;
+
+    FrameChannel(FrameChannelLayout* layout, const std::string& name);
+};
+
+/** A frame read in place from a channel.
+ */
+struct FrameView {
+    const uint32_t* pixels;
+    uint64_t frameNumber;
+    uint32_t slot;
+    uint64_t sequence;
+};
+
+/** The reading end of a FrameChannel. No call makes a system call, so
+ * polling for frames costs nothing but the loads.
+ */
+class FrameReader {
+public:
+    typedef std::shared_ptr<FrameReader> Ptr;
+
+    ~FrameReader();
+
+    /** Maps the channel a writer created as name. nullptr if there is none,
+     * or it isn't a channel this build can read.
+     */
+    static Ptr open(const std::string& name);
+
+    /** Reads a channel in memory the caller has, e.g. one attach()ed to
+     * in-process. nullptr as for open().
+     */
+    static Ptr attach(const void* memory, size_t size);
+
+    /** Frames published so far; a new one is in when this goes up.
+     */
+    inline uint64_t published() const { return _layout->published.load(std::memory_order_acquire); }
+
+    /** The newest complete frame, in place. False if there hasn't been one.
+     *
+     * The writer can come round to the slot again from a frame later, so
+     * check valid() after reading the pixels, and drop whatever was read from
+     * them if it says no.
+     */
+    bool latest(FrameView& view) const;
+
+    /** Whether the writer has left view's pixels alone since latest().
+     */
+    bool valid(const FrameView& view) const;
+
+    /** Copies the newest complete frame out, trying again whenever the writer
+     * gets in the way. False if there hasn't been one.
+     */
+    bool copyLatest(uint32_t* pixels, uint64_t& frameNumber) const;
+
+private:
+    const FrameChannelLayout* _layout;
+    bool _mapped; // Whether _layout is a mapping to undo.
+
+    FrameReader(const FrameChannelLayout* layout, bool mapped);
+};
+
+#endif // __FrameChannel_h__
@@ -0,0 +1,70 @@
+#ifndef __Fuzz_h__
+#define __Fuzz_h__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "CPU.h"
+
+// Input layout: A F B C D E H L, SP and PC little-endian, a flags byte (bit 0
+// is IME), then a memory image from address 0. Memory past the image is zero
+// and anything past 64 KiB of image is ignored.
+#define FUZZ_HEADER_SIZE 13
+#define FUZZ_MAX_INPUT (FUZZ_HEADER_SIZE + 0x10000)
+
+// Machine cycles each input runs for.
+#define FUZZ_MACHINE_CYCLES 2048
+
+// One byte per pair of consecutive opcodes.
+#define FUZZ_COVERAGE_SIZE 0x10000
+
+enum FuzzOutcome : uint8_t {
+    FUZZ_OK,
+    FUZZ_DIVERGED,
+};
+
+/** Runs fuzz inputs on two CPUs over flat memory, one with superinstructions
+ * and one without, and reports any difference between them.
+ *
+ * Both are forked from the input rather than built for it: the CPUs are
+ * reused, and each memory is put back by rewriting only the pages the input
+ * covers and the pages the last run wrote, so a run costs little more than
+ * the instructions in it.
+ *
+ * Coverage is the guest's, not the host's: which pairs of opcodes ran one
+ * after the other. It needs no compiler instrumentation, so any build can
+ * steer a fuzzing loop with it.
+ */
+class FuzzTarget {
+public:
+    FuzzTarget();
+
+    FuzzOutcome run(const uint8_t* data, size_t size);
+
+    /** What differed in the last run that diverged.
+     */
+    inline const std::string& report() const { return _report; }
+
+    /** Each opcode pair the last run executed, once, as previous << 8 |
+     * opcode; edgeCount() of them.
+     */
+    inline const uint16_t* edges() const { return _edges; }
+    inline uint32_t edgeCount() const { return _edgeCount; }
+
+private:
+    class FlatMemory;
+
+    std::shared_ptr<FlatMemory> _memories[2];
+    CPU _plain;
+    CPU _fused;
+    uint8_t _coverage[FUZZ_COVERAGE_SIZE]; // Non-zero for each entry in _edges.
+    uint16_t _edges[FUZZ_MACHINE_CYCLES];
+    uint32_t _edgeCount;
+    std::string _report;
+
+    void describe(const char* what);
+};
+
+#endif // __Fuzz_h__
@@ -0,0 +1,188 @@
+#ifndef __GameBoy_h__
+#define __GameBoy_h__
+
+#include <cstdint>
+#include <vector>
+
+#include "CPU.h"
+#include "MMU.h"
+#include "Profiler.h"
+
+#define MAX_IDLE_LOOP_BYTES 32
+
+/** Host time spent in each half of the machine over one frame.
+ */
+struct FrameCost {
+    double cpuMicroseconds;
+    double ppuMicroseconds;
+    bool rendered;
+};
+
+/** A complete DMG or CGB: the CPU and everything on its bus, clocked
+ * together.
+ */
+class GameBoy {
+public:
+    /** A machine as the boot ROM hands over to the cartridge: CPU registers,
+     * I/O registers and, on a DMG, the logo in VRAM, all as the hardware
+     * leaves them for the model the cartridge asks for. Nothing is run to
+     * get there.
+     */
+    GameBoy(const std::vector<uint8_t>& rom);
+
+    /** Powers the machine back on, through the boot ROM if it has one.
+     */
+    void reset();
+
+    /** Runs image, a DMG_BOOT_ROM_SIZE or CGB_BOOT_ROM_SIZE boot ROM dump for
+     * the model the cartridge asks for, from 0x0000 on every reset() from now
+     * on, including the one this does. Empty goes back to skipping it. False,
+     * changing nothing, if the size is wrong.
+     */
+    bool bootROM(const std::vector<uint8_t>& image);
+
+    /** Appends everything needed to carry on from exactly here to state,
+     * whether or not the CPU is at an instruction boundary. See StateWriter
+     * for the layout.
+     */
+    void saveState(std::vector<uint8_t>& state) const;
+
+    /** Puts the machine back where saveState() left one running the same ROM
+     * in the same kind of build. False, leaving the machine as it was, if
+     * state is from another ROM, another version or isn't a save state.
+     */
+    bool loadState(const std::vector<uint8_t>& state);
+
+    /** Runs one machine cycle: four crystal ticks for the CPU, then the same
+     * four for the rest of the bus, or two when a CGB runs at double speed.
+     */
+    inline void step() {
+        if (_cpu.accurateTiming()) {
+            step<AccurateTiming>();
+        } else {
+            step<FastTiming>();
+        }
+    }
+
+    /** As step(), with the CPU's timing picked by the caller rather than
+     * looked up every cycle; runFrame() picks it once per frame.
+     */
+    template<class Timing>
+    inline void step() {
+        for (int i = 0; i < CLOCK_CYCLES_PER_MACHINE_CYCLE; i++) {
+            _cpu.clock<Timing>();
+        }
+
+        _mmu->machineCycle<Timing>();
+
+        _machineCycles++;
+
+        if (_idleLoopSkip && _cpu.atInstructionBoundary()) {
+            checkIdleLoop();
+        }
+    }
+
+    /** Runs the bus on by machineCycles and counts them, for an instruction
+     * the CPU didn't run itself, e.g. one BatchEngine ran across lanes. Only
+     * valid at an instruction boundary.
+     */
+    inline void runBus(uint32_t machineCycles) {
+        for (uint32_t i = 0; i < machineCycles; i++) {
+            _mmu->machineCycle();
+        }
+
+        _machineCycles += machineCycles;
+    }
+
+    /** Runs until the PPU finishes the current frame.
+     */
+    void runFrame();
+
+    /** As runFrame, but times the CPU and PPU separately.
+     *
+     * Timing is taken around every machine cycle, so this is noticeably
+     * slower than runFrame; use it for the breakdown, not for throughput.
+     */
+    void runFrame(FrameCost& cost);
+
+    /** Hash of the cartridge ROM, as loaded.
+     */
+    uint64_t romHash() const;
+
+    /** Hash of everything that determines how the machine runs from here:
+     * CPU registers, RAM, VRAM, OAM and device registers.
+     */
+    uint64_t stateHash() const;
+
+    /** CPU and bus counters in one flat struct; all zero unless built with
+     * GB_PERF_COUNTERS.
+     */
+    PerfCounters counters() const;
+    void resetCounters();
+
+    /** Attaches a guest profiler to the CPU, reading ROM banks from this
+     * machine's cartridge; nullptr detaches it.
+     */
+    void profiler(Profiler* profiler);
+
+    /** Whether busy-wait polling loops are skipped.
+     *
+     * A short backward loop whose body only reads memory, and which leaves
+     * every register as it found it, is a fixed point: until some device
+     * changes what it reads, each iteration is identical. With skipping on,
+     * once one iteration has been seen to be a fixed point, the bus is
+     * advanced straight to the last whole iteration before the next device
+     * event, leaving the machine exactly where running the loop would have.
+     *
+     * Skipped instructions are not seen by the perf counters or profiler.
+     */
+    inline bool idleLoopSkip() const { return _idleLoopSkip; }
+    void idleLoopSkip(bool enabled);
+
+    inline uint64_t idleCyclesSkipped() const { return _idleCyclesSkipped; }
+
+    /** Machine cycles run since construction. */
+    inline uint64_t machineCycles() const { return _machineCycles; }
+
+    inline CPU& cpu() { return _cpu; }
+    inline MMU& mmu() { return *_mmu; }
+    inline PPU& ppu() { return _mmu->ppu(); }
+
+private:
+    // The loop most recently entered through a backward branch, and the CPU
+    // state at the start of its last iteration.
+    struct IdleLoop {
+        uint16_t head;
+        uint16_t last; // The last instruction boundary before looping back.
+        bool pollsOnly;
+
+        bool haveIteration;
+        uint8_t registers[8];
+        uint16_t stackPointer;
+        bool interruptsEnabled;
+        uint64_t startCycle;
+        uint32_t cyclesUntilEvent;
+    };
+
+    MMU::Ptr _mmu;
+    CPU _cpu;
+
+    uint64_t _machineCycles;
+    bool _idleLoopSkip;
+    uint64_t _idleCyclesSkipped;
+    uint16_t _lastInstruction;
+    IdleLoop _idleLoop;
+
+    void skipBoot();
+
+    template<class Timing>
+    void runFrameWith();
+
+    template<class Timing>
+    void runFrameWith(FrameCost& cost);
+
+    void checkIdleLoop();
+    bool analyseIdleLoop(uint16_t head, uint16_t last);
+};
+
+#endif // __GameBoy_h__
@@ -0,0 +1,23 @@
+#ifndef __Hash_h__
+#define __Hash_h__
+
+#include <cstddef>
+#include <cstdint>
+
+/** XXH64 of the given bytes.
+ *
+ * Used wherever we need to compare ROMs or machine state across runs, so the
+ * output must stay stable across builds and hosts.
+ */
+uint64_t hash64(const void* data, size_t length, uint64_t seed = 0);
+
+/** Fast hash for small fixed blocks such as RAM pages.
+ *
+ * XXH3-style: 64-byte stripes are folded into eight 64-bit lanes with a
+ * 32x32 multiply, which maps directly onto SSE2. The SSE2 and scalar paths
+ * produce identical output, so streams from different builds compare.
+ */
+uint64_t blockHash(const void* data, size_t length);
+uint64_t blockHashScalar(const void* data, size_t length);
+
+#endif // __Hash_h__
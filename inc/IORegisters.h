@@ -0,0 +1,85 @@
+#ifndef __IORegisters_h__
+#define __IORegisters_h__
+
+#include <cstdint>
+
+enum IORegister : uint16_t {
+    // Joypad
+    IO_P1 = 0xff00,
+
+    // Serial
+    IO_SB = 0xff01,
+    IO_SC = 0xff02,
+
+    // Timer
+    IO_DIV  = 0xff04,
+    IO_TIMA = 0xff05,
+    IO_TMA  = 0xff06,
+    IO_TAC  = 0xff07,
+
+    // Interrupt Request
+    IO_IF = 0xff0f,
+
+    // Sound, which isn't emulated; these only read back what was written.
+    IO_NR10 = 0xff10,
+    IO_NR11 = 0xff11,
+    IO_NR12 = 0xff12,
+    IO_NR13 = 0xff13,
+    IO_NR14 = 0xff14,
+    IO_NR21 = 0xff16,
+    IO_NR22 = 0xff17,
+    IO_NR23 = 0xff18,
+    IO_NR24 = 0xff19,
+    IO_NR30 = 0xff1a,
+    IO_NR31 = 0xff1b,
+    IO_NR32 = 0xff1c,
+    IO_NR33 = 0xff1d,
+    IO_NR34 = 0xff1e,
+    IO_NR41 = 0xff20,
+    IO_NR42 = 0xff21,
+    IO_NR43 = 0xff22,
+    IO_NR44 = 0xff23,
+    IO_NR50 = 0xff24,
+    IO_NR51 = 0xff25,
+    IO_NR52 = 0xff26,
+
+    // LCD
+    IO_LCDC = 0xff40,
+    IO_STAT = 0xff41,
+    IO_SCY  = 0xff42,
+    IO_SCX  = 0xff43,
+    IO_LY   = 0xff44,
+    IO_LYC  = 0xff45,
+    IO_DMA  = 0xff46,
+    IO_BGP  = 0xff47,
+    IO_OBP0 = 0xff48,
+    IO_OBP1 = 0xff49,
+    IO_WY   = 0xff4a,
+    IO_WX   = 0xff4b,
+
+    // Writing 1 unmaps the boot ROM for good.
+    IO_BOOT = 0xff50,
+
+    // CGB only
+    IO_KEY1 = 0xff4d,
+    IO_VBK  = 0xff4f,
+    IO_BCPS = 0xff68,
+    IO_BCPD = 0xff69,
+    IO_OCPS = 0xff6a,
+    IO_OCPD = 0xff6b,
+    IO_SVBK = 0xff70,
+
+    // Interrupt Enable
+    IO_IE = 0xffff,
+};
+
+// Bits of IF and IE, in priority order.
+enum Interrupt : uint8_t {
+    INT_VBLANK   = 0x01,
+    INT_LCD_STAT = 0x02,
+    INT_TIMER    = 0x04,
+    INT_SERIAL   = 0x08,
+    INT_JOYPAD   = 0x10,
+};
+
+#endif // __IORegisters_h__
@@ -0,0 +1,51 @@
+#ifndef __Joypad_h__
+#define __Joypad_h__
+
+#include <cstdint>
+
+class StateReader;
+class StateWriter;
+
+/** The P1 register at 0xff00.
+ *
+ * Buttons are tracked as a pressed mask, one bit per Button. The register
+ * itself is active-low and only reports the group(s) selected by bits 4-5.
+ */
+class Joypad {
+public:
+    enum Button : uint8_t {
+        BUTTON_A      = 0x01,
+        BUTTON_B      = 0x02,
+        BUTTON_SELECT = 0x04,
+        BUTTON_START  = 0x08,
+        BUTTON_RIGHT  = 0x10,
+        BUTTON_LEFT   = 0x20,
+        BUTTON_UP     = 0x40,
+        BUTTON_DOWN   = 0x80,
+    };
+
+    Joypad(uint8_t& interruptFlags);
+
+    void reset();
+
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+
+    uint8_t read() const;
+    void write(uint8_t value);
+
+    inline uint8_t buttons() const { return _pressed; }
+
+    /** Replaces the pressed mask, requesting the joypad interrupt if any
+     * selected line goes low.
+     */
+    void buttons(uint8_t pressed);
+
+    uint8_t _select; // Bits 4-5 of P1, as written.
+    uint8_t _pressed;
+
+private:
+    uint8_t& _interruptFlags;
+};
+
+#endif // __Joypad_h__
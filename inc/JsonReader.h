@@ -0,0 +1,73 @@
+#ifndef __JsonReader_h__
+#define __JsonReader_h__
+
+#include <cstddef>
+#include <cstdint>
+
+/** A string inside the document being read; escapes are left as they are.
+ */
+struct JsonString {
+    const char* data;
+    size_t size;
+
+    bool operator==(const char* other) const;
+    inline bool operator!=(const char* other) const { return !(*this == other); }
+};
+
+/** Pull reader over a JSON document held in memory. Nothing is allocated and
+ * nothing is copied; the caller walks the structure it expects and skips
+ * anything else.
+ *
+ * Every call returns false on malformed input, after which failed() stays
+ * true and further calls do nothing.
+ *
+ *   reader.beginObject();
+ *   JsonString key;
+ *   while (reader.nextMember(key)) {
+ *       if (key == "pc") reader.readInteger(pc); else reader.skipValue();
+ *   }
+ */
+class JsonReader {
+public:
+    JsonReader(const char* begin, const char* end);
+
+    bool beginObject();
+
+    /** Reads the key of the next member, leaving its value to be read. False
+     * at the end of the object, which is consumed.
+     */
+    bool nextMember(JsonString& key);
+
+    bool beginArray();
+
+    /** True if another element follows, which is left to be read. False at
+     * the end of the array, which is consumed.
+     */
+    bool nextElement();
+
+    bool readInteger(int64_t& value);
+    bool readString(JsonString& value);
+
+    /** Skips a value of any kind, including null.
+     */
+    bool skipValue();
+
+    /** True once only whitespace is left.
+     */
+    bool atEnd();
+
+    inline bool failed() const { return _failed; }
+
+private:
+    const char* _cursor;
+    const char* _end;
+    bool _failed;
+    bool _first; // No comma is expected before the next member or element.
+
+    char peek();
+    bool expect(char c);
+    bool fail();
+    bool nextItem(char close);
+};
+
+#endif // __JsonReader_h__
@@ -0,0 +1,49 @@
+#ifndef __Lockstep_h__
+#define __Lockstep_h__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Ten seconds of emulated time.
+#define DEFAULT_LOCKSTEP_FRAMES 600
+
+/** One way of running the same machine: which of the optimisations that are
+ * supposed to be invisible are switched on, and which timing the CPU has.
+ */
+struct LockstepEngine {
+    const char* name;
+    bool fusion;
+    bool idleLoopSkip;
+    bool accurateTiming;
+};
+
+/** Looks up an engine by name: "plain" (neither), "fusion", "idle", or
+ * "fast" (both), all with fast timing, or "accurate" (neither, with accurate
+ * timing). False if there is no such engine.
+ */
+bool lockstepEngine(const std::string& name, LockstepEngine& engine);
+
+struct LockstepResult {
+    bool diverged;
+    uint32_t frames;
+    uint64_t machineCycles;
+    uint64_t comparisons; // Instruction boundaries both machines stopped at.
+    double seconds;
+    std::string report;   // What differed and the run-up to it.
+};
+
+/** Runs a ROM on two engines side by side for up to maxFrames frames,
+ * stopping at the first difference.
+ *
+ * The machines are compared whenever both stop at an instruction boundary on
+ * the same machine cycle. A fused pair or a skipped idle loop means one
+ * machine passes boundaries the other never stops at, so the one behind is
+ * always run until they line up again. At each comparison the CPU registers
+ * and the writes each made through the bus since the last one must match,
+ * and after every frame the whole machine state hash as well.
+ */
+LockstepResult runLockstep(const std::vector<uint8_t>& rom, const LockstepEngine& first,
+    const LockstepEngine& second, uint32_t maxFrames = DEFAULT_LOCKSTEP_FRAMES);
+
+#endif // __Lockstep_h__
@@ -0,0 +1,210 @@
+#ifndef __MMU_h__
+#define __MMU_h__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Cartridge.h"
+#include "Joypad.h"
+#include "Memory.h"
+#include "PerfCounters.h"
+#include "PPU.h"
+#include "Serial.h"
+
+// Work RAM is two 4 KiB windows, 0xc000 and 0xd000. The DMG only has the two
+// banks behind them; the CGB can switch any of banks 1-7 into the second.
+#define WRAM_BANK_SIZE 0x1000
+#define WRAM_BANK_COUNT 8
+#define WRAM_SIZE (WRAM_BANK_SIZE * WRAM_BANK_COUNT)
+#define HRAM_SIZE 0x7f
+#define IO_SIZE 0x80
+
+// Register A as the CGB boot ROM leaves it, which is how software tells it
+// is running on one.
+#define CGB_BOOT_A 0x11
+
+// A DMG boot ROM covers 0x0000-0x00ff. A CGB one goes on to 0x08ff, but leaves
+// the cartridge header at 0x0100-0x01ff showing through.
+#define DMG_BOOT_ROM_SIZE 0x100
+#define CGB_BOOT_ROM_SIZE 0x900
+
+// RAM is tracked for changes in 256-byte pages, so that consumers like the
+// state hasher only revisit what was written since they last looked.
+#define DIRTY_PAGE_SHIFT 8
+#define DIRTY_PAGE_SIZE (1 << DIRTY_PAGE_SHIFT)
+#define WRAM_PAGE_BASE 0
+#define VRAM_PAGE_BASE (WRAM_PAGE_BASE + WRAM_SIZE / DIRTY_PAGE_SIZE)
+#define OAM_PAGE (VRAM_PAGE_BASE + VRAM_SIZE * VRAM_BANK_COUNT / DIRTY_PAGE_SIZE)
+#define HRAM_PAGE (OAM_PAGE + 1)
+#define DIRTY_PAGE_COUNT (HRAM_PAGE + 1)
+
+/** One write through the bus, as recorded by MMU::writeLog().
+ */
+struct BusWrite {
+    uint16_t addr;
+    uint8_t value;
+
+    inline bool operator==(const BusWrite& other) const { return addr == other.addr && value == other.value; }
+};
+
+/** The DMG or CGB address space, routing CPU accesses to the cartridge, RAM
+ * and memory-mapped devices.
+ *
+ * The machine is a CGB when the cartridge header says it supports one.
+ */
+class MMU : public Memory {
+public:
+    typedef std::shared_ptr<MMU> Ptr;
+
+    MMU(const std::vector<uint8_t>& rom);
+
+    void reset();
+
+    /** RAM, bus registers and every device's state. Loading marks every page
+     * dirty.
+     */
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+
+    /** Advances every device on the bus by one crystal tick.
+     */
+    inline void clock() {
+        _ppu.clock();
+        _serial.clock();
+    }
+
+    /** Runs the bus through one machine cycle for a CPU with the given
+     * timing. With AccurateTiming, the CPU may already have run it ahead to
+     * make an access later in its instruction, in which case it is not run
+     * again; FastTiming never does, so it doesn't check.
+     */
+    template<class Timing>
+    inline void machineCycle() {
+        if (Timing::accurate && _cyclesAhead > 0) {
+            _cyclesAhead--;
+            return;
+        }
+
+        const int ticks = ticksPerMachineCycle();
+        for (int i = 0; i < ticks; i++) {
+            clock();
+        }
+    }
+
+    /** As machineCycle<AccurateTiming>(), which is right for either timing
+     * at the cost of the check.
+     */
+    inline void machineCycle() { machineCycle<AccurateTiming>(); }
+
+    inline void advanceMachineCycle() override {
+        const int ticks = ticksPerMachineCycle();
+        for (int i = 0; i < ticks; i++) {
+            clock();
+        }
+
+        _cyclesAhead++;
+    }
+
+    /** Crystal ticks before any device on the bus next changes something the
+     * CPU could observe.
+     */
+    inline uint32_t cyclesUntilEvent() const override {
+        const uint32_t ppu = _ppu.dotsUntilEvent();
+        const uint32_t serial = _serial.dotsUntilEvent();
+        return ppu < serial ? ppu : serial;
+    }
+
+    /** Advances every device by several ticks at once; only valid for up to
+     * cyclesUntilEvent() ticks.
+     */
+    inline void skip(uint32_t cycles) {
+        _ppu.skip(cycles);
+        _serial.skip(cycles);
+    }
+
+    /** Crystal ticks per CPU machine cycle: 4, or 2 while a CGB runs at
+     * double speed.
+     */
+    inline int ticksPerMachineCycle() const { return _doubleSpeed ? 2 : 4; }
+
+    inline bool cgb() const { return _ppu.cgb(); }
+    inline bool doubleSpeed() const { return _doubleSpeed; }
+
+    uint8_t read(uint16_t addr) override;
+    uint8_t peek(uint16_t addr) override;
+    void write(uint16_t addr, uint8_t value) override;
+
+    /** Switches speed if a CGB has one armed through KEY1.
+     */
+    bool stop() override;
+
+    /** Maps image over the start of the cartridge from the next reset() on,
+     * until the program writes to 0xff50; empty for none. Sizes are up to the
+     * caller, see DMG_BOOT_ROM_SIZE.
+     */
+    inline void bootROM(const std::vector<uint8_t>& image) { _bootROM = image; }
+    inline bool hasBootROM() const { return !_bootROM.empty(); }
+
+    /** Flags every page as written, e.g. after state has been replaced from
+     * outside the bus.
+     */
+    void markAllDirty();
+
+    /** Appends every write through the bus to log, or stops with nullptr. The
+     * MMU does not own it.
+     */
+    inline void writeLog(std::vector<BusWrite>* log) { _writeLog = log; }
+
+    /** Snapshot of the bus counters; all zero unless built with
+     * GB_PERF_COUNTERS.
+     */
+    BusCounters counters() const;
+    void resetCounters();
+
+    inline Cartridge& cartridge() { return _cartridge; }
+    inline Joypad& joypad() { return _joypad; }
+    inline PPU& ppu() { return _ppu; }
+    inline Serial& serial() { return _serial; }
+
+    uint8_t _workRAM[WRAM_SIZE];
+    uint8_t _highRAM[HRAM_SIZE];
+    uint8_t _io[IO_SIZE]; // Backing store for registers no device claims.
+    uint8_t _interruptFlags;
+    uint8_t _interruptEnable;
+
+    bool _doubleSpeed;
+    bool _speedSwitchArmed;
+    bool _bootROMMapped;
+
+    uint8_t _workRAMBank; // SVBK as written; 0 maps bank 1.
+
+    // Where in _workRAM the windows at 0xc000 and 0xd000 (and their echoes)
+    // currently point, and where in VRAM 0x8000 does. Switching banks only
+    // moves these; nothing is copied.
+    size_t _workRAMPages[2];
+    size_t _vramBankOffset;
+
+    // Non-zero for pages written through the bus since the flag was cleared.
+    uint8_t _dirtyPages[DIRTY_PAGE_COUNT];
+
+private:
+    Cartridge _cartridge;
+    Joypad _joypad;
+    PPU _ppu;
+    Serial _serial;
+    std::vector<BusWrite>* _writeLog;
+    std::vector<uint8_t> _bootROM;
+
+    uint8_t _cyclesAhead; // Machine cycles the CPU has run the bus ahead of the clock.
+
+#ifdef GB_PERF_COUNTERS
+    BusCounters _counters;
+#endif
+
+    uint8_t readIO(uint16_t addr);
+    void writeIO(uint16_t addr, uint8_t value);
+};
+
+#endif // __MMU_h__
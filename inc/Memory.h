@@ -4,6 +4,21 @@
 #include <cstdint>
 #include <memory>
 
+/** Bus timings the instructions are built for, one instantiation of each.
+ *
+ * With FastTiming, every access of an instruction is made at its start and it
+ * takes as long as documented. With AccurateTiming, every access first runs
+ * the bus up to the machine cycle it falls on, and the instruction takes as
+ * many cycles as its accesses and internal cycles add up to.
+ */
+struct FastTiming {
+    static const bool accurate = false;
+};
+
+struct AccurateTiming {
+    static const bool accurate = true;
+};
+
 class Memory {
 public:
     typedef std::shared_ptr<Memory> Ptr;
@@ -11,6 +26,30 @@ public:
     virtual uint8_t read(uint16_t addr) = 0;
     virtual void write(uint16_t addr, uint8_t value) = 0;
 
+    /** Reads as read() does, but for the emulator's own use rather than the
+     * program's, e.g. checking for interrupts or decoding ahead, so it isn't
+     * counted as bus traffic.
+     */
+    virtual uint8_t peek(uint16_t addr) { return read(addr); }
+
+    /** Crystal ticks that can pass before anything behind this memory changes
+     * on its own, i.e. other than by being written. 0 if unknown.
+     */
+    virtual uint32_t cyclesUntilEvent() const { return 0; }
+
+    /** Called when the CPU executes STOP. Returns true if something behind
+     * this memory took it as its cue, e.g. a CGB speed switch, in which case
+     * the CPU carries on rather than stopping.
+     */
+    virtual bool stop() { return false; }
+
+    /** Runs whatever is behind this memory through one machine cycle ahead
+     * of the machine's own clock, so that an access later in an instruction
+     * sees the bus as it is by then. Only CPUs with accurate timing call
+     * this.
+     */
+    virtual void advanceMachineCycle() { }
+
     uint16_t readLI(uint16_t addr);
     void writeLI(uint16_t addr, uint16_t value);
 };
@@ -0,0 +1,91 @@
+#ifndef __Movie_h__
+#define __Movie_h__
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "GameBoy.h"
+
+#define MOVIE_VERSION 1
+#define DEFAULT_CHECKPOINT_INTERVAL 60
+
+/** A recorded joypad input stream.
+ *
+ * Input is stored per frame as runs of identical button masks. The movie
+ * carries the hash of the ROM and machine state it was recorded from, plus a
+ * state hash every checkpointInterval frames, so playback can say not just
+ * that it diverged but between which two checkpoints.
+ *
+ * On disk (little-endian):
+ *   "GBMV", u16 version, u16 checkpoint interval, u64 ROM hash,
+ *   u64 start state hash, u32 frame count, u32 run count,
+ *   runs of { u8 buttons, varint length }, u32 checkpoint count,
+ *   u64 checkpoint hashes.
+ */
+class Movie {
+public:
+    struct Run {
+        uint8_t buttons;
+        uint32_t length;
+    };
+
+    Movie();
+
+    /** An empty movie. A checkpointInterval of 0, which load() would reject,
+     * checkpoints every frame.
+     */
+    Movie(uint64_t romHash, uint64_t startStateHash, uint16_t checkpointInterval = DEFAULT_CHECKPOINT_INTERVAL);
+
+    /** Adds one frame of input.
+     */
+    void append(uint8_t buttons);
+
+    /** Records the state hash expected at the end of the next checkpoint.
+     */
+    inline void checkpoint(uint64_t hash) { _checkpoints.push_back(hash); }
+
+    bool save(std::ostream& stream) const;
+    bool load(std::istream& stream);
+
+    inline uint32_t frameCount() const { return _frameCount; }
+
+    uint64_t _romHash;
+    uint64_t _startStateHash;
+    uint16_t _checkpointInterval;
+    uint32_t _frameCount;
+    std::vector<Run> _runs;
+    std::vector<uint64_t> _checkpoints;
+};
+
+struct PlaybackResult {
+    bool romMatches;
+    bool startMatches;
+    bool synced;
+    uint32_t framesPlayed;
+
+    // When !synced, the divergence happened in (lastGoodFrame, firstBadFrame].
+    uint32_t lastGoodFrame;
+    uint32_t firstBadFrame;
+};
+
+/** Runs one frame with the given input, appending it to the movie and
+ * checkpointing when one is due.
+ */
+void recordFrame(GameBoy& gameBoy, Movie& movie, uint8_t buttons);
+
+/** Plays the movie back as fast as the core will run, checking every
+ * checkpoint on the way and stopping at the first mismatch.
+ *
+ * onFrame, if given, is called after each frame with the number of frames
+ * played so far.
+ */
+PlaybackResult playMovie(
+    GameBoy& gameBoy,
+    const Movie& movie,
+    const std::function<void(uint32_t)>& onFrame = nullptr
+);
+
+#endif // __Movie_h__
@@ -0,0 +1,67 @@
+#ifndef __OpcodeHeat_h__
+#define __OpcodeHeat_h__
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "GameBoy.h"
+
+// Handlers that between them ran this share of a training run's instructions,
+// taking the busiest first, are hot.
+#define HEAT_HOT_COVERAGE 0.95
+
+// Handlers that ran less than this share of the instructions are cold.
+#define HEAT_COLD_SHARE 0.0001
+
+enum HandlerHeat : uint8_t {
+    HEAT_COLD,
+    HEAT_NEUTRAL,
+    HEAT_HOT,
+};
+
+/** The CPU member function decodeAndExecute() runs an opcode with, or nullptr
+ * for NOP and the unused opcodes, which have none. Worked out from the opcode
+ * bits rather than taken from the switch, so the "opcode handlers" test holds
+ * it to the switch's cases one opcode at a time.
+ */
+const char* opcodeHandler(uint8_t opcode);
+
+/** Every handler opcodeHandler() names, in opcode order of first use.
+ */
+std::vector<const char*> opcodeHandlers();
+
+/** How often each opcode ran over some training run, for laying out the
+ * dispatcher (OPCODE_LAYOUT in CMake) by what actually runs.
+ *
+ * Opcodes are counted at instruction boundaries, as --pair-profile does, so
+ * this works in any build; instructions run as part of a fused pair count
+ * too, since fusion is turned off while running.
+ */
+class OpcodeProfile {
+public:
+    OpcodeProfile();
+
+    /** Runs a machine for frames frames, counting what it executes.
+     */
+    void run(GameBoy& gameBoy, uint32_t frames);
+
+    inline uint64_t count(uint8_t opcode) const { return _counts[opcode]; }
+    inline void add(uint8_t opcode, uint64_t count) { _counts[opcode] += count; }
+
+    uint64_t total() const;
+
+    /** The heat of each of opcodeHandlers(), in the same order.
+     */
+    std::vector<HandlerHeat> classify() const;
+
+    /** Writes the header OPCODE_LAYOUT builds with: a LAYOUT_<handler>
+     * definition for every handler, with the share of the run each had.
+     */
+    bool writeLayout(std::ostream& out) const;
+
+private:
+    uint64_t _counts[256];
+};
+
+#endif // __OpcodeHeat_h__
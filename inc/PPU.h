@@ -0,0 +1,189 @@
+#ifndef __PPU_h__
+#define __PPU_h__
+
+#include <cstdint>
+#include <memory>
+
+#define SCREEN_WIDTH 160
+#define SCREEN_HEIGHT 144
+
+#define DOTS_PER_LINE 456
+#define LINES_PER_FRAME 154
+#define DOTS_PER_FRAME (DOTS_PER_LINE * LINES_PER_FRAME)
+#define OAM_SCAN_DOTS 80
+#define PIXEL_TRANSFER_DOTS 172
+
+#define VRAM_SIZE 0x2000 // Per bank.
+#define VRAM_BANK_COUNT 2
+#define OAM_SIZE 0xa0
+
+// Eight palettes of four RGB555 colors, for each of BG and OBJ.
+#define PALETTE_RAM_SIZE 0x40
+#define CGB_PALETTE_COUNT 8
+
+class StateReader;
+class StateWriter;
+
+/** Somewhere other than the PPU's own framebuffer to compose frames into,
+ * e.g. memory shared with another process.
+ */
+class FrameSink {
+public:
+    typedef std::shared_ptr<FrameSink> Ptr;
+
+    virtual ~FrameSink() {}
+
+    /** SCREEN_WIDTH * SCREEN_HEIGHT pixels to compose the next frame into.
+     * The PPU writes them until publishFrame(), or until the next call if the
+     * frame is abandoned, e.g. because the LCD was switched off.
+     */
+    virtual uint32_t* beginFrame() = 0;
+
+    /** The frame composed since beginFrame() is complete. The PPU reads the
+     * buffer, but no longer writes it, until the next beginFrame().
+     */
+    virtual void publishFrame(uint64_t frameNumber) = 0;
+};
+
+class PPU {
+public:
+    enum Mode : uint8_t {
+        HBLANK = 0,
+        VBLANK = 1,
+        OAM_SCAN = 2,
+        PIXEL_TRANSFER = 3,
+    };
+
+    /** interruptFlags is the IF register, owned by whoever maps the bus.
+     */
+    PPU(uint8_t& interruptFlags);
+
+    void reset();
+
+    /** Memory, registers, where the PPU is in the frame and the frame so far.
+     * The render interval and frame sink are settings, not state, and stay.
+     */
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+
+    /** Whether the PPU runs as a CGB: tile attributes from VRAM bank 1, color
+     * palettes from palette RAM and OAM-order sprite priority. Set before
+     * reset().
+     */
+    inline bool cgb() const { return _cgb; }
+    inline void cgb(bool enabled) { _cgb = enabled; }
+
+    /** Advances the PPU by one dot, which runs at the crystal frequency.
+     */
+    void clock();
+
+    /** Dots that can be clocked before anything visible outside the PPU
+     * changes: mode, LY, STAT, IF or the frame count.
+     */
+    uint32_t dotsUntilEvent() const;
+
+    /** Advances by several dots at once. Only valid for up to
+     * dotsUntilEvent() dots, across which clock() would do nothing but count.
+     */
+    inline void skip(uint32_t dots) { _dot += dots; }
+
+    uint8_t readRegister(uint16_t addr) const;
+    void writeRegister(uint16_t addr, uint8_t value);
+
+    // The CPU is locked out of VRAM during pixel transfer and out of OAM for
+    // the whole of OAM scan and pixel transfer.
+    inline bool vramAccessible() const { return _mode != PIXEL_TRANSFER; }
+    inline bool oamAccessible() const { return _mode == HBLANK || _mode == VBLANK; }
+
+    /** How often pixels are actually composed.
+     *
+     * 1 renders every frame, N renders every Nth frame and 0 never renders.
+     * Mode timing, LY, STAT, interrupts and the VRAM/OAM lockout windows are
+     * identical regardless; skipped frames just leave the framebuffer holding
+     * the last rendered frame.
+     */
+    inline unsigned renderInterval() const { return _renderInterval; }
+    inline void renderInterval(unsigned interval) { _renderInterval = interval; }
+
+    /** Whether the frame currently being scanned out is being composed.
+     */
+    inline bool renderingFrame() const { return _renderFrame; }
+
+    /** Whether the most recently finished frame was composed.
+     */
+    inline bool frameRendered() const { return _frameRendered; }
+
+    /** Incremented on every VBlank entry, or every DOTS_PER_FRAME dots while
+     * the LCD is off.
+     */
+    inline uint64_t frameCount() const { return _frameCount; }
+
+    /** SCREEN_WIDTH * SCREEN_HEIGHT pixels, 0xAARRGGBB.
+     */
+    inline const uint32_t* framebuffer() const { return _framebuffer; }
+
+    /** Composes rendered frames into sink's buffers, from the next rendered
+     * frame on, instead of into the PPU's own; nullptr goes back to that.
+     * framebuffer() follows along. The sink stays attached across reset().
+     */
+    inline FrameSink::Ptr frameSink() const { return _frameSink; }
+    void frameSink(FrameSink::Ptr sink);
+
+    // Exposed for the same reasons as the CPU registers.
+    uint8_t _vram[VRAM_SIZE * VRAM_BANK_COUNT]; // Bank 1 is only used by the CGB.
+    uint8_t _oam[OAM_SIZE];
+    uint8_t _bgPaletteRAM[PALETTE_RAM_SIZE];
+    uint8_t _objPaletteRAM[PALETTE_RAM_SIZE];
+
+    uint8_t _lcdc;
+    uint8_t _stat; // Only the interrupt select bits (3-6) are stored.
+    uint8_t _scy;
+    uint8_t _scx;
+    uint8_t _ly;
+    uint8_t _lyc;
+    uint8_t _bgp;
+    uint8_t _obp0;
+    uint8_t _obp1;
+    uint8_t _wy;
+    uint8_t _wx;
+    uint8_t _bcps; // Palette RAM index, bit 7 auto-increments on write.
+    uint8_t _ocps;
+
+    Mode _mode;
+    uint32_t _dot; // Counts a whole frame while the LCD is off.
+
+private:
+    uint8_t& _interruptFlags;
+
+    bool _cgb;
+    bool _statLine;
+    bool _renderFrame;
+    bool _frameRendered;
+    unsigned _renderInterval;
+    uint64_t _frameCount;
+    uint8_t _windowLine;
+
+    uint32_t* _framebuffer; // _ownFramebuffer or a buffer from _frameSink.
+    uint32_t _ownFramebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+    FrameSink::Ptr _frameSink;
+
+    // Palette RAM already converted to framebuffer colors, so that a CGB
+    // pixel costs one lookup just like a DMG one. Updated on every write.
+    uint32_t _bgColors[CGB_PALETTE_COUNT][4];
+    uint32_t _objColors[CGB_PALETTE_COUNT][4];
+
+    void setMode(Mode mode);
+    void updateStatLine();
+    void startFrame();
+    void finishFrame();
+
+    void writePaletteData(uint8_t* paletteRAM, uint8_t& index, uint32_t (*colors)[4], uint8_t value);
+    void resolvePalettes();
+
+    void renderScanline();
+    void renderCGBScanline();
+    int selectSprites(uint8_t* sprites, int height) const;
+    uint8_t tileColor(uint16_t tileDataAddress, uint8_t x, uint8_t y) const;
+};
+
+#endif // __PPU_h__
@@ -0,0 +1,54 @@
+#ifndef __PerfCounters_h__
+#define __PerfCounters_h__
+
+#include <cstdint>
+
+// Counters are compiled in with -DGB_PERF_COUNTERS (ENABLE_PERF_COUNTERS in
+// CMake). Without it, PERF_COUNT expands to nothing and the counter storage
+// doesn't exist, so the hot paths are exactly as they would be otherwise.
+#ifdef GB_PERF_COUNTERS
+#define PERF_COUNTERS_ENABLED true
+#define PERF_COUNT(counter) (counter)++
+#else
+#define PERF_COUNTERS_ENABLED false
+#define PERF_COUNT(counter)
+#endif
+
+#define INTERRUPT_SOURCE_COUNT 5
+
+enum BusRegion : uint8_t {
+    BUS_ROM0,
+    BUS_ROMX,
+    BUS_VRAM,
+    BUS_ERAM,
+    BUS_WRAM,
+    BUS_ECHO,
+    BUS_OAM,
+    BUS_UNUSABLE,
+    BUS_IO,
+    BUS_HRAM,
+    BUS_IE,
+    BUS_REGION_COUNT,
+};
+
+struct CPUCounters {
+    uint64_t opcodes[256];
+    uint64_t cbOpcodes[256];
+    uint64_t interrupts[INTERRUPT_SOURCE_COUNT]; // Indexed by IF bit.
+    uint64_t haltCycles; // Machine cycles spent halted.
+};
+
+struct BusCounters {
+    uint64_t reads[BUS_REGION_COUNT];
+    uint64_t writes[BUS_REGION_COUNT];
+    uint64_t bankSwitches; // Writes that changed the mapped ROM bank.
+};
+
+struct PerfCounters {
+    CPUCounters cpu;
+    BusCounters bus;
+};
+
+const char* busRegionName(BusRegion region);
+
+#endif // __PerfCounters_h__
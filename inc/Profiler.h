@@ -0,0 +1,84 @@
+#ifndef __Profiler_h__
+#define __Profiler_h__
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <vector>
+
+#include "Cartridge.h"
+
+#define DEFAULT_SAMPLE_INTERVAL 1024
+#define MAX_PROFILE_DEPTH 64
+
+/** Guest-level sampling profiler.
+ *
+ * Attached to a CPU, it takes the program counter every sampleInterval
+ * machine cycles, along with the guest call stack it has followed through
+ * CALL, RST, interrupts and RET. Locations in ROM are qualified by the bank
+ * mapped when they were reached.
+ *
+ * Stacks are unwound by stack pointer rather than by counting returns, so
+ * code that drops a return address or returns through a jump table only
+ * costs the frames it actually left.
+ */
+class Profiler {
+public:
+    Profiler(uint32_t sampleInterval = DEFAULT_SAMPLE_INTERVAL);
+
+    /** Where to read the ROM bank from; without one, 0x4000-0x7fff is
+     * reported as bank 1.
+     */
+    inline void cartridge(const Cartridge* cartridge) { _cartridge = cartridge; }
+
+    /** Called by the CPU once per machine cycle.
+     */
+    inline void machineCycle(uint16_t programCounter) {
+        if (--_countdown == 0) {
+            _countdown = _sampleInterval;
+            sample(programCounter);
+        }
+    }
+
+    /** A call to target has pushed its return address, leaving the stack
+     * pointer at stackPointer.
+     */
+    void enter(uint16_t target, uint16_t stackPointer);
+
+    /** A return has popped its address, leaving the stack pointer at
+     * stackPointer.
+     */
+    void leave(uint16_t stackPointer);
+
+    /** Drops all samples and the current stack.
+     */
+    void reset();
+
+    /** Writes one "frame;frame;...;pc count" line per distinct stack, outer
+     * frames first, as consumed by flamegraph.pl and compatible tools.
+     */
+    bool writeFolded(std::ostream& stream) const;
+
+    inline uint64_t sampleCount() const { return _sampleCount; }
+    inline size_t depth() const { return _stack.size(); }
+
+private:
+    struct Frame {
+        uint32_t location;
+        uint16_t stackPointer;
+    };
+
+    const Cartridge* _cartridge;
+    uint32_t _sampleInterval;
+    uint32_t _countdown;
+    uint64_t _sampleCount;
+
+    std::vector<Frame> _stack;
+    std::vector<uint32_t> _key;
+    std::map<std::vector<uint32_t>, uint64_t> _samples;
+
+    uint32_t location(uint16_t address) const;
+    void sample(uint16_t programCounter);
+};
+
+#endif // __Profiler_h__
@@ -0,0 +1,102 @@
+#ifndef __SaveState_h__
+#define __SaveState_h__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define SAVE_STATE_MAGIC 0x53534247 // "GBSS"
+#define SAVE_STATE_VERSION 3
+
+/** Appends a machine's state to a buffer, little-endian whatever the host.
+ *
+ * A save state is the magic number, u16 version and u64 ROM hash, followed by each component's state in a fixed order: the
+ * GameBoy's own, the CPU's, then the MMU's and its devices'. The layout is
+ * whatever the components' saveState() write, so it only changes along with
+ * SAVE_STATE_VERSION.
+ */
+class StateWriter {
+public:
+    StateWriter(std::vector<uint8_t>& data) : _data(data) {}
+
+    inline void u8(uint8_t value) { _data.push_back(value); }
+    inline void u16(uint16_t value) { put(value, 2); }
+    inline void u32(uint32_t value) { put(value, 4); }
+    inline void u64(uint64_t value) { put(value, 8); }
+    inline void flag(bool value) { _data.push_back(value ? 1 : 0); }
+
+    inline void bytes(const void* data, size_t size) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        _data.insert(_data.end(), bytes, bytes + size);
+    }
+
+private:
+    std::vector<uint8_t>& _data;
+
+    inline void put(uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            _data.push_back((uint8_t)(value >> (8 * i)));
+        }
+    }
+};
+
+/** Reads back what a StateWriter wrote. Reading past the end gives zeroes and
+ * clears ok(), so a component can read its whole state before anyone checks.
+ */
+class StateReader {
+public:
+    StateReader(const std::vector<uint8_t>& data) : _data(data), _offset(0), _ok(true) {}
+
+    inline uint8_t u8() { return (uint8_t)get(1); }
+    inline uint16_t u16() { return (uint16_t)get(2); }
+    inline uint32_t u32() { return (uint32_t)get(4); }
+    inline uint64_t u64() { return get(8); }
+    inline bool flag() { return get(1) != 0; }
+
+    inline void bytes(void* data, size_t size) {
+        if (!take(size)) {
+            memset(data, 0, size);
+            return;
+        }
+
+        memcpy(data, &_data[_offset - size], size);
+    }
+
+    /** For a component that finds its state doesn't fit this machine.
+     */
+    inline void fail() { _ok = false; }
+
+    inline bool ok() const { return _ok; }
+    inline bool atEnd() const { return _offset == _data.size(); }
+
+private:
+    const std::vector<uint8_t>& _data;
+    size_t _offset;
+    bool _ok;
+
+    inline bool take(size_t size) {
+        if (!_ok || _data.size() - _offset < size) {
+            _ok = false;
+            return false;
+        }
+
+        _offset += size;
+        return true;
+    }
+
+    inline uint64_t get(int bytes) {
+        if (!take(bytes)) {
+            return 0;
+        }
+
+        uint64_t value = 0;
+        for (int i = bytes - 1; i >= 0; i--) {
+            value = (value << 8) | _data[_offset - bytes + i];
+        }
+
+        return value;
+    }
+};
+
+#endif // __SaveState_h__
@@ -0,0 +1,122 @@
+#ifndef __Serial_h__
+#define __Serial_h__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// 8 bits at 8192 Hz, on the internal clock.
+#define SERIAL_TRANSFER_DOTS 4096
+
+class Serial;
+class StateReader;
+class StateWriter;
+
+/** Whatever is plugged into the link port.
+ */
+class SerialTransport {
+public:
+    typedef std::shared_ptr<SerialTransport> Ptr;
+
+    virtual ~SerialTransport() {}
+
+    /** This side, driving the clock, has shifted out a byte. The byte shifted
+     * in comes back through Serial::complete(), either from inside this call
+     * or later, e.g. once the other end has caught up.
+     */
+    virtual void send(Serial& serial, uint8_t out) = 0;
+
+    /** Dots before the transport next delivers anything, less one as for the
+     * PPU; effectively forever for one that only answers from inside send().
+     */
+    virtual uint32_t dotsUntilSync() const { return UINT32_MAX; }
+};
+
+/** The SB and SC registers at 0xff01-0xff02.
+ *
+ * With nothing plugged in, transfers on the internal clock shift in 0xff, as
+ * with no cable, and transfers on an external clock never finish.
+ */
+class Serial {
+public:
+    Serial(uint8_t& interruptFlags);
+
+    void reset();
+
+    /** The transfer in progress, if any; the transport is left plugged in.
+     */
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+
+    inline void clock() {
+        if (_shiftDots != 0 && --_shiftDots == 0) {
+            shifted();
+        }
+    }
+
+    /** Dots before an internal clock transfer finishes shifting or the
+     * transport next delivers a byte, less one as for the PPU; effectively
+     * forever if neither can happen.
+     */
+    inline uint32_t dotsUntilEvent() const {
+        const uint32_t shift = _shiftDots != 0 ? _shiftDots - 1u : UINT32_MAX;
+        const uint32_t sync = _transport ? _transport->dotsUntilSync() : UINT32_MAX;
+        return shift < sync ? shift : sync;
+    }
+
+    /** Only valid for up to dotsUntilEvent() dots.
+     */
+    inline void skip(uint32_t dots) {
+        if (_shiftDots != 0) {
+            _shiftDots -= dots;
+        }
+    }
+
+    uint8_t read(uint16_t addr) const;
+    void write(uint16_t addr, uint8_t value);
+
+    /** The transport stays plugged in across reset(); nullptr unplugs it.
+     */
+    inline SerialTransport::Ptr transport() const { return _transport; }
+    inline void transport(SerialTransport::Ptr transport) { _transport = transport; }
+
+    /** Finishes the transfer waiting on the other end with the byte it shifted
+     * in. Ignored if no transfer is waiting, e.g. because it was cancelled.
+     */
+    void complete(uint8_t in);
+
+    /** Offers a byte clocked in by the other end. If a transfer is waiting on
+     * the external clock it finishes, out gets the byte shifted out and this
+     * returns true; otherwise nothing happens.
+     */
+    bool receive(uint8_t in, uint8_t& out);
+
+    uint8_t _data;    // SB
+    uint8_t _control; // SC, bits 0 and 7.
+    uint16_t _shiftDots;
+    bool _awaitingReply;
+
+private:
+    uint8_t& _interruptFlags;
+    SerialTransport::Ptr _transport;
+
+    void shifted();
+};
+
+/** Collects every byte sent, answering each with 0xff. Test ROMs print their
+ * results this way.
+ */
+class SerialBuffer : public SerialTransport {
+public:
+    typedef std::shared_ptr<SerialBuffer> Ptr;
+
+    void send(Serial& serial, uint8_t out) override;
+
+    inline const std::string& output() const { return _output; }
+    inline void clear() { _output.clear(); }
+
+private:
+    std::string _output;
+};
+
+#endif // __Serial_h__
@@ -0,0 +1,119 @@
+#ifndef __SerialLink_h__
+#define __SerialLink_h__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "GameBoy.h"
+#include "Serial.h"
+
+#define LINK_SYNC_CYCLES 256
+#define LINK_PACKET_SIZE 3
+
+/** One end of a link cable to another machine.
+ *
+ * Linked machines never look at each other directly. Each stops every
+ * syncInterval machine cycles, sends the other a packet and reads the one the
+ * other sent from the sync point before. A packet carries at most one byte
+ * clocked out and at most one answer to the other end's last byte. A byte sent
+ * at sync point k is therefore received at k + 1 and answered at k + 2,
+ * whatever the host does in between.
+ *
+ * Runs are deterministic as a result, without stepping the two machines in
+ * lockstep every cycle. The price is that a transfer takes up to two sync
+ * intervals longer than on hardware. With the default interval that is still
+ * less than the time the transfer takes to shift.
+ *
+ * Sync points are counted in machine cycles since each machine was made, so
+ * both ends should be plugged into their machines' serial ports before either
+ * machine runs. Once runLinkedFrame() has told the link which machine it is
+ * plugged into, it reports the next sync point as a serial event, so neither
+ * idle loop skipping nor instruction fusion runs across one.
+ *
+ * Packets (LINK_PACKET_SIZE bytes): u8 flags, u8 byte sent, u8 answer.
+ */
+class SerialLink : public SerialTransport {
+public:
+    typedef std::shared_ptr<SerialLink> Ptr;
+
+    SerialLink(uint32_t syncInterval = LINK_SYNC_CYCLES);
+
+    void send(Serial& serial, uint8_t out) override;
+    uint32_t dotsUntilSync() const override;
+
+    /** The machine whose cycle count sync points are measured against; set
+     * by runLinkedFrame(). Until then the link reports no events of its own.
+     */
+    inline void machine(const GameBoy* gameBoy) { _machine = gameBoy; }
+
+    /** Machine cycle count at which the next sync is due.
+     */
+    inline uint64_t nextSync() const { return _nextSync; }
+
+    /** Exchanges packets with the other end, delivering anything it sent to
+     * serial. Returns false if the other end has gone, after which the link
+     * acts as an unplugged cable.
+     */
+    bool sync(Serial& serial);
+
+    inline bool connected() const { return _connected; }
+
+protected:
+    virtual bool writePacket(const uint8_t* packet) = 0;
+    virtual bool readPacket(uint8_t* packet) = 0;
+
+private:
+    const GameBoy* _machine;
+    uint32_t _syncInterval;
+    uint64_t _nextSync;
+    bool _connected;
+    bool _havePeerPacket; // False until the other end's first packet is due.
+
+    bool _pendingSend;
+    uint8_t _pendingByte;
+
+    bool disconnect(Serial& serial);
+};
+
+/** Both ends of an in-process cable, for two machines run by
+ * runLinkedFrame().
+ */
+void makeSerialPair(SerialLink::Ptr& first, SerialLink::Ptr& second, uint32_t syncInterval = LINK_SYNC_CYCLES);
+
+/** A cable to a machine in another process, over a Unix domain socket.
+ */
+class SerialSocket : public SerialLink {
+public:
+    ~SerialSocket();
+
+    /** Waits for one connection on path. nullptr on failure.
+     */
+    static SerialLink::Ptr listen(const std::string& path, uint32_t syncInterval = LINK_SYNC_CYCLES);
+
+    /** Connects to a machine listening on path. nullptr on failure.
+     */
+    static SerialLink::Ptr connect(const std::string& path, uint32_t syncInterval = LINK_SYNC_CYCLES);
+
+protected:
+    bool writePacket(const uint8_t* packet) override;
+    bool readPacket(uint8_t* packet) override;
+
+private:
+    int _fd;
+
+    SerialSocket(int fd, uint32_t syncInterval);
+};
+
+/** Runs until the PPU finishes the current frame, syncing over the link on
+ * the way. Returns false if the other end has gone; the frame still finishes.
+ */
+bool runLinkedFrame(GameBoy& gameBoy, SerialLink& link);
+
+/** Runs two machines cabled together in-process until the first finishes the
+ * current frame. Whenever the first reaches a sync point, the second is run up
+ * to the same one, so the two never drift more than one interval apart.
+ */
+bool runLinkedFrame(GameBoy& first, SerialLink& firstLink, GameBoy& second, SerialLink& secondLink);
+
+#endif // __SerialLink_h__
@@ -0,0 +1,80 @@
+#ifndef __SingleStep_h__
+#define __SingleStep_h__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CPU.h"
+
+// Opcodes are tallied with the CB-prefixed ones after the rest.
+#define SINGLE_STEP_OPCODES 512
+
+// More RAM entries than any one instruction touches.
+#define MAX_SINGLE_STEP_RAM 32
+
+struct SingleStepState {
+    uint16_t pc, sp;
+    uint8_t a, b, c, d, e, f, h, l;
+    bool ime;
+
+    uint8_t ramCount;
+    uint16_t ramAddresses[MAX_SINGLE_STEP_RAM];
+    uint8_t ramValues[MAX_SINGLE_STEP_RAM];
+};
+
+struct SingleStepCase {
+    std::string name;
+    SingleStepState initial;
+    SingleStepState final;
+    uint32_t cycles; // Machine cycles, one per bus cycle listed.
+};
+
+struct SingleStepTally {
+    uint32_t passed;
+    uint32_t failed;
+    std::string firstFailure; // Case name and what differed.
+};
+
+/** Runs per-instruction test vectors in the SingleStepTests format: each case
+ * gives the CPU and RAM state before one instruction, the state after it and
+ * the bus cycles it takes.
+ *
+ * The CPU does all of an instruction's memory accesses in its first machine
+ * cycle, so only the number of bus cycles is compared, not what happens on
+ * each.
+ */
+class SingleStepRunner {
+public:
+    SingleStepRunner();
+
+    /** Whether the number of machine cycles is compared. On by default.
+     */
+    inline void checkCycles(bool enabled) { _checkCycles = enabled; }
+
+    /** Runs every case in a file's contents, adding the results to tallies,
+     * which holds SINGLE_STEP_OPCODES entries. False if the file isn't a
+     * JSON array of cases.
+     */
+    bool runFile(const char* begin, const char* end, std::vector<SingleStepTally>& tallies);
+
+    /** Runs one case. On a mismatch, describes it in mismatch if that is not
+     * nullptr.
+     */
+    bool runCase(const SingleStepCase& test, std::string* mismatch = nullptr);
+
+    /** Tally index of the instruction a case starts with.
+     */
+    static uint16_t opcodeIndex(const SingleStepState& initial);
+
+private:
+    class SparseMemory;
+
+    std::shared_ptr<SparseMemory> _memory;
+    CPU _cpu;
+    bool _checkCycles;
+    SingleStepCase _case; // Reused for every case in a file.
+};
+
+#endif // __SingleStep_h__
@@ -0,0 +1,51 @@
+#ifndef __StateHasher_h__
+#define __StateHasher_h__
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "GameBoy.h"
+
+#define FRAME_HASH_VERSION 1
+
+/** Per-region hashes of a machine, taken once a frame.
+ *
+ * Page hashes are cached between calls and only the pages the MMU has seen
+ * written are rehashed, so a frame that touches little RAM costs little. The
+ * hasher clears the MMU's dirty flags, so there should be one per machine.
+ */
+class StateHasher {
+public:
+    enum Region : uint8_t {
+        REGION_CPU,
+        REGION_WRAM,
+        REGION_HRAM,
+        REGION_VRAM,
+        REGION_OAM,
+        REGION_COUNT,
+    };
+
+    struct FrameHashes {
+        uint64_t regions[REGION_COUNT];
+    };
+
+    StateHasher();
+
+    FrameHashes hash(GameBoy& gameBoy);
+
+    static const char* regionName(Region region);
+
+private:
+    uint64_t _pageHashes[DIRTY_PAGE_COUNT];
+};
+
+/** A frame hash stream is a "GBFH" tag and u16 version, followed by one
+ * record of REGION_COUNT little-endian u64s per frame.
+ */
+bool writeFrameHashHeader(std::ostream& stream);
+bool writeFrameHashes(std::ostream& stream, const StateHasher::FrameHashes& hashes);
+bool readFrameHashStream(std::istream& stream, std::vector<StateHasher::FrameHashes>& frames);
+
+#endif // __StateHasher_h__
@@ -0,0 +1,102 @@
+#ifndef __VecEnv_h__
+#define __VecEnv_h__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "GameBoy.h"
+
+#define VEC_ENV_OBSERVATION_PIXELS (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+// How long an idle worker keeps checking for the next step before it sleeps.
+// Steps that follow one another closer than this never wait on a wake up.
+#define VEC_ENV_SPIN_MICROSECONDS 200
+
+struct VecEnvOptions {
+    uint32_t framesPerStep;             // Frames each step runs with its action held.
+    std::vector<uint16_t> ramAddresses; // Read through the bus after every step.
+    unsigned threads;                   // Including the caller's; 0 for one per core.
+    bool pinThreads;                    // Each worker to a core of its own, on Linux.
+    unsigned renderInterval;            // As PPU::renderInterval().
+
+    VecEnvOptions() :
+        framesPerStep(1),
+        threads(0),
+        pinThreads(false),
+        renderInterval(1) {
+    }
+};
+
+/** Many machines running the same ROM, stepped together, for training agents.
+ *
+ * Each step holds one action, a button mask, down on every machine for
+ * framesPerStep frames, then writes every machine's last frame and the bytes
+ * at ramAddresses, from which a reward can be worked out, into arrays the
+ * caller owns, one after another by machine.
+ *
+ * Machines are shared out between a pool of worker threads that lives as long
+ * as the environment, and the thread calling step(). Each takes the next
+ * machine nobody has started, so threads that finish early pick up the slack.
+ * Machines share nothing, so each runs exactly as it would alone.
+ */
+class VecEnv {
+public:
+    VecEnv(const std::vector<uint8_t>& rom, size_t count, const VecEnvOptions& options = VecEnvOptions());
+    ~VecEnv();
+
+    inline size_t count() const { return _envs.size(); }
+
+    /** Threads working on a step, including the caller.
+     */
+    inline unsigned threads() const { return (unsigned)_workers.size() + 1; }
+
+    /** Bytes written per machine to the ram array of step().
+     */
+    inline size_t ramBytes() const { return _options.ramAddresses.size(); }
+
+    /** A machine, for inspection between steps.
+     */
+    inline GameBoy& env(size_t index) { return *_envs[index]; }
+
+    /** Runs one step on every machine, with count() actions in. observations
+     * gets count() * VEC_ENV_OBSERVATION_PIXELS pixels and ram gets count() *
+     * ramBytes() bytes; either can be nullptr if not wanted.
+     */
+    void step(const uint8_t* actions, uint32_t* observations, uint8_t* ram);
+
+    /** Puts a machine, or all of them, back as it was when created.
+     */
+    void reset(size_t index);
+    void reset();
+
+private:
+    std::vector<std::unique_ptr<GameBoy>> _envs;
+    std::vector<uint8_t> _startState;
+    VecEnvOptions _options;
+
+    // The step being run. Set before _next is reset for it, which is what
+    // workers claim machines through.
+    const uint8_t* _actions;
+    uint32_t* _observations;
+    uint8_t* _ram;
+    std::atomic<size_t> _next;
+    std::atomic<size_t> _remaining;
+
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::atomic<uint64_t> _generation; // Goes up once a step, and to stop.
+    std::atomic<bool> _stopping;
+
+    void work(unsigned worker);
+    void runShare();
+    void runEnv(size_t index);
+};
+
+#endif // __VecEnv_h__
@@ -0,0 +1,139 @@
+#include "GameBoy.h"
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include <string>
+#include <vector>
+
+// The gameboy Python module.
+//
+//     import gameboy
+//     machine = gameboy.GameBoy(open("game.gb", "rb").read())
+//     machine.buttons = gameboy.BUTTON_START
+//     machine.run_frames(60)
+//     screen = machine.framebuffer  # (144, 160) uint32, 0xAARRGGBB
+//
+// framebuffer, wram, vram, oam and hram are NumPy views of the machine's own
+// memory, not copies, so they follow it as it runs and cost nothing to take.
+// Each keeps its machine alive for as long as it is around. They are read
+// only: writes go through write(), so the MMU sees them and keeps its dirty
+// pages, and with them the state hasher, up to date.
+//
+// step() and run_frames() release the GIL, so threads each running machines
+// of their own run in parallel. A machine is not safe to use from two threads
+// at once.
+
+namespace py = pybind11;
+
+/** A read only NumPy array over data owned by owner.
+ */
+template<typename T>
+static py::array_t<T> view(py::handle owner, const T* data, std::vector<py::ssize_t> shape) {
+    py::array_t<T> array(shape, data, owner);
+    array.attr("setflags")(py::arg("write") = false);
+    return array;
+}
+
+PYBIND11_MODULE(gameboy, module) {
+    module.doc() = "Game Boy and Game Boy Color emulator";
+
+    module.attr("BUTTON_A") = (int)Joypad::BUTTON_A;
+    module.attr("BUTTON_B") = (int)Joypad::BUTTON_B;
+    module.attr("BUTTON_SELECT") = (int)Joypad::BUTTON_SELECT;
+    module.attr("BUTTON_START") = (int)Joypad::BUTTON_START;
+    module.attr("BUTTON_RIGHT") = (int)Joypad::BUTTON_RIGHT;
+    module.attr("BUTTON_LEFT") = (int)Joypad::BUTTON_LEFT;
+    module.attr("BUTTON_UP") = (int)Joypad::BUTTON_UP;
+    module.attr("BUTTON_DOWN") = (int)Joypad::BUTTON_DOWN;
+
+    module.attr("SCREEN_WIDTH") = SCREEN_WIDTH;
+    module.attr("SCREEN_HEIGHT") = SCREEN_HEIGHT;
+
+    py::class_<GameBoy>(module, "GameBoy")
+        .def(py::init([](py::bytes rom) {
+            const std::string data = static_cast<std::string>(rom);
+            return new GameBoy(std::vector<uint8_t>(data.begin(), data.end()));
+        }), py::arg("rom"), "A machine running the given ROM image, from power on.")
+
+        .def("reset", &GameBoy::reset)
+
+        .def("step", [](GameBoy& gameBoy, uint64_t machineCycles) {
+            for (uint64_t i = 0; i < machineCycles; i++) {
+                gameBoy.step();
+            }
+        }, py::arg("machine_cycles") = 1, py::call_guard<py::gil_scoped_release>(),
+            "Runs the given number of machine cycles.")
+
+        .def("run_frames", [](GameBoy& gameBoy, uint32_t frames) {
+            for (uint32_t i = 0; i < frames; i++) {
+                gameBoy.runFrame();
+            }
+        }, py::arg("frames") = 1, py::call_guard<py::gil_scoped_release>(),
+            "Runs until the PPU has finished the given number of frames.")
+
+        .def_property("buttons",
+            [](GameBoy& gameBoy) { return gameBoy.mmu().joypad().buttons(); },
+            [](GameBoy& gameBoy, uint8_t pressed) { gameBoy.mmu().joypad().buttons(pressed); },
+            "Buttons held down, as BUTTON_* flags.")
+
+        .def("save_state", [](const GameBoy& gameBoy) {
+            std::vector<uint8_t> state;
+            gameBoy.saveState(state);
+            return py::bytes((const char*)state.data(), state.size());
+        }, "Everything needed to carry on from here, as bytes.")
+
+        .def("load_state", [](GameBoy& gameBoy, py::bytes state) {
+            const std::string data = static_cast<std::string>(state);
+            if (!gameBoy.loadState(std::vector<uint8_t>(data.begin(), data.end()))) {
+                throw py::value_error("not a save state of this ROM from this build");
+            }
+        }, py::arg("state"), "Carries on from where save_state() left off.")
+
+        .def("read", [](GameBoy& gameBoy, uint16_t addr) {
+            return gameBoy.mmu().read(addr);
+        }, py::arg("addr"), "Reads a byte through the bus, as the CPU would.")
+
+        .def("write", [](GameBoy& gameBoy, uint16_t addr, uint8_t value) {
+            gameBoy.mmu().write(addr, value);
+        }, py::arg("addr"), py::arg("value"), "Writes a byte through the bus, as the CPU would.")
+
+        .def_property_readonly("framebuffer", [](py::object self) {
+            GameBoy& gameBoy = self.cast<GameBoy&>();
+            return view<uint32_t>(self, gameBoy.ppu().framebuffer(), { SCREEN_HEIGHT, SCREEN_WIDTH });
+        }, "The last frame, SCREEN_HEIGHT rows of SCREEN_WIDTH 0xAARRGGBB pixels.")
+
+        .def_property_readonly("wram", [](py::object self) {
+            GameBoy& gameBoy = self.cast<GameBoy&>();
+            return view<uint8_t>(self, gameBoy.mmu()._workRAM, { WRAM_SIZE });
+        }, "Work RAM, every bank; the DMG only uses the first two.")
+
+        .def_property_readonly("vram", [](py::object self) {
+            GameBoy& gameBoy = self.cast<GameBoy&>();
+            return view<uint8_t>(self, gameBoy.ppu()._vram, { VRAM_SIZE * VRAM_BANK_COUNT });
+        }, "Video RAM, both banks; the DMG only uses the first.")
+
+        .def_property_readonly("oam", [](py::object self) {
+            GameBoy& gameBoy = self.cast<GameBoy&>();
+            return view<uint8_t>(self, gameBoy.ppu()._oam, { OAM_SIZE });
+        }, "Sprite attribute memory.")
+
+        .def_property_readonly("hram", [](py::object self) {
+            GameBoy& gameBoy = self.cast<GameBoy&>();
+            return view<uint8_t>(self, gameBoy.mmu()._highRAM, { HRAM_SIZE });
+        }, "High RAM, 0xff80-0xfffe.")
+
+        .def_property("render_interval",
+            [](GameBoy& gameBoy) { return gameBoy.ppu().renderInterval(); },
+            [](GameBoy& gameBoy, unsigned interval) { gameBoy.ppu().renderInterval(interval); },
+            "Compose every Nth frame's pixels; 0 never does.")
+
+        .def_property("idle_loop_skip",
+            [](GameBoy& gameBoy) { return gameBoy.idleLoopSkip(); },
+            [](GameBoy& gameBoy, bool enabled) { gameBoy.idleLoopSkip(enabled); })
+
+        .def_property_readonly("frame_count", [](GameBoy& gameBoy) { return gameBoy.ppu().frameCount(); })
+        .def_property_readonly("machine_cycles", &GameBoy::machineCycles)
+        .def("state_hash", &GameBoy::stateHash)
+        .def("rom_hash", &GameBoy::romHash);
+}
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+# Smoke test for the gameboy module: imports it, runs a ROM and reads back
+# the framebuffer and RAM through their NumPy views. CTest runs it with the
+# module's directory on PYTHONPATH when built with ENABLE_PYTHON.
+
+import sys
+import threading
+
+import numpy
+
+import gameboy
+
+# Turns the LCD off, fills the top half of tile 0 with colour 3, then turns
+# it back on, so every tile on screen is black over white.
+PROGRAM = bytes([
+    0xaf, 0xe0, 0x40,  # XOR A; LDH (LCDC), A
+    0x21, 0x00, 0x80,  # LD HL, 0x8000
+    0x3e, 0xff,        # LD A, 0xff
+    0x06, 0x08,        # LD B, 8
+    0x22, 0x05,        # fill: LD (HL+), A; DEC B
+    0x20, 0xfc,        # JR NZ, fill
+    0x3e, 0x91,        # LD A, 0x91
+    0xe0, 0x40,        # LDH (LCDC), A
+    0x18, 0xfe,        # done: JR done
+])
+
+BLACK = 0xff000000
+WHITE = 0xffffffff
+
+
+def test_rom():
+    rom = bytearray(0x8000)
+    rom[0x100:0x100 + len(PROGRAM)] = PROGRAM
+    return bytes(rom)
+
+
+def check(condition, what):
+    if not condition:
+        print("FAILED: " + what)
+        sys.exit(1)
+
+
+def main():
+    machine = gameboy.GameBoy(test_rom())
+    machine.run_frames(3)
+    check(machine.frame_count == 3, "run_frames() runs whole frames")
+
+    screen = machine.framebuffer
+    check(screen.shape == (gameboy.SCREEN_HEIGHT, gameboy.SCREEN_WIDTH), "framebuffer shape")
+    check(screen.dtype == numpy.uint32, "framebuffer type")
+    check(not screen.flags.writeable, "framebuffer is read only")
+    check(screen[0, 0] == BLACK and screen[4, 0] == WHITE, "framebuffer shows the tile")
+    check(screen[gameboy.SCREEN_HEIGHT - 1, gameboy.SCREEN_WIDTH - 1] == WHITE, "framebuffer is all there")
+
+    # The views are of the machine's own memory, and keep it alive.
+    wram = machine.wram
+    vram = machine.vram
+    del machine
+    check(vram[0] == 0xff and vram[8] == 0x00, "vram holds the tile")
+
+    check(not wram.flags.writeable, "wram is read only")
+    other = gameboy.GameBoy(test_rom())
+    other.write(0xc010, 0xa5)
+    check(other.read(0xc010) == 0xa5 and other.wram[0x10] == 0xa5, "read() and write() go through the bus")
+    check(wram[0x10] == 0x00, "each machine has its own memory")
+
+    state = other.save_state()
+    cycles = other.machine_cycles
+    other.step(1000)
+    check(other.machine_cycles == cycles + 1000, "step() runs machine cycles")
+    other.load_state(state)
+    check(other.machine_cycles == cycles and other.read(0xc010) == 0xa5, "load_state() restores save_state()")
+
+    try:
+        gameboy.GameBoy(bytes(0x8000)).load_state(state)
+        check(False, "load_state() rejects another ROM's state")
+    except ValueError:
+        pass
+
+    # Machines on threads of their own run in parallel and agree.
+    machines = [gameboy.GameBoy(test_rom()) for _ in range(4)]
+    threads = [threading.Thread(target=m.run_frames, args=(10,)) for m in machines]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    check(len(set(m.state_hash() for m in machines)) == 1, "threaded machines agree")
+    print("gameboy module OK")
+
+
+if __name__ == "__main__":
+    main()
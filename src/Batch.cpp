@@ -0,0 +1,386 @@
+#include "Batch.h"
+
+#include "ALU.h"
+#include "Opcodes.h"
+
+#define BATCH_ROW_F 6
+#define BATCH_NO_KEY 0xffffffff
+
+// What running an opcode across lanes takes; BATCH_SCALAR for anything that
+// touches more than registers.
+enum BatchOp : uint8_t {
+    BATCH_SCALAR = 0,
+    BATCH_NOP,
+    BATCH_LOAD,           // LD r, r'
+    BATCH_LOAD_IMMEDIATE, // LD r, n
+    BATCH_ALU,            // ADD A, r ... CP r
+    BATCH_ALU_IMMEDIATE,  // ADD A, n ... CP n
+    BATCH_INCREMENT,      // INC r
+    BATCH_DECREMENT,      // DEC r
+    BATCH_JUMP,           // JR n
+    BATCH_JUMP_IF,        // JR cc, n
+};
+
+// By whether the lane's CPU has accurate timing. Everything that runs across
+// lanes with accurate timing runs the same way with fast timing.
+static BatchOp g_batchOps[2][256];
+
+static bool buildBatchTable() {
+    for (auto& ops : g_batchOps) {
+        ops[Opcode::NOP] = BATCH_NOP;
+
+        for (int opcode = 0x40; opcode < 0xc0; opcode++) {
+            const bool memoryOperand = (opcode & 0x07) == 0x06 || (opcode < 0x80 && (opcode & 0x38) == 0x30);
+            if (!memoryOperand) {
+                ops[opcode] = opcode < 0x80 ? BATCH_LOAD : BATCH_ALU;
+            }
+        }
+
+        for (int index = 0; index < 8; index++) {
+            if (index != 6) {
+                ops[0x04 | index << 3] = BATCH_INCREMENT;
+                ops[0x05 | index << 3] = BATCH_DECREMENT;
+            }
+        }
+    }
+
+    // With accurate timing, an operand fetch has to wait for its own machine
+    // cycle, and a relative jump takes one longer when taken; these only run
+    // across lanes where the whole instruction happens at once.
+    BatchOp* fast = g_batchOps[0];
+    for (int index = 0; index < 8; index++) {
+        if (index != 6) {
+            fast[0x06 | index << 3] = BATCH_LOAD_IMMEDIATE;
+        }
+
+        fast[0xc6 | index << 3] = BATCH_ALU_IMMEDIATE;
+    }
+
+    fast[Opcode::JR_N] = BATCH_JUMP;
+    fast[Opcode::JR_NZ_N] = BATCH_JUMP_IF;
+    fast[Opcode::JR_Z_N] = BATCH_JUMP_IF;
+    fast[Opcode::JR_NC_N] = BATCH_JUMP_IF;
+    fast[Opcode::JR_C_N] = BATCH_JUMP_IF;
+
+    return true;
+}
+
+static const bool g_batchTableBuilt = buildBatchTable();
+
+static inline bool hasOperand(BatchOp op) {
+    return op == BATCH_LOAD_IMMEDIATE || op == BATCH_ALU_IMMEDIATE || op == BATCH_JUMP || op == BATCH_JUMP_IF;
+}
+
+BatchEngine::BatchEngine(const std::vector<uint8_t>& rom, size_t lanes) :
+    _count(lanes),
+    _registers(8 * lanes),
+    _stackPointers(lanes),
+    _programCounters(lanes),
+    _pending(lanes),
+    _keys(lanes),
+    _mask(lanes),
+    _stats() {
+    for (size_t i = 0; i < lanes; i++) {
+        _lanes.emplace_back(new GameBoy(rom));
+    }
+
+    reloadRegisters();
+}
+
+// Registers //////////////////////////////////////////////////////////////////
+
+void BatchEngine::loadLane(size_t index) {
+    CPU& cpu = _lanes[index]->cpu();
+
+    for (int reg = 0; reg < 8; reg++) {
+        if (reg != BATCH_ROW_F) {
+            cpu.reg8(reg) = row(reg)[index];
+        }
+    }
+
+    cpu._flags = row(BATCH_ROW_F)[index];
+    cpu._stackPointer = _stackPointers[index];
+    cpu._programCounter = _programCounters[index];
+}
+
+void BatchEngine::storeLane(size_t index) {
+    CPU& cpu = _lanes[index]->cpu();
+
+    for (int reg = 0; reg < 8; reg++) {
+        if (reg != BATCH_ROW_F) {
+            row(reg)[index] = cpu.reg8(reg);
+        }
+    }
+
+    row(BATCH_ROW_F)[index] = cpu._flags;
+
+    _stackPointers[index] = cpu._stackPointer;
+    _programCounters[index] = cpu._programCounter;
+}
+
+void BatchEngine::flushRegisters() {
+    for (size_t i = 0; i < _count; i++) {
+        loadLane(i);
+    }
+}
+
+void BatchEngine::reloadRegisters() {
+    for (size_t i = 0; i < _count; i++) {
+        storeLane(i);
+    }
+}
+
+// Running ////////////////////////////////////////////////////////////////////
+
+void BatchEngine::runFrame() {
+    std::vector<uint64_t> frames(_count);
+    std::vector<uint8_t> active(_count, 1);
+
+    for (size_t i = 0; i < _count; i++) {
+        frames[i] = _lanes[i]->ppu().frameCount();
+    }
+
+    size_t running = _count;
+    while (running > 0) {
+        runRound(active);
+
+        for (size_t i = 0; i < _count; i++) {
+            if (active[i] && _lanes[i]->ppu().frameCount() != frames[i]) {
+                active[i] = 0;
+                running--;
+            }
+        }
+    }
+}
+
+void BatchEngine::runRound(const std::vector<uint8_t>& active) {
+    _stats.rounds++;
+
+    // What each lane is about to run. Interrupts and HALT are left to the
+    // lane's CPU, as is every instruction that isn't register-only.
+    for (size_t i = 0; i < _count; i++) {
+        _pending[i] = active[i];
+        _keys[i] = BATCH_NO_KEY;
+
+        if (!active[i]) {
+            continue;
+        }
+
+        GameBoy& gameBoy = *_lanes[i];
+        MMU& mmu = gameBoy.mmu();
+        const bool interruptPending = (mmu._interruptEnable & mmu._interruptFlags & 0x1f) != 0;
+        if (gameBoy.cpu()._isHalted || interruptPending) {
+            continue;
+        }
+
+        const uint16_t pc = _programCounters[i];
+        const uint8_t opcode = mmu.peek(pc);
+        const BatchOp op = g_batchOps[gameBoy.cpu().accurateTiming() ? 1 : 0][opcode];
+        if (op != BATCH_SCALAR) {
+            const uint8_t operand = hasOperand(op) ? mmu.peek(pc + 1) : 0;
+            _keys[i] = (uint32_t)pc << 16 | (uint32_t)opcode << 8 | operand;
+        }
+    }
+
+    // Pick groups by their first lane; a lane alone in its group runs below.
+    size_t first = 0;
+    for (int group = 0; group < BATCH_MAX_GROUPS; group++) {
+        while (first < _count && (!_pending[first] || _keys[first] == BATCH_NO_KEY)) {
+            first++;
+        }
+
+        if (first == _count) {
+            break;
+        }
+
+        const uint32_t key = _keys[first];
+        size_t members = 0;
+        for (size_t i = 0; i < _count; i++) {
+            _mask[i] = _pending[i] && _keys[i] == key;
+            members += _mask[i];
+        }
+
+        if (members < BATCH_MIN_GROUP) {
+            _keys[first] = BATCH_NO_KEY;
+            continue;
+        }
+
+        runGroup((uint8_t)(key >> 8), (uint8_t)key);
+
+        for (size_t i = 0; i < _count; i++) {
+            _pending[i] &= !_mask[i];
+        }
+
+        _stats.groups++;
+        _stats.vectorInstructions += members;
+    }
+
+    for (size_t i = 0; i < _count; i++) {
+        if (_pending[i]) {
+            runScalar(i);
+        }
+    }
+}
+
+void BatchEngine::runScalar(size_t index) {
+    GameBoy& gameBoy = *_lanes[index];
+    CPU& cpu = gameBoy.cpu();
+
+    loadLane(index);
+
+    do {
+        gameBoy.step();
+    } while (!cpu.atInstructionBoundary() && !cpu._isHalted);
+
+    storeLane(index);
+    _stats.scalarInstructions++;
+}
+
+// Instructions across lanes //////////////////////////////////////////////////
+
+// Every loop below computes the result for every lane and keeps it only for
+// those in the group, so that it has no branches and vectorises.
+
+template<typename Operand>
+static void aluAcross(int operation, size_t count, const uint8_t* mask, uint8_t* a, uint8_t* f, Operand operandOf) {
+    switch (operation) {
+        case 0: // ADD
+        case 1: // ADC
+            for (size_t i = 0; i < count; i++) {
+                const uint8_t carry = operation == 1 && (f[i] & FLAG_C) != 0 ? 1 : 0;
+                const uint8_t value = operandOf(i) + carry;
+                const uint8_t flags = (f[i] & 0x0f) | addFlags(a[i], value);
+                const uint8_t result = a[i] + value;
+                a[i] = mask[i] ? result : a[i];
+                f[i] = mask[i] ? flags : f[i];
+            }
+            break;
+        case 2: // SUB
+        case 3: // SBC
+            for (size_t i = 0; i < count; i++) {
+                const uint8_t carry = operation == 3 && (f[i] & FLAG_C) != 0 ? 1 : 0;
+                const uint8_t value = operandOf(i);
+                const uint8_t flags = (f[i] & 0x0f) | subtractFlags(a[i], value, carry);
+                const uint8_t result = a[i] - value - carry;
+                a[i] = mask[i] ? result : a[i];
+                f[i] = mask[i] ? flags : f[i];
+            }
+            break;
+        case 4: // AND
+        case 5: // XOR
+        case 6: // OR
+            for (size_t i = 0; i < count; i++) {
+                const uint8_t value = operandOf(i);
+                const uint8_t result = operation == 4 ? a[i] & value : operation == 5 ? a[i] ^ value : a[i] | value;
+                const uint8_t flags = (f[i] & 0x0f) | (result == 0 ? FLAG_Z : 0) | (operation == 4 ? FLAG_H : 0);
+                a[i] = mask[i] ? result : a[i];
+                f[i] = mask[i] ? flags : f[i];
+            }
+            break;
+        case 7: // CP
+            for (size_t i = 0; i < count; i++) {
+                const uint8_t flags = (f[i] & 0x0f) | compareFlags(a[i], operandOf(i));
+                f[i] = mask[i] ? flags : f[i];
+            }
+            break;
+    }
+}
+
+void BatchEngine::runGroup(uint8_t opcode, uint8_t operand) {
+    const size_t count = _count;
+    const uint8_t* mask = _mask.data();
+    uint8_t* a = row(REG_A);
+    uint8_t* f = row(BATCH_ROW_F);
+    uint16_t* pc = _programCounters.data();
+
+    uint16_t length = 1;
+    uint32_t cycles = 1;
+
+    // Lanes with either timing can share a group, which only ever holds
+    // opcodes that run the same on both.
+    const BatchOp op = g_batchOps[0][opcode];
+
+    switch (op) {
+        case BATCH_LOAD: {
+            uint8_t* to = row((opcode >> 3) & 0x07);
+            const uint8_t* from = row(opcode & 0x07);
+            for (size_t i = 0; i < count; i++) {
+                to[i] = mask[i] ? from[i] : to[i];
+            }
+            break;
+        }
+        case BATCH_LOAD_IMMEDIATE: {
+            uint8_t* to = row((opcode >> 3) & 0x07);
+            for (size_t i = 0; i < count; i++) {
+                to[i] = mask[i] ? operand : to[i];
+            }
+            length = 2;
+            cycles = 2;
+            break;
+        }
+        case BATCH_ALU: {
+            const uint8_t* from = row(opcode & 0x07);
+            aluAcross((opcode >> 3) & 0x07, count, mask, a, f, [from](size_t i) { return from[i]; });
+            break;
+        }
+        case BATCH_ALU_IMMEDIATE:
+            aluAcross((opcode >> 3) & 0x07, count, mask, a, f, [operand](size_t) { return operand; });
+            length = 2;
+            cycles = 2;
+            break;
+        case BATCH_INCREMENT: {
+            uint8_t* reg = row((opcode >> 3) & 0x07);
+            for (size_t i = 0; i < count; i++) {
+                const uint8_t flags = (f[i] & (FLAG_C | 0x0f)) | incrementFlags(reg[i]);
+                const uint8_t result = reg[i] + 1;
+                reg[i] = mask[i] ? result : reg[i];
+                f[i] = mask[i] ? flags : f[i];
+            }
+            break;
+        }
+        case BATCH_DECREMENT: {
+            uint8_t* reg = row((opcode >> 3) & 0x07);
+            for (size_t i = 0; i < count; i++) {
+                const uint8_t flags = (f[i] & (FLAG_C | 0x0f)) | decrementFlags(reg[i]);
+                const uint8_t result = reg[i] - 1;
+                reg[i] = mask[i] ? result : reg[i];
+                f[i] = mask[i] ? flags : f[i];
+            }
+            break;
+        }
+        case BATCH_JUMP:
+        case BATCH_JUMP_IF: {
+            // JR cc is 0x20 | cc << 3: bit 4 picks C over Z, bit 3 whether it
+            // has to be set.
+            const bool always = op == BATCH_JUMP;
+            const uint8_t flag = (opcode & 0x10) != 0 ? FLAG_C : FLAG_Z;
+            const uint8_t wanted = (opcode & 0x08) != 0 ? flag : 0;
+            const uint16_t offset = (uint16_t)(int8_t)operand;
+
+            for (size_t i = 0; i < count; i++) {
+                const bool taken = always || (f[i] & flag) == wanted;
+                const uint16_t target = pc[i] + 2 + (taken ? offset : 0);
+                pc[i] = mask[i] ? target : pc[i];
+            }
+
+            length = 0;
+            cycles = 2;
+            break;
+        }
+        default:
+            break;
+    }
+
+    if (length != 0) {
+        for (size_t i = 0; i < count; i++) {
+            pc[i] = mask[i] ? pc[i] + length : pc[i];
+        }
+    }
+
+    // Each lane's bus runs on its own.
+    for (size_t i = 0; i < count; i++) {
+        if (mask[i]) {
+            _lanes[i]->runBus(cycles);
+        }
+    }
+}
@@ -1,25 +1,97 @@
 #include "CPU.h"
 
+#include "ALU.h"
+#include "IORegisters.h"
 #include "Log.h"
 #include "Opcodes.h"
+#include "Profiler.h"
+#include "SaveState.h"
 #include "Util.h"
 
+#include <cstring>
 #include <sstream>
 
-CPU::CPU(Memory::Ptr memory) : _memory(memory) {
+// With OPCODE_LAYOUT, handlers are laid out by how much a training run used
+// them (see OpcodeHeat.h): hot ones together in .text.hot, and cold ones out
+// of line in .text.unlikely, so the dispatcher only carries code that runs.
+#ifdef GB_OPCODE_LAYOUT
+#include "OpcodeLayout.h"
+#define OPCODE_HOT __attribute__((hot))
+#define OPCODE_COLD __attribute__((cold, noinline))
+#define LAYOUT(handler) LAYOUT_##handler
+#else
+#define LAYOUT(handler)
+#endif
+
+CPU::CPU(Memory::Ptr memory) :
+    _fusion(true),
+    _accurateTiming(DEFAULT_ACCURATE_TIMING),
+    _memory(memory),
+    _profiler(nullptr) {
     reset();
+    resetCounters();
 }
 
 void CPU::reset() {
+    // Zeroed rather than left as whatever was there, so that two machines
+    // started from the same ROM are in the same state.
+    memset(_registers, 0, sizeof(_registers));
+
     _programCounter = INIT_VECTOR;
     _stackPointer = INIT_STACK_POINTER;
-    _flags = 0;
     _interruptsEnabled = true;
     _isHalted = false;
     _isStopped = false;
 
     _awaitingClockCycles = CLOCK_CYCLES_PER_MACHINE_CYCLE;
     _awaitingMachineCycles = 0;
+    _accessCycle = 0;
+    _busCycle = 0;
+}
+
+void CPU::saveState(StateWriter& state) const {
+    state.u8(_regA);
+    state.u8(_flags);
+    state.u8(_regB);
+    state.u8(_regC);
+    state.u8(_regD);
+    state.u8(_regE);
+    state.u8(_regH);
+    state.u8(_regL);
+    state.u16(_stackPointer);
+    state.u16(_programCounter);
+
+    state.flag(_interruptsEnabled);
+    state.flag(_isHalted);
+    state.flag(_isStopped);
+
+    state.u8((uint8_t)_awaitingClockCycles);
+    state.u8((uint8_t)_awaitingMachineCycles);
+}
+
+void CPU::loadState(StateReader& state) {
+    _regA = state.u8();
+    _flags = state.u8();
+    _regB = state.u8();
+    _regC = state.u8();
+    _regD = state.u8();
+    _regE = state.u8();
+    _regH = state.u8();
+    _regL = state.u8();
+    _stackPointer = state.u16();
+    _programCounter = state.u16();
+
+    _interruptsEnabled = state.flag();
+    _isHalted = state.flag();
+    _isStopped = state.flag();
+
+    _awaitingClockCycles = (int8_t)state.u8();
+    _awaitingMachineCycles = (int8_t)state.u8();
+
+    // Accesses are all made by the time an instruction's cycles are counted
+    // out, so there is none in flight to carry over.
+    _accessCycle = 0;
+    _busCycle = 0;
 }
 
 void CPU::clock() {
@@ -28,24 +100,224 @@ void CPU::clock() {
     //          to drive machine state.
     if (--_awaitingClockCycles <= 0) {
         _awaitingClockCycles = CLOCK_CYCLES_PER_MACHINE_CYCLE;
-        machineCycle();
+        if (_accurateTiming) {
+            machineCycle<AccurateTiming>();
+        } else {
+            machineCycle<FastTiming>();
+        }
     }
 }
 
+CPUCounters CPU::counters() const {
+#ifdef GB_PERF_COUNTERS
+    return _counters;
+#else
+    CPUCounters counters;
+    memset(&counters, 0, sizeof(counters));
+    return counters;
+#endif
+}
+
+void CPU::resetCounters() {
+#ifdef GB_PERF_COUNTERS
+    memset(&_counters, 0, sizeof(_counters));
+#endif
+}
+
+template<class Timing>
 void CPU::machineCycle() {
     // IMPROVE: For now, machine cycles just wait in an attempt to keep timing
     //          accurate. A better implementation would split up machine states
     //          for accurate internals.
+    if (_profiler != nullptr) {
+        _profiler->machineCycle(_programCounter);
+    }
+
     if (_awaitingMachineCycles > 0) {
         _awaitingMachineCycles--;
         return;
     }
 
-    _awaitingMachineCycles = decodeAndExecute() - 1;
+    startInstruction<Timing>();
+}
+
+template void CPU::machineCycle<FastTiming>();
+template void CPU::machineCycle<AccurateTiming>();
+
+template<class Timing>
+void CPU::startInstruction() {
+    const auto interruptCycles = serviceInterrupts<Timing>();
+    if (interruptCycles > 0) {
+        _awaitingMachineCycles = interruptCycles - 1;
+        return;
+    }
+
+    if (_isHalted) {
+        PERF_COUNT(_counters.haltCycles);
+        return;
+    }
+
+    const int8_t cycles = decodeAndExecute<Timing>();
+
+    // With accurate timing, every machine cycle was either an access or an
+    // internal one.
+    _awaitingMachineCycles = (Timing::accurate ? _accessCycle : cycles) - 1;
+}
+
+template<class Timing>
+int8_t CPU::serviceInterrupts() {
+    const uint8_t pending = _memory->peek(IO_IE) & _memory->peek(IO_IF) & 0x1f;
+    if (pending == 0) {
+        return 0;
+    }
+
+    // Any pending interrupt ends HALT, even if it isn't going to be serviced.
+    _isHalted = false;
+
+    if (!_interruptsEnabled) {
+        return 0;
+    }
+
+    // Lowest bit has highest priority.
+    uint8_t index = 0;
+    while ((pending & (0x01 << index)) == 0) {
+        index++;
+    }
+
+    PERF_COUNT(_counters.interrupts[index]);
+
+    _interruptsEnabled = false;
+    _memory->write(IO_IF, (_memory->peek(IO_IF) & 0x1f) & ~(0x01 << index));
+
+    // Two internal cycles, the push, then one to load the vector.
+    beginInstruction<Timing>();
+    busIdle<Timing>();
+    busIdle<Timing>();
+    push16<Timing>(_programCounter);
+    busIdle<Timing>();
+    _programCounter = 0x0040 + index * 8;
+
+    if (_profiler != nullptr) {
+        _profiler->enter(_programCounter, _stackPointer);
+    }
+
+    return 5;
+}
+
+// Superinstructions //////////////////////////////////////////////////////////
+
+// Machine cycles taken by each instruction that can start a fused pair, or 0.
+// The pairs are the hottest in gameboyEmulator --pair-profile runs that have
+// a second half with no effect outside the CPU that depends on timing:
+//
+//   LD A,(HL+); LD (DE),A    copy loops
+//   DEC r; JR NZ             counted loops
+//   CP n; JR cc              dispatch and polling
+//   LDH A,(n); AND n         register polling
+static uint8_t g_fusionFirstCycles[256];
+
+static bool buildFusionTable() {
+    g_fusionFirstCycles[Opcode::LDI_A_aHL] = 2;
+    g_fusionFirstCycles[Opcode::CP_N] = 2;
+    g_fusionFirstCycles[Opcode::LDH_A_afN] = 3;
+
+    const uint8_t decrements[] = {
+        Opcode::DEC_A, Opcode::DEC_B, Opcode::DEC_C, Opcode::DEC_D,
+        Opcode::DEC_E, Opcode::DEC_H, Opcode::DEC_L,
+    };
+
+    for (const auto opcode : decrements) {
+        g_fusionFirstCycles[opcode] = 1;
+    }
+
+    return true;
+}
+
+static const bool g_fusionTableBuilt = buildFusionTable();
+
+static inline bool isConditionalRelativeJump(uint8_t opcode) {
+    return opcode == Opcode::JR_NZ_N || opcode == Opcode::JR_Z_N ||
+        opcode == Opcode::JR_NC_N || opcode == Opcode::JR_C_N;
 }
 
+int8_t CPU::executeFused(uint8_t opcode) {
+    const bool hasOperand = opcode == Opcode::CP_N || opcode == Opcode::LDH_A_afN;
+    const uint8_t second = _memory->peek(_programCounter + (hasOperand ? 1 : 0));
+
+    bool pair = false;
+    switch(opcode) {
+        case Opcode::LDI_A_aHL: {
+            // The store happens earlier than it would have, which only goes
+            // unnoticed outside I/O and IE.
+            const uint16_t address = regDE();
+            pair = second == Opcode::LD_aDE_A &&
+                (address < 0xff00 || (address >= 0xff80 && address < 0xffff));
+            break;
+        }
+        case Opcode::CP_N:
+            pair = isConditionalRelativeJump(second);
+            break;
+        case Opcode::LDH_A_afN:
+            pair = second == Opcode::AND_N;
+            break;
+        default:
+            pair = second == Opcode::JR_NZ_N;
+            break;
+    }
+
+    // Nothing the second instruction reads, and no interrupt that would have
+    // been taken before it, may change while the first one runs.
+    const uint32_t firstTicks = g_fusionFirstCycles[opcode] * CLOCK_CYCLES_PER_MACHINE_CYCLE;
+    if (!pair || _memory->cyclesUntilEvent() < firstTicks) {
+        return 0;
+    }
+
+    int8_t cycles = 0;
+    switch(opcode) {
+        case Opcode::LDI_A_aHL:
+        case Opcode::LDH_A_afN:
+            cycles = I_LoadAddressIntoRegister<FastTiming>(opcode);
+            break;
+        case Opcode::CP_N:
+            cycles = I_Compare<FastTiming>(opcode);
+            break;
+        default:
+            cycles = I_Decrement<FastTiming>(opcode);
+            break;
+    }
+
+    // The second opcode was only peeked at; fetch it as the program would.
+    busRead<FastTiming>(_programCounter++);
+    PERF_COUNT(_counters.opcodes[second]);
+
+    switch(second) {
+        case Opcode::LD_aDE_A:
+            cycles += I_StoreToAddress<FastTiming>(second);
+            break;
+        case Opcode::AND_N:
+            cycles += I_And<FastTiming>(second);
+            break;
+        default:
+            cycles += I_ConditionalRelativeJump<FastTiming>(second);
+            break;
+    }
+
+    return cycles;
+}
+
+template<class Timing>
 int8_t CPU::decodeAndExecute() {
-    uint8_t opcode = _memory->read(_programCounter++);
+    beginInstruction<Timing>();
+
+    uint8_t opcode = busRead<Timing>(_programCounter++);
+    PERF_COUNT(_counters.opcodes[opcode]);
+
+    if (!Timing::accurate && _fusion && g_fusionFirstCycles[opcode] != 0) {
+        const int8_t cycles = executeFused(opcode);
+        if (cycles > 0) {
+            return cycles;
+        }
+    }
 
     switch(opcode) {
         case Opcode::LD_A_n:
@@ -55,7 +327,7 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::LD_E_n:
         case Opcode::LD_H_n:
         case Opcode::LD_L_n:
-            return I_LoadImmediate(opcode);
+            return I_LoadImmediate<Timing>(opcode);
         case Opcode::LD_A_A:
         case Opcode::LD_A_B:
         case Opcode::LD_A_C:
@@ -106,7 +378,7 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::LD_L_H:
         case Opcode::LD_L_L:
         case Opcode::LD_HL_SP:
-            return I_TransferRegister(opcode);
+            return I_TransferRegister<Timing>(opcode);
         case Opcode::LD_A_aHL:
         case Opcode::LD_B_aHL:
         case Opcode::LD_C_aHL:
@@ -121,7 +393,7 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::LDD_A_aHL:
         case Opcode::LDI_A_aHL:
         case Opcode::LDH_A_afN:
-            return I_LoadAddressIntoRegister(opcode);
+            return I_LoadAddressIntoRegister<Timing>(opcode);
         case Opcode::LD_aHL_A:
         case Opcode::LD_aHL_B:
         case Opcode::LD_aHL_C:
@@ -137,26 +409,26 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::LDD_aHL_A:
         case Opcode::LDI_aHL_A:
         case Opcode::LDH_afN_A:
-            return I_StoreToAddress(opcode);
+            return I_StoreToAddress<Timing>(opcode);
         case Opcode::LD_BC_NN:
         case Opcode::LD_DE_NN:
         case Opcode::LD_HL_NN:
         case Opcode::LD_SP_NN:
-            return I_LoadImmediate16(opcode);
+            return I_LoadImmediate16<Timing>(opcode);
         case Opcode::LD_HL_aSPN:
-            return I_LoadHLWithSPN();
+            return I_LoadHLWithSPN<Timing>();
         case Opcode::LD_aNN_SP:
-            return I_StoreStackPointer();
+            return I_StoreStackPointer<Timing>();
         case Opcode::PUSH_AF:
         case Opcode::PUSH_BC:
         case Opcode::PUSH_DE:
         case Opcode::PUSH_HL:
-            return I_PushRegister(opcode);
+            return I_PushRegister<Timing>(opcode);
         case Opcode::POP_AF:
         case Opcode::POP_BC:
         case Opcode::POP_DE:
         case Opcode::POP_HL:
-            return I_PopRegister(opcode);
+            return I_PopRegister<Timing>(opcode);
         case Opcode::ADD_A_A:
         case Opcode::ADD_A_B:
         case Opcode::ADD_A_C:
@@ -175,7 +447,7 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::ADC_A_L:
         case Opcode::ADC_A_aHL:
         case Opcode::ADC_A_N:
-            return I_8BitAdd(opcode);
+            return I_8BitAdd<Timing>(opcode);
         case Opcode::SUB_A:
         case Opcode::SUB_B:
         case Opcode::SUB_C:
@@ -194,7 +466,7 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::SBC_A_L:
         case Opcode::SBC_A_aHL:
         case Opcode::SBC_A_N:
-            return I_8BitSubtract(opcode);
+            return I_8BitSubtract<Timing>(opcode);
         case Opcode::AND_A:
         case Opcode::AND_B:
         case Opcode::AND_C:
@@ -204,7 +476,7 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::AND_L:
         case Opcode::AND_aHL:
         case Opcode::AND_N:
-            return I_And(opcode);
+            return I_And<Timing>(opcode);
         case Opcode::OR_A:
         case Opcode::OR_B:
         case Opcode::OR_C:
@@ -214,7 +486,7 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::OR_L:
         case Opcode::OR_aHL:
         case Opcode::OR_N:
-            return I_Or(opcode);
+            return I_Or<Timing>(opcode);
         case Opcode::XOR_A:
         case Opcode::XOR_B:
         case Opcode::XOR_C:
@@ -224,7 +496,7 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::XOR_L:
         case Opcode::XOR_aHL:
         case Opcode::XOR_N:
-            return I_Xor(opcode);
+            return I_Xor<Timing>(opcode);
         case Opcode::CP_A:
         case Opcode::CP_B:
         case Opcode::CP_C:
@@ -234,7 +506,7 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::CP_L:
         case Opcode::CP_aHL:
         case Opcode::CP_N:
-            return I_Compare(opcode);
+            return I_Compare<Timing>(opcode);
         case Opcode::INC_A:
         case Opcode::INC_B:
         case Opcode::INC_C:
@@ -243,7 +515,7 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::INC_H:
         case Opcode::INC_L:
         case Opcode::INC_aHL:
-            return I_Increment(opcode);
+            return I_Increment<Timing>(opcode);
         case Opcode::DEC_A:
         case Opcode::DEC_B:
         case Opcode::DEC_C:
@@ -252,24 +524,24 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::DEC_H:
         case Opcode::DEC_L:
         case Opcode::DEC_aHL:
-            return I_Decrement(opcode);
+            return I_Decrement<Timing>(opcode);
         case Opcode::ADD_HL_BC:
         case Opcode::ADD_HL_DE:
         case Opcode::ADD_HL_HL:
         case Opcode::ADD_HL_SP:
-            return I_16BitAdd(opcode);
+            return I_16BitAdd<Timing>(opcode);
         case Opcode::ADD_SP_N:
-            return I_AddToSP();
+            return I_AddToSP<Timing>();
         case Opcode::INC_BC:
         case Opcode::INC_DE:
         case Opcode::INC_HL:
         case Opcode::INC_SP:
-            return I_16BitIncrement(opcode);
+            return I_16BitIncrement<Timing>(opcode);
         case Opcode::DEC_BC:
         case Opcode::DEC_DE:
         case Opcode::DEC_HL:
         case Opcode::DEC_SP:
-            return I_16BitDecrement(opcode);
+            return I_16BitDecrement<Timing>(opcode);
         case Opcode::DAA:
             return I_DecimalAdjust();
         case Opcode::CPL:
@@ -279,28 +551,28 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::SCF:
             return I_SetCarry();
         case Opcode::JP_NN:
-            return I_UnconditionalJump();
+            return I_UnconditionalJump<Timing>();
         case Opcode::JP_NZ_NN:
         case Opcode::JP_Z_NN:
         case Opcode::JP_NC_NN:
         case Opcode::JP_C_NN:
-            return I_ConditionalJump(opcode);
+            return I_ConditionalJump<Timing>(opcode);
         case Opcode::JP_HL:
             return I_JumpToHL();
         case Opcode::JR_N:
-            return I_UnconditionalRelativeJump();
+            return I_UnconditionalRelativeJump<Timing>();
         case Opcode::JR_NZ_N:
         case Opcode::JR_Z_N:
         case Opcode::JR_NC_N:
         case Opcode::JR_C_N:
-            return I_ConditionalRelativeJump(opcode);
+            return I_ConditionalRelativeJump<Timing>(opcode);
         case Opcode::CALL_NN:
-            return I_Call();
+            return I_Call<Timing>();
         case Opcode::CALL_NZ_NN:
         case Opcode::CALL_Z_NN:
         case Opcode::CALL_NC_NN:
         case Opcode::CALL_C_NN:
-            return I_ConditionalCall(opcode);
+            return I_ConditionalCall<Timing>(opcode);
         case Opcode::RST_00:
         case Opcode::RST_08:
         case Opcode::RST_10:
@@ -309,15 +581,15 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::RST_28:
         case Opcode::RST_30:
         case Opcode::RST_38:
-            return I_RST(opcode);
+            return I_RST<Timing>(opcode);
         case Opcode::RET:
         case Opcode::RETI:
-            return I_Return(opcode);
+            return I_Return<Timing>(opcode);
         case Opcode::RET_NZ:
         case Opcode::RET_Z:
         case Opcode::RET_NC:
         case Opcode::RET_C:
-            return I_ConditionalReturn(opcode);
+            return I_ConditionalReturn<Timing>(opcode);
         case Opcode::HALT:
             return I_Halt();
         case Opcode::STOP:
@@ -326,7 +598,7 @@ int8_t CPU::decodeAndExecute() {
         case Opcode::EI:
             return I_SetInterruptEnable(opcode);
         case Opcode::PREFIX_CB:
-            return I_ExecCBGroup();
+            return I_ExecCBGroup<Timing>();
         case Opcode::RLCA:
         case Opcode::RLA:
         case Opcode::RRCA:
@@ -338,73 +610,54 @@ int8_t CPU::decodeAndExecute() {
     }
 }
 
-int8_t CPU::I_LoadImmediate(uint8_t opcode) {
-    uint8_t value = _memory->read(_programCounter++);
+template<class Timing>
+LAYOUT(I_LoadImmediate) int8_t CPU::I_LoadImmediate(uint8_t opcode) {
+    uint8_t value = busRead<Timing>(_programCounter++);
 
-    switch(opcode) {
-        case Opcode::LD_A_n: _regA = value; break;
-        case Opcode::LD_B_n: _regB = value; break;
-        case Opcode::LD_C_n: _regC = value; break;
-        case Opcode::LD_D_n: _regD = value; break;
-        case Opcode::LD_E_n: _regE = value; break;
-        case Opcode::LD_H_n: _regH = value; break;
-        case Opcode::LD_L_n: _regL = value; break;
-    }
+    reg8((opcode >> 3) & 0x07) = value;
 
     return  2;
 }
 
-#define REG_TRANSFER_GROUP(reg) \
-    case Opcode::LD_##reg##_A: _reg##reg = _regA; break; \
-    case Opcode::LD_##reg##_B: _reg##reg = _regB; break; \
-    case Opcode::LD_##reg##_C: _reg##reg = _regC; break; \
-    case Opcode::LD_##reg##_D: _reg##reg = _regD; break; \
-    case Opcode::LD_##reg##_E: _reg##reg = _regE; break; \
-    case Opcode::LD_##reg##_H: _reg##reg = _regH; break; \
-    case Opcode::LD_##reg##_L: _reg##reg = _regL; break; \
-
-int8_t CPU::I_TransferRegister(uint8_t opcode) {
-    switch(opcode) {
-        REG_TRANSFER_GROUP(A);
-        REG_TRANSFER_GROUP(B);
-        REG_TRANSFER_GROUP(C);
-        REG_TRANSFER_GROUP(D);
-        REG_TRANSFER_GROUP(E);
-        REG_TRANSFER_GROUP(H);
-        REG_TRANSFER_GROUP(L);
-        case Opcode::LD_HL_SP:
-            _stackPointer = regHL();
-            return 2;
+template<class Timing>
+LAYOUT(I_TransferRegister) int8_t CPU::I_TransferRegister(uint8_t opcode) {
+    if (opcode == Opcode::LD_HL_SP) {
+        _stackPointer = regHL();
+        busIdle<Timing>();
+        return 2;
     }
 
+    reg8((opcode >> 3) & 0x07) = reg8(opcode & 0x07);
+
     return 1;
 }
 
-int8_t CPU::I_LoadAddressIntoRegister(uint8_t opcode) {
+template<class Timing>
+LAYOUT(I_LoadAddressIntoRegister) int8_t CPU::I_LoadAddressIntoRegister(uint8_t opcode) {
     if (opcode == Opcode::LD_A_afC) {
-        _regA = _memory->read(0xff00 + (uint16_t)_regC);
+        _regA = busRead<Timing>(0xff00 + (uint16_t)_regC);
         return 2;
     } else if (opcode == Opcode::LDH_A_afN) {
-        const auto indirectAddress = _memory->read(_programCounter++);
-        _regA = _memory->read(0xff00 + (uint16_t)indirectAddress);
+        const auto indirectAddress = busRead<Timing>(_programCounter++);
+        _regA = busRead<Timing>(0xff00 + (uint16_t)indirectAddress);
         return 3;
     }
 
     switch(opcode) {
         case Opcode::LD_A_aBC:
-            _regA = _memory->read(regBC());
+            _regA = busRead<Timing>(regBC());
             return 2;
         case Opcode::LD_A_aDE:
-            _regA = _memory->read(regDE());
+            _regA = busRead<Timing>(regDE());
             return 2;
         case Opcode::LD_A_aNN:
-            const auto addr = _memory->readLI(_programCounter);
+            const auto addr = busRead16<Timing>(_programCounter);
             _programCounter += 2;
-            _regA = _memory->read(addr);
+            _regA = busRead<Timing>(addr);
             return 4;
     }
 
-    const auto value = _memory->read(regHL());
+    const auto value = busRead<Timing>(regHL());
 
     if (opcode == Opcode::LDD_A_aHL) {
         regHL(regHL() - 1);
@@ -412,62 +665,50 @@ int8_t CPU::I_LoadAddressIntoRegister(uint8_t opcode) {
         regHL(regHL() + 1);
     }
 
-    switch(opcode) {
-        case Opcode::LDI_A_aHL:
-        case Opcode::LDD_A_aHL:
-        case Opcode::LD_A_aHL: _regA = value; break;
-        case Opcode::LD_B_aHL: _regB = value; break;
-        case Opcode::LD_C_aHL: _regC = value; break;
-        case Opcode::LD_D_aHL: _regD = value; break;
-        case Opcode::LD_E_aHL: _regE = value; break;
-        case Opcode::LD_H_aHL: _regH = value; break;
-        case Opcode::LD_L_aHL: _regL = value; break;
+    if (opcode == Opcode::LDI_A_aHL || opcode == Opcode::LDD_A_aHL) {
+        _regA = value;
+    } else {
+        reg8((opcode >> 3) & 0x07) = value;
     }
 
     return 2;
 }
 
-int8_t CPU::I_StoreToAddress(uint8_t opcode) {
+template<class Timing>
+LAYOUT(I_StoreToAddress) int8_t CPU::I_StoreToAddress(uint8_t opcode) {
     if (opcode == Opcode::LD_afC_A) {
-        _memory->write(0xff00 + (uint16_t)_regC, _regA);
+        busWrite<Timing>(0xff00 + (uint16_t)_regC, _regA);
         return 2;
     } else if (opcode == Opcode::LDH_afN_A) {
-        const auto indirectAddress = _memory->read(_programCounter++);
-        _memory->write(0xff00 + (uint16_t)indirectAddress, _regA);
+        const auto indirectAddress = busRead<Timing>(_programCounter++);
+        busWrite<Timing>(0xff00 + (uint16_t)indirectAddress, _regA);
         return 3;
     }
 
     switch(opcode) {
         case Opcode::LD_aBC_A:
-            _memory->write(regBC(), _regA);
+            busWrite<Timing>(regBC(), _regA);
             return 2;
         case Opcode::LD_aDE_A:
-            _memory->write(regDE(), _regA);
+            busWrite<Timing>(regDE(), _regA);
             return 2;
         case Opcode::LD_aNN_A:
-            const auto addr = _memory->readLI(_programCounter);
+            const auto addr = busRead16<Timing>(_programCounter);
             _programCounter += 2;
-            _memory->write(addr, _regA);
+            busWrite<Timing>(addr, _regA);
             return 4;
     }
 
     uint8_t value = 0;
-    switch(opcode) {
-        case Opcode::LDD_aHL_A:
-        case Opcode::LDI_aHL_A:
-        case Opcode::LD_aHL_A: value = _regA; break;
-        case Opcode::LD_aHL_B: value = _regB; break;
-        case Opcode::LD_aHL_C: value = _regC; break;
-        case Opcode::LD_aHL_D: value = _regD; break;
-        case Opcode::LD_aHL_E: value = _regE; break;
-        case Opcode::LD_aHL_H: value = _regH; break;
-        case Opcode::LD_aHL_L: value = _regL; break;
-        case Opcode::LD_aHL_n:
-            value = _memory->read(_programCounter++);
-            break;
+    if (opcode == Opcode::LDD_aHL_A || opcode == Opcode::LDI_aHL_A) {
+        value = _regA;
+    } else if (opcode == Opcode::LD_aHL_n) {
+        value = busRead<Timing>(_programCounter++);
+    } else {
+        value = reg8(opcode & 0x07);
     }
 
-    _memory->write(regHL(), value);
+    busWrite<Timing>(regHL(), value);
 
     if (opcode == Opcode::LDD_aHL_A) {
         regHL(regHL() - 1);
@@ -478,27 +719,24 @@ int8_t CPU::I_StoreToAddress(uint8_t opcode) {
     return opcode == Opcode::LD_aHL_n ? 3 : 2;
 }
 
-int8_t CPU::I_LoadImmediate16(uint8_t opcode) {
-    const auto value = _memory->readLI(_programCounter);
+template<class Timing>
+LAYOUT(I_LoadImmediate16) int8_t CPU::I_LoadImmediate16(uint8_t opcode) {
+    const auto value = busRead16<Timing>(_programCounter);
     _programCounter += 2;
 
-    switch(opcode) {
-        case Opcode::LD_BC_NN: regBC(value); break;
-        case Opcode::LD_DE_NN: regDE(value); break;
-        case Opcode::LD_HL_NN: regHL(value); break;
-        case Opcode::LD_SP_NN: _stackPointer = value; break;
-    }
+    pairOrSP((opcode >> 4) & 0x03) = value;
 
     return 3;
 }
 
-int8_t CPU::I_LoadHLWithSPN() {
-    auto rawOffset = _memory->read(_programCounter++);
+template<class Timing>
+LAYOUT(I_LoadHLWithSPN) int8_t CPU::I_LoadHLWithSPN() {
+    auto rawOffset = busRead<Timing>(_programCounter++);
     auto offset = *reinterpret_cast<int8_t*>(&rawOffset);
     const auto effectiveAddress = _stackPointer + (int16_t)offset;
     // Little-endian load
-    _regL = _memory->read(effectiveAddress);
-    _regH = _memory->read(effectiveAddress + 1);
+    _regL = busRead<Timing>(effectiveAddress);
+    _regH = busRead<Timing>(effectiveAddress + 1);
 
     zFlag(false);
     nFlag(false);
@@ -517,105 +755,114 @@ int8_t CPU::I_LoadHLWithSPN() {
     return 3;
 }
 
-int8_t CPU::I_StoreStackPointer() {
-    const auto address = _memory->readLI(_programCounter);
+template<class Timing>
+LAYOUT(I_StoreStackPointer) int8_t CPU::I_StoreStackPointer() {
+    const auto address = busRead16<Timing>(_programCounter);
     _programCounter += 2;
 
-    _memory->writeLI(address, _stackPointer);
+    busWrite16<Timing>(address, _stackPointer);
 
     return 5;
 }
 
-int8_t CPU::I_PushRegister(uint8_t opcode) {
-    uint16_t value = 0;
-    switch (opcode) {
-        case Opcode::PUSH_AF: value = regAF(); break;
-        case Opcode::PUSH_BC: value = regBC(); break;
-        case Opcode::PUSH_DE: value = regDE(); break;
-        case Opcode::PUSH_HL: value = regHL(); break;
-    }
-
-    _stackPointer -= 2;
+template<class Timing>
+LAYOUT(I_PushRegister) int8_t CPU::I_PushRegister(uint8_t opcode) {
+    uint16_t value = _pairs[(opcode >> 4) & 0x03];
 
-    _memory->writeLI(_stackPointer, value);
+    busIdle<Timing>();
+    push16<Timing>(value);
 
     return 4;
 }
 
-int8_t CPU::I_PopRegister(uint8_t opcode) {
-    uint16_t value = _memory->readLI(_stackPointer);
-    _stackPointer += 2;
+template<class Timing>
+LAYOUT(I_PopRegister) int8_t CPU::I_PopRegister(uint8_t opcode) {
+    uint16_t value = pop16<Timing>();
 
-    switch (opcode) {
-        case Opcode::POP_AF: regAF(value); break;
-        case Opcode::POP_BC: regBC(value); break;
-        case Opcode::POP_DE: regDE(value); break;
-        case Opcode::POP_HL: regHL(value); break;
-    }
+    _pairs[(opcode >> 4) & 0x03] = value;
 
     return 3;
 }
 
-int8_t CPU::I_8BitAdd(uint8_t opcode) {
-    uint8_t operand = 0;
-    int8_t cycles = 1;
+// ALU operations with a register or (HL) operand are 0x80-0xbf, with the
+// operand in the r field; the immediate forms are 0xc6-0xfe.
+#define DECODE_ALU_OPERAND() \
+    uint8_t operand = 0; \
+    int8_t cycles = 1; \
+ \
+    if (opcode >= 0xc0) { \
+        operand = busRead<Timing>(_programCounter++); \
+        cycles = 2; \
+    } else if ((opcode & 0x07) == 0x06) { \
+        operand = busRead<Timing>(regHL()); \
+        cycles = 2; \
+    } else { \
+        operand = reg8(opcode & 0x07); \
+    } \
+
+#ifdef GB_ALU_TABLES
+static uint8_t g_addFlags[256][256];
+static uint8_t g_subtractFlags[2][256][256];
+static uint8_t g_compareFlags[256][256];
+static uint8_t g_incrementFlags[256];
+static uint8_t g_decrementFlags[256];
+static uint16_t g_decimalAdjust[8][256]; // By N, H and C.
+
+static bool buildALUTables() {
+    for (int a = 0; a < 256; a++) {
+        for (int operand = 0; operand < 256; operand++) {
+            g_addFlags[a][operand] = addFlags(a, operand);
+            g_subtractFlags[0][a][operand] = subtractFlags(a, operand, 0);
+            g_subtractFlags[1][a][operand] = subtractFlags(a, operand, 1);
+            g_compareFlags[a][operand] = compareFlags(a, operand);
+        }
 
-    switch(opcode) {
-        case Opcode::ADD_A_A: case Opcode::ADC_A_A: operand = _regA; break;
-        case Opcode::ADD_A_B: case Opcode::ADC_A_B: operand = _regB; break;
-        case Opcode::ADD_A_C: case Opcode::ADC_A_C: operand = _regC; break;
-        case Opcode::ADD_A_D: case Opcode::ADC_A_D: operand = _regD; break;
-        case Opcode::ADD_A_E: case Opcode::ADC_A_E: operand = _regE; break;
-        case Opcode::ADD_A_H: case Opcode::ADC_A_H: operand = _regH; break;
-        case Opcode::ADD_A_L: case Opcode::ADC_A_L: operand = _regL; break;
-        case Opcode::ADD_A_aHL: case Opcode::ADC_A_aHL:
-            operand = _memory->read(regHL());
-            cycles = 2;
-            break;
-        case Opcode::ADD_A_N: case Opcode::ADC_A_N:
-            operand = _memory->read(_programCounter++);
-            cycles = 2;
-            break;
+        g_incrementFlags[a] = incrementFlags(a);
+        g_decrementFlags[a] = decrementFlags(a);
+
+        for (int flags = 0; flags < 8; flags++) {
+            g_decimalAdjust[flags][a] = decimalAdjust(a, flags << 4);
+        }
     }
 
+    return true;
+}
+
+static const bool g_aluTablesBuilt = buildALUTables();
+
+#define ADD_FLAGS(a, operand) g_addFlags[a][operand]
+#define SUBTRACT_FLAGS(a, operand, carry) g_subtractFlags[carry][a][operand]
+#define COMPARE_FLAGS(a, operand) g_compareFlags[a][operand]
+#define INCREMENT_FLAGS(original) g_incrementFlags[original]
+#define DECREMENT_FLAGS(original) g_decrementFlags[original]
+#define DECIMAL_ADJUST(a, flags) g_decimalAdjust[((flags) >> 4) & 0x07][a]
+#else
+#define ADD_FLAGS(a, operand) addFlags(a, operand)
+#define SUBTRACT_FLAGS(a, operand, carry) subtractFlags(a, operand, carry)
+#define COMPARE_FLAGS(a, operand) compareFlags(a, operand)
+#define INCREMENT_FLAGS(original) incrementFlags(original)
+#define DECREMENT_FLAGS(original) decrementFlags(original)
+#define DECIMAL_ADJUST(a, flags) decimalAdjust(a, flags)
+#endif
+
+template<class Timing>
+LAYOUT(I_8BitAdd) int8_t CPU::I_8BitAdd(uint8_t opcode) {
+    DECODE_ALU_OPERAND();
+
     // All ADC instructions are at or above 0x08 in their row.
     if (((opcode & 0x0f) >= 0x08) && cFlag()) {
         operand++;
     }
 
-    const uint8_t result = _regA + operand;
-
-    zFlag(result == 0);
-    nFlag(false);
-    hFlag((((_regA & 0x0f) + (operand & 0x0f)) & 0x10) != 0);
-    cFlag(result < _regA || result < operand);
-
-    _regA = result;
+    _flags = (_flags & 0x0f) | ADD_FLAGS(_regA, operand);
+    _regA += operand;
 
     return cycles;
 }
 
-int8_t CPU::I_8BitSubtract(uint8_t opcode) {
-    uint8_t operand = 0;
-    int8_t cycles = 1;
-
-    switch(opcode) {
-        case Opcode::SUB_A: case Opcode::SBC_A_A: operand = _regA; break;
-        case Opcode::SUB_B: case Opcode::SBC_A_B: operand = _regB; break;
-        case Opcode::SUB_C: case Opcode::SBC_A_C: operand = _regC; break;
-        case Opcode::SUB_D: case Opcode::SBC_A_D: operand = _regD; break;
-        case Opcode::SUB_E: case Opcode::SBC_A_E: operand = _regE; break;
-        case Opcode::SUB_H: case Opcode::SBC_A_H: operand = _regH; break;
-        case Opcode::SUB_L: case Opcode::SBC_A_L: operand = _regL; break;
-        case Opcode::SUB_aHL: case Opcode::SBC_A_aHL:
-            operand = _memory->read(regHL());
-            cycles = 2;
-            break;
-        case Opcode::SUB_N: case Opcode::SBC_A_N:
-            operand = _memory->read(_programCounter++);
-            cycles = 2;
-            break;
-    }
+template<class Timing>
+LAYOUT(I_8BitSubtract) int8_t CPU::I_8BitSubtract(uint8_t opcode) {
+    DECODE_ALU_OPERAND();
 
     uint8_t carryValue = 0;
 
@@ -624,42 +871,15 @@ int8_t CPU::I_8BitSubtract(uint8_t opcode) {
         carryValue = 1;
     }
 
-    const uint8_t result = _regA - operand - carryValue;
-
-    zFlag(result == 0);
-    nFlag(true);
-    hFlag(((_regA & 0x0f) - (operand & 0x0f) - carryValue) < 0);
-    cFlag(result > _regA);
-
-    _regA = result;
+    _flags = (_flags & 0x0f) | SUBTRACT_FLAGS(_regA, operand, carryValue);
+    _regA = _regA - operand - carryValue;
 
     return cycles;
 }
 
-#define DECODE_LOGICAL_OPERAND(operation) \
-    uint8_t operand = 0; \
-    int8_t cycles = 1; \
- \
-    switch(opcode) { \
-        case Opcode::operation##_A: operand = _regA; break; \
-        case Opcode::operation##_B: operand = _regB; break; \
-        case Opcode::operation##_C: operand = _regC; break; \
-        case Opcode::operation##_D: operand = _regD; break; \
-        case Opcode::operation##_E: operand = _regE; break; \
-        case Opcode::operation##_H: operand = _regH; break; \
-        case Opcode::operation##_L: operand = _regL; break; \
-        case Opcode::operation##_aHL: \
-            operand = _memory->read(regHL()); \
-            cycles = 2; \
-            break; \
-        case Opcode::operation##_N: \
-            operand = _memory->read(_programCounter++); \
-            cycles = 2; \
-            break; \
-    } \
-
-int8_t CPU::I_And(uint8_t opcode) {
-    DECODE_LOGICAL_OPERAND(AND);
+template<class Timing>
+LAYOUT(I_And) int8_t CPU::I_And(uint8_t opcode) {
+    DECODE_ALU_OPERAND();
 
     _regA = _regA & operand;
 
@@ -671,8 +891,9 @@ int8_t CPU::I_And(uint8_t opcode) {
     return cycles;
 }
 
-int8_t CPU::I_Or(uint8_t opcode) {
-    DECODE_LOGICAL_OPERAND(OR);
+template<class Timing>
+LAYOUT(I_Or) int8_t CPU::I_Or(uint8_t opcode) {
+    DECODE_ALU_OPERAND();
 
     _regA = _regA | operand;
 
@@ -684,8 +905,9 @@ int8_t CPU::I_Or(uint8_t opcode) {
     return cycles;
 }
 
-int8_t CPU::I_Xor(uint8_t opcode) {
-    DECODE_LOGICAL_OPERAND(XOR);
+template<class Timing>
+LAYOUT(I_Xor) int8_t CPU::I_Xor(uint8_t opcode) {
+    DECODE_ALU_OPERAND();
 
     _regA = _regA ^ operand;
 
@@ -697,84 +919,50 @@ int8_t CPU::I_Xor(uint8_t opcode) {
     return cycles;
 }
 
-int8_t CPU::I_Compare(uint8_t opcode) {
-    DECODE_LOGICAL_OPERAND(CP);
+template<class Timing>
+LAYOUT(I_Compare) int8_t CPU::I_Compare(uint8_t opcode) {
+    DECODE_ALU_OPERAND();
 
-    const uint8_t result = _regA - operand;
-
-    zFlag(result == 0);
-    nFlag(true);
-    hFlag(((_regA & 0x0f) - (operand & 0x0f)) < 0);
-    cFlag(result > _regA || result > operand);
+    _flags = (_flags & 0x0f) | COMPARE_FLAGS(_regA, operand);
 
     return cycles;
 }
 
-#define INC_REGISTER(reg) \
-    case Opcode::INC_##reg: original = _reg##reg; _reg##reg++; break; \
-
-int8_t CPU::I_Increment(uint8_t opcode) {
+template<class Timing>
+LAYOUT(I_Increment) int8_t CPU::I_Increment(uint8_t opcode) {
     uint8_t original = 0;
     if (opcode == Opcode::INC_aHL) {
-        original = _memory->read(regHL());
-        _memory->write(regHL(), original + 1);
-    }
-
-    switch(opcode) {
-        INC_REGISTER(A)
-        INC_REGISTER(B)
-        INC_REGISTER(C)
-        INC_REGISTER(D)
-        INC_REGISTER(E)
-        INC_REGISTER(H)
-        INC_REGISTER(L)
+        original = busRead<Timing>(regHL());
+        busWrite<Timing>(regHL(), original + 1);
+    } else {
+        uint8_t& reg = reg8((opcode >> 3) & 0x07);
+        original = reg++;
     }
 
-    uint8_t newVal = original + 1;
-    zFlag(newVal == 0);
-    nFlag(false);
-    hFlag((((original & 0xf) + (1 & 0xf)) & 0x10) != 0);
+    _flags = (_flags & (FLAG_C | 0x0f)) | INCREMENT_FLAGS(original);
 
     return opcode == Opcode::INC_aHL ? 3 : 1;
 }
 
-#define DEC_REGISTER(reg) \
-    case Opcode::DEC_##reg: original = _reg##reg; _reg##reg--; break; \
-
-int8_t CPU::I_Decrement(uint8_t opcode) {
+template<class Timing>
+LAYOUT(I_Decrement) int8_t CPU::I_Decrement(uint8_t opcode) {
     uint8_t original = 0;
     if (opcode == Opcode::DEC_aHL) {
-        original = _memory->read(regHL());
-        _memory->write(regHL(), original - 1);
-    }
-
-    switch(opcode) {
-        DEC_REGISTER(A)
-        DEC_REGISTER(B)
-        DEC_REGISTER(C)
-        DEC_REGISTER(D)
-        DEC_REGISTER(E)
-        DEC_REGISTER(H)
-        DEC_REGISTER(L)
+        original = busRead<Timing>(regHL());
+        busWrite<Timing>(regHL(), original - 1);
+    } else {
+        uint8_t& reg = reg8((opcode >> 3) & 0x07);
+        original = reg--;
     }
 
-    uint8_t newVal = original - 1;
-    zFlag(newVal == 0);
-    nFlag(true);
-    hFlag(((original & 0x0f) - (1 & 0x0f)) < 0);
+    _flags = (_flags & (FLAG_C | 0x0f)) | DECREMENT_FLAGS(original);
 
     return opcode == Opcode::DEC_aHL ? 3 : 1;
 }
 
-int8_t CPU::I_16BitAdd(uint8_t opcode) {
-    uint16_t operand = 0;
-
-    switch(opcode) {
-        case Opcode::ADD_HL_BC: operand = regBC(); break;
-        case Opcode::ADD_HL_DE: operand = regDE(); break;
-        case Opcode::ADD_HL_HL: operand = regHL(); break;
-        case Opcode::ADD_HL_SP: operand = _stackPointer; break;
-    }
+template<class Timing>
+LAYOUT(I_16BitAdd) int8_t CPU::I_16BitAdd(uint8_t opcode) {
+    const uint16_t operand = pairOrSP((opcode >> 4) & 0x03);
 
     uint16_t result = regHL() + operand;
 
@@ -783,12 +971,14 @@ int8_t CPU::I_16BitAdd(uint8_t opcode) {
     cFlag(result < regHL() || result < operand);
 
     regHL(result);
+    busIdle<Timing>();
 
     return 2;
 }
 
-int8_t CPU::I_AddToSP() {
-    auto rawOperand = _memory->read(_programCounter++);
+template<class Timing>
+LAYOUT(I_AddToSP) int8_t CPU::I_AddToSP() {
+    auto rawOperand = busRead<Timing>(_programCounter++);
     auto operand = *reinterpret_cast<int8_t*>(&rawOperand);
 
     uint16_t result = _stackPointer + operand;
@@ -799,65 +989,42 @@ int8_t CPU::I_AddToSP() {
     cFlag(result < _stackPointer || result < operand);
 
     _stackPointer = result;
+    busIdle<Timing>();
+    busIdle<Timing>();
 
     return 4;
 }
 
-int8_t CPU::I_16BitIncrement(uint8_t opcode) {
+template<class Timing>
+LAYOUT(I_16BitIncrement) int8_t CPU::I_16BitIncrement(uint8_t opcode) {
     // Affects no flags
 
-    switch(opcode) {
-        case Opcode::INC_BC: regBC(regBC() + 1); break;
-        case Opcode::INC_DE: regDE(regDE() + 1); break;
-        case Opcode::INC_HL: regHL(regHL() + 1); break;
-        case Opcode::INC_SP: _stackPointer++; break;
-    }
+    pairOrSP((opcode >> 4) & 0x03)++;
+    busIdle<Timing>();
 
     return 2;
 }
 
-int8_t CPU::I_16BitDecrement(uint8_t opcode) {
+template<class Timing>
+LAYOUT(I_16BitDecrement) int8_t CPU::I_16BitDecrement(uint8_t opcode) {
     // Affects no flags
 
-    switch(opcode) {
-        case Opcode::DEC_BC: regBC(regBC() - 1); break;
-        case Opcode::DEC_DE: regDE(regDE() - 1); break;
-        case Opcode::DEC_HL: regHL(regHL() - 1); break;
-        case Opcode::DEC_SP: _stackPointer--; break;
-    }
+    pairOrSP((opcode >> 4) & 0x03)--;
+    busIdle<Timing>();
 
     return 2;
 }
 
-// Using implementation from
-// https://forums.nesdev.com/viewtopic.php?f=20&t=15944#p196282
-int8_t CPU::I_DecimalAdjust() {
-    if (!nFlag()) {
-        if (cFlag() || _regA > 0x99) {
-            _regA += 0x60;
-            cFlag(true);
-        }
-
-        if (hFlag() || (_regA & 0x0f) > 0x09) {
-            _regA += 0x6;
-        }
-    } else {
-        if (cFlag()) {
-            _regA -= 0x60;
-        }
-
-        if (hFlag()) {
-            _regA -= 0x6;
-        }
-    }
+LAYOUT(I_DecimalAdjust) int8_t CPU::I_DecimalAdjust() {
+    const uint16_t adjusted = DECIMAL_ADJUST(_regA, _flags);
 
-    zFlag(_regA == 0);
-    hFlag(false);
+    _regA = (uint8_t)adjusted;
+    _flags = (_flags & 0x0f) | (uint8_t)(adjusted >> 8);
 
     return 1;
 }
 
-int8_t CPU::I_ComplementA() {
+LAYOUT(I_ComplementA) int8_t CPU::I_ComplementA() {
     _regA = ~_regA;
 
     nFlag(true);
@@ -866,7 +1033,7 @@ int8_t CPU::I_ComplementA() {
     return 1;
 }
 
-int8_t CPU::I_ComplementCarry() {
+LAYOUT(I_ComplementCarry) int8_t CPU::I_ComplementCarry() {
     nFlag(false);
     hFlag(false);
     cFlag(!cFlag());
@@ -874,7 +1041,7 @@ int8_t CPU::I_ComplementCarry() {
     return 1;
 }
 
-int8_t CPU::I_SetCarry() {
+LAYOUT(I_SetCarry) int8_t CPU::I_SetCarry() {
     nFlag(false);
     hFlag(false);
     cFlag(true);
@@ -882,8 +1049,10 @@ int8_t CPU::I_SetCarry() {
     return 1;
 }
 
-int8_t CPU::I_UnconditionalJump() {
-    _programCounter = _memory->readLI(_programCounter);
+template<class Timing>
+LAYOUT(I_UnconditionalJump) int8_t CPU::I_UnconditionalJump() {
+    _programCounter = busRead16<Timing>(_programCounter);
+    busIdle<Timing>();
     return 3;
 }
 
@@ -896,75 +1065,92 @@ int8_t CPU::I_UnconditionalJump() {
         case Opcode::mnemonic##_C##addrlen: condition = cFlag(); break; \
     } \
 
-int8_t CPU::I_ConditionalJump(uint8_t opcode) {
-    uint16_t newAddress = _memory->readLI(_programCounter);
+template<class Timing>
+LAYOUT(I_ConditionalJump) int8_t CPU::I_ConditionalJump(uint8_t opcode) {
+    uint16_t newAddress = busRead16<Timing>(_programCounter);
     _programCounter += 2;
 
     BRANCH_CONDITION(JP, _NN);
 
     if (condition) {
         _programCounter = newAddress;
+        busIdle<Timing>();
     }
 
     return 3;
 }
 
-int8_t CPU::I_JumpToHL() {
+LAYOUT(I_JumpToHL) int8_t CPU::I_JumpToHL() {
     _programCounter = regHL();
     return 4;
 }
 
-int8_t CPU::I_UnconditionalRelativeJump() {
-    auto rawOffset = _memory->read(_programCounter++);
+template<class Timing>
+LAYOUT(I_UnconditionalRelativeJump) int8_t CPU::I_UnconditionalRelativeJump() {
+    auto rawOffset = busRead<Timing>(_programCounter++);
     auto offset = *reinterpret_cast<int8_t*>(&rawOffset);
 
     _programCounter += offset;
+    busIdle<Timing>();
 
     return 2;
 }
 
-int8_t CPU::I_ConditionalRelativeJump(uint8_t opcode) {
-    auto rawOffset = _memory->read(_programCounter++);
+template<class Timing>
+LAYOUT(I_ConditionalRelativeJump) int8_t CPU::I_ConditionalRelativeJump(uint8_t opcode) {
+    auto rawOffset = busRead<Timing>(_programCounter++);
     auto offset = *reinterpret_cast<int8_t*>(&rawOffset);
 
     BRANCH_CONDITION(JR, _N);
 
     if (condition) {
         _programCounter += offset;
+        busIdle<Timing>();
     }
 
     return 2;
 }
 
-int8_t CPU::I_Call() {
-    auto address = _memory->readLI(_programCounter);
+template<class Timing>
+LAYOUT(I_Call) int8_t CPU::I_Call() {
+    auto address = busRead16<Timing>(_programCounter);
     _programCounter += 2;
 
-    _stackPointer -= 2;
-    _memory->writeLI(_stackPointer, _programCounter);
+    busIdle<Timing>();
+    push16<Timing>(_programCounter);
 
     _programCounter = address;
 
+    if (_profiler != nullptr) {
+        _profiler->enter(address, _stackPointer);
+    }
+
     return 3;
 }
 
-int8_t CPU::I_ConditionalCall(uint8_t opcode) {
-    auto address = _memory->readLI(_programCounter);
+template<class Timing>
+LAYOUT(I_ConditionalCall) int8_t CPU::I_ConditionalCall(uint8_t opcode) {
+    auto address = busRead16<Timing>(_programCounter);
     _programCounter += 2;
 
     BRANCH_CONDITION(CALL, _NN);
 
     if (condition) {
-        _stackPointer -= 2;
-        _memory->writeLI(_stackPointer, _programCounter);
+        busIdle<Timing>();
+        push16<Timing>(_programCounter);
 
         _programCounter = address;
+
+        if (_profiler != nullptr) {
+            _profiler->enter(address, _stackPointer);
+        }
     }
 
     return 3;
 }
 
-int8_t CPU::I_RST(uint8_t opcode) {
+template<class Timing>
+LAYOUT(I_RST) int8_t CPU::I_RST(uint8_t opcode) {
     uint16_t address = 0x0000;
 
     switch(opcode) {
@@ -977,17 +1163,22 @@ int8_t CPU::I_RST(uint8_t opcode) {
         case Opcode::RST_38: address = 0x0038; break;
     }
 
-    _stackPointer -= 2;
-    _memory->writeLI(_stackPointer, _programCounter);
+    busIdle<Timing>();
+    push16<Timing>(_programCounter);
 
     _programCounter = address;
 
+    if (_profiler != nullptr) {
+        _profiler->enter(address, _stackPointer);
+    }
+
     return 4;
 }
 
-int8_t CPU::I_Return(uint8_t opcode) {
-    uint16_t address = _memory->readLI(_stackPointer);
-    _stackPointer += 2;
+template<class Timing>
+LAYOUT(I_Return) int8_t CPU::I_Return(uint8_t opcode) {
+    uint16_t address = pop16<Timing>();
+    busIdle<Timing>();
 
     _programCounter = address;
 
@@ -995,29 +1186,39 @@ int8_t CPU::I_Return(uint8_t opcode) {
         _interruptsEnabled = true;
     }
 
+    if (_profiler != nullptr) {
+        _profiler->leave(_stackPointer);
+    }
+
     return 2;
 }
 
-int8_t CPU::I_ConditionalReturn(uint8_t opcode) {
+template<class Timing>
+LAYOUT(I_ConditionalReturn) int8_t CPU::I_ConditionalReturn(uint8_t opcode) {
     BRANCH_CONDITION(RET,);
+    busIdle<Timing>();
 
     if (condition) {
-        uint16_t address = _memory->readLI(_stackPointer);
-        _stackPointer += 2;
+        uint16_t address = pop16<Timing>();
+        busIdle<Timing>();
 
         _programCounter = address;
+
+        if (_profiler != nullptr) {
+            _profiler->leave(_stackPointer);
+        }
     }
 
     return 2;
 }
 
-int8_t CPU::I_Halt() {
+LAYOUT(I_Halt) int8_t CPU::I_Halt() {
     _isHalted = true;
     return 1;
 }
 
-int8_t CPU::I_Stop() {
-    _isStopped = true;
+LAYOUT(I_Stop) int8_t CPU::I_Stop() {
+    _isStopped = !_memory->stop();
 
     // For some reason, this takes an extra byte.
     _programCounter++;
@@ -1025,171 +1226,124 @@ int8_t CPU::I_Stop() {
     return 1;
 }
 
-int8_t CPU::I_SetInterruptEnable(uint8_t opcode) {
+LAYOUT(I_SetInterruptEnable) int8_t CPU::I_SetInterruptEnable(uint8_t opcode) {
     _interruptsEnabled = opcode == Opcode::EI;
     return 1;
 }
 
-int8_t CPU::I_ExecCBGroup() {
-    const auto opcode = _memory->read(_programCounter++);
-    const uint8_t highNibble = opcode & 0xf0;
-    const uint8_t lowNibble = opcode & 0x0f;
-    const bool dataIsInRegister = lowNibble != 0x06 && lowNibble != 0x0e;
-
-    uint8_t* dataPtr; // Pointer to byte we're working with
-    uint8_t tempReadData = 0x00; // Only used if reading/writing to memory
-
-    if (dataIsInRegister) {
-        switch(lowNibble) {
-            case 0x00: case 0x08: dataPtr = &_regB; break;
-            case 0x01: case 0x09: dataPtr = &_regC; break;
-            case 0x02: case 0x0a: dataPtr = &_regD; break;
-            case 0x03: case 0x0b: dataPtr = &_regE; break;
-            case 0x04: case 0x0c: dataPtr = &_regH; break;
-            case 0x05: case 0x0d: dataPtr = &_regL; break;
-            case 0x07: case 0x0f: dataPtr = &_regA; break;
-        }
-    } else {
-        tempReadData = _memory->read(regHL());
-        dataPtr = &tempReadData;
-    }
-
-    if (highNibble == 0x00) {
-        if (lowNibble <= 0x07) {
-            RotateLeft(dataPtr, true);
-        } else {
-            RotateRight(dataPtr, true);
-        }
-    } else if (highNibble == 0x10) {
-        if (lowNibble <= 0x07) {
-            RotateLeft(dataPtr, false);
-        } else {
-            RotateRight(dataPtr, false);
-        }
-    } else if (highNibble == 0x20) {
-        if (lowNibble <= 0x07) {
-            ShiftLeft(dataPtr);
-        } else {
-            ShiftRight(dataPtr, true);
-        }
-    } else if (highNibble == 0x30) {
-        if (lowNibble <= 0x07) {
-            Swap(dataPtr);
-        } else {
-            ShiftRight(dataPtr, false);
-        }
-    } else {
-        // Bitwise instructions start at 0x40. They increment bit index every 8
-        // values. They run from positions 0-7.
-        uint8_t bitIndex = ((opcode - 0x40) / 8) % 8;
-
-         if (highNibble >= 0x40 && highNibble <= 0x70) {
-            TestBit(dataPtr, bitIndex);
-        } else if (highNibble >= 0x80 && highNibble <= 0xB0) {
-            ResetBit(dataPtr, bitIndex);
-        } else {
-            SetBit(dataPtr, bitIndex);
+// CB prefix //////////////////////////////////////////////////////////////////
+
+// Value and flags (Z and C; N and H are always clear) after each rotate, shift
+// and swap, by operation (bits 3-5 of the CB opcode), carry in and operand.
+struct ShiftResult {
+    uint8_t value;
+    uint8_t flags;
+};
+
+static ShiftResult g_shiftResults[8][2][256];
+
+static bool buildShiftResults() {
+    for (int operation = 0; operation < 8; operation++) {
+        for (int carry = 0; carry < 2; carry++) {
+            for (int value = 0; value < 256; value++) {
+                int result = 0;
+                bool carryOut = false;
+
+                switch(operation) {
+                    case 0: result = (value << 1) | (value >> 7); carryOut = value & 0x80; break; // RLC
+                    case 1: result = (value >> 1) | (value << 7); carryOut = value & 0x01; break; // RRC
+                    case 2: result = (value << 1) | carry; carryOut = value & 0x80; break;        // RL
+                    case 3: result = (value >> 1) | (carry << 7); carryOut = value & 0x01; break; // RR
+                    case 4: result = value << 1; carryOut = value & 0x80; break;                  // SLA
+                    case 5: result = (value >> 1) | (value & 0x80); carryOut = value & 0x01; break; // SRA
+                    case 6: result = (value << 4) | (value >> 4); break;                          // SWAP
+                    case 7: result = value >> 1; carryOut = value & 0x01; break;                  // SRL
+                }
+
+                auto& entry = g_shiftResults[operation][carry][value];
+                entry.value = (uint8_t)result;
+                entry.flags = ((uint8_t)result == 0 ? 0x80 : 0x00) | (carryOut ? 0x10 : 0x00);
+            }
         }
     }
 
-    if (!dataIsInRegister) {
-        _memory->write(regHL(), tempReadData);
-    }
-
-    return dataIsInRegister ? 2 : 4;
+    return true;
 }
 
-int8_t CPU::I_RotateA(uint8_t opcode) {
-    switch (opcode) {
-        case Opcode::RLCA: RotateLeft(&_regA, true); break;
-        case Opcode::RLA: RotateLeft(&_regA, false); break;
-        case Opcode::RRCA: RotateRight(&_regA, true); break;
-        case Opcode::RRA: RotateRight(&_regA, false); break;
-    }
-
-    return 1;
-}
+static const bool g_shiftResultsBuilt = buildShiftResults();
 
-void CPU::RotateLeft(uint8_t* value, bool withCarry) {
-    const bool b7Set = (*value & 0x80) != 0;
+// Each CB opcode gets its own instantiation, so the operand, operation and bit
+// mask are all constants and BIT/SET/RES come down to a single mask.
+template<class Timing, uint8_t OPCODE>
+int8_t CPU::CB_Op(CPU& cpu) {
+    const uint8_t index = OPCODE & 0x07;
+    const uint8_t mask = 0x01 << ((OPCODE >> 3) & 0x07);
+    const bool inMemory = index == 0x06;
 
-    (*value) <<= 1;
-    if ((!withCarry && cFlag()) || (withCarry && b7Set)) {
-        (*value) |= 0x01;
-    }
+    uint8_t value = inMemory ? cpu.busRead<Timing>(cpu.regHL()) : cpu.reg8(index);
 
-    cFlag(b7Set);
-
-    zFlag(*value == 0);
-    nFlag(false);
-    hFlag(false);
-}
-
-void CPU::RotateRight(uint8_t* value, bool withCarry) {
-    const bool b0Set = (*value & 0x01) != 0;
-
-    (*value) >>= 1;
-    if ((!withCarry && cFlag()) || (withCarry && b0Set)) {
-        (*value) |= 0x80;
+    switch(OPCODE >> 6) {
+        case 0x00: {
+            const auto& result = g_shiftResults[(OPCODE >> 3) & 0x07][cpu.cFlag() ? 1 : 0][value];
+            value = result.value;
+            cpu._flags = (cpu._flags & 0x0f) | result.flags;
+            break;
+        }
+        case 0x01:
+            // BIT: Z from the bit, N clear, H set, C kept. Nothing is written.
+            cpu._flags = (cpu._flags & 0x1f) | 0x20 | ((value & mask) == 0 ? 0x80 : 0x00);
+            return inMemory ? 4 : 2;
+        case 0x02:
+            value &= ~mask;
+            break;
+        case 0x03:
+            value |= mask;
+            break;
     }
 
-    cFlag(b0Set);
-
-    zFlag(*value == 0);
-    nFlag(false);
-    hFlag(false);
-}
-
-void CPU::ShiftLeft(uint8_t* value) {
-    const bool b7Set = (*value & 0x80) != 0;
-
-    (*value) <<= 1;
-
-    zFlag((*value) == 0);
-    nFlag(false);
-    hFlag(false);
-    cFlag(b7Set);
-}
-
-void CPU::ShiftRight(uint8_t* value, bool preserveMSB) {
-    const bool b0Set = (*value & 0x01) != 0;
-    const bool b7Set = (*value & 0x80) != 0;
-
-    (*value) >>= 1;
-
-    if (preserveMSB && b7Set) {
-        (*value) |= 0x80;
+    if (inMemory) {
+        cpu.busWrite<Timing>(cpu.regHL(), value);
+    } else {
+        cpu.reg8(index) = value;
     }
 
-    zFlag((*value) == 0);
-    nFlag(false);
-    hFlag(false);
-    cFlag(b0Set);
+    return inMemory ? 4 : 2;
 }
 
-void CPU::Swap(uint8_t* value) {
-    (*value) = ((*value) << 4) | ((*value) >> 4);
-
-    zFlag((*value) == 0);
-    nFlag(false);
-    hFlag(false);
-    cFlag(false);
+#define CB_HANDLER_ROW(timing, row) \
+    &CPU::CB_Op<timing, row + 0x00>, &CPU::CB_Op<timing, row + 0x01>, &CPU::CB_Op<timing, row + 0x02>, \
+    &CPU::CB_Op<timing, row + 0x03>, &CPU::CB_Op<timing, row + 0x04>, &CPU::CB_Op<timing, row + 0x05>, \
+    &CPU::CB_Op<timing, row + 0x06>, &CPU::CB_Op<timing, row + 0x07>, &CPU::CB_Op<timing, row + 0x08>, \
+    &CPU::CB_Op<timing, row + 0x09>, &CPU::CB_Op<timing, row + 0x0a>, &CPU::CB_Op<timing, row + 0x0b>, \
+    &CPU::CB_Op<timing, row + 0x0c>, &CPU::CB_Op<timing, row + 0x0d>, &CPU::CB_Op<timing, row + 0x0e>, \
+    &CPU::CB_Op<timing, row + 0x0f> \
+
+#define CB_HANDLER_TABLE(timing) { \
+    CB_HANDLER_ROW(timing, 0x00), CB_HANDLER_ROW(timing, 0x10), CB_HANDLER_ROW(timing, 0x20), \
+    CB_HANDLER_ROW(timing, 0x30), CB_HANDLER_ROW(timing, 0x40), CB_HANDLER_ROW(timing, 0x50), \
+    CB_HANDLER_ROW(timing, 0x60), CB_HANDLER_ROW(timing, 0x70), CB_HANDLER_ROW(timing, 0x80), \
+    CB_HANDLER_ROW(timing, 0x90), CB_HANDLER_ROW(timing, 0xa0), CB_HANDLER_ROW(timing, 0xb0), \
+    CB_HANDLER_ROW(timing, 0xc0), CB_HANDLER_ROW(timing, 0xd0), CB_HANDLER_ROW(timing, 0xe0), \
+    CB_HANDLER_ROW(timing, 0xf0), \
+} \
+
+const CPU::CBHandler CPU::_fastCBHandlers[256] = CB_HANDLER_TABLE(FastTiming);
+const CPU::CBHandler CPU::_accurateCBHandlers[256] = CB_HANDLER_TABLE(AccurateTiming);
+
+template<class Timing>
+LAYOUT(I_ExecCBGroup) int8_t CPU::I_ExecCBGroup() {
+    const auto opcode = busRead<Timing>(_programCounter++);
+    PERF_COUNT(_counters.cbOpcodes[opcode]);
+
+    return (Timing::accurate ? _accurateCBHandlers : _fastCBHandlers)[opcode](*this);
 }
 
-void CPU::TestBit(uint8_t* value, uint8_t bitIndex) {
-    uint8_t mask = 0x01 << bitIndex;
+LAYOUT(I_RotateA) int8_t CPU::I_RotateA(uint8_t opcode) {
+    // RLCA, RRCA, RLA and RRA line up with the first four CB operations.
+    const auto& result = g_shiftResults[(opcode >> 3) & 0x03][cFlag() ? 1 : 0][_regA];
 
-    zFlag(((*value) & mask) == 0);
-    nFlag(false);
-    hFlag(true);
-}
+    _regA = result.value;
+    _flags = (_flags & 0x0f) | result.flags;
 
-void CPU::SetBit(uint8_t* value, uint8_t bitIndex) {
-    uint8_t mask = 0x01 << bitIndex;
-    (*value) |= mask;
-}
-
-void CPU::ResetBit(uint8_t* value, uint8_t bitIndex) {
-    uint8_t mask = ~(0x01 << bitIndex);
-    (*value) &= mask;
+    return 1;
 }
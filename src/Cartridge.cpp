@@ -0,0 +1,94 @@
+#include "Cartridge.h"
+
+#include "SaveState.h"
+
+Cartridge::Cartridge(const std::vector<uint8_t>& rom) : _rom(rom) {
+    // Pad out to whole banks so that bank reads never leave the vector.
+    const size_t bankCount = (_rom.size() + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE;
+    _romBankCount = bankCount < 2 ? 2 : bankCount;
+    _rom.resize(_romBankCount * ROM_BANK_SIZE, 0xff);
+
+    _hasMBC = _rom[CARTRIDGE_TYPE_ADDRESS] != 0x00;
+    _ram.resize(_hasMBC ? 4 * RAM_BANK_SIZE : RAM_BANK_SIZE, 0x00);
+
+    reset();
+}
+
+void Cartridge::reset() {
+    _bankLow = 1;
+    _bankHigh = 0;
+    _ramEnabled = !_hasMBC;
+    _advancedBanking = false;
+
+    updateBankOffset();
+}
+
+void Cartridge::saveState(StateWriter& state) const {
+    state.u32((uint32_t)_ram.size());
+    state.bytes(_ram.data(), _ram.size());
+
+    state.u8(_bankLow);
+    state.u8(_bankHigh);
+    state.flag(_ramEnabled);
+    state.flag(_advancedBanking);
+}
+
+void Cartridge::loadState(StateReader& state) {
+    if (state.u32() != _ram.size()) {
+        state.fail();
+        return;
+    }
+
+    state.bytes(_ram.data(), _ram.size());
+
+    _bankLow = state.u8();
+    _bankHigh = state.u8();
+    _ramEnabled = state.flag();
+    _advancedBanking = state.flag();
+
+    updateBankOffset();
+}
+
+void Cartridge::writeControl(uint16_t addr, uint8_t value) {
+    if (!_hasMBC) {
+        return;
+    }
+
+    if (addr < 0x2000) {
+        _ramEnabled = (value & 0x0f) == 0x0a;
+    } else if (addr < 0x4000) {
+        _bankLow = value & 0x1f;
+        if (_bankLow == 0) {
+            _bankLow = 1;
+        }
+    } else if (addr < 0x6000) {
+        _bankHigh = value & 0x03;
+    } else {
+        _advancedBanking = (value & 0x01) != 0;
+    }
+
+    updateBankOffset();
+}
+
+uint8_t Cartridge::readRAM(uint16_t addr) const {
+    if (!_ramEnabled) {
+        return 0xff;
+    }
+
+    const size_t bank = _advancedBanking ? _bankHigh : 0;
+    return _ram[(bank * RAM_BANK_SIZE + (addr - 0xa000)) % _ram.size()];
+}
+
+void Cartridge::writeRAM(uint16_t addr, uint8_t value) {
+    if (!_ramEnabled) {
+        return;
+    }
+
+    const size_t bank = _advancedBanking ? _bankHigh : 0;
+    _ram[(bank * RAM_BANK_SIZE + (addr - 0xa000)) % _ram.size()] = value;
+}
+
+void Cartridge::updateBankOffset() {
+    const size_t bank = ((size_t)_bankHigh << 5) | _bankLow;
+    _romBankOffset = (bank % _romBankCount) * ROM_BANK_SIZE;
+}
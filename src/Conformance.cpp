@@ -0,0 +1,116 @@
+#include "Conformance.h"
+
+#include "GameBoy.h"
+#include "Opcodes.h"
+
+#include <chrono>
+
+#define SIGNATURE_STATUS_RUNNING 0x80
+#define SIGNATURE_TEXT_OFFSET 4
+#define MAX_SIGNATURE_TEXT 0x1000
+
+static const uint8_t g_signature[3] = { 0xde, 0xb0, 0x61 };
+static const uint8_t g_mooneyePass[6] = { 3, 5, 8, 13, 21, 34 };
+
+// blargg's memory protocol lives at the start of cartridge RAM, which is read
+// directly since the ROM may have disabled it again.
+static bool checkSignature(const Cartridge& cartridge, ConformanceResult& result) {
+    const auto& ram = cartridge._ram;
+    if (ram.size() < SIGNATURE_TEXT_OFFSET ||
+        ram[1] != g_signature[0] || ram[2] != g_signature[1] || ram[3] != g_signature[2] ||
+        ram[0] == SIGNATURE_STATUS_RUNNING) {
+        return false;
+    }
+
+    result.verdict = ram[0] == 0x00 ? VERDICT_PASS : VERDICT_FAIL;
+    result.detector = "signature";
+    for (size_t i = SIGNATURE_TEXT_OFFSET; i < ram.size() && i < MAX_SIGNATURE_TEXT && ram[i] != 0; i++) {
+        result.output.push_back((char)ram[i]);
+    }
+
+    return true;
+}
+
+static bool checkSerial(const std::string& output, ConformanceResult& result) {
+    const bool passed = output.find("Passed") != std::string::npos;
+    const bool failed = output.find("Failed") != std::string::npos;
+    if (!passed && !failed) {
+        return false;
+    }
+
+    // A suite prints "Failed" once for the whole run, even if most tests in
+    // it passed.
+    result.verdict = failed ? VERDICT_FAIL : VERDICT_PASS;
+    result.detector = "serial";
+    result.output = output;
+    return true;
+}
+
+static bool checkRegisters(GameBoy& gameBoy, ConformanceResult& result) {
+    CPU& cpu = gameBoy.cpu();
+    if (!cpu.atInstructionBoundary() || gameBoy.mmu().peek(cpu._programCounter) != Opcode::LD_B_B) {
+        return false;
+    }
+
+    const uint8_t registers[6] = { cpu._regB, cpu._regC, cpu._regD, cpu._regE, cpu._regH, cpu._regL };
+
+    bool pass = true;
+    bool fail = true;
+    for (int i = 0; i < 6; i++) {
+        pass = pass && registers[i] == g_mooneyePass[i];
+        fail = fail && registers[i] == 0x42;
+    }
+
+    // LD B,B is also just an instruction; only the two patterns mean anything.
+    if (!pass && !fail) {
+        return false;
+    }
+
+    result.verdict = pass ? VERDICT_PASS : VERDICT_FAIL;
+    result.detector = "registers";
+    return true;
+}
+
+ConformanceResult runConformance(const std::vector<uint8_t>& rom, uint32_t maxFrames) {
+    const auto start = std::chrono::steady_clock::now();
+
+    ConformanceResult result;
+    result.verdict = VERDICT_TIMEOUT;
+    result.frames = 0;
+
+    GameBoy gameBoy(rom);
+    gameBoy.ppu().renderInterval(0);
+
+    const auto serial = std::make_shared<SerialBuffer>();
+    gameBoy.mmu().serial().transport(serial);
+
+    bool done = false;
+    while (!done && result.frames < maxFrames) {
+        const auto frame = gameBoy.ppu().frameCount();
+        while (!done && gameBoy.ppu().frameCount() == frame) {
+            gameBoy.step();
+            done = checkRegisters(gameBoy, result);
+        }
+
+        result.frames++;
+        done = done ||
+            checkSerial(serial->output(), result) ||
+            checkSignature(gameBoy.mmu().cartridge(), result);
+    }
+
+    if (result.verdict == VERDICT_TIMEOUT) {
+        result.output = serial->output();
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+const char* verdictName(ConformanceVerdict verdict) {
+    switch(verdict) {
+        case VERDICT_PASS: return "PASS";
+        case VERDICT_FAIL: return "FAIL";
+        case VERDICT_TIMEOUT: return "TIMEOUT";
+        default: return "?";
+    }
+}
@@ -0,0 +1,203 @@
+#include "FrameChannel.h"
+
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool usable(const void* memory, size_t size) {
+    return memory != nullptr && size >= sizeof(FrameChannelLayout) &&
+        ((uintptr_t)memory % FRAME_CHANNEL_ALIGNMENT) == 0;
+}
+
+// Writing ///////////////////////////////////////////////////////////////////
+
+FrameChannel::FrameChannel(FrameChannelLayout* layout, const std::string& name) :
+    _layout(layout),
+    _name(name),
+    _writeSlot(0) {
+    new (&_layout->latest) std::atomic<uint32_t>(0);
+    new (&_layout->published) std::atomic<uint64_t>(0);
+
+    for (auto& slot : _layout->slots) {
+        new (&slot.sequence) std::atomic<uint64_t>(0);
+        slot.frameNumber = 0;
+        memset(slot.pixels, 0xff, sizeof(slot.pixels));
+    }
+
+    _layout->version = FRAME_CHANNEL_VERSION;
+    _layout->width = SCREEN_WIDTH;
+    _layout->height = SCREEN_HEIGHT;
+
+    // Readers check the magic number first, so it goes in last.
+    std::atomic_thread_fence(std::memory_order_release);
+    _layout->magic = FRAME_CHANNEL_MAGIC;
+}
+
+FrameChannel::~FrameChannel() {
+    if (!_name.empty()) {
+        munmap(_layout, sizeof(FrameChannelLayout));
+        shm_unlink(_name.c_str());
+    }
+}
+
+FrameChannel::Ptr FrameChannel::create(const std::string& name) {
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    if (ftruncate(fd, sizeof(FrameChannelLayout)) != 0) {
+        close(fd);
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+
+    void* memory = mmap(nullptr, sizeof(FrameChannelLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (memory == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+
+    return Ptr(new FrameChannel((FrameChannelLayout*)memory, name));
+}
+
+FrameChannel::Ptr FrameChannel::attach(void* memory, size_t size) {
+    if (!usable(memory, size)) {
+        return nullptr;
+    }
+
+    return Ptr(new FrameChannel((FrameChannelLayout*)memory, ""));
+}
+
+uint32_t* FrameChannel::beginFrame() {
+    FrameChannelSlot& slot = _layout->slots[_writeSlot];
+
+    // Already odd if the last frame begun here was abandoned.
+    const uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    if ((sequence & 1) == 0) {
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    return slot.pixels;
+}
+
+void FrameChannel::publishFrame(uint64_t frameNumber) {
+    FrameChannelSlot& slot = _layout->slots[_writeSlot];
+
+    slot.frameNumber = frameNumber;
+    slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+    _layout->latest.store(_writeSlot, std::memory_order_release);
+    _layout->published.store(_layout->published.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+    // The oldest frame, which readers have had the longest to finish with.
+    _writeSlot = (_writeSlot + 1) % FRAME_CHANNEL_SLOTS;
+}
+
+// Reading ///////////////////////////////////////////////////////////////////
+
+FrameReader::FrameReader(const FrameChannelLayout* layout, bool mapped) : _layout(layout), _mapped(mapped) {
+}
+
+FrameReader::~FrameReader() {
+    if (_mapped) {
+        munmap((void*)_layout, sizeof(FrameChannelLayout));
+    }
+}
+
+static bool readable(const FrameChannelLayout* layout) {
+    const bool ready = layout->magic == FRAME_CHANNEL_MAGIC;
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    return ready && layout->version == FRAME_CHANNEL_VERSION &&
+        layout->width == SCREEN_WIDTH && layout->height == SCREEN_HEIGHT;
+}
+
+FrameReader::Ptr FrameReader::open(const std::string& name) {
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(FrameChannelLayout)) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* memory = mmap(nullptr, sizeof(FrameChannelLayout), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+
+    const auto layout = (const FrameChannelLayout*)memory;
+    if (!readable(layout)) {
+        munmap(memory, sizeof(FrameChannelLayout));
+        return nullptr;
+    }
+
+    return Ptr(new FrameReader(layout, true));
+}
+
+FrameReader::Ptr FrameReader::attach(const void* memory, size_t size) {
+    if (!usable(memory, size) || !readable((const FrameChannelLayout*)memory)) {
+        return nullptr;
+    }
+
+    return Ptr(new FrameReader((const FrameChannelLayout*)memory, false));
+}
+
+bool FrameReader::latest(FrameView& view) const {
+    while (true) {
+        if (published() == 0) {
+            return false;
+        }
+
+        const uint32_t index = _layout->latest.load(std::memory_order_acquire);
+        const FrameChannelSlot& slot = _layout->slots[index];
+
+        // Odd only if the writer has lapped the reader since latest was read;
+        // it has moved on to a newer frame by then.
+        const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if ((sequence & 1) != 0) {
+            continue;
+        }
+
+        view.pixels = slot.pixels;
+        view.frameNumber = slot.frameNumber;
+        view.slot = index;
+        view.sequence = sequence;
+
+        if (valid(view)) {
+            return true;
+        }
+    }
+}
+
+bool FrameReader::valid(const FrameView& view) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return _layout->slots[view.slot].sequence.load(std::memory_order_relaxed) == view.sequence;
+}
+
+bool FrameReader::copyLatest(uint32_t* pixels, uint64_t& frameNumber) const {
+    FrameView view;
+    do {
+        if (!latest(view)) {
+            return false;
+        }
+
+        memcpy(pixels, view.pixels, sizeof(uint32_t) * FRAME_PIXELS);
+    } while (!valid(view));
+
+    frameNumber = view.frameNumber;
+    return true;
+}
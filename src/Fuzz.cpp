@@ -0,0 +1,205 @@
+#include "Fuzz.h"
+
+#include "Opcodes.h"
+
+#include <cstdio>
+#include <cstring>
+
+#define FLAT_PAGE_SHIFT 8
+#define FLAT_PAGE_COUNT 256
+#define FLAT_PAGE_SIZE (1 << FLAT_PAGE_SHIFT)
+
+// Longer than any instruction or fused pair; past it, one CPU has stopped
+// where the other doesn't.
+#define MAX_UNALIGNED_CYCLES 16
+
+/** 64 KiB of plain RAM that only changes when written. Loading an image
+ * rewrites the pages the image or the last run touched and nothing else.
+ */
+class FuzzTarget::FlatMemory : public Memory {
+public:
+    FlatMemory() : _imagePages(0) {
+        memset(_bytes, 0, sizeof(_bytes));
+        memset(_dirtyPages, 0, sizeof(_dirtyPages));
+    }
+
+    uint8_t read(uint16_t addr) override {
+        return _bytes[addr];
+    }
+
+    void write(uint16_t addr, uint8_t value) override {
+        _bytes[addr] = value;
+        _dirtyPages[addr >> FLAT_PAGE_SHIFT] = 1;
+    }
+
+    // Nothing changes unless the CPU writes it, so pairs can always be fused.
+    uint32_t cyclesUntilEvent() const override {
+        return UINT32_MAX;
+    }
+
+    void load(const uint8_t* image, size_t size) {
+        const size_t pages = (size + FLAT_PAGE_SIZE - 1) >> FLAT_PAGE_SHIFT;
+
+        for (size_t page = 0; page < FLAT_PAGE_COUNT; page++) {
+            uint8_t* bytes = _bytes + (page << FLAT_PAGE_SHIFT);
+            const size_t offset = page << FLAT_PAGE_SHIFT;
+
+            if (page < pages) {
+                const size_t count = size - offset < FLAT_PAGE_SIZE ? size - offset : FLAT_PAGE_SIZE;
+                memcpy(bytes, image + offset, count);
+                memset(bytes + count, 0, FLAT_PAGE_SIZE - count);
+            } else if (page < _imagePages || _dirtyPages[page]) {
+                memset(bytes, 0, FLAT_PAGE_SIZE);
+            }
+        }
+
+        _imagePages = pages;
+        memset(_dirtyPages, 0, sizeof(_dirtyPages));
+    }
+
+    uint8_t _bytes[0x10000];
+    uint8_t _dirtyPages[FLAT_PAGE_COUNT];
+    size_t _imagePages;
+};
+
+FuzzTarget::FuzzTarget() :
+    _memories{ std::make_shared<FlatMemory>(), std::make_shared<FlatMemory>() },
+    _plain(_memories[0]),
+    _fused(_memories[1]),
+    _edgeCount(0) {
+    _plain.fusion(false);
+    _fused.fusion(true);
+    memset(_coverage, 0, sizeof(_coverage));
+}
+
+static void loadRegisters(CPU& cpu, const uint8_t* header) {
+    cpu.reset();
+    cpu._regA = header[0];
+    cpu._flags = header[1];
+    cpu._regB = header[2];
+    cpu._regC = header[3];
+    cpu._regD = header[4];
+    cpu._regE = header[5];
+    cpu._regH = header[6];
+    cpu._regL = header[7];
+    cpu._stackPointer = (uint16_t)(header[8] | (header[9] << 8));
+    cpu._programCounter = (uint16_t)(header[10] | (header[11] << 8));
+    cpu._interruptsEnabled = (header[12] & 0x01) != 0;
+}
+
+// Runs until the CPU is between instructions, or halted, and returns the
+// machine cycles that took.
+static uint32_t stepInstruction(CPU& cpu) {
+    uint32_t cycles = 0;
+    do {
+        for (int i = 0; i < CLOCK_CYCLES_PER_MACHINE_CYCLE; i++) {
+            cpu.clock();
+        }
+        cycles++;
+    } while (!cpu.atInstructionBoundary() && !cpu._isHalted);
+
+    return cycles;
+}
+
+static bool sameCPU(const CPU& a, const CPU& b) {
+    return memcmp(a._registers, b._registers, sizeof(a._registers)) == 0 &&
+        a._stackPointer == b._stackPointer &&
+        a._programCounter == b._programCounter &&
+        a._interruptsEnabled == b._interruptsEnabled &&
+        a._isHalted == b._isHalted;
+}
+
+FuzzOutcome FuzzTarget::run(const uint8_t* data, size_t size) {
+    uint8_t header[FUZZ_HEADER_SIZE] = { 0 };
+    memcpy(header, data, size < FUZZ_HEADER_SIZE ? size : FUZZ_HEADER_SIZE);
+
+    const uint8_t* image = data + (size < FUZZ_HEADER_SIZE ? size : FUZZ_HEADER_SIZE);
+    size_t imageSize = size > FUZZ_HEADER_SIZE ? size - FUZZ_HEADER_SIZE : 0;
+    if (imageSize > sizeof(_memories[0]->_bytes)) {
+        imageSize = sizeof(_memories[0]->_bytes);
+    }
+
+    for (auto& memory : _memories) {
+        memory->load(image, imageSize);
+    }
+
+    loadRegisters(_plain, header);
+    loadRegisters(_fused, header);
+
+    for (uint32_t i = 0; i < _edgeCount; i++) {
+        _coverage[_edges[i]] = 0;
+    }
+    _edgeCount = 0;
+    _report.clear();
+
+    // As in runLockstep(), the CPU behind runs on, and the two are compared
+    // whenever they are between instructions on the same cycle.
+    const uint8_t* bytes = _memories[0]->_bytes;
+    uint32_t plainCycles = 0;
+    uint32_t fusedCycles = 0;
+    uint8_t previous = 0;
+    uint32_t aligned = 0;
+
+    while (true) {
+        if (plainCycles == fusedCycles) {
+            if (!sameCPU(_plain, _fused)) {
+                describe("CPU state differs");
+                return FUZZ_DIVERGED;
+            }
+
+            aligned = plainCycles;
+            if (aligned >= FUZZ_MACHINE_CYCLES) {
+                break;
+            }
+        } else if ((plainCycles > fusedCycles ? plainCycles : fusedCycles) - aligned > MAX_UNALIGNED_CYCLES) {
+            describe("instruction boundaries stopped lining up");
+            return FUZZ_DIVERGED;
+        }
+
+        if (plainCycles <= fusedCycles) {
+            const uint8_t opcode = bytes[_plain._programCounter];
+            const uint16_t edge = (uint16_t)(previous << 8 | opcode);
+            if (!_coverage[edge] && _edgeCount < FUZZ_MACHINE_CYCLES) {
+                _coverage[edge] = 1;
+                _edges[_edgeCount++] = edge;
+            }
+
+            previous = opcode;
+            plainCycles += stepInstruction(_plain);
+        } else {
+            fusedCycles += stepInstruction(_fused);
+        }
+    }
+
+    if (memcmp(_memories[0]->_bytes, _memories[1]->_bytes, sizeof(_memories[0]->_bytes)) != 0) {
+        describe("memory differs");
+        return FUZZ_DIVERGED;
+    }
+
+    return FUZZ_OK;
+}
+
+void FuzzTarget::describe(const char* what) {
+    char text[256];
+    const CPU* cpus[2] = { &_plain, &_fused };
+    const char* names[2] = { "plain", "fusion" };
+
+    _report = what;
+    _report += "\n           A  F  B  C  D  E  H  L  SP   PC   IME HALT\n";
+    for (int i = 0; i < 2; i++) {
+        const CPU& cpu = *cpus[i];
+        snprintf(text, sizeof(text), "  %-8s %02x %02x %02x %02x %02x %02x %02x %02x %04x %04x %d   %d\n", names[i],
+            cpu._regA, cpu._flags, cpu._regB, cpu._regC, cpu._regD, cpu._regE, cpu._regH, cpu._regL,
+            cpu._stackPointer, cpu._programCounter, cpu._interruptsEnabled, cpu._isHalted);
+        _report += text;
+    }
+
+    for (uint32_t addr = 0; addr < sizeof(_memories[0]->_bytes); addr++) {
+        if (_memories[0]->_bytes[addr] != _memories[1]->_bytes[addr]) {
+            snprintf(text, sizeof(text), "  first memory difference at %04x: %02x / %02x\n", addr,
+                _memories[0]->_bytes[addr], _memories[1]->_bytes[addr]);
+            _report += text;
+            break;
+        }
+    }
+}
@@ -0,0 +1,487 @@
+#include "GameBoy.h"
+
+#include "Hash.h"
+#include "IORegisters.h"
+#include "Opcodes.h"
+#include "SaveState.h"
+
+#include <chrono>
+#include <cstring>
+
+#define HEADER_LOGO_ADDRESS 0x0104
+#define HEADER_LOGO_SIZE 0x30
+#define HEADER_CHECKSUM_ADDRESS 0x014d
+
+// Where the boot ROMs leave the registers, from A to L in r-field order. On a
+// DMG, F also gets H and C set unless the header checksum is 0.
+static const uint8_t g_dmgRegisters[8] = { 0x00, 0x13, 0x00, 0xd8, 0x01, 0x4d, 0x80, 0x01 };
+static const uint8_t g_cgbRegisters[8] = { 0x00, 0x00, 0xff, 0x56, 0x00, 0x0d, 0x80, CGB_BOOT_A };
+
+// I/O registers the boot ROMs leave behind that nothing here emulates, so
+// they only ever read back as this: the timer and sound.
+static const struct {
+    uint16_t addr;
+    uint8_t value;
+} g_postBootIO[] = {
+    { IO_TIMA, 0x00 }, { IO_TMA, 0x00 }, { IO_TAC, 0xf8 },
+    { IO_NR10, 0x80 }, { IO_NR11, 0xbf }, { IO_NR12, 0xf3 }, { IO_NR13, 0xff }, { IO_NR14, 0xbf },
+    { IO_NR21, 0x3f }, { IO_NR22, 0x00 }, { IO_NR23, 0xff }, { IO_NR24, 0xbf },
+    { IO_NR30, 0x7f }, { IO_NR31, 0xff }, { IO_NR32, 0x9f }, { IO_NR33, 0xff }, { IO_NR34, 0xbf },
+    { IO_NR41, 0xff }, { IO_NR42, 0x00 }, { IO_NR43, 0x00 }, { IO_NR44, 0xbf },
+    { IO_NR50, 0x77 }, { IO_NR51, 0xf3 }, { IO_NR52, 0xf1 },
+};
+
+// The (R) tile the DMG boot ROM puts after the logo.
+static const uint8_t g_registeredTile[8] = { 0x3c, 0x42, 0xb9, 0xa5, 0xb9, 0xa5, 0x42, 0x3c };
+
+// Each bit of a logo nibble, doubled up into a byte.
+static uint8_t doubleNibble(uint8_t nibble) {
+    uint8_t doubled = 0;
+    for (int bit = 3; bit >= 0; bit--) {
+        doubled = (uint8_t)(doubled << 2 | ((nibble >> bit) & 0x01) * 0x03);
+    }
+
+    return doubled;
+}
+
+GameBoy::GameBoy(const std::vector<uint8_t>& rom) :
+    _mmu(std::make_shared<MMU>(rom)),
+    _cpu(_mmu),
+    _machineCycles(0),
+    _idleLoopSkip(false),
+    _idleCyclesSkipped(0) {
+    skipBoot();
+    idleLoopSkip(false);
+}
+
+void GameBoy::reset() {
+    _mmu->reset();
+    _cpu.reset();
+
+    if (_mmu->_bootROMMapped) {
+        _cpu._programCounter = 0x0000;
+        _cpu._stackPointer = 0x0000;
+        _cpu._interruptsEnabled = false;
+    } else {
+        skipBoot();
+    }
+
+    idleLoopSkip(_idleLoopSkip);
+}
+
+bool GameBoy::bootROM(const std::vector<uint8_t>& image) {
+    const size_t size = _mmu->cgb() ? CGB_BOOT_ROM_SIZE : DMG_BOOT_ROM_SIZE;
+    if (!image.empty() && image.size() != size) {
+        return false;
+    }
+
+    _mmu->bootROM(image);
+    reset();
+    return true;
+}
+
+void GameBoy::skipBoot() {
+    MMU& mmu = *_mmu;
+    PPU& ppu = mmu.ppu();
+    const bool cgb = mmu.cgb();
+
+    const uint8_t* registers = cgb ? g_cgbRegisters : g_dmgRegisters;
+    for (uint8_t index = 0; index < 8; index++) {
+        if (index != 6) {
+            _cpu.reg8(index) = registers[index];
+        }
+    }
+
+    _cpu._flags = registers[6];
+    if (!cgb && mmu.peek(HEADER_CHECKSUM_ADDRESS) != 0) {
+        _cpu._flags |= 0x30;
+    }
+
+    _cpu._stackPointer = INIT_STACK_POINTER;
+    _cpu._programCounter = INIT_VECTOR;
+    _cpu._interruptsEnabled = false;
+
+    for (const auto& io : g_postBootIO) {
+        mmu._io[io.addr - 0xff00] = io.value;
+    }
+
+    // DIV depends on how long the CGB boot ROM took, which varies.
+    if (!cgb) {
+        mmu._io[IO_DIV - 0xff00] = 0xab;
+    } else {
+        mmu._io[IO_DMA - 0xff00] = 0x00;
+    }
+
+    mmu._interruptFlags = INT_VBLANK;
+    mmu.joypad()._select = 0x00;
+
+    if (!cgb) {
+        // The logo, scaled up from the header into tiles 1-24, then the (R)
+        // tile, only the low bit plane of each.
+        uint16_t tile = 0x0010;
+        for (uint16_t i = 0; i < HEADER_LOGO_SIZE; i++) {
+            const uint8_t logo = mmu.peek(HEADER_LOGO_ADDRESS + i);
+            const uint8_t rows[] = { doubleNibble(logo >> 4), doubleNibble(logo & 0x0f) };
+            for (const uint8_t row : rows) {
+                ppu._vram[tile] = row;
+                ppu._vram[tile + 2] = row;
+                tile += 4;
+            }
+        }
+
+        for (const uint8_t row : g_registeredTile) {
+            ppu._vram[tile] = row;
+            tile += 2;
+        }
+
+        // Two rows of twelve tiles in the middle of the first map, and (R)
+        // after the top one.
+        for (uint8_t i = 0; i < 12; i++) {
+            ppu._vram[0x1904 + i] = (uint8_t)(i + 0x01);
+            ppu._vram[0x1924 + i] = (uint8_t)(i + 0x0d);
+        }
+
+        ppu._vram[0x1910] = 0x19;
+    }
+
+    // The LCD is on with the logo up when the cartridge takes over; here it
+    // starts a frame at the same time.
+    ppu.writeRegister(IO_LCDC, 0x91);
+    mmu.markAllDirty();
+}
+
+void GameBoy::saveState(std::vector<uint8_t>& state) const {
+    StateWriter writer(state);
+    writer.u32(SAVE_STATE_MAGIC);
+    writer.u16(SAVE_STATE_VERSION);
+    writer.u64(romHash());
+
+    writer.u64(_machineCycles);
+    _cpu.saveState(writer);
+    _mmu->saveState(writer);
+}
+
+bool GameBoy::loadState(const std::vector<uint8_t>& state) {
+    // Loading goes straight into the machine, so anything that could make it
+    // fail part way is ruled out first. Given the same ROM and build, a state
+    // only fits if it is exactly as long as this machine's own.
+    std::vector<uint8_t> current;
+    saveState(current);
+    if (state.size() != current.size()) {
+        return false;
+    }
+
+    StateReader reader(state);
+    if (reader.u32() != SAVE_STATE_MAGIC ||
+        reader.u16() != SAVE_STATE_VERSION ||
+        reader.u64() != romHash()) {
+        return false;
+    }
+
+    _machineCycles = reader.u64();
+    _cpu.loadState(reader);
+    _mmu->loadState(reader);
+
+    // Whatever loop was being watched was in the old state.
+    idleLoopSkip(_idleLoopSkip);
+
+    return reader.ok() && reader.atEnd();
+}
+
+void GameBoy::runFrame() {
+    if (_cpu.accurateTiming()) {
+        runFrameWith<AccurateTiming>();
+    } else {
+        runFrameWith<FastTiming>();
+    }
+}
+
+void GameBoy::runFrame(FrameCost& cost) {
+    if (_cpu.accurateTiming()) {
+        runFrameWith<AccurateTiming>(cost);
+    } else {
+        runFrameWith<FastTiming>(cost);
+    }
+}
+
+template<class Timing>
+void GameBoy::runFrameWith() {
+    const auto frame = ppu().frameCount();
+    while (ppu().frameCount() == frame) {
+        step<Timing>();
+    }
+}
+
+template<class Timing>
+void GameBoy::runFrameWith(FrameCost& cost) {
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::duration cpuTime(0);
+    Clock::duration ppuTime(0);
+
+    const auto frame = ppu().frameCount();
+    while (ppu().frameCount() == frame) {
+        const auto start = Clock::now();
+        for (int i = 0; i < CLOCK_CYCLES_PER_MACHINE_CYCLE; i++) {
+            _cpu.clock<Timing>();
+        }
+
+        const auto split = Clock::now();
+        _mmu->machineCycle<Timing>();
+
+        _machineCycles++;
+
+        // A skipped loop is time the devices run on without the CPU.
+        if (_idleLoopSkip && _cpu.atInstructionBoundary()) {
+            checkIdleLoop();
+        }
+
+        const auto end = Clock::now();
+        cpuTime += split - start;
+        ppuTime += end - split;
+    }
+
+    cost.cpuMicroseconds = std::chrono::duration<double, std::micro>(cpuTime).count();
+    cost.ppuMicroseconds = std::chrono::duration<double, std::micro>(ppuTime).count();
+    cost.rendered = ppu().frameRendered();
+}
+
+void GameBoy::idleLoopSkip(bool enabled) {
+    _idleLoopSkip = enabled;
+    _lastInstruction = _cpu._programCounter;
+
+    _idleLoop.head = 0;
+    _idleLoop.last = 0;
+    _idleLoop.pollsOnly = false;
+    _idleLoop.haveIteration = false;
+}
+
+void GameBoy::checkIdleLoop() {
+    const uint16_t pc = _cpu._programCounter;
+    const uint16_t previous = _lastInstruction;
+    _lastInstruction = pc;
+
+    const bool backwardBranch = pc <= previous && previous - pc <= MAX_IDLE_LOOP_BYTES;
+    if (!backwardBranch) {
+        // Leaving the loop, e.g. for an interrupt, means starting over.
+        if (pc < _idleLoop.head || pc > _idleLoop.last) {
+            _idleLoop.pollsOnly = false;
+            _idleLoop.haveIteration = false;
+        }
+
+        return;
+    }
+
+    if (pc != _idleLoop.head || previous != _idleLoop.last || !_idleLoop.pollsOnly) {
+        _idleLoop.head = pc;
+        _idleLoop.last = previous;
+        _idleLoop.pollsOnly = analyseIdleLoop(pc, previous);
+        _idleLoop.haveIteration = false;
+
+        if (!_idleLoop.pollsOnly) {
+            return;
+        }
+    }
+
+    // The iteration that just ended is a fixed point if it put every register
+    // back, and it says something about the next ones only if no device event
+    // happened while it ran.
+    const uint64_t iterationCycles = _machineCycles - _idleLoop.startCycle;
+    const uint64_t iterationTicks = iterationCycles * _mmu->ticksPerMachineCycle();
+
+    const bool fixedPoint = _idleLoop.haveIteration &&
+        iterationTicks <= _idleLoop.cyclesUntilEvent &&
+        memcmp(_idleLoop.registers, _cpu._registers, sizeof(_idleLoop.registers)) == 0 &&
+        _idleLoop.stackPointer == _cpu._stackPointer &&
+        _idleLoop.interruptsEnabled == _cpu._interruptsEnabled;
+
+    // An interrupt would be taken, or end HALT, at the next boundary. IF only
+    // changes on device events, so if none is pending none will be until the
+    // next event.
+    const bool interruptPending = (_mmu->peek(IO_IE) & _mmu->peek(IO_IF) & 0x1f) != 0;
+
+    if (fixedPoint && !interruptPending && iterationTicks > 0) {
+        const uint64_t iterations = _mmu->cyclesUntilEvent() / iterationTicks;
+
+        _mmu->skip((uint32_t)(iterations * iterationTicks));
+        _machineCycles += iterations * iterationCycles;
+        _idleCyclesSkipped += iterations * iterationCycles;
+    }
+
+    memcpy(_idleLoop.registers, _cpu._registers, sizeof(_idleLoop.registers));
+    _idleLoop.stackPointer = _cpu._stackPointer;
+    _idleLoop.interruptsEnabled = _cpu._interruptsEnabled;
+    _idleLoop.startCycle = _machineCycles;
+    _idleLoop.cyclesUntilEvent = _mmu->cyclesUntilEvent();
+    _idleLoop.haveIteration = true;
+}
+
+// Length of an instruction that can appear in the body of an idle loop, or 0
+// for anything that writes memory, uses the stack, changes interrupt or HALT
+// state, or branches.
+static int pollingInstructionLength(uint8_t opcode, uint8_t next) {
+    if (opcode == Opcode::PREFIX_CB) {
+        // BIT only reads; every other CB operation on (HL) writes it back.
+        return (next >= 0x40 && next < 0x80) || (next & 0x07) != 0x06 ? 2 : 0;
+    }
+
+    if (opcode >= 0x40 && opcode < 0xc0) {
+        // LD r,r', LD r,(HL) and the ALU on registers or (HL); not LD (HL),r
+        // or HALT.
+        return opcode >= 0x70 && opcode < 0x78 ? 0 : 1;
+    }
+
+    if (opcode < 0x40) {
+        switch(opcode & 0x0f) {
+            case 0x00: return opcode == Opcode::NOP ? 1 : 0;        // Not STOP or JR.
+            case 0x01: return 3;                                    // LD rr,nn
+            case 0x02: return 0;                                    // LD (rr),A
+            case 0x03: case 0x0b: return 1;                         // INC/DEC rr
+            case 0x04: case 0x05: case 0x0c: case 0x0d:             // INC/DEC r
+                return opcode == 0x34 || opcode == 0x35 ? 0 : 1;
+            case 0x06: case 0x0e:                                   // LD r,n
+                return opcode == 0x36 ? 0 : 2;
+            case 0x07: case 0x0f: return 1;                         // Rotates, DAA, CPL, SCF, CCF
+            case 0x08: return 0;                                    // LD (nn),SP or JR.
+            case 0x09: return 1;                                    // ADD HL,rr
+            case 0x0a: return 1;                                    // LD A,(rr)
+        }
+    }
+
+    switch(opcode) {
+        case 0xc6: case 0xce: case 0xd6: case 0xde:                 // ALU A,n
+        case 0xe6: case 0xee: case 0xf6: case 0xfe:
+        case Opcode::LDH_A_afN:
+        case 0xf8:                                                  // LD HL,SP+n
+            return 2;
+        case 0xf2:                                                  // LD A,(C)
+        case 0xf9:                                                  // LD SP,HL
+            return 1;
+        case Opcode::LD_A_aNN:
+            return 3;
+    }
+
+    return 0;
+}
+
+bool GameBoy::analyseIdleLoop(uint16_t head, uint16_t last) {
+    uint16_t pc = head;
+    while (pc < last) {
+        const int length = pollingInstructionLength(_mmu->peek(pc), _mmu->peek(pc + 1));
+        if (length == 0) {
+            return false;
+        }
+
+        pc += length;
+    }
+
+    if (pc != last) {
+        return false;
+    }
+
+    // The last instruction boundary is normally the branch, but it is the one
+    // before when the CPU ran the two as a fused pair.
+    uint16_t branch = last;
+    uint8_t opcode = _mmu->peek(branch);
+    const int length = pollingInstructionLength(opcode, _mmu->peek(branch + 1));
+    if (length > 0) {
+        branch += length;
+        opcode = _mmu->peek(branch);
+    }
+
+    // Code has to come from somewhere the CPU alone decides the contents of;
+    // VRAM and OAM read differently by PPU mode.
+    const uint32_t end = (uint32_t)branch + 3;
+    const bool stableCode = end <= 0x8000 ||
+        (head >= 0xc000 && end <= 0xfe00) ||
+        (head >= 0xff80 && end <= 0xffff);
+
+    if (!stableCode) {
+        return false;
+    }
+
+    switch(opcode) {
+        case Opcode::JR_N:
+        case Opcode::JR_NZ_N:
+        case Opcode::JR_Z_N:
+        case Opcode::JR_NC_N:
+        case Opcode::JR_C_N: {
+            const uint8_t rawOffset = _mmu->peek(branch + 1);
+            return (uint16_t)(branch + 2 + *reinterpret_cast<const int8_t*>(&rawOffset)) == head;
+        }
+        case Opcode::JP_NN:
+        case Opcode::JP_NZ_NN:
+        case Opcode::JP_Z_NN:
+        case Opcode::JP_NC_NN:
+        case Opcode::JP_C_NN:
+            return (uint16_t)(_mmu->peek(branch + 2) << 8 | _mmu->peek(branch + 1)) == head;
+    }
+
+    return false;
+}
+
+PerfCounters GameBoy::counters() const {
+    PerfCounters counters;
+    counters.cpu = _cpu.counters();
+    counters.bus = _mmu->counters();
+    return counters;
+}
+
+void GameBoy::resetCounters() {
+    _cpu.resetCounters();
+    _mmu->resetCounters();
+}
+
+void GameBoy::profiler(Profiler* profiler) {
+    if (profiler != nullptr) {
+        profiler->cartridge(&_mmu->cartridge());
+    }
+
+    _cpu.profiler(profiler);
+}
+
+uint64_t GameBoy::romHash() const {
+    const auto& rom = _mmu->cartridge()._rom;
+    return hash64(rom.data(), rom.size());
+}
+
+uint64_t GameBoy::stateHash() const {
+    const uint8_t registers[] = {
+        _cpu._regA, _cpu._regB, _cpu._regC, _cpu._regD,
+        _cpu._regE, _cpu._regH, _cpu._regL, _cpu._flags,
+        (uint8_t)(_cpu._stackPointer >> 8), (uint8_t)_cpu._stackPointer,
+        (uint8_t)(_cpu._programCounter >> 8), (uint8_t)_cpu._programCounter,
+        (uint8_t)_cpu._interruptsEnabled, (uint8_t)_cpu._isHalted,
+        _mmu->_interruptFlags, _mmu->_interruptEnable,
+    };
+
+    MMU& mmu = *_mmu;
+    const PPU& ppu = mmu.ppu();
+    const Cartridge& cartridge = mmu.cartridge();
+
+    const uint8_t devices[] = {
+        ppu._lcdc, ppu._stat, ppu._scy, ppu._scx, ppu._ly, ppu._lyc,
+        ppu._bgp, ppu._obp0, ppu._obp1, ppu._wy, ppu._wx, (uint8_t)ppu._mode,
+        (uint8_t)(ppu._dot >> 16), (uint8_t)(ppu._dot >> 8), (uint8_t)ppu._dot, ppu._bcps, ppu._ocps,
+        (uint8_t)mmu._doubleSpeed, (uint8_t)mmu._speedSwitchArmed, (uint8_t)mmu._bootROMMapped,
+        mmu._workRAMBank, (uint8_t)(mmu._vramBankOffset / VRAM_SIZE),
+        mmu.joypad()._select, mmu.joypad()._pressed,
+        mmu.serial()._data, mmu.serial()._control, (uint8_t)mmu.serial()._awaitingReply,
+        (uint8_t)(mmu.serial()._shiftDots >> 8), (uint8_t)mmu.serial()._shiftDots,
+        cartridge._bankLow, cartridge._bankHigh,
+        (uint8_t)cartridge._ramEnabled, (uint8_t)cartridge._advancedBanking,
+    };
+
+    uint64_t hash = hash64(registers, sizeof(registers));
+    hash = hash64(devices, sizeof(devices), hash);
+    hash = hash64(mmu._workRAM, sizeof(mmu._workRAM), hash);
+    hash = hash64(mmu._highRAM, sizeof(mmu._highRAM), hash);
+    hash = hash64(mmu._io, sizeof(mmu._io), hash);
+    hash = hash64(ppu._vram, sizeof(ppu._vram), hash);
+    hash = hash64(ppu._oam, sizeof(ppu._oam), hash);
+    hash = hash64(ppu._bgPaletteRAM, sizeof(ppu._bgPaletteRAM), hash);
+    hash = hash64(ppu._objPaletteRAM, sizeof(ppu._objPaletteRAM), hash);
+    hash = hash64(cartridge._ram.data(), cartridge._ram.size(), hash);
+
+    return hash;
+}
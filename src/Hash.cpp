@@ -0,0 +1,222 @@
+#include "Hash.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Reference: https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+
+static const uint64_t PRIME64_1 = 0x9e3779b185ebca87ULL;
+static const uint64_t PRIME64_2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t PRIME64_3 = 0x165667b19e3779f9ULL;
+static const uint64_t PRIME64_4 = 0x85ebca77c2b2ae63ULL;
+static const uint64_t PRIME64_5 = 0x27d4eb2f165667c5ULL;
+
+static inline uint64_t rotl(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// The spec reads little-endian; every host we build on is.
+static inline uint64_t read64(const uint8_t* data) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(const uint8_t* data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint64_t accumulate(uint64_t accumulator, uint64_t input) {
+    accumulator += input * PRIME64_2;
+    accumulator = rotl(accumulator, 31);
+    return accumulator * PRIME64_1;
+}
+
+static inline uint64_t mergeRound(uint64_t accumulator, uint64_t value) {
+    accumulator ^= accumulate(0, value);
+    return accumulator * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t hash64(const void* data, size_t length, uint64_t seed) {
+    const uint8_t* input = static_cast<const uint8_t*>(data);
+    const uint8_t* const end = input + length;
+    uint64_t hash;
+
+    if (length >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+
+        const uint8_t* const limit = end - 32;
+        do {
+            v1 = accumulate(v1, read64(input));
+            v2 = accumulate(v2, read64(input + 8));
+            v3 = accumulate(v3, read64(input + 16));
+            v4 = accumulate(v4, read64(input + 24));
+            input += 32;
+        } while (input <= limit);
+
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        hash = mergeRound(hash, v1);
+        hash = mergeRound(hash, v2);
+        hash = mergeRound(hash, v3);
+        hash = mergeRound(hash, v4);
+    } else {
+        hash = seed + PRIME64_5;
+    }
+
+    hash += (uint64_t)length;
+
+    while (input + 8 <= end) {
+        hash ^= accumulate(0, read64(input));
+        hash = rotl(hash, 27) * PRIME64_1 + PRIME64_4;
+        input += 8;
+    }
+
+    if (input + 4 <= end) {
+        hash ^= (uint64_t)read32(input) * PRIME64_1;
+        hash = rotl(hash, 23) * PRIME64_2 + PRIME64_3;
+        input += 4;
+    }
+
+    while (input < end) {
+        hash ^= (*input) * PRIME64_5;
+        hash = rotl(hash, 11) * PRIME64_1;
+        input++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+#define STRIPE_SIZE 64
+#define STRIPE_LANES 8
+
+static const uint8_t g_blockKey[STRIPE_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe,
+    0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78,
+    0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e,
+    0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+};
+
+static inline void accumulateStripeScalar(uint64_t* lanes, const uint8_t* stripe) {
+    for (int i = 0; i < STRIPE_LANES; i++) {
+        const uint64_t value = read64(stripe + i * 8);
+        const uint64_t keyed = value ^ read64(g_blockKey + i * 8);
+        lanes[i ^ 1] += value;
+        lanes[i] += (keyed & 0xffffffff) * (keyed >> 32);
+    }
+}
+
+#ifdef __SSE2__
+static inline void accumulateStripeSSE2(__m128i* lanes, const uint8_t* stripe) {
+    for (int i = 0; i < STRIPE_LANES / 2; i++) {
+        const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stripe) + i);
+        const __m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g_blockKey) + i);
+        const __m128i keyed = _mm_xor_si128(value, key);
+        const __m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+        const __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+        lanes[i] = _mm_add_epi64(lanes[i], _mm_add_epi64(product, swapped));
+    }
+}
+#endif
+
+static inline uint64_t fold128(uint64_t a, uint64_t b) {
+    const unsigned __int128 product = (unsigned __int128)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static uint64_t mergeLanes(const uint64_t* lanes, size_t length) {
+    uint64_t hash = (uint64_t)length * PRIME64_1;
+    for (int i = 0; i < STRIPE_LANES; i += 2) {
+        hash += fold128(
+            lanes[i] ^ read64(g_blockKey + i * 8),
+            lanes[i + 1] ^ read64(g_blockKey + (i + 1) * 8)
+        );
+    }
+
+    hash ^= hash >> 37;
+    hash *= 0x165667919e3779f9ULL;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static inline void initialLanes(uint64_t* lanes) {
+    lanes[0] = PRIME64_3;
+    lanes[1] = PRIME64_1;
+    lanes[2] = PRIME64_2;
+    lanes[3] = PRIME64_3;
+    lanes[4] = PRIME64_4;
+    lanes[5] = PRIME64_2;
+    lanes[6] = PRIME64_5;
+    lanes[7] = PRIME64_1;
+}
+
+uint64_t blockHashScalar(const void* data, size_t length) {
+    const uint8_t* input = static_cast<const uint8_t*>(data);
+    uint64_t lanes[STRIPE_LANES];
+    initialLanes(lanes);
+
+    size_t offset = 0;
+    for (; offset + STRIPE_SIZE <= length; offset += STRIPE_SIZE) {
+        accumulateStripeScalar(lanes, input + offset);
+    }
+
+    // The tail is zero-padded out to a whole stripe; length goes into the
+    // merge so that padding can't collide with real zeros.
+    if (offset < length) {
+        uint8_t tail[STRIPE_SIZE] = { 0 };
+        memcpy(tail, input + offset, length - offset);
+        accumulateStripeScalar(lanes, tail);
+    }
+
+    return mergeLanes(lanes, length);
+}
+
+uint64_t blockHash(const void* data, size_t length) {
+#ifdef __SSE2__
+    const uint8_t* input = static_cast<const uint8_t*>(data);
+    uint64_t initial[STRIPE_LANES];
+    initialLanes(initial);
+
+    __m128i lanes[STRIPE_LANES / 2];
+    for (int i = 0; i < STRIPE_LANES / 2; i++) {
+        lanes[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(initial) + i);
+    }
+
+    size_t offset = 0;
+    for (; offset + STRIPE_SIZE <= length; offset += STRIPE_SIZE) {
+        accumulateStripeSSE2(lanes, input + offset);
+    }
+
+    if (offset < length) {
+        uint8_t tail[STRIPE_SIZE] = { 0 };
+        memcpy(tail, input + offset, length - offset);
+        accumulateStripeSSE2(lanes, tail);
+    }
+
+    uint64_t merged[STRIPE_LANES];
+    for (int i = 0; i < STRIPE_LANES / 2; i++) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(merged) + i, lanes[i]);
+    }
+
+    return mergeLanes(merged, length);
+#else
+    return blockHashScalar(data, length);
+#endif
+}
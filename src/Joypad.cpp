@@ -0,0 +1,55 @@
+#include "Joypad.h"
+
+#include "IORegisters.h"
+#include "SaveState.h"
+
+#define SELECT_DIRECTIONS 0x10
+#define SELECT_BUTTONS 0x20
+
+Joypad::Joypad(uint8_t& interruptFlags) : _interruptFlags(interruptFlags) {
+    reset();
+}
+
+void Joypad::reset() {
+    _select = SELECT_DIRECTIONS | SELECT_BUTTONS;
+    _pressed = 0x00;
+}
+
+void Joypad::saveState(StateWriter& state) const {
+    state.u8(_select);
+    state.u8(_pressed);
+}
+
+void Joypad::loadState(StateReader& state) {
+    _select = state.u8();
+    _pressed = state.u8();
+}
+
+uint8_t Joypad::read() const {
+    uint8_t lines = 0x0f;
+
+    if ((_select & SELECT_DIRECTIONS) == 0) {
+        lines &= ~(_pressed >> 4);
+    }
+
+    if ((_select & SELECT_BUTTONS) == 0) {
+        lines &= ~(_pressed & 0x0f);
+    }
+
+    return 0xc0 | _select | (lines & 0x0f);
+}
+
+void Joypad::write(uint8_t value) {
+    _select = value & (SELECT_DIRECTIONS | SELECT_BUTTONS);
+}
+
+void Joypad::buttons(uint8_t pressed) {
+    const uint8_t before = read();
+    _pressed = pressed;
+    const uint8_t after = read();
+
+    // Any line going from high to low.
+    if ((before & ~after & 0x0f) != 0) {
+        _interruptFlags |= INT_JOYPAD;
+    }
+}
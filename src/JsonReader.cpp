@@ -0,0 +1,166 @@
+#include "JsonReader.h"
+
+#include <cstring>
+
+bool JsonString::operator==(const char* other) const {
+    return strncmp(data, other, size) == 0 && other[size] == '\0';
+}
+
+JsonReader::JsonReader(const char* begin, const char* end) :
+    _cursor(begin),
+    _end(end),
+    _failed(false),
+    _first(false) {
+}
+
+char JsonReader::peek() {
+    while (_cursor < _end && (*_cursor == ' ' || *_cursor == '\n' || *_cursor == '\r' || *_cursor == '\t')) {
+        _cursor++;
+    }
+
+    return _cursor < _end ? *_cursor : '\0';
+}
+
+bool JsonReader::expect(char c) {
+    if (_failed || peek() != c) {
+        return fail();
+    }
+
+    _cursor++;
+    return true;
+}
+
+bool JsonReader::fail() {
+    _failed = true;
+    return false;
+}
+
+bool JsonReader::beginObject() {
+    _first = true;
+    return expect('{');
+}
+
+bool JsonReader::beginArray() {
+    _first = true;
+    return expect('[');
+}
+
+bool JsonReader::nextItem(char close) {
+    if (_failed) {
+        return false;
+    }
+
+    const char c = peek();
+    if (c == close) {
+        _cursor++;
+        _first = false;
+        return false;
+    }
+
+    if (!_first && !expect(',')) {
+        return false;
+    }
+
+    _first = false;
+    return true;
+}
+
+bool JsonReader::nextMember(JsonString& key) {
+    return nextItem('}') && readString(key) && expect(':');
+}
+
+bool JsonReader::nextElement() {
+    return nextItem(']');
+}
+
+bool JsonReader::readInteger(int64_t& value) {
+    if (_failed) {
+        return false;
+    }
+
+    peek();
+    const bool negative = _cursor < _end && *_cursor == '-';
+    if (negative) {
+        _cursor++;
+    }
+
+    if (_cursor >= _end || *_cursor < '0' || *_cursor > '9') {
+        return fail();
+    }
+
+    value = 0;
+    while (_cursor < _end && *_cursor >= '0' && *_cursor <= '9') {
+        value = value * 10 + (*_cursor++ - '0');
+    }
+
+    if (negative) {
+        value = -value;
+    }
+
+    _first = false;
+    return true;
+}
+
+bool JsonReader::readString(JsonString& value) {
+    if (!expect('"')) {
+        return false;
+    }
+
+    value.data = _cursor;
+    while (_cursor < _end && *_cursor != '"') {
+        // The escaped character can't end the string.
+        _cursor += *_cursor == '\\' ? 2 : 1;
+    }
+
+    if (_cursor >= _end) {
+        return fail();
+    }
+
+    value.size = (size_t)(_cursor - value.data);
+    _cursor++;
+    _first = false;
+    return true;
+}
+
+bool JsonReader::skipValue() {
+    if (_failed) {
+        return false;
+    }
+
+    JsonString ignored;
+    switch (peek()) {
+        case '{':
+            beginObject();
+            while (nextMember(ignored)) {
+                skipValue();
+            }
+            break;
+        case '[':
+            beginArray();
+            while (nextElement()) {
+                skipValue();
+            }
+            break;
+        case '"':
+            readString(ignored);
+            break;
+        default:
+            // Numbers, true, false and null.
+            if (_cursor >= _end || strchr(",]}", *_cursor) != nullptr) {
+                return fail();
+            }
+
+            while (_cursor < _end && strchr(",]} \n\r\t", *_cursor) == nullptr) {
+                _cursor++;
+            }
+            break;
+    }
+
+    _first = false;
+    return !_failed;
+}
+
+bool JsonReader::atEnd() {
+    peek();
+    return !_failed && _cursor >= _end;
+}
@@ -0,0 +1,191 @@
+#include "Lockstep.h"
+
+#include "GameBoy.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+// Boundaries remembered for the report.
+#define LOCKSTEP_HISTORY 16
+
+// An idle loop skip can jump a machine up to a frame ahead (the LCD being off
+// makes the whole frame one event); past two, the boundaries have stopped
+// lining up.
+#define MAX_UNALIGNED_CYCLES (2 * 70224 / 4)
+
+static const LockstepEngine g_engines[] = {
+    { "plain", false, false, false },
+    { "fusion", true, false, false },
+    { "idle", false, true, false },
+    { "fast", true, true, false },
+    { "accurate", false, false, true },
+};
+
+bool lockstepEngine(const std::string& name, LockstepEngine& engine) {
+    for (const auto& candidate : g_engines) {
+        if (name == candidate.name) {
+            engine = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Runs until the CPU is between instructions, or halted.
+static void stepInstruction(GameBoy& gameBoy) {
+    do {
+        gameBoy.step();
+    } while (!gameBoy.cpu().atInstructionBoundary() && !gameBoy.cpu()._isHalted);
+}
+
+static bool sameCPU(CPU& a, CPU& b) {
+    return memcmp(a._registers, b._registers, sizeof(a._registers)) == 0 &&
+        a._stackPointer == b._stackPointer &&
+        a._programCounter == b._programCounter &&
+        a._interruptsEnabled == b._interruptsEnabled &&
+        a._isHalted == b._isHalted;
+}
+
+static void dumpCPU(std::ostream& out, const char* name, CPU& cpu) {
+    char line[128];
+    snprintf(line, sizeof(line), "  %-8s %02x %02x %02x %02x %02x %02x %02x %02x %04x %04x %d   %d\n", name,
+        cpu._regA, cpu._flags, cpu._regB, cpu._regC, cpu._regD, cpu._regE, cpu._regH, cpu._regL,
+        cpu._stackPointer, cpu._programCounter, cpu._interruptsEnabled, cpu._isHalted);
+    out << line;
+}
+
+static void dumpWrites(std::ostream& out, const char* name, const std::vector<BusWrite>& writes) {
+    char entry[16];
+    out << "  " << name << ":";
+    for (const auto& write : writes) {
+        snprintf(entry, sizeof(entry), " %04x=%02x", write.addr, write.value);
+        out << entry;
+    }
+    out << (writes.empty() ? " none\n" : "\n");
+}
+
+LockstepResult runLockstep(const std::vector<uint8_t>& rom, const LockstepEngine& first,
+    const LockstepEngine& second, uint32_t maxFrames) {
+    const auto start = std::chrono::steady_clock::now();
+
+    LockstepResult result;
+    result.diverged = false;
+    result.frames = 0;
+    result.comparisons = 0;
+
+    GameBoy a(rom);
+    GameBoy b(rom);
+    a.cpu().fusion(first.fusion);
+    a.cpu().accurateTiming(first.accurateTiming);
+    a.idleLoopSkip(first.idleLoopSkip);
+    b.cpu().fusion(second.fusion);
+    b.cpu().accurateTiming(second.accurateTiming);
+    b.idleLoopSkip(second.idleLoopSkip);
+    a.ppu().renderInterval(0);
+    b.ppu().renderInterval(0);
+
+    std::vector<BusWrite> writes[2];
+    a.mmu().writeLog(&writes[0]);
+    b.mmu().writeLog(&writes[1]);
+
+    uint16_t history[LOCKSTEP_HISTORY];
+    uint64_t lastComparison = 0;
+    uint64_t lastFrame = a.ppu().frameCount();
+    bool hashDue = false;
+
+    const char* reason = nullptr;
+    while (result.frames < maxFrames) {
+        if (a.machineCycles() <= b.machineCycles()) {
+            stepInstruction(a);
+        } else {
+            stepInstruction(b);
+        }
+
+        if (a.ppu().frameCount() != lastFrame) {
+            lastFrame = a.ppu().frameCount();
+            result.frames++;
+            hashDue = true;
+        }
+
+        if (a.machineCycles() != b.machineCycles()) {
+            const uint64_t ahead = a.machineCycles() > b.machineCycles() ? a.machineCycles() : b.machineCycles();
+            if (ahead - lastComparison > MAX_UNALIGNED_CYCLES) {
+                reason = "instruction boundaries stopped lining up";
+                break;
+            }
+
+            continue;
+        }
+
+        if (!sameCPU(a.cpu(), b.cpu())) {
+            reason = "CPU state differs";
+            break;
+        }
+
+        if (writes[0] != writes[1]) {
+            reason = "bus writes differ";
+            break;
+        }
+
+        if (hashDue && a.stateHash() != b.stateHash()) {
+            reason = "machine state differs outside the CPU";
+            break;
+        }
+
+        history[result.comparisons % LOCKSTEP_HISTORY] = a.cpu()._programCounter;
+        result.comparisons++;
+        lastComparison = a.machineCycles();
+        hashDue = false;
+        writes[0].clear();
+        writes[1].clear();
+    }
+
+    result.machineCycles = a.machineCycles();
+
+    if (reason != nullptr) {
+        result.diverged = true;
+
+        std::ostringstream out;
+        out << reason << " after " << result.comparisons << " instructions, at machine cycle "
+            << a.machineCycles() << " (" << first.name << ") / " << b.machineCycles() << " (" << second.name
+            << "), frame " << result.frames << "\n";
+
+        out << "           A  F  B  C  D  E  H  L  SP   PC   IME HALT\n";
+        dumpCPU(out, first.name, a.cpu());
+        dumpCPU(out, second.name, b.cpu());
+
+        out << "  writes since the last match\n";
+        dumpWrites(out, first.name, writes[0]);
+        dumpWrites(out, second.name, writes[1]);
+
+        char entry[8];
+        out << "  last matching boundaries:";
+        const uint64_t count = result.comparisons < LOCKSTEP_HISTORY ? result.comparisons : LOCKSTEP_HISTORY;
+        for (uint64_t i = result.comparisons - count; i < result.comparisons; i++) {
+            snprintf(entry, sizeof(entry), " %04x", history[i % LOCKSTEP_HISTORY]);
+            out << entry;
+        }
+
+        // Where the machines last agreed, which is where a repro should start
+        // looking.
+        const uint16_t pc = count > 0 ? history[(result.comparisons - 1) % LOCKSTEP_HISTORY] : INIT_VECTOR;
+        snprintf(entry, sizeof(entry), "%04x:", pc);
+        out << "\n  code at " << entry;
+        for (int i = 0; i < 4; i++) {
+            snprintf(entry, sizeof(entry), " %02x", a.mmu().peek(pc + i));
+            out << entry;
+        }
+        out << "\n";
+
+        result.report = out.str();
+    }
+
+    a.mmu().writeLog(nullptr);
+    b.mmu().writeLog(nullptr);
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
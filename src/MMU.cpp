@@ -0,0 +1,333 @@
+#include "MMU.h"
+
+#include "IORegisters.h"
+#include "SaveState.h"
+
+#include <cstring>
+
+#ifdef GB_PERF_COUNTERS
+static inline BusRegion busRegion(uint16_t addr) {
+    static const BusRegion pageRegions[16] = {
+        BUS_ROM0, BUS_ROM0, BUS_ROM0, BUS_ROM0,
+        BUS_ROMX, BUS_ROMX, BUS_ROMX, BUS_ROMX,
+        BUS_VRAM, BUS_VRAM, BUS_ERAM, BUS_ERAM,
+        BUS_WRAM, BUS_WRAM, BUS_ECHO, BUS_ECHO,
+    };
+
+    if (addr < 0xfe00) {
+        return pageRegions[addr >> 12];
+    } else if (addr < 0xfea0) {
+        return BUS_OAM;
+    } else if (addr < 0xff00) {
+        return BUS_UNUSABLE;
+    } else if (addr < 0xff80) {
+        return BUS_IO;
+    } else if (addr < 0xffff) {
+        return BUS_HRAM;
+    }
+
+    return BUS_IE;
+}
+#endif
+
+// Where in _workRAM the window at 0xd000 points for an SVBK value. Bank 0
+// can't be switched in; asking for it gets bank 1.
+static inline size_t workRAMPage(uint8_t bank) {
+    return (size_t)(bank == 0 ? 1 : bank) * WRAM_BANK_SIZE;
+}
+
+MMU::MMU(const std::vector<uint8_t>& rom) : _interruptFlags(0x00), _cartridge(rom), _joypad(_interruptFlags), _ppu(_interruptFlags), _serial(_interruptFlags), _writeLog(nullptr) {
+    _ppu.cgb(_cartridge.supportsCGB());
+    reset();
+    resetCounters();
+}
+
+void MMU::reset() {
+    memset(_workRAM, 0, sizeof(_workRAM));
+    memset(_highRAM, 0, sizeof(_highRAM));
+    memset(_io, 0xff, sizeof(_io));
+    _interruptFlags = 0x00;
+    _interruptEnable = 0x00;
+
+    _doubleSpeed = false;
+    _speedSwitchArmed = false;
+    _bootROMMapped = !_bootROM.empty();
+    _workRAMBank = 0;
+    _workRAMPages[0] = 0;
+    _workRAMPages[1] = workRAMPage(_workRAMBank);
+    _vramBankOffset = 0;
+
+    _cartridge.reset();
+    _joypad.reset();
+    _ppu.reset();
+    _serial.reset();
+
+    _cyclesAhead = 0;
+
+    markAllDirty();
+}
+
+void MMU::saveState(StateWriter& state) const {
+    state.bytes(_workRAM, sizeof(_workRAM));
+    state.bytes(_highRAM, sizeof(_highRAM));
+    state.bytes(_io, sizeof(_io));
+    state.u8(_interruptFlags);
+    state.u8(_interruptEnable);
+
+    state.flag(_doubleSpeed);
+    state.flag(_speedSwitchArmed);
+    state.flag(_bootROMMapped);
+    state.u8(_workRAMBank);
+    state.u8((uint8_t)(_vramBankOffset / VRAM_SIZE));
+
+    state.u8(_cyclesAhead);
+
+    _cartridge.saveState(state);
+    _joypad.saveState(state);
+    _ppu.saveState(state);
+    _serial.saveState(state);
+}
+
+void MMU::loadState(StateReader& state) {
+    state.bytes(_workRAM, sizeof(_workRAM));
+    state.bytes(_highRAM, sizeof(_highRAM));
+    state.bytes(_io, sizeof(_io));
+    _interruptFlags = state.u8();
+    _interruptEnable = state.u8();
+
+    _doubleSpeed = state.flag();
+    _speedSwitchArmed = state.flag();
+    _bootROMMapped = state.flag() && !_bootROM.empty();
+    _workRAMPages[0] = 0;
+    _workRAMBank = state.u8() & 0x07;
+    _workRAMPages[1] = workRAMPage(_workRAMBank);
+    _vramBankOffset = (state.u8() % VRAM_BANK_COUNT) * VRAM_SIZE;
+
+    _cyclesAhead = state.u8();
+
+    _cartridge.loadState(state);
+    _joypad.loadState(state);
+    _ppu.loadState(state);
+    _serial.loadState(state);
+
+    markAllDirty();
+}
+
+void MMU::markAllDirty() {
+    memset(_dirtyPages, 1, sizeof(_dirtyPages));
+}
+
+BusCounters MMU::counters() const {
+#ifdef GB_PERF_COUNTERS
+    return _counters;
+#else
+    BusCounters counters;
+    memset(&counters, 0, sizeof(counters));
+    return counters;
+#endif
+}
+
+void MMU::resetCounters() {
+#ifdef GB_PERF_COUNTERS
+    memset(&_counters, 0, sizeof(_counters));
+#endif
+}
+
+uint8_t MMU::read(uint16_t addr) {
+    PERF_COUNT(_counters.reads[busRegion(addr)]);
+    return MMU::peek(addr);
+}
+
+uint8_t MMU::peek(uint16_t addr) {
+    if (addr < 0x8000) {
+        if (_bootROMMapped && addr < _bootROM.size() && (addr & 0xff00) != 0x0100) {
+            return _bootROM[addr];
+        }
+
+        return _cartridge.readROM(addr);
+    } else if (addr < 0xa000) {
+        return _ppu.vramAccessible() ? _ppu._vram[_vramBankOffset + (addr - 0x8000)] : 0xff;
+    } else if (addr < 0xc000) {
+        return _cartridge.readRAM(addr);
+    } else if (addr < 0xfe00) {
+        // 0xe000-0xfdff echoes work RAM.
+        return _workRAM[_workRAMPages[(addr >> 12) & 0x01] + (addr & (WRAM_BANK_SIZE - 1))];
+    } else if (addr < 0xfea0) {
+        return _ppu.oamAccessible() ? _ppu._oam[addr - 0xfe00] : 0xff;
+    } else if (addr < 0xff00) {
+        return 0xff;
+    } else if (addr < 0xff80) {
+        return readIO(addr);
+    } else if (addr < 0xffff) {
+        return _highRAM[addr - 0xff80];
+    }
+
+    return _interruptEnable;
+}
+
+void MMU::write(uint16_t addr, uint8_t value) {
+    PERF_COUNT(_counters.writes[busRegion(addr)]);
+
+    if (_writeLog != nullptr) {
+        _writeLog->push_back({ addr, value });
+    }
+
+    if (addr < 0x8000) {
+#ifdef GB_PERF_COUNTERS
+        const auto bank = _cartridge.romBank();
+        _cartridge.writeControl(addr, value);
+        if (_cartridge.romBank() != bank) {
+            _counters.bankSwitches++;
+        }
+#else
+        _cartridge.writeControl(addr, value);
+#endif
+    } else if (addr < 0xa000) {
+        if (_ppu.vramAccessible()) {
+            const size_t offset = _vramBankOffset + (addr - 0x8000);
+            _ppu._vram[offset] = value;
+            _dirtyPages[VRAM_PAGE_BASE + (offset >> DIRTY_PAGE_SHIFT)] = 1;
+        }
+    } else if (addr < 0xc000) {
+        _cartridge.writeRAM(addr, value);
+    } else if (addr < 0xfe00) {
+        const size_t offset = _workRAMPages[(addr >> 12) & 0x01] + (addr & (WRAM_BANK_SIZE - 1));
+        _workRAM[offset] = value;
+        _dirtyPages[WRAM_PAGE_BASE + (offset >> DIRTY_PAGE_SHIFT)] = 1;
+    } else if (addr < 0xfea0) {
+        if (_ppu.oamAccessible()) {
+            _ppu._oam[addr - 0xfe00] = value;
+            _dirtyPages[OAM_PAGE] = 1;
+        }
+    } else if (addr < 0xff00) {
+        return;
+    } else if (addr < 0xff80) {
+        writeIO(addr, value);
+    } else if (addr < 0xffff) {
+        _highRAM[addr - 0xff80] = value;
+        _dirtyPages[HRAM_PAGE] = 1;
+    } else {
+        _interruptEnable = value;
+    }
+}
+
+uint8_t MMU::readIO(uint16_t addr) {
+    switch(addr) {
+        case IO_P1:
+            return _joypad.read();
+        case IO_SB:
+        case IO_SC:
+            return _serial.read(addr);
+        case IO_IF:
+            return 0xe0 | _interruptFlags;
+        case IO_LCDC:
+        case IO_STAT:
+        case IO_SCY:
+        case IO_SCX:
+        case IO_LY:
+        case IO_LYC:
+        case IO_BGP:
+        case IO_OBP0:
+        case IO_OBP1:
+        case IO_WY:
+        case IO_WX:
+            return _ppu.readRegister(addr);
+    }
+
+    // On a DMG these fall through to the unclaimed backing store.
+    if (cgb()) {
+        switch(addr) {
+            case IO_KEY1:
+                return (_doubleSpeed ? 0x80 : 0x00) | 0x7e | (_speedSwitchArmed ? 0x01 : 0x00);
+            case IO_VBK:
+                return 0xfe | (uint8_t)(_vramBankOffset / VRAM_SIZE);
+            case IO_SVBK:
+                return 0xf8 | _workRAMBank;
+            case IO_BCPS:
+            case IO_BCPD:
+            case IO_OCPS:
+            case IO_OCPD:
+                return _ppu.readRegister(addr);
+        }
+    }
+
+    return _io[addr - 0xff00];
+}
+
+void MMU::writeIO(uint16_t addr, uint8_t value) {
+    switch(addr) {
+        case IO_P1:
+            _joypad.write(value);
+            return;
+        case IO_SB:
+        case IO_SC:
+            _serial.write(addr, value);
+            return;
+        case IO_IF:
+            _interruptFlags = value & 0x1f;
+            return;
+        case IO_DMA: {
+            // IMPROVE: Real OAM DMA takes 160 machine cycles and locks the CPU
+            //          out of everything but HRAM while it runs.
+            const uint16_t source = (uint16_t)value << 8;
+            for (uint16_t i = 0; i < OAM_SIZE; i++) {
+                _ppu._oam[i] = source < 0xfe00 ? read(source + i) : 0xff;
+            }
+            _dirtyPages[OAM_PAGE] = 1;
+            _io[addr - 0xff00] = value;
+            return;
+        }
+        case IO_LCDC:
+        case IO_STAT:
+        case IO_SCY:
+        case IO_SCX:
+        case IO_LY:
+        case IO_LYC:
+        case IO_BGP:
+        case IO_OBP0:
+        case IO_OBP1:
+        case IO_WY:
+        case IO_WX:
+            _ppu.writeRegister(addr, value);
+            return;
+        case IO_BOOT:
+            _bootROMMapped = _bootROMMapped && (value & 0x01) == 0;
+            return;
+    }
+
+    if (cgb()) {
+        switch(addr) {
+            case IO_KEY1:
+                _speedSwitchArmed = (value & 0x01) != 0;
+                return;
+            case IO_VBK:
+                _vramBankOffset = (size_t)(value & 0x01) * VRAM_SIZE;
+                return;
+            case IO_SVBK:
+                // Reads back as written, even 0.
+                _workRAMBank = value & 0x07;
+                _workRAMPages[1] = workRAMPage(_workRAMBank);
+                return;
+            case IO_BCPS:
+            case IO_BCPD:
+            case IO_OCPS:
+            case IO_OCPD:
+                _ppu.writeRegister(addr, value);
+                return;
+        }
+    }
+
+    _io[addr - 0xff00] = value;
+}
+
+bool MMU::stop() {
+    if (!cgb() || !_speedSwitchArmed) {
+        return false;
+    }
+
+    // IMPROVE: The real switch stalls the CPU for 2050 machine cycles while
+    //          the clock settles.
+    _doubleSpeed = !_doubleSpeed;
+    _speedSwitchArmed = false;
+    return true;
+}
@@ -0,0 +1,204 @@
+#include "Movie.h"
+
+#include <cstring>
+
+static const char g_magic[4] = { 'G', 'B', 'M', 'V' };
+
+static void writeLE(std::ostream& stream, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        stream.put((char)(value & 0xff));
+        value >>= 8;
+    }
+}
+
+static bool readLE(std::istream& stream, uint64_t& value, int bytes) {
+    value = 0;
+    for (int i = 0; i < bytes; i++) {
+        const int byte = stream.get();
+        if (byte == std::char_traits<char>::eof()) {
+            return false;
+        }
+
+        value |= (uint64_t)(uint8_t)byte << (8 * i);
+    }
+
+    return true;
+}
+
+static void writeVarint(std::ostream& stream, uint32_t value) {
+    while (value >= 0x80) {
+        stream.put((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+
+    stream.put((char)value);
+}
+
+static bool readVarint(std::istream& stream, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        const int byte = stream.get();
+        if (byte == std::char_traits<char>::eof()) {
+            return false;
+        }
+
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+Movie::Movie() : Movie(0, 0) {
+}
+
+Movie::Movie(uint64_t romHash, uint64_t startStateHash, uint16_t checkpointInterval) :
+    _romHash(romHash),
+    _startStateHash(startStateHash),
+    _checkpointInterval(checkpointInterval != 0 ? checkpointInterval : 1),
+    _frameCount(0) {
+}
+
+void Movie::append(uint8_t buttons) {
+    if (_runs.empty() || _runs.back().buttons != buttons) {
+        Run run = { buttons, 0 };
+        _runs.push_back(run);
+    }
+
+    _runs.back().length++;
+    _frameCount++;
+}
+
+bool Movie::save(std::ostream& stream) const {
+    stream.write(g_magic, sizeof(g_magic));
+    writeLE(stream, MOVIE_VERSION, 2);
+    writeLE(stream, _checkpointInterval, 2);
+    writeLE(stream, _romHash, 8);
+    writeLE(stream, _startStateHash, 8);
+    writeLE(stream, _frameCount, 4);
+
+    writeLE(stream, _runs.size(), 4);
+    for (const auto& run : _runs) {
+        stream.put((char)run.buttons);
+        writeVarint(stream, run.length);
+    }
+
+    writeLE(stream, _checkpoints.size(), 4);
+    for (const auto hash : _checkpoints) {
+        writeLE(stream, hash, 8);
+    }
+
+    return stream.good();
+}
+
+bool Movie::load(std::istream& stream) {
+    char magic[sizeof(g_magic)];
+    if (!stream.read(magic, sizeof(magic)) || memcmp(magic, g_magic, sizeof(magic)) != 0) {
+        return false;
+    }
+
+    uint64_t version, interval, romHash, startHash, frameCount, runCount;
+    if (!readLE(stream, version, 2) || version != MOVIE_VERSION ||
+        !readLE(stream, interval, 2) || interval == 0 ||
+        !readLE(stream, romHash, 8) ||
+        !readLE(stream, startHash, 8) ||
+        !readLE(stream, frameCount, 4) ||
+        !readLE(stream, runCount, 4)) {
+        return false;
+    }
+
+    std::vector<Run> runs;
+    uint64_t runFrames = 0;
+    for (uint64_t i = 0; i < runCount; i++) {
+        const int buttons = stream.get();
+        Run run = { (uint8_t)buttons, 0 };
+        if (buttons == std::char_traits<char>::eof() || !readVarint(stream, run.length)) {
+            return false;
+        }
+
+        runFrames += run.length;
+        runs.push_back(run);
+    }
+
+    uint64_t checkpointCount;
+    if (runFrames != frameCount || !readLE(stream, checkpointCount, 4)) {
+        return false;
+    }
+
+    std::vector<uint64_t> checkpoints;
+    for (uint64_t i = 0; i < checkpointCount; i++) {
+        uint64_t hash;
+        if (!readLE(stream, hash, 8)) {
+            return false;
+        }
+
+        checkpoints.push_back(hash);
+    }
+
+    _romHash = romHash;
+    _startStateHash = startHash;
+    _checkpointInterval = (uint16_t)interval;
+    _frameCount = (uint32_t)frameCount;
+    _runs.swap(runs);
+    _checkpoints.swap(checkpoints);
+
+    return true;
+}
+
+void recordFrame(GameBoy& gameBoy, Movie& movie, uint8_t buttons) {
+    gameBoy.mmu().joypad().buttons(buttons);
+    gameBoy.runFrame();
+    movie.append(buttons);
+
+    if (movie.frameCount() % movie._checkpointInterval == 0) {
+        movie.checkpoint(gameBoy.stateHash());
+    }
+}
+
+PlaybackResult playMovie(
+    GameBoy& gameBoy,
+    const Movie& movie,
+    const std::function<void(uint32_t)>& onFrame
+) {
+    PlaybackResult result;
+    result.romMatches = gameBoy.romHash() == movie._romHash;
+    result.startMatches = gameBoy.stateHash() == movie._startStateHash;
+    result.synced = result.romMatches && result.startMatches;
+    result.framesPlayed = 0;
+    result.lastGoodFrame = 0;
+    result.firstBadFrame = 0;
+
+    if (!result.synced) {
+        return result;
+    }
+
+    size_t checkpoint = 0;
+    for (const auto& run : movie._runs) {
+        for (uint32_t i = 0; i < run.length; i++) {
+            gameBoy.mmu().joypad().buttons(run.buttons);
+            gameBoy.runFrame();
+            result.framesPlayed++;
+
+            if (onFrame) {
+                onFrame(result.framesPlayed);
+            }
+
+            if (result.framesPlayed % movie._checkpointInterval != 0 ||
+                checkpoint >= movie._checkpoints.size()) {
+                continue;
+            }
+
+            if (gameBoy.stateHash() != movie._checkpoints[checkpoint++]) {
+                result.synced = false;
+                result.firstBadFrame = result.framesPlayed;
+                return result;
+            }
+
+            result.lastGoodFrame = result.framesPlayed;
+        }
+    }
+
+    return result;
+}
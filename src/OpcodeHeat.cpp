@@ -0,0 +1,223 @@
+#include "OpcodeHeat.h"
+
+#include "Opcodes.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+
+const char* opcodeHandler(uint8_t opcode) {
+    // The register-to-register block, bar HALT where LD (HL),(HL) would be.
+    if (opcode >= 0x40 && opcode < 0x80 && opcode != Opcode::HALT) {
+        if ((opcode & 0xf8) == 0x70) {
+            return "I_StoreToAddress";
+        }
+
+        return (opcode & 0x07) == 0x06 ? "I_LoadAddressIntoRegister" : "I_TransferRegister";
+    }
+
+    // The ALU block, and the same operations on an immediate.
+    if ((opcode >= 0x80 && opcode < 0xc0) || (opcode >= 0xc0 && (opcode & 0x07) == 0x06)) {
+        switch((opcode >> 3) & 0x07) {
+            case 0:
+            case 1: return "I_8BitAdd";
+            case 2:
+            case 3: return "I_8BitSubtract";
+            case 4: return "I_And";
+            case 5: return "I_Xor";
+            case 6: return "I_Or";
+            default: return "I_Compare";
+        }
+    }
+
+    if (opcode >= 0xc0 && (opcode & 0x07) == 0x07) {
+        return "I_RST";
+    }
+
+    if (opcode < 0x40) {
+        switch(opcode & 0x0f) {
+            case 0x01: return "I_LoadImmediate16";
+            case 0x03: return "I_16BitIncrement";
+            case 0x09: return "I_16BitAdd";
+            case 0x0b: return "I_16BitDecrement";
+            case 0x04:
+            case 0x0c: return "I_Increment";
+            case 0x05:
+            case 0x0d: return "I_Decrement";
+            case 0x06:
+            case 0x0e: return opcode == Opcode::LD_aHL_n ? "I_StoreToAddress" : "I_LoadImmediate";
+            case 0x02: return "I_StoreToAddress";
+            case 0x0a: return "I_LoadAddressIntoRegister";
+            default: break;
+        }
+    }
+
+    switch(opcode) {
+        case Opcode::RLCA:
+        case Opcode::RLA:
+        case Opcode::RRCA:
+        case Opcode::RRA: return "I_RotateA";
+        case Opcode::LD_aNN_SP: return "I_StoreStackPointer";
+        case Opcode::STOP: return "I_Stop";
+        case Opcode::JR_N: return "I_UnconditionalRelativeJump";
+        case Opcode::JR_NZ_N:
+        case Opcode::JR_Z_N:
+        case Opcode::JR_NC_N:
+        case Opcode::JR_C_N: return "I_ConditionalRelativeJump";
+        case Opcode::DAA: return "I_DecimalAdjust";
+        case Opcode::CPL: return "I_ComplementA";
+        case Opcode::SCF: return "I_SetCarry";
+        case Opcode::CCF: return "I_ComplementCarry";
+        case Opcode::HALT: return "I_Halt";
+        case Opcode::RET_NZ:
+        case Opcode::RET_Z:
+        case Opcode::RET_NC:
+        case Opcode::RET_C: return "I_ConditionalReturn";
+        case Opcode::RET:
+        case Opcode::RETI: return "I_Return";
+        case Opcode::POP_BC:
+        case Opcode::POP_DE:
+        case Opcode::POP_HL:
+        case Opcode::POP_AF: return "I_PopRegister";
+        case Opcode::PUSH_BC:
+        case Opcode::PUSH_DE:
+        case Opcode::PUSH_HL:
+        case Opcode::PUSH_AF: return "I_PushRegister";
+        case Opcode::JP_NZ_NN:
+        case Opcode::JP_Z_NN:
+        case Opcode::JP_NC_NN:
+        case Opcode::JP_C_NN: return "I_ConditionalJump";
+        case Opcode::JP_NN: return "I_UnconditionalJump";
+        case Opcode::JP_HL: return "I_JumpToHL";
+        case Opcode::CALL_NZ_NN:
+        case Opcode::CALL_Z_NN:
+        case Opcode::CALL_NC_NN:
+        case Opcode::CALL_C_NN: return "I_ConditionalCall";
+        case Opcode::CALL_NN: return "I_Call";
+        case Opcode::PREFIX_CB: return "I_ExecCBGroup";
+        case Opcode::LDH_afN_A:
+        case Opcode::LD_afC_A:
+        case Opcode::LD_aNN_A: return "I_StoreToAddress";
+        case Opcode::LDH_A_afN:
+        case Opcode::LD_A_afC:
+        case Opcode::LD_A_aNN: return "I_LoadAddressIntoRegister";
+        case Opcode::ADD_SP_N: return "I_AddToSP";
+        case Opcode::LD_HL_aSPN: return "I_LoadHLWithSPN";
+        case Opcode::LD_HL_SP: return "I_TransferRegister";
+        case Opcode::DI:
+        case Opcode::EI: return "I_SetInterruptEnable";
+        default: return nullptr;
+    }
+}
+
+std::vector<const char*> opcodeHandlers() {
+    std::vector<const char*> handlers;
+    for (int opcode = 0; opcode < 256; opcode++) {
+        const char* handler = opcodeHandler((uint8_t)opcode);
+        if (handler && std::find_if(handlers.begin(), handlers.end(),
+                [&](const char* seen) { return strcmp(seen, handler) == 0; }) == handlers.end()) {
+            handlers.push_back(handler);
+        }
+    }
+
+    return handlers;
+}
+
+OpcodeProfile::OpcodeProfile() {
+    memset(_counts, 0, sizeof(_counts));
+}
+
+void OpcodeProfile::run(GameBoy& gameBoy, uint32_t frames) {
+    // Every instruction boundary has to be seen, so nothing is fused.
+    const bool fusion = gameBoy.cpu().fusion();
+    gameBoy.cpu().fusion(false);
+
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        const auto current = gameBoy.ppu().frameCount();
+        while (gameBoy.ppu().frameCount() == current) {
+            gameBoy.step();
+
+            if (gameBoy.cpu().atInstructionBoundary()) {
+                _counts[gameBoy.mmu().peek(gameBoy.cpu()._programCounter)]++;
+            }
+        }
+    }
+
+    gameBoy.cpu().fusion(fusion);
+}
+
+uint64_t OpcodeProfile::total() const {
+    uint64_t total = 0;
+    for (int opcode = 0; opcode < 256; opcode++) {
+        total += _counts[opcode];
+    }
+
+    return total;
+}
+
+static std::vector<uint64_t> handlerCounts(const OpcodeProfile& profile, const std::vector<const char*>& handlers) {
+    std::vector<uint64_t> counts(handlers.size());
+    for (int opcode = 0; opcode < 256; opcode++) {
+        const char* handler = opcodeHandler((uint8_t)opcode);
+        for (size_t i = 0; handler && i < handlers.size(); i++) {
+            if (strcmp(handlers[i], handler) == 0) {
+                counts[i] += profile.count((uint8_t)opcode);
+                break;
+            }
+        }
+    }
+
+    return counts;
+}
+
+std::vector<HandlerHeat> OpcodeProfile::classify() const {
+    const auto handlers = opcodeHandlers();
+    const auto counts = handlerCounts(*this, handlers);
+    const double all = (double)total();
+
+    std::vector<size_t> order(handlers.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return counts[a] > counts[b]; });
+
+    std::vector<HandlerHeat> heat(handlers.size(), HEAT_NEUTRAL);
+    uint64_t covered = 0;
+    for (const auto i : order) {
+        if (all == 0 || counts[i] < all * HEAT_COLD_SHARE) {
+            heat[i] = HEAT_COLD;
+        } else if (covered < all * HEAT_HOT_COVERAGE) {
+            heat[i] = HEAT_HOT;
+        }
+
+        covered += counts[i];
+    }
+
+    return heat;
+}
+
+bool OpcodeProfile::writeLayout(std::ostream& out) const {
+    static const char* const names[] = { "cold", "", "hot" };
+    static const char* const attributes[] = { "OPCODE_COLD", "", "OPCODE_HOT" };
+
+    const auto handlers = opcodeHandlers();
+    const auto counts = handlerCounts(*this, handlers);
+    const auto heat = classify();
+    const uint64_t all = total();
+
+    out << "// Opcode layout written by opcodeheat, from " << all << " instructions.\n"
+        << "// Build with -DOPCODE_LAYOUT=<this file>. Hot handlers ran "
+        << HEAT_HOT_COVERAGE * 100 << "% of them; cold ones under "
+        << HEAT_COLD_SHARE * 100 << "% each.\n\n";
+
+    for (size_t i = 0; i < handlers.size(); i++) {
+        const double share = all > 0 ? 100.0 * counts[i] / all : 0;
+        out << "#define LAYOUT_" << std::left << std::setw(30) << handlers[i]
+            << std::setw(12) << attributes[heat[i]] << "// "
+            << std::right << std::fixed << std::setprecision(4) << std::setw(8) << share << "% "
+            << names[heat[i]] << "\n";
+    }
+
+    return (bool)out;
+}
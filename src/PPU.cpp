@@ -0,0 +1,615 @@
+#include "PPU.h"
+
+#include "IORegisters.h"
+#include "SaveState.h"
+
+#include <cstring>
+
+#define LCDC_BG_ENABLE      0x01
+#define LCDC_OBJ_ENABLE     0x02
+#define LCDC_OBJ_TALL       0x04
+#define LCDC_BG_MAP_HIGH    0x08
+#define LCDC_TILE_DATA_LOW  0x10
+#define LCDC_WINDOW_ENABLE  0x20
+#define LCDC_WINDOW_MAP_HIGH 0x40
+#define LCDC_LCD_ENABLE     0x80
+
+#define STAT_HBLANK_SELECT  0x08
+#define STAT_VBLANK_SELECT  0x10
+#define STAT_OAM_SELECT     0x20
+#define STAT_LYC_SELECT     0x40
+
+#define MAX_SPRITES_PER_LINE 10
+
+#define PALETTE_INDEX_MASK       0x3f
+#define PALETTE_AUTO_INCREMENT   0x80
+
+#define CGB_ATTR_PALETTE    0x07
+#define CGB_ATTR_BANK       0x08
+#define ATTR_X_FLIP         0x20
+#define ATTR_Y_FLIP         0x40
+#define ATTR_PRIORITY       0x80
+
+#define CGB_COLOR_COUNT 0x8000
+
+static const uint32_t g_dmgShades[4] = {
+    0xffffffff,
+    0xffaaaaaa,
+    0xff555555,
+    0xff000000,
+};
+
+// Every RGB555 color palette RAM can hold, as a framebuffer color. This is
+// the one place a color correction curve would go.
+struct CGBColorTable {
+    uint32_t colors[CGB_COLOR_COUNT];
+
+    CGBColorTable() {
+        for (uint32_t color = 0; color < CGB_COLOR_COUNT; color++) {
+            const uint32_t red = color & 0x1f;
+            const uint32_t green = (color >> 5) & 0x1f;
+            const uint32_t blue = (color >> 10) & 0x1f;
+
+            colors[color] = 0xff000000 |
+                (((red << 3) | (red >> 2)) << 16) |
+                (((green << 3) | (green >> 2)) << 8) |
+                ((blue << 3) | (blue >> 2));
+        }
+    }
+};
+
+static const uint32_t* cgbColors() {
+    static const CGBColorTable table;
+    return table.colors;
+}
+
+PPU::PPU(uint8_t& interruptFlags) :
+    _interruptFlags(interruptFlags),
+    _cgb(false),
+    _renderInterval(1),
+    _framebuffer(_ownFramebuffer) {
+    reset();
+}
+
+void PPU::reset() {
+    memset(_vram, 0, sizeof(_vram));
+    memset(_oam, 0, sizeof(_oam));
+    memset(_bgPaletteRAM, 0xff, sizeof(_bgPaletteRAM));
+    memset(_objPaletteRAM, 0xff, sizeof(_objPaletteRAM));
+    memset(_framebuffer, 0xff, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
+
+    _lcdc = 0x00;
+    _stat = 0x00;
+    _scy = 0x00;
+    _scx = 0x00;
+    _ly = 0x00;
+    _lyc = 0x00;
+    _bgp = 0xfc;
+    _obp0 = 0xff;
+    _obp1 = 0xff;
+    _wy = 0x00;
+    _wx = 0x00;
+    _bcps = 0x00;
+    _ocps = 0x00;
+
+    resolvePalettes();
+
+    _mode = HBLANK;
+    _dot = 0;
+    _statLine = false;
+    _frameCount = 0;
+    _frameRendered = false;
+
+    startFrame();
+}
+
+void PPU::saveState(StateWriter& state) const {
+    state.bytes(_vram, sizeof(_vram));
+    state.bytes(_oam, sizeof(_oam));
+    state.bytes(_bgPaletteRAM, sizeof(_bgPaletteRAM));
+    state.bytes(_objPaletteRAM, sizeof(_objPaletteRAM));
+
+    const uint8_t registers[] = {
+        _lcdc, _stat, _scy, _scx, _ly, _lyc, _bgp, _obp0, _obp1, _wy, _wx, _bcps, _ocps,
+    };
+    state.bytes(registers, sizeof(registers));
+
+    state.u8(_mode);
+    state.u32(_dot);
+    state.flag(_statLine);
+    state.flag(_renderFrame);
+    state.flag(_frameRendered);
+    state.u64(_frameCount);
+    state.u8(_windowLine);
+
+    // Lines already composed this frame aren't composed again.
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+        state.u32(_framebuffer[i]);
+    }
+}
+
+void PPU::loadState(StateReader& state) {
+    state.bytes(_vram, sizeof(_vram));
+    state.bytes(_oam, sizeof(_oam));
+    state.bytes(_bgPaletteRAM, sizeof(_bgPaletteRAM));
+    state.bytes(_objPaletteRAM, sizeof(_objPaletteRAM));
+
+    uint8_t registers[13];
+    state.bytes(registers, sizeof(registers));
+    _lcdc = registers[0];
+    _stat = registers[1];
+    _scy = registers[2];
+    _scx = registers[3];
+    _ly = registers[4];
+    _lyc = registers[5];
+    _bgp = registers[6];
+    _obp0 = registers[7];
+    _obp1 = registers[8];
+    _wy = registers[9];
+    _wx = registers[10];
+    _bcps = registers[11];
+    _ocps = registers[12];
+
+    _mode = (Mode)(state.u8() & 0x03);
+    _dot = state.u32();
+    _statLine = state.flag();
+    _renderFrame = state.flag();
+    _frameRendered = state.flag();
+    _frameCount = state.u64();
+    _windowLine = state.u8();
+
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+        _framebuffer[i] = state.u32();
+    }
+
+    resolvePalettes();
+}
+
+void PPU::clock() {
+    if ((_lcdc & LCDC_LCD_ENABLE) == 0) {
+        // Keep frames ticking so that anything paced by them still runs.
+        if (++_dot >= DOTS_PER_FRAME) {
+            _dot = 0;
+            finishFrame();
+            startFrame();
+        }
+
+        return;
+    }
+
+    _dot++;
+
+    if (_ly < SCREEN_HEIGHT) {
+        if (_dot == OAM_SCAN_DOTS) {
+            setMode(PIXEL_TRANSFER);
+        } else if (_dot == OAM_SCAN_DOTS + PIXEL_TRANSFER_DOTS) {
+            // Only the pixels are skipped; the mode change is unconditional.
+            if (_renderFrame) {
+                if (_cgb) {
+                    renderCGBScanline();
+                } else {
+                    renderScanline();
+                }
+            }
+
+            setMode(HBLANK);
+        }
+    }
+
+    if (_dot < DOTS_PER_LINE) {
+        return;
+    }
+
+    _dot = 0;
+    _ly++;
+
+    if (_ly == SCREEN_HEIGHT) {
+        _interruptFlags |= INT_VBLANK;
+        setMode(VBLANK);
+        finishFrame();
+    } else if (_ly == LINES_PER_FRAME) {
+        _ly = 0;
+        startFrame();
+        setMode(OAM_SCAN);
+    } else if (_ly < SCREEN_HEIGHT) {
+        setMode(OAM_SCAN);
+    } else {
+        updateStatLine();
+    }
+}
+
+uint32_t PPU::dotsUntilEvent() const {
+    // clock() acts on the dot it counts up to, so one less than the distance.
+    if ((_lcdc & LCDC_LCD_ENABLE) == 0) {
+        return DOTS_PER_FRAME - _dot - 1;
+    }
+
+    if (_ly < SCREEN_HEIGHT) {
+        if (_dot < OAM_SCAN_DOTS) {
+            return OAM_SCAN_DOTS - _dot - 1;
+        } else if (_dot < OAM_SCAN_DOTS + PIXEL_TRANSFER_DOTS) {
+            return OAM_SCAN_DOTS + PIXEL_TRANSFER_DOTS - _dot - 1;
+        }
+    }
+
+    return DOTS_PER_LINE - _dot - 1;
+}
+
+uint8_t PPU::readRegister(uint16_t addr) const {
+    switch(addr) {
+        case IO_LCDC: return _lcdc;
+        case IO_STAT:
+            return 0x80 | _stat | (_ly == _lyc ? 0x04 : 0x00) | (uint8_t)_mode;
+        case IO_SCY: return _scy;
+        case IO_SCX: return _scx;
+        case IO_LY: return _ly;
+        case IO_LYC: return _lyc;
+        case IO_BGP: return _bgp;
+        case IO_OBP0: return _obp0;
+        case IO_OBP1: return _obp1;
+        case IO_WY: return _wy;
+        case IO_WX: return _wx;
+        case IO_BCPS: return 0x40 | _bcps;
+        case IO_BCPD:
+            return vramAccessible() ? _bgPaletteRAM[_bcps & PALETTE_INDEX_MASK] : 0xff;
+        case IO_OCPS: return 0x40 | _ocps;
+        case IO_OCPD:
+            return vramAccessible() ? _objPaletteRAM[_ocps & PALETTE_INDEX_MASK] : 0xff;
+    }
+
+    return 0xff;
+}
+
+void PPU::writeRegister(uint16_t addr, uint8_t value) {
+    switch(addr) {
+        case IO_LCDC: {
+            const bool wasOn = (_lcdc & LCDC_LCD_ENABLE) != 0;
+            _lcdc = value;
+
+            if (wasOn && (value & LCDC_LCD_ENABLE) == 0) {
+                _ly = 0;
+                _dot = 0;
+                _mode = HBLANK;
+                _statLine = false;
+            } else if (!wasOn && (value & LCDC_LCD_ENABLE) != 0) {
+                _ly = 0;
+                _dot = 0;
+                startFrame();
+                setMode(OAM_SCAN);
+            }
+            break;
+        }
+        case IO_STAT:
+            _stat = value & 0x78;
+            updateStatLine();
+            break;
+        case IO_SCY: _scy = value; break;
+        case IO_SCX: _scx = value; break;
+        case IO_LYC:
+            _lyc = value;
+            updateStatLine();
+            break;
+        case IO_BGP: _bgp = value; break;
+        case IO_OBP0: _obp0 = value; break;
+        case IO_OBP1: _obp1 = value; break;
+        case IO_WY: _wy = value; break;
+        case IO_WX: _wx = value; break;
+        case IO_BCPS: _bcps = value & 0xbf; break;
+        case IO_BCPD: writePaletteData(_bgPaletteRAM, _bcps, _bgColors, value); break;
+        case IO_OCPS: _ocps = value & 0xbf; break;
+        case IO_OCPD: writePaletteData(_objPaletteRAM, _ocps, _objColors, value); break;
+    }
+}
+
+void PPU::writePaletteData(uint8_t* paletteRAM, uint8_t& index, uint32_t (*colors)[4], uint8_t value) {
+    const uint8_t addr = index & PALETTE_INDEX_MASK;
+
+    // Palette RAM is locked along with VRAM, but the index still advances.
+    if (vramAccessible()) {
+        paletteRAM[addr] = value;
+
+        const uint8_t entry = addr >> 1;
+        const uint16_t color = (uint16_t)(paletteRAM[entry * 2] | (paletteRAM[entry * 2 + 1] << 8));
+        colors[entry >> 2][entry & 0x03] = cgbColors()[color & (CGB_COLOR_COUNT - 1)];
+    }
+
+    if (index & PALETTE_AUTO_INCREMENT) {
+        index = PALETTE_AUTO_INCREMENT | ((addr + 1) & PALETTE_INDEX_MASK);
+    }
+}
+
+void PPU::resolvePalettes() {
+    const uint32_t* table = cgbColors();
+
+    for (int entry = 0; entry < PALETTE_RAM_SIZE / 2; entry++) {
+        const uint16_t bg = (uint16_t)(_bgPaletteRAM[entry * 2] | (_bgPaletteRAM[entry * 2 + 1] << 8));
+        const uint16_t obj = (uint16_t)(_objPaletteRAM[entry * 2] | (_objPaletteRAM[entry * 2 + 1] << 8));
+
+        _bgColors[entry >> 2][entry & 0x03] = table[bg & (CGB_COLOR_COUNT - 1)];
+        _objColors[entry >> 2][entry & 0x03] = table[obj & (CGB_COLOR_COUNT - 1)];
+    }
+}
+
+void PPU::setMode(Mode mode) {
+    _mode = mode;
+    updateStatLine();
+}
+
+void PPU::updateStatLine() {
+    if ((_lcdc & LCDC_LCD_ENABLE) == 0) {
+        return;
+    }
+
+    // The STAT interrupt fires on the rising edge of the OR of all enabled
+    // sources, so overlapping sources don't request it twice.
+    const bool line =
+        ((_stat & STAT_LYC_SELECT) && _ly == _lyc) ||
+        ((_stat & STAT_HBLANK_SELECT) && _mode == HBLANK) ||
+        ((_stat & STAT_VBLANK_SELECT) && _mode == VBLANK) ||
+        ((_stat & STAT_OAM_SELECT) && _mode == OAM_SCAN);
+
+    if (line && !_statLine) {
+        _interruptFlags |= INT_LCD_STAT;
+    }
+
+    _statLine = line;
+}
+
+void PPU::frameSink(FrameSink::Ptr sink) {
+    if (sink == nullptr && _frameSink != nullptr) {
+        memcpy(_ownFramebuffer, _framebuffer, sizeof(_ownFramebuffer));
+        _framebuffer = _ownFramebuffer;
+    }
+
+    _frameSink = sink;
+}
+
+void PPU::startFrame() {
+    _renderFrame = _renderInterval != 0 && (_frameCount % _renderInterval) == 0;
+    _windowLine = 0;
+
+    // Frames that won't be composed leave the last one where it is.
+    if (_frameSink != nullptr && _renderFrame && (_lcdc & LCDC_LCD_ENABLE) != 0) {
+        _framebuffer = _frameSink->beginFrame();
+    }
+}
+
+void PPU::finishFrame() {
+    _frameRendered = _renderFrame && (_lcdc & LCDC_LCD_ENABLE) != 0;
+
+    // A sink attached part way through a frame gets the next one.
+    if (_frameSink != nullptr && _frameRendered && _framebuffer != _ownFramebuffer) {
+        _frameSink->publishFrame(_frameCount);
+    }
+
+    _frameCount++;
+}
+
+int PPU::selectSprites(uint8_t* sprites, int height) const {
+    // OAM scan picks the first ten sprites on the line, in OAM order.
+    int spriteCount = 0;
+    for (int i = 0; i < OAM_SIZE / 4 && spriteCount < MAX_SPRITES_PER_LINE; i++) {
+        const int top = (int)_oam[i * 4] - 16;
+        if (_ly >= top && _ly < top + height) {
+            sprites[spriteCount++] = (uint8_t)i;
+        }
+    }
+
+    return spriteCount;
+}
+
+uint8_t PPU::tileColor(uint16_t tileDataAddress, uint8_t x, uint8_t y) const {
+    const uint8_t low = _vram[tileDataAddress + y * 2];
+    const uint8_t high = _vram[tileDataAddress + y * 2 + 1];
+    const uint8_t bit = 7 - x;
+
+    return (((high >> bit) & 0x01) << 1) | ((low >> bit) & 0x01);
+}
+
+void PPU::renderScanline() {
+    uint32_t* line = &_framebuffer[_ly * SCREEN_WIDTH];
+    uint8_t colorIds[SCREEN_WIDTH];
+
+    memset(colorIds, 0, sizeof(colorIds));
+
+    if (_lcdc & LCDC_BG_ENABLE) {
+        const bool unsignedTiles = (_lcdc & LCDC_TILE_DATA_LOW) != 0;
+        const bool windowVisible = (_lcdc & LCDC_WINDOW_ENABLE) && _ly >= _wy && _wx <= 166;
+        const int windowStart = (int)_wx - 7;
+
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            uint16_t mapBase;
+            uint8_t pixelX, pixelY;
+
+            if (windowVisible && x >= windowStart) {
+                mapBase = (_lcdc & LCDC_WINDOW_MAP_HIGH) ? 0x1c00 : 0x1800;
+                pixelX = (uint8_t)(x - windowStart);
+                pixelY = _windowLine;
+            } else {
+                mapBase = (_lcdc & LCDC_BG_MAP_HIGH) ? 0x1c00 : 0x1800;
+                pixelX = (uint8_t)(_scx + x);
+                pixelY = (uint8_t)(_scy + _ly);
+            }
+
+            const uint8_t tileIndex = _vram[mapBase + (pixelY / 8) * 32 + (pixelX / 8)];
+            const uint16_t tileAddress = unsignedTiles ?
+                (uint16_t)(tileIndex * 16) :
+                (uint16_t)(0x1000 + (int8_t)tileIndex * 16);
+
+            colorIds[x] = tileColor(tileAddress, pixelX & 0x07, pixelY & 0x07);
+        }
+
+        if (windowVisible && windowStart < SCREEN_WIDTH) {
+            _windowLine++;
+        }
+    }
+
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        line[x] = g_dmgShades[(_bgp >> (colorIds[x] * 2)) & 0x03];
+    }
+
+    if ((_lcdc & LCDC_OBJ_ENABLE) == 0) {
+        return;
+    }
+
+    const int height = (_lcdc & LCDC_OBJ_TALL) ? 16 : 8;
+
+    uint8_t sprites[MAX_SPRITES_PER_LINE];
+    const int spriteCount = selectSprites(sprites, height);
+
+    // Lower X wins, then lower OAM index. Sort stably into priority order and
+    // draw from the back so the winner lands last.
+    for (int i = 1; i < spriteCount; i++) {
+        for (int j = i; j > 0 && _oam[sprites[j] * 4 + 1] < _oam[sprites[j - 1] * 4 + 1]; j--) {
+            const uint8_t swap = sprites[j];
+            sprites[j] = sprites[j - 1];
+            sprites[j - 1] = swap;
+        }
+    }
+
+    for (int i = spriteCount - 1; i >= 0; i--) {
+        const uint8_t* sprite = &_oam[sprites[i] * 4];
+        const int top = (int)sprite[0] - 16;
+        const int left = (int)sprite[1] - 8;
+        const uint8_t attributes = sprite[3];
+        const uint8_t palette = (attributes & 0x10) ? _obp1 : _obp0;
+
+        uint8_t row = (uint8_t)(_ly - top);
+        if (attributes & ATTR_Y_FLIP) {
+            row = (uint8_t)(height - 1 - row);
+        }
+
+        uint8_t tileIndex = sprite[2];
+        if (height == 16) {
+            tileIndex &= 0xfe;
+        }
+
+        const uint16_t tileAddress = (uint16_t)(tileIndex * 16 + (row / 8) * 16);
+
+        for (int column = 0; column < 8; column++) {
+            const int x = left + column;
+            if (x < 0 || x >= SCREEN_WIDTH) {
+                continue;
+            }
+
+            const uint8_t color = tileColor(
+                tileAddress,
+                (attributes & ATTR_X_FLIP) ? (uint8_t)(7 - column) : (uint8_t)column,
+                row & 0x07
+            );
+
+            if (color == 0 || ((attributes & ATTR_PRIORITY) && colorIds[x] != 0)) {
+                continue;
+            }
+
+            line[x] = g_dmgShades[(palette >> (color * 2)) & 0x03];
+        }
+    }
+}
+
+void PPU::renderCGBScanline() {
+    uint32_t* line = &_framebuffer[_ly * SCREEN_WIDTH];
+    uint8_t colorIds[SCREEN_WIDTH];
+    uint8_t bgPriority[SCREEN_WIDTH];
+
+    // On the CGB the background is always drawn; LCDC bit 0 instead decides
+    // whether it can ever be drawn over sprites.
+    const bool bgCanWin = (_lcdc & LCDC_BG_ENABLE) != 0;
+    const bool unsignedTiles = (_lcdc & LCDC_TILE_DATA_LOW) != 0;
+    const bool windowVisible = (_lcdc & LCDC_WINDOW_ENABLE) && _ly >= _wy && _wx <= 166;
+    const int windowStart = (int)_wx - 7;
+
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        uint16_t mapBase;
+        uint8_t pixelX, pixelY;
+
+        if (windowVisible && x >= windowStart) {
+            mapBase = (_lcdc & LCDC_WINDOW_MAP_HIGH) ? 0x1c00 : 0x1800;
+            pixelX = (uint8_t)(x - windowStart);
+            pixelY = _windowLine;
+        } else {
+            mapBase = (_lcdc & LCDC_BG_MAP_HIGH) ? 0x1c00 : 0x1800;
+            pixelX = (uint8_t)(_scx + x);
+            pixelY = (uint8_t)(_scy + _ly);
+        }
+
+        // Bank 1 holds an attribute byte for every map entry in bank 0.
+        const uint16_t mapAddress = mapBase + (pixelY / 8) * 32 + (pixelX / 8);
+        const uint8_t tileIndex = _vram[mapAddress];
+        const uint8_t attributes = _vram[VRAM_SIZE + mapAddress];
+
+        uint16_t tileAddress = unsignedTiles ?
+            (uint16_t)(tileIndex * 16) :
+            (uint16_t)(0x1000 + (int8_t)tileIndex * 16);
+        if (attributes & CGB_ATTR_BANK) {
+            tileAddress += VRAM_SIZE;
+        }
+
+        const uint8_t column = (attributes & ATTR_X_FLIP) ? (uint8_t)(7 - (pixelX & 0x07)) : (pixelX & 0x07);
+        const uint8_t row = (attributes & ATTR_Y_FLIP) ? (uint8_t)(7 - (pixelY & 0x07)) : (pixelY & 0x07);
+
+        colorIds[x] = tileColor(tileAddress, column, row);
+        bgPriority[x] = attributes & ATTR_PRIORITY;
+        line[x] = _bgColors[attributes & CGB_ATTR_PALETTE][colorIds[x]];
+    }
+
+    if (windowVisible && windowStart < SCREEN_WIDTH) {
+        _windowLine++;
+    }
+
+    if ((_lcdc & LCDC_OBJ_ENABLE) == 0) {
+        return;
+    }
+
+    const int height = (_lcdc & LCDC_OBJ_TALL) ? 16 : 8;
+
+    // Priority is purely by OAM index, so draw from the back and let the
+    // lowest index land last.
+    uint8_t sprites[MAX_SPRITES_PER_LINE];
+    const int spriteCount = selectSprites(sprites, height);
+
+    for (int i = spriteCount - 1; i >= 0; i--) {
+        const uint8_t* sprite = &_oam[sprites[i] * 4];
+        const int top = (int)sprite[0] - 16;
+        const int left = (int)sprite[1] - 8;
+        const uint8_t attributes = sprite[3];
+        const uint32_t* palette = _objColors[attributes & CGB_ATTR_PALETTE];
+
+        uint8_t row = (uint8_t)(_ly - top);
+        if (attributes & ATTR_Y_FLIP) {
+            row = (uint8_t)(height - 1 - row);
+        }
+
+        uint8_t tileIndex = sprite[2];
+        if (height == 16) {
+            tileIndex &= 0xfe;
+        }
+
+        uint16_t tileAddress = (uint16_t)(tileIndex * 16 + (row / 8) * 16);
+        if (attributes & CGB_ATTR_BANK) {
+            tileAddress += VRAM_SIZE;
+        }
+
+        for (int column = 0; column < 8; column++) {
+            const int x = left + column;
+            if (x < 0 || x >= SCREEN_WIDTH) {
+                continue;
+            }
+
+            const uint8_t color = tileColor(
+                tileAddress,
+                (attributes & ATTR_X_FLIP) ? (uint8_t)(7 - column) : (uint8_t)column,
+                row & 0x07
+            );
+
+            const bool behindBG = bgCanWin && colorIds[x] != 0 &&
+                ((attributes & ATTR_PRIORITY) || bgPriority[x]);
+
+            if (color == 0 || behindBG) {
+                continue;
+            }
+
+            line[x] = palette[color];
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#include "PerfCounters.h"
+
+const char* busRegionName(BusRegion region) {
+    switch(region) {
+        case BUS_ROM0: return "ROM0";
+        case BUS_ROMX: return "ROMX";
+        case BUS_VRAM: return "VRAM";
+        case BUS_ERAM: return "ERAM";
+        case BUS_WRAM: return "WRAM";
+        case BUS_ECHO: return "ECHO";
+        case BUS_OAM: return "OAM";
+        case BUS_UNUSABLE: return "UNUSABLE";
+        case BUS_IO: return "IO";
+        case BUS_HRAM: return "HRAM";
+        case BUS_IE: return "IE";
+        default: return "?";
+    }
+}
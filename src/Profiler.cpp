@@ -0,0 +1,77 @@
+#include "Profiler.h"
+
+#include <cstdio>
+
+Profiler::Profiler(uint32_t sampleInterval) :
+    _cartridge(nullptr),
+    _sampleInterval(sampleInterval > 0 ? sampleInterval : 1) {
+    reset();
+}
+
+void Profiler::enter(uint16_t target, uint16_t stackPointer) {
+    // Past the limit, calls simply aren't tracked; unwinding goes by stack
+    // pointer, so the frames that are kept stay consistent.
+    if (_stack.size() >= MAX_PROFILE_DEPTH) {
+        return;
+    }
+
+    Frame frame = { location(target), stackPointer };
+    _stack.push_back(frame);
+}
+
+void Profiler::leave(uint16_t stackPointer) {
+    while (!_stack.empty() && _stack.back().stackPointer < stackPointer) {
+        _stack.pop_back();
+    }
+}
+
+void Profiler::reset() {
+    _countdown = _sampleInterval;
+    _sampleCount = 0;
+    _stack.clear();
+    _samples.clear();
+}
+
+bool Profiler::writeFolded(std::ostream& stream) const {
+    char name[16];
+
+    for (const auto& entry : _samples) {
+        for (size_t i = 0; i < entry.first.size(); i++) {
+            const uint32_t location = entry.first[i];
+            const uint16_t address = location & 0xffff;
+
+            if (address < 0x8000) {
+                snprintf(name, sizeof(name), "%02x:%04x", location >> 16, address);
+            } else {
+                snprintf(name, sizeof(name), "%04x", address);
+            }
+
+            stream << (i > 0 ? ";" : "") << name;
+        }
+
+        stream << " " << entry.second << "\n";
+    }
+
+    return stream.good();
+}
+
+uint32_t Profiler::location(uint16_t address) const {
+    if (address < 0x4000 || address >= 0x8000) {
+        return address;
+    }
+
+    const uint32_t bank = _cartridge != nullptr ? _cartridge->romBank() : 1;
+    return (bank << 16) | address;
+}
+
+void Profiler::sample(uint16_t programCounter) {
+    _key.clear();
+    for (const auto& frame : _stack) {
+        _key.push_back(frame.location);
+    }
+
+    _key.push_back(location(programCounter));
+
+    _samples[_key]++;
+    _sampleCount++;
+}
@@ -0,0 +1,90 @@
+#include "Serial.h"
+
+#include "IORegisters.h"
+#include "SaveState.h"
+
+#define SC_TRANSFER       0x80
+#define SC_INTERNAL_CLOCK 0x01
+
+Serial::Serial(uint8_t& interruptFlags) : _interruptFlags(interruptFlags) {
+    reset();
+}
+
+void Serial::reset() {
+    _data = 0x00;
+    _control = 0x00;
+    _shiftDots = 0;
+    _awaitingReply = false;
+}
+
+void Serial::saveState(StateWriter& state) const {
+    state.u8(_data);
+    state.u8(_control);
+    state.u16(_shiftDots);
+    state.flag(_awaitingReply);
+}
+
+void Serial::loadState(StateReader& state) {
+    _data = state.u8();
+    _control = state.u8();
+    _shiftDots = state.u16();
+    _awaitingReply = state.flag();
+}
+
+uint8_t Serial::read(uint16_t addr) const {
+    if (addr == IO_SB) {
+        return _data;
+    }
+
+    return 0x7e | _control;
+}
+
+void Serial::write(uint16_t addr, uint8_t value) {
+    if (addr == IO_SB) {
+        _data = value;
+        return;
+    }
+
+    // IMPROVE: The CGB's fast clock (bit 1) isn't supported, and the internal
+    //          clock doesn't speed up with the CPU in double speed mode.
+    _control = value & (SC_TRANSFER | SC_INTERNAL_CLOCK);
+    _awaitingReply = false;
+    _shiftDots = (_control == (SC_TRANSFER | SC_INTERNAL_CLOCK)) ? SERIAL_TRANSFER_DOTS : 0;
+}
+
+void Serial::shifted() {
+    _awaitingReply = true;
+
+    if (_transport) {
+        _transport->send(*this, _data);
+    } else {
+        complete(0xff);
+    }
+}
+
+void Serial::complete(uint8_t in) {
+    if (!_awaitingReply) {
+        return;
+    }
+
+    _data = in;
+    _control &= ~SC_TRANSFER;
+    _awaitingReply = false;
+    _interruptFlags |= INT_SERIAL;
+}
+
+bool Serial::receive(uint8_t in, uint8_t& out) {
+    if (_control != SC_TRANSFER) {
+        return false;
+    }
+
+    out = _data;
+    _awaitingReply = true;
+    complete(in);
+    return true;
+}
+
+void SerialBuffer::send(Serial& serial, uint8_t out) {
+    _output.push_back((char)out);
+    serial.complete(0xff);
+}
@@ -0,0 +1,304 @@
+#include "SerialLink.h"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define PACKET_SEND   0x01
+#define PACKET_ANSWER 0x02
+
+SerialLink::SerialLink(uint32_t syncInterval) :
+    _machine(nullptr),
+    _syncInterval(syncInterval),
+    _nextSync(syncInterval),
+    _connected(true),
+    _havePeerPacket(false),
+    _pendingSend(false),
+    _pendingByte(0xff) {
+}
+
+void SerialLink::send(Serial& serial, uint8_t out) {
+    if (!_connected) {
+        serial.complete(0xff);
+        return;
+    }
+
+    // Only one transfer can be waiting at a time, since software can't start
+    // another until this one completes.
+    _pendingSend = true;
+    _pendingByte = out;
+}
+
+uint32_t SerialLink::dotsUntilSync() const {
+    if (!_machine || !_connected) {
+        return UINT32_MAX;
+    }
+
+    // The sync lands after the machine cycle that reaches it. Counting two
+    // dots to a machine cycle, as at double speed, never overstates the gap.
+    const uint64_t now = _machine->machineCycles();
+    if (now >= _nextSync) {
+        return 0;
+    }
+
+    const uint64_t dots = (_nextSync - now) * 2 - 1;
+    return dots < UINT32_MAX ? (uint32_t)dots : UINT32_MAX;
+}
+
+bool SerialLink::sync(Serial& serial) {
+    uint8_t packet[LINK_PACKET_SIZE] = { 0x00, 0xff, 0xff };
+    _nextSync += _syncInterval;
+
+    if (!_connected) {
+        return false;
+    }
+
+    if (_havePeerPacket) {
+        uint8_t in[LINK_PACKET_SIZE];
+        if (!readPacket(in)) {
+            return disconnect(serial);
+        }
+
+        // An answer finishes our own transfer first, so a machine that was
+        // waiting on one is listening again by the time the other end's byte
+        // is offered. Both ends do the same, whichever runs first.
+        if (in[0] & PACKET_ANSWER) {
+            serial.complete(in[2]);
+        }
+
+        if (in[0] & PACKET_SEND) {
+            uint8_t answer;
+            if (!serial.receive(in[1], answer)) {
+                answer = 0xff;
+            }
+
+            packet[0] |= PACKET_ANSWER;
+            packet[2] = answer;
+        }
+    }
+
+    if (_pendingSend) {
+        packet[0] |= PACKET_SEND;
+        packet[1] = _pendingByte;
+        _pendingSend = false;
+    }
+
+    _havePeerPacket = true;
+
+    return writePacket(packet) || disconnect(serial);
+}
+
+bool SerialLink::disconnect(Serial& serial) {
+    _connected = false;
+    _pendingSend = false;
+    serial.complete(0xff);
+    return false;
+}
+
+// In-process cable //////////////////////////////////////////////////////////
+
+typedef std::array<uint8_t, LINK_PACKET_SIZE> Packet;
+
+struct SerialCable {
+    std::deque<Packet> packets[2]; // Indexed by the end that sent them.
+};
+
+class SerialPairEnd : public SerialLink {
+public:
+    SerialPairEnd(std::shared_ptr<SerialCable> cable, int end, uint32_t syncInterval) :
+        SerialLink(syncInterval),
+        _cable(cable),
+        _end(end) {
+    }
+
+protected:
+    bool writePacket(const uint8_t* packet) override {
+        Packet copy;
+        std::copy(packet, packet + LINK_PACKET_SIZE, copy.begin());
+        _cable->packets[_end].push_back(copy);
+        return true;
+    }
+
+    bool readPacket(uint8_t* packet) override {
+        // Empty only if this end was run further ahead than runLinkedFrame
+        // ever lets it.
+        auto& packets = _cable->packets[1 - _end];
+        if (packets.empty()) {
+            return false;
+        }
+
+        std::copy(packets.front().begin(), packets.front().end(), packet);
+        packets.pop_front();
+        return true;
+    }
+
+private:
+    std::shared_ptr<SerialCable> _cable;
+    int _end;
+};
+
+void makeSerialPair(SerialLink::Ptr& first, SerialLink::Ptr& second, uint32_t syncInterval) {
+    const auto cable = std::make_shared<SerialCable>();
+    first = std::make_shared<SerialPairEnd>(cable, 0, syncInterval);
+    second = std::make_shared<SerialPairEnd>(cable, 1, syncInterval);
+}
+
+// Unix domain socket /////////////////////////////////////////////////////////
+
+static bool socketAddress(const std::string& path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+SerialSocket::SerialSocket(int fd, uint32_t syncInterval) : SerialLink(syncInterval), _fd(fd) {
+}
+
+SerialSocket::~SerialSocket() {
+    close(_fd);
+}
+
+SerialLink::Ptr SerialSocket::listen(const std::string& path, uint32_t syncInterval) {
+    sockaddr_un address;
+    if (!socketAddress(path, address)) {
+        return nullptr;
+    }
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return nullptr;
+    }
+
+    // A socket file left behind by an earlier run would make bind() fail.
+    unlink(path.c_str());
+
+    if (bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || ::listen(listener, 1) != 0) {
+        close(listener);
+        return nullptr;
+    }
+
+    int fd;
+    do {
+        fd = accept(listener, nullptr, nullptr);
+    } while (fd < 0 && errno == EINTR);
+
+    close(listener);
+    unlink(path.c_str());
+
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    return SerialLink::Ptr(new SerialSocket(fd, syncInterval));
+}
+
+SerialLink::Ptr SerialSocket::connect(const std::string& path, uint32_t syncInterval) {
+    sockaddr_un address;
+    if (!socketAddress(path, address)) {
+        return nullptr;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    if (::connect(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    return SerialLink::Ptr(new SerialSocket(fd, syncInterval));
+}
+
+bool SerialSocket::writePacket(const uint8_t* packet) {
+    size_t written = 0;
+    while (written < LINK_PACKET_SIZE) {
+        const ssize_t count = ::send(_fd, packet + written, LINK_PACKET_SIZE - written, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (count <= 0) {
+            return false;
+        }
+
+        written += (size_t)count;
+    }
+
+    return true;
+}
+
+bool SerialSocket::readPacket(uint8_t* packet) {
+    size_t received = 0;
+    while (received < LINK_PACKET_SIZE) {
+        const ssize_t count = recv(_fd, packet + received, LINK_PACKET_SIZE - received, 0);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (count <= 0) {
+            return false;
+        }
+
+        received += (size_t)count;
+    }
+
+    return true;
+}
+
+// Running linked machines ////////////////////////////////////////////////////
+
+bool runLinkedFrame(GameBoy& gameBoy, SerialLink& link) {
+    link.machine(&gameBoy);
+
+    const auto frame = gameBoy.ppu().frameCount();
+    while (gameBoy.ppu().frameCount() == frame) {
+        gameBoy.step();
+
+        while (gameBoy.machineCycles() >= link.nextSync()) {
+            link.sync(gameBoy.mmu().serial());
+        }
+    }
+
+    return link.connected();
+}
+
+bool runLinkedFrame(GameBoy& first, SerialLink& firstLink, GameBoy& second, SerialLink& secondLink) {
+    firstLink.machine(&first);
+    secondLink.machine(&second);
+
+    const auto frame = first.ppu().frameCount();
+    while (first.ppu().frameCount() == frame) {
+        first.step();
+
+        while (first.machineCycles() >= firstLink.nextSync()) {
+            if (!firstLink.sync(first.mmu().serial())) {
+                return false;
+            }
+
+            // Bring the second machine up to the same sync point, where it
+            // reads what the first sent at the one before.
+            while (second.machineCycles() < secondLink.nextSync()) {
+                second.step();
+            }
+
+            if (!secondLink.sync(second.mmu().serial())) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,358 @@
+#include "SingleStep.h"
+
+#include "JsonReader.h"
+#include "Opcodes.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+// Enough for any instruction, or for an interrupt being taken instead.
+#define MAX_TRACKED_WRITES 8
+
+// A case that hasn't finished by then has hung the CPU.
+#define MAX_CASE_CYCLES 32
+
+/** 64 KiB of flat memory that only ever holds what a case put there. Reset
+ * clears just the addresses the last case touched, so nothing is allocated or
+ * swept between cases, unless it wrote more than can be tracked.
+ *
+ * Anything not set reads as zero, which keeps IE and IF, and so interrupts,
+ * out of the way unless a case sets them.
+ */
+class SingleStepRunner::SparseMemory : public Memory {
+public:
+    SparseMemory() : _writeCount(0), _writesLost(false) {
+        memset(_bytes, 0, sizeof(_bytes));
+    }
+
+    uint8_t read(uint16_t addr) override {
+        return _bytes[addr];
+    }
+
+    void write(uint16_t addr, uint8_t value) override {
+        _bytes[addr] = value;
+
+        if (_writeCount < MAX_TRACKED_WRITES) {
+            _writes[_writeCount++] = addr;
+        } else {
+            _writesLost = true;
+        }
+    }
+
+    void load(const SingleStepState& state) {
+        for (int i = 0; i < state.ramCount; i++) {
+            _bytes[state.ramAddresses[i]] = state.ramValues[i];
+        }
+
+        _writeCount = 0;
+        _writesLost = false;
+    }
+
+    void clear(const SingleStepState& state) {
+        // Past MAX_TRACKED_WRITES there's no telling where the rest went.
+        if (_writesLost) {
+            memset(_bytes, 0, sizeof(_bytes));
+            _writeCount = 0;
+            _writesLost = false;
+            return;
+        }
+
+        for (int i = 0; i < state.ramCount; i++) {
+            _bytes[state.ramAddresses[i]] = 0;
+        }
+
+        for (int i = 0; i < _writeCount; i++) {
+            _bytes[_writes[i]] = 0;
+        }
+    }
+
+    uint8_t _bytes[65536];
+    uint16_t _writes[MAX_TRACKED_WRITES];
+    int _writeCount;
+    bool _writesLost;
+};
+
+// Parsing ////////////////////////////////////////////////////////////////////
+
+static bool readByte(JsonReader& reader, uint8_t& value) {
+    int64_t number;
+    if (!reader.readInteger(number) || number < 0 || number > 0xff) {
+        return false;
+    }
+
+    value = (uint8_t)number;
+    return true;
+}
+
+static bool readWord(JsonReader& reader, uint16_t& value) {
+    int64_t number;
+    if (!reader.readInteger(number) || number < 0 || number > 0xffff) {
+        return false;
+    }
+
+    value = (uint16_t)number;
+    return true;
+}
+
+// [[address, value], ...]
+static bool readRAM(JsonReader& reader, SingleStepState& state) {
+    state.ramCount = 0;
+    reader.beginArray();
+    while (reader.nextElement()) {
+        if (state.ramCount == MAX_SINGLE_STEP_RAM) {
+            return false;
+        }
+
+        reader.beginArray();
+        if (!reader.nextElement() || !readWord(reader, state.ramAddresses[state.ramCount]) ||
+            !reader.nextElement() || !readByte(reader, state.ramValues[state.ramCount]) ||
+            reader.nextElement()) {
+            return false;
+        }
+
+        state.ramCount++;
+    }
+
+    return !reader.failed();
+}
+
+static bool readState(JsonReader& reader, SingleStepState& state) {
+    memset(&state, 0, sizeof(state));
+
+    JsonString key;
+    reader.beginObject();
+    while (reader.nextMember(key)) {
+        bool ok;
+        uint8_t ime = 0;
+        if (key == "pc") {
+            ok = readWord(reader, state.pc);
+        } else if (key == "sp") {
+            ok = readWord(reader, state.sp);
+        } else if (key == "a") {
+            ok = readByte(reader, state.a);
+        } else if (key == "b") {
+            ok = readByte(reader, state.b);
+        } else if (key == "c") {
+            ok = readByte(reader, state.c);
+        } else if (key == "d") {
+            ok = readByte(reader, state.d);
+        } else if (key == "e") {
+            ok = readByte(reader, state.e);
+        } else if (key == "f") {
+            ok = readByte(reader, state.f);
+        } else if (key == "h") {
+            ok = readByte(reader, state.h);
+        } else if (key == "l") {
+            ok = readByte(reader, state.l);
+        } else if (key == "ime") {
+            ok = readByte(reader, ime);
+            state.ime = ime != 0;
+        } else if (key == "ram") {
+            ok = readRAM(reader, state);
+        } else {
+            ok = reader.skipValue();
+        }
+
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return !reader.failed();
+}
+
+static bool readCase(JsonReader& reader, SingleStepCase& test) {
+    test.name.clear();
+    test.cycles = 0;
+
+    JsonString key;
+    reader.beginObject();
+    while (reader.nextMember(key)) {
+        bool ok = true;
+        if (key == "name") {
+            JsonString name;
+            ok = reader.readString(name);
+            if (ok) {
+                test.name.assign(name.data, name.size);
+            }
+        } else if (key == "initial") {
+            ok = readState(reader, test.initial);
+        } else if (key == "final") {
+            ok = readState(reader, test.final);
+        } else if (key == "cycles") {
+            // Each entry is one machine cycle's bus activity, or null.
+            reader.beginArray();
+            while (reader.nextElement()) {
+                reader.skipValue();
+                test.cycles++;
+            }
+        } else {
+            ok = reader.skipValue();
+        }
+
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return !reader.failed();
+}
+
+// Running ////////////////////////////////////////////////////////////////////
+
+SingleStepRunner::SingleStepRunner() :
+    _memory(std::make_shared<SparseMemory>()),
+    _cpu(_memory),
+    _checkCycles(true) {
+    _cpu.fusion(false);
+}
+
+uint16_t SingleStepRunner::opcodeIndex(const SingleStepState& initial) {
+    uint8_t opcode = 0;
+    bool prefixed = false;
+
+    for (int i = 0; i < initial.ramCount; i++) {
+        if (initial.ramAddresses[i] == initial.pc) {
+            opcode = initial.ramValues[i];
+        }
+    }
+
+    if (opcode == Opcode::PREFIX_CB) {
+        for (int i = 0; i < initial.ramCount; i++) {
+            if (initial.ramAddresses[i] == (uint16_t)(initial.pc + 1)) {
+                opcode = initial.ramValues[i];
+                prefixed = true;
+            }
+        }
+    }
+
+    return prefixed ? 0x100 + opcode : opcode;
+}
+
+bool SingleStepRunner::runFile(const char* begin, const char* end, std::vector<SingleStepTally>& tallies) {
+    JsonReader reader(begin, end);
+    reader.beginArray();
+    while (reader.nextElement()) {
+        if (!readCase(reader, _case)) {
+            return false;
+        }
+
+        auto& tally = tallies[opcodeIndex(_case.initial)];
+        const bool first = tally.failed == 0;
+        if (runCase(_case, first ? &tally.firstFailure : nullptr)) {
+            tally.passed++;
+        } else {
+            tally.failed++;
+        }
+    }
+
+    return reader.atEnd();
+}
+
+// Only the first difference is kept; it is usually the one that matters.
+static void describe(std::string* mismatch, const char* format, ...) {
+    if (mismatch == nullptr || !mismatch->empty()) {
+        return;
+    }
+
+    char text[64];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    *mismatch = text;
+}
+
+bool SingleStepRunner::runCase(const SingleStepCase& test, std::string* mismatch) {
+    const SingleStepState& initial = test.initial;
+    const SingleStepState& final = test.final;
+
+    _memory->load(initial);
+
+    _cpu.reset();
+    _cpu._programCounter = initial.pc;
+    _cpu._stackPointer = initial.sp;
+    _cpu._regA = initial.a;
+    _cpu._regB = initial.b;
+    _cpu._regC = initial.c;
+    _cpu._regD = initial.d;
+    _cpu._regE = initial.e;
+    _cpu._flags = initial.f;
+    _cpu._regH = initial.h;
+    _cpu._regL = initial.l;
+    _cpu._interruptsEnabled = initial.ime;
+
+    uint32_t cycles = 0;
+    do {
+        for (int i = 0; i < CLOCK_CYCLES_PER_MACHINE_CYCLE; i++) {
+            _cpu.clock();
+        }
+        cycles++;
+    } while (!_cpu.atInstructionBoundary() && !_cpu._isHalted && cycles < MAX_CASE_CYCLES);
+
+    if (mismatch != nullptr) {
+        mismatch->clear();
+    }
+
+    bool pass = true;
+    const auto check = [&](const char* what, unsigned expected, unsigned actual) {
+        if (expected != actual) {
+            describe(mismatch, "%s: expected $%02x, got $%02x", what, expected, actual);
+            pass = false;
+        }
+    };
+
+    check("a", final.a, _cpu._regA);
+    check("b", final.b, _cpu._regB);
+    check("c", final.c, _cpu._regC);
+    check("d", final.d, _cpu._regD);
+    check("e", final.e, _cpu._regE);
+    check("f", final.f, _cpu._flags);
+    check("h", final.h, _cpu._regH);
+    check("l", final.l, _cpu._regL);
+    check("pc", final.pc, _cpu._programCounter);
+    check("sp", final.sp, _cpu._stackPointer);
+    check("ime", final.ime, _cpu._interruptsEnabled);
+
+    for (int i = 0; i < final.ramCount; i++) {
+        const uint16_t addr = final.ramAddresses[i];
+        if (_memory->_bytes[addr] != final.ramValues[i]) {
+            describe(mismatch, "$%04x: expected $%02x, got $%02x", addr, final.ramValues[i], _memory->_bytes[addr]);
+            pass = false;
+        }
+    }
+
+    // A write to anywhere the final state doesn't list shouldn't have
+    // happened at all.
+    for (int i = 0; i < _memory->_writeCount; i++) {
+        bool listed = false;
+        for (int j = 0; j < final.ramCount; j++) {
+            listed = listed || final.ramAddresses[j] == _memory->_writes[i];
+        }
+
+        if (!listed) {
+            describe(mismatch, "stray write of $%02x to $%04x", _memory->_bytes[_memory->_writes[i]], _memory->_writes[i]);
+            pass = false;
+        }
+    }
+
+    if (_memory->_writesLost) {
+        describe(mismatch, "more than %d writes", MAX_TRACKED_WRITES);
+        pass = false;
+    }
+
+    if (_checkCycles) {
+        if (cycles != test.cycles) {
+            describe(mismatch, "cycles: expected %u, got %u", test.cycles, cycles);
+            pass = false;
+        }
+    }
+
+    if (!pass && mismatch != nullptr) {
+        *mismatch = test.name + ": " + *mismatch;
+    }
+
+    _memory->clear(initial);
+    return pass;
+}
@@ -0,0 +1,111 @@
+#include "StateHasher.h"
+
+#include "Hash.h"
+
+#include <cstring>
+
+static const char g_magic[4] = { 'G', 'B', 'F', 'H' };
+
+StateHasher::StateHasher() {
+    memset(_pageHashes, 0, sizeof(_pageHashes));
+}
+
+StateHasher::FrameHashes StateHasher::hash(GameBoy& gameBoy) {
+    MMU& mmu = gameBoy.mmu();
+    const PPU& ppu = mmu.ppu();
+    const CPU& cpu = gameBoy.cpu();
+
+    for (int page = 0; page < DIRTY_PAGE_COUNT; page++) {
+        if (!mmu._dirtyPages[page]) {
+            continue;
+        }
+
+        if (page < VRAM_PAGE_BASE) {
+            const uint8_t* data = &mmu._workRAM[(page - WRAM_PAGE_BASE) * DIRTY_PAGE_SIZE];
+            _pageHashes[page] = blockHash(data, DIRTY_PAGE_SIZE);
+        } else if (page < OAM_PAGE) {
+            const uint8_t* data = &ppu._vram[(page - VRAM_PAGE_BASE) * DIRTY_PAGE_SIZE];
+            _pageHashes[page] = blockHash(data, DIRTY_PAGE_SIZE);
+        } else if (page == OAM_PAGE) {
+            _pageHashes[page] = blockHash(ppu._oam, sizeof(ppu._oam));
+        } else {
+            _pageHashes[page] = blockHash(mmu._highRAM, sizeof(mmu._highRAM));
+        }
+
+        mmu._dirtyPages[page] = 0;
+    }
+
+    const uint8_t registers[] = {
+        cpu._regA, cpu._regB, cpu._regC, cpu._regD,
+        cpu._regE, cpu._regH, cpu._regL, cpu._flags,
+        (uint8_t)(cpu._stackPointer >> 8), (uint8_t)cpu._stackPointer,
+        (uint8_t)(cpu._programCounter >> 8), (uint8_t)cpu._programCounter,
+        (uint8_t)cpu._interruptsEnabled, (uint8_t)cpu._isHalted,
+    };
+
+    FrameHashes hashes;
+    hashes.regions[REGION_CPU] = blockHash(registers, sizeof(registers));
+    hashes.regions[REGION_WRAM] = blockHash(&_pageHashes[WRAM_PAGE_BASE], (VRAM_PAGE_BASE - WRAM_PAGE_BASE) * sizeof(uint64_t));
+    hashes.regions[REGION_VRAM] = blockHash(&_pageHashes[VRAM_PAGE_BASE], (OAM_PAGE - VRAM_PAGE_BASE) * sizeof(uint64_t));
+    hashes.regions[REGION_OAM] = _pageHashes[OAM_PAGE];
+    hashes.regions[REGION_HRAM] = _pageHashes[HRAM_PAGE];
+
+    return hashes;
+}
+
+const char* StateHasher::regionName(Region region) {
+    switch(region) {
+        case REGION_CPU: return "CPU";
+        case REGION_WRAM: return "WRAM";
+        case REGION_HRAM: return "HRAM";
+        case REGION_VRAM: return "VRAM";
+        case REGION_OAM: return "OAM";
+        default: return "?";
+    }
+}
+
+bool writeFrameHashHeader(std::ostream& stream) {
+    stream.write(g_magic, sizeof(g_magic));
+    stream.put((char)(FRAME_HASH_VERSION & 0xff));
+    stream.put((char)(FRAME_HASH_VERSION >> 8));
+    return stream.good();
+}
+
+bool writeFrameHashes(std::ostream& stream, const StateHasher::FrameHashes& hashes) {
+    uint8_t record[StateHasher::REGION_COUNT * 8];
+    for (int region = 0; region < StateHasher::REGION_COUNT; region++) {
+        for (int byte = 0; byte < 8; byte++) {
+            record[region * 8 + byte] = (uint8_t)(hashes.regions[region] >> (8 * byte));
+        }
+    }
+
+    stream.write(reinterpret_cast<const char*>(record), sizeof(record));
+    return stream.good();
+}
+
+bool readFrameHashStream(std::istream& stream, std::vector<StateHasher::FrameHashes>& frames) {
+    char header[sizeof(g_magic) + 2];
+    if (!stream.read(header, sizeof(header)) ||
+        memcmp(header, g_magic, sizeof(g_magic)) != 0 ||
+        (uint8_t)header[4] != (FRAME_HASH_VERSION & 0xff) ||
+        (uint8_t)header[5] != (FRAME_HASH_VERSION >> 8)) {
+        return false;
+    }
+
+    uint8_t record[StateHasher::REGION_COUNT * 8];
+    while (stream.read(reinterpret_cast<char*>(record), sizeof(record))) {
+        StateHasher::FrameHashes hashes;
+        for (int region = 0; region < StateHasher::REGION_COUNT; region++) {
+            uint64_t value = 0;
+            for (int byte = 7; byte >= 0; byte--) {
+                value = (value << 8) | record[region * 8 + byte];
+            }
+            hashes.regions[region] = value;
+        }
+
+        frames.push_back(hashes);
+    }
+
+    // A partial trailing record means the writer was cut off.
+    return stream.gcount() == 0;
+}
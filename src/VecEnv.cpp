@@ -0,0 +1,157 @@
+#include "VecEnv.h"
+
+#include <chrono>
+#include <cstring>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+VecEnv::VecEnv(const std::vector<uint8_t>& rom, size_t count, const VecEnvOptions& options) :
+    _options(options),
+    _actions(nullptr),
+    _observations(nullptr),
+    _ram(nullptr),
+    _next(0),
+    _remaining(0),
+    _generation(0),
+    _stopping(false) {
+    for (size_t i = 0; i < count; i++) {
+        _envs.emplace_back(new GameBoy(rom));
+        _envs.back()->ppu().renderInterval(options.renderInterval);
+    }
+
+    if (count > 0) {
+        _envs[0]->saveState(_startState);
+    }
+
+    unsigned threads = options.threads != 0 ? options.threads : std::thread::hardware_concurrency();
+    if (threads > count) {
+        threads = (unsigned)count;
+    }
+
+    for (unsigned i = 1; i < threads; i++) {
+        _workers.emplace_back(&VecEnv::work, this, i);
+    }
+}
+
+VecEnv::~VecEnv() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        _generation++;
+    }
+
+    _wake.notify_all();
+
+    for (auto& worker : _workers) {
+        worker.join();
+    }
+}
+
+void VecEnv::step(const uint8_t* actions, uint32_t* observations, uint8_t* ram) {
+    _actions = actions;
+    _observations = observations;
+    _ram = ram;
+    _remaining = _envs.size();
+    _next = 0;
+
+    if (!_workers.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _generation++;
+        }
+
+        _wake.notify_all();
+    }
+
+    runShare();
+
+    // Only the machines other threads are still on are left by now.
+    while (_remaining.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+}
+
+void VecEnv::reset(size_t index) {
+    _envs[index]->loadState(_startState);
+}
+
+void VecEnv::reset() {
+    for (size_t i = 0; i < _envs.size(); i++) {
+        reset(i);
+    }
+}
+
+void VecEnv::work(unsigned worker) {
+#ifdef __linux__
+    if (_options.pinThreads) {
+        const unsigned cores = std::thread::hardware_concurrency();
+
+        // The caller's thread isn't ours to pin, so it gets the first core to
+        // itself as far as the workers go.
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cores > 0 ? worker % cores : 0, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+#endif
+
+    typedef std::chrono::steady_clock Clock;
+
+    uint64_t seen = 0;
+    while (true) {
+        uint64_t generation = _generation.load(std::memory_order_acquire);
+
+        if (generation == seen) {
+            const auto spinUntil = Clock::now() + std::chrono::microseconds(VEC_ENV_SPIN_MICROSECONDS);
+            while (generation == seen && Clock::now() < spinUntil) {
+                std::this_thread::yield();
+                generation = _generation.load(std::memory_order_acquire);
+            }
+        }
+
+        if (generation == seen) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&]() { return _generation.load() != seen; });
+            generation = _generation.load();
+        }
+
+        if (_stopping) {
+            return;
+        }
+
+        seen = generation;
+        runShare();
+    }
+}
+
+void VecEnv::runShare() {
+    for (size_t index = _next++; index < _envs.size(); index = _next++) {
+        runEnv(index);
+        _remaining.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void VecEnv::runEnv(size_t index) {
+    GameBoy& gameBoy = *_envs[index];
+
+    gameBoy.mmu().joypad().buttons(_actions[index]);
+    for (uint32_t frame = 0; frame < _options.framesPerStep; frame++) {
+        gameBoy.runFrame();
+    }
+
+    if (_observations != nullptr) {
+        memcpy(_observations + index * VEC_ENV_OBSERVATION_PIXELS, gameBoy.ppu().framebuffer(),
+            VEC_ENV_OBSERVATION_PIXELS * sizeof(uint32_t));
+    }
+
+    if (_ram != nullptr) {
+        const auto& addresses = _options.ramAddresses;
+        uint8_t* out = _ram + index * addresses.size();
+        for (size_t i = 0; i < addresses.size(); i++) {
+            out[i] = gameBoy.mmu().peek(addresses[i]);
+        }
+    }
+}
@@ -1,6 +1,416 @@
+#include "FileList.h"
+#include "FrameChannel.h"
+#include "GameBoy.h"
+#include "Movie.h"
+#include "SerialLink.h"
+#include "StateHasher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
+
+static void printUsage(const char* program) {
+    std::cerr << "usage: " << program << " <rom> [options]\n"
+              << "  --frames N        run N frames, then exit (default 600)\n"
+              << "  --render-every N  compose every Nth frame; 0 never renders (default 1)\n"
+              << "  --stats           print per-frame CPU/PPU host time as CSV\n"
+              << "  --skip-idle       skip busy-wait polling loops (same results, less work)\n"
+              << "  --pair-profile N  print the N most frequent consecutive opcode pairs, unfused\n"
+              << "  --movie FILE      play back a recorded movie, checking its state hashes\n"
+              << "  --record-movie FILE  record the frames run as a movie\n"
+              << "  --input FILE      buttons to record, one mask per frame, repeating (default none)\n"
+              << "  --hash-out FILE   write per-frame state hashes for hashdiff\n"
+              << "  --counters        print perf counters on exit (needs ENABLE_PERF_COUNTERS)\n"
+              << "  --profile FILE    sample guest call stacks, written as folded stacks\n"
+              << "  --profile-interval N  machine cycles between samples (default 1024)\n"
+              << "  --serial-out      print whatever the ROM sends over serial on exit\n"
+              << "  --link-listen PATH   wait for another instance to link up over a Unix socket\n"
+              << "  --link-connect PATH  link up with an instance listening on PATH\n"
+              << "  --frame-shm NAME  publish frames to shared memory NAME for framewatch and the like\n"
+              << "  --boot-rom FILE   run a boot ROM image first instead of starting after it\n";
+}
+
+static void printCounters(const PerfCounters& counters) {
+    if (!PERF_COUNTERS_ENABLED) {
+        std::cerr << "perf counters not compiled in; configure with -DENABLE_PERF_COUNTERS=ON\n";
+        return;
+    }
+
+    std::vector<int> opcodes;
+    for (int i = 0; i < 256; i++) {
+        if (counters.cpu.opcodes[i] != 0) {
+            opcodes.push_back(i);
+        }
+    }
+
+    std::sort(opcodes.begin(), opcodes.end(), [&](int a, int b) {
+        return counters.cpu.opcodes[a] > counters.cpu.opcodes[b];
+    });
+
+    std::cerr << "top opcodes:\n";
+    for (size_t i = 0; i < opcodes.size() && i < 16; i++) {
+        std::cerr << "  0x" << std::hex << opcodes[i] << std::dec
+                  << " " << counters.cpu.opcodes[opcodes[i]] << "\n";
+    }
+
+    std::cerr << "bus (reads/writes):\n";
+    for (int region = 0; region < BUS_REGION_COUNT; region++) {
+        std::cerr << "  " << busRegionName((BusRegion)region) << " "
+                  << counters.bus.reads[region] << "/" << counters.bus.writes[region] << "\n";
+    }
+
+    std::cerr << "interrupts:";
+    for (int i = 0; i < INTERRUPT_SOURCE_COUNT; i++) {
+        std::cerr << " " << counters.cpu.interrupts[i];
+    }
+
+    std::cerr << "\nhalt cycles: " << counters.cpu.haltCycles
+              << "\nbank switches: " << counters.bus.bankSwitches << "\n";
+}
+
+static void printPairs(const std::vector<uint64_t>& pairs, unsigned long count) {
+    std::vector<int> order;
+    for (int i = 0; i < (int)pairs.size(); i++) {
+        if (pairs[i] != 0) {
+            order.push_back(i);
+        }
+    }
+
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return pairs[a] > pairs[b]; });
+
+    std::cout << "first,second,count\n";
+    for (size_t i = 0; i < order.size() && i < count; i++) {
+        std::cout << "0x" << std::hex << (order[i] >> 8) << ",0x" << (order[i] & 0xff)
+                  << std::dec << "," << pairs[order[i]] << "\n";
+    }
+}
+
+/** Reads an input schedule: one Joypad::Button mask per frame, in decimal or
+ * 0x-prefixed hex, separated by whitespace. False if the file can't be read,
+ * holds anything else, or is empty.
+ */
+static bool readInput(const char* path, std::vector<uint8_t>& input) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    std::string word;
+    while (file >> word) {
+        char* end;
+        const unsigned long buttons = strtoul(word.c_str(), &end, 0);
+        if (*end != '\0' || buttons > 0xff) {
+            return false;
+        }
+
+        input.push_back((uint8_t)buttons);
+    }
+
+    return !input.empty();
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    unsigned long frames = 600;
+    unsigned long renderEvery = 1;
+    bool stats = false;
+    bool showCounters = false;
+    bool skipIdle = false;
+    unsigned long pairProfile = 0;
+    const char* moviePath = nullptr;
+    const char* recordPath = nullptr;
+    const char* inputPath = nullptr;
+    const char* hashPath = nullptr;
+    const char* profilePath = nullptr;
+    unsigned long profileInterval = DEFAULT_SAMPLE_INTERVAL;
+    bool serialOut = false;
+    const char* linkListenPath = nullptr;
+    const char* linkConnectPath = nullptr;
+    const char* frameChannelName = nullptr;
+    const char* bootROMPath = nullptr;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--render-every") == 0 && i + 1 < argc) {
+            renderEvery = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "--skip-idle") == 0) {
+            skipIdle = true;
+        } else if (strcmp(argv[i], "--pair-profile") == 0 && i + 1 < argc) {
+            pairProfile = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--counters") == 0) {
+            showCounters = true;
+        } else if (strcmp(argv[i], "--movie") == 0 && i + 1 < argc) {
+            moviePath = argv[++i];
+        } else if (strcmp(argv[i], "--record-movie") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            inputPath = argv[++i];
+        } else if (strcmp(argv[i], "--hash-out") == 0 && i + 1 < argc) {
+            hashPath = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (strcmp(argv[i], "--profile-interval") == 0 && i + 1 < argc) {
+            profileInterval = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--serial-out") == 0) {
+            serialOut = true;
+        } else if (strcmp(argv[i], "--link-listen") == 0 && i + 1 < argc) {
+            linkListenPath = argv[++i];
+        } else if (strcmp(argv[i], "--link-connect") == 0 && i + 1 < argc) {
+            linkConnectPath = argv[++i];
+        } else if (strcmp(argv[i], "--frame-shm") == 0 && i + 1 < argc) {
+            frameChannelName = argv[++i];
+        } else if (strcmp(argv[i], "--boot-rom") == 0 && i + 1 < argc) {
+            bootROMPath = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    const bool linked = linkListenPath || linkConnectPath;
+    if (linked && (serialOut || moviePath || recordPath)) {
+        std::cerr << "a link takes the serial port; it can't be used with --serial-out or movies\n";
+        return 1;
+    }
+
+    if (moviePath && recordPath) {
+        std::cerr << "--movie and --record-movie can't be used together\n";
+        return 1;
+    }
+
+    if (inputPath && !recordPath) {
+        std::cerr << "--input needs --record-movie\n";
+        return 1;
+    }
+
+    std::vector<uint8_t> input(1, 0);
+    if (inputPath) {
+        input.clear();
+        if (!readInput(inputPath, input)) {
+            std::cerr << "could not read input " << inputPath << "\n";
+            return 1;
+        }
+    }
+
+    std::vector<uint8_t> rom;
+    if (!readFile(argv[1], rom)) {
+        std::cerr << "could not read " << argv[1] << "\n";
+        return 1;
+    }
+
+    GameBoy gameBoy(rom);
+    if (bootROMPath) {
+        std::vector<uint8_t> bootROM;
+        if (!readFile(bootROMPath, bootROM) || !gameBoy.bootROM(bootROM)) {
+            std::cerr << "could not load boot ROM " << bootROMPath << "\n";
+            return 1;
+        }
+    }
+
+    gameBoy.ppu().renderInterval((unsigned)renderEvery);
+    gameBoy.idleLoopSkip(skipIdle);
+
+    const auto serialBuffer = std::make_shared<SerialBuffer>();
+    if (serialOut) {
+        gameBoy.mmu().serial().transport(serialBuffer);
+    }
+
+    SerialLink::Ptr link;
+    if (linkListenPath) {
+        std::cerr << "waiting for a link on " << linkListenPath << "\n";
+        link = SerialSocket::listen(linkListenPath);
+    } else if (linkConnectPath) {
+        link = SerialSocket::connect(linkConnectPath);
+    }
+
+    if (linked && !link) {
+        std::cerr << "could not link up on " << (linkListenPath ? linkListenPath : linkConnectPath) << "\n";
+        return 1;
+    }
+
+    if (link) {
+        gameBoy.mmu().serial().transport(link);
+    }
+
+    if (frameChannelName) {
+        const auto channel = FrameChannel::create(frameChannelName);
+        if (!channel) {
+            std::cerr << "could not create shared memory " << frameChannelName << "\n";
+            return 1;
+        }
+
+        gameBoy.ppu().frameSink(channel);
+    }
+
+    Profiler profiler((uint32_t)profileInterval);
+    if (profilePath) {
+        gameBoy.profiler(&profiler);
+    }
+
+    const auto writeProfile = [&]() {
+        if (!profilePath) {
+            return true;
+        }
+
+        std::ofstream file(profilePath);
+        if (!file || !profiler.writeFolded(file)) {
+            std::cerr << "could not write " << profilePath << "\n";
+            return false;
+        }
+
+        std::cerr << profiler.sampleCount() << " samples written to " << profilePath << "\n";
+        return true;
+    };
+
+    std::ofstream hashFile;
+    StateHasher hasher;
+    if (hashPath) {
+        hashFile.open(hashPath, std::ios::binary);
+        if (!hashFile || !writeFrameHashHeader(hashFile)) {
+            std::cerr << "could not write " << hashPath << "\n";
+            return 1;
+        }
+    }
+
+    // Every mode ends a frame at VBlank entry, which is where hashes are taken.
+    const auto afterFrame = [&]() {
+        if (hashPath) {
+            writeFrameHashes(hashFile, hasher.hash(gameBoy));
+        }
+    };
+
+    Movie movie;
+    if (moviePath) {
+        std::ifstream file(moviePath, std::ios::binary);
+        if (!file || !movie.load(file)) {
+            std::cerr << "could not load movie " << moviePath << "\n";
+            return 1;
+        }
+    }
+
+    // Taken before anything runs, so playback can check it starts from here.
+    Movie recording(gameBoy.romHash(), gameBoy.stateHash());
+
+    int status = 0;
+    const auto start = std::chrono::steady_clock::now();
+
+    if (moviePath) {
+        const auto result = playMovie(gameBoy, movie, [&](uint32_t) { afterFrame(); });
+        frames = result.framesPlayed;
+
+        if (!result.romMatches) {
+            std::cerr << "movie was recorded against a different ROM\n";
+        } else if (!result.startMatches) {
+            std::cerr << "movie was recorded from a different start state\n";
+        } else if (!result.synced) {
+            std::cerr << "desync between frames " << result.lastGoodFrame
+                      << " and " << result.firstBadFrame << "\n";
+        }
+
+        status = result.synced ? 0 : 2;
+    } else if (recordPath) {
+        for (unsigned long frame = 0; frame < frames; frame++) {
+            recordFrame(gameBoy, recording, input[frame % input.size()]);
+            afterFrame();
+        }
+    } else if (pairProfile > 0) {
+        // Every instruction boundary has to be seen, so nothing is fused.
+        gameBoy.cpu().fusion(false);
+
+        std::vector<uint64_t> pairs(0x10000);
+        int previous = -1;
+        for (unsigned long frame = 0; frame < frames; frame++) {
+            const auto current = gameBoy.ppu().frameCount();
+            while (gameBoy.ppu().frameCount() == current) {
+                gameBoy.step();
+
+                if (gameBoy.cpu().atInstructionBoundary()) {
+                    const uint8_t opcode = gameBoy.mmu().peek(gameBoy.cpu()._programCounter);
+                    if (previous >= 0) {
+                        pairs[(previous << 8) | opcode]++;
+                    }
+                    previous = opcode;
+                }
+            }
+
+            afterFrame();
+        }
+
+        printPairs(pairs, pairProfile);
+    } else if (stats) {
+        double cpuTotal = 0;
+        double ppuTotal = 0;
+
+        std::cout << "frame,rendered,cpu_us,ppu_us\n";
+        for (unsigned long frame = 0; frame < frames; frame++) {
+            FrameCost cost;
+            gameBoy.runFrame(cost);
+            afterFrame();
+
+            cpuTotal += cost.cpuMicroseconds;
+            ppuTotal += cost.ppuMicroseconds;
+            std::cout << frame << "," << (cost.rendered ? 1 : 0) << ","
+                      << cost.cpuMicroseconds << "," << cost.ppuMicroseconds << "\n";
+        }
+
+        std::cerr << "cpu " << cpuTotal / 1000.0 << " ms, ppu " << ppuTotal / 1000.0 << " ms\n";
+    } else if (link) {
+        // Losing the link is like pulling the cable: the game carries on.
+        for (unsigned long frame = 0; frame < frames; frame++) {
+            const bool wasConnected = link->connected();
+            if (!runLinkedFrame(gameBoy, *link) && wasConnected) {
+                std::cerr << "link closed at frame " << frame << "\n";
+            }
+
+            afterFrame();
+        }
+    } else {
+        for (unsigned long frame = 0; frame < frames; frame++) {
+            gameBoy.runFrame();
+            afterFrame();
+        }
+    }
+
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << frames << " frames in " << seconds << " s ("
+              << (seconds > 0 ? frames / seconds : 0) << " fps)\n";
+
+    if (skipIdle) {
+        std::cerr << gameBoy.idleCyclesSkipped() << " of " << gameBoy.machineCycles()
+                  << " machine cycles skipped as idle\n";
+    }
+
+    if (serialOut) {
+        std::cout << serialBuffer->output();
+    }
+
+    if (showCounters) {
+        printCounters(gameBoy.counters());
+    }
+
+    if (recordPath) {
+        std::ofstream file(recordPath, std::ios::binary);
+        if (!file || !recording.save(file)) {
+            std::cerr << "could not write " << recordPath << "\n";
+            return 1;
+        }
+    }
+
+    if (!writeProfile()) {
+        return 1;
+    }
 
-int main(int, char**) {
-    std::cout << "test\n";
-    return 0;
+    return status;
 }
@@ -1,8 +1,31 @@
 #include "TestBase.H"
 
+#include "Batch.h"
+#include "Conformance.h"
+#include "FrameChannel.h"
+#include "Fuzz.h"
+#include "GameBoy.h"
+#include "JsonReader.h"
+#include "Lockstep.h"
+#include "Hash.h"
+#include "IORegisters.h"
+#include "MMU.h"
+#include "Movie.h"
+#include "OpcodeHeat.h"
 #include "Opcodes.h"
-
+#include "Profiler.h"
+#include "SerialLink.h"
+#include "SingleStep.h"
+#include "StateHasher.h"
+#include "VecEnv.h"
+
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <sstream>
+
+#include <unistd.h>
 
 // Combo Registers ////////////////////////////////////////////////////////////
 TEST_CASE("read BC") {
@@ -77,6 +100,27 @@ TEST_CASE("write HL") {
     CHECK(testCPU._regL == 0x06);
 }
 
+TEST_CASE("register file indices") {
+    WITH_CPU_AND_SIMPLE_MEMORY();
+
+    testCPU.regAF(0x0102);
+    testCPU.regBC(0x0304);
+    testCPU.regDE(0x0506);
+    testCPU.regHL(0x0708);
+
+    CHECK(testCPU.reg8(REG_B) == 0x03);
+    CHECK(testCPU.reg8(REG_C) == 0x04);
+    CHECK(testCPU.reg8(REG_D) == 0x05);
+    CHECK(testCPU.reg8(REG_E) == 0x06);
+    CHECK(testCPU.reg8(REG_H) == 0x07);
+    CHECK(testCPU.reg8(REG_L) == 0x08);
+    CHECK(testCPU.reg8(REG_A) == 0x01);
+    CHECK(testCPU._flags == 0x02);
+
+    testCPU.reg8(REG_E) = 0xff;
+    CHECK(testCPU._pairs[PAIR_DE] == 0x05ff);
+}
+
 // Flags //////////////////////////////////////////////////////////////////////
 
 TEST_CASE("rw Z") {
@@ -133,6 +177,23 @@ TEST_CASE("rw C") {
 
 // Instructions ///////////////////////////////////////////////////////////////
 
+// Machine cycles of the branches whose length depends on the timing model.
+// Accurate timing counts every access and internal cycle, as the hardware
+// takes them; otherwise a branch takes as long whether it is taken or not.
+#ifdef GB_ACCURATE_TIMING
+#define JP_TAKEN_CYCLES 4
+#define JR_TAKEN_CYCLES 3
+#define CALL_CYCLES 6
+#define RET_CYCLES 4
+#define RET_TAKEN_CYCLES 5
+#else
+#define JP_TAKEN_CYCLES 3
+#define JR_TAKEN_CYCLES 2
+#define CALL_CYCLES 3
+#define RET_CYCLES 2
+#define RET_TAKEN_CYCLES 2
+#endif
+
 TEST_CASE("load immediate") {
     WITH_CPU_AND_SIMPLE_MEMORY();
 
@@ -1363,7 +1424,7 @@ TEST_CASE("conditional jump") {
     });
 
     testCPU.zFlag(false);
-    CLOCK(12);
+    CLOCK(4 * JP_TAKEN_CYCLES);
     CHECK(testCPU._programCounter == 0x0102);
 
     testCPU._programCounter = INIT_VECTOR + 3;
@@ -1372,7 +1433,7 @@ TEST_CASE("conditional jump") {
     CHECK(testCPU._programCounter == INIT_VECTOR + 6);
 
     testCPU.zFlag(true);
-    CLOCK(12);
+    CLOCK(4 * JP_TAKEN_CYCLES);
     CHECK(testCPU._programCounter == 0x0506);
 
     testCPU._programCounter = INIT_VECTOR + 9;
@@ -1381,7 +1442,7 @@ TEST_CASE("conditional jump") {
     CHECK(testCPU._programCounter == INIT_VECTOR + 12);
 
     testCPU.cFlag(false);
-    CLOCK(12);
+    CLOCK(4 * JP_TAKEN_CYCLES);
     CHECK(testCPU._programCounter == 0x090A);
 
     testCPU._programCounter = INIT_VECTOR + 15;
@@ -1390,7 +1451,7 @@ TEST_CASE("conditional jump") {
     CHECK(testCPU._programCounter == INIT_VECTOR + 18);
 
     testCPU.cFlag(true);
-    CLOCK(12);
+    CLOCK(4 * JP_TAKEN_CYCLES);
     CHECK(testCPU._programCounter == 0x0D0E);
 
     testCPU._programCounter = INIT_VECTOR + 21;
@@ -1448,7 +1509,7 @@ TEST_CASE("conditional relative jump") {
     });
 
     testCPU.zFlag(false);
-    CLOCK(8);
+    CLOCK(4 * JR_TAKEN_CYCLES);
     CHECK(testCPU._programCounter == INIT_VECTOR + 3);
 
     testCPU._programCounter = INIT_VECTOR + 2;
@@ -1457,7 +1518,7 @@ TEST_CASE("conditional relative jump") {
     CHECK(testCPU._programCounter == INIT_VECTOR + 4);
 
     testCPU.zFlag(true);
-    CLOCK(8);
+    CLOCK(4 * JR_TAKEN_CYCLES);
     CHECK(testCPU._programCounter == INIT_VECTOR + 9);
 
     testCPU._programCounter = INIT_VECTOR + 6;
@@ -1466,7 +1527,7 @@ TEST_CASE("conditional relative jump") {
     CHECK(testCPU._programCounter == INIT_VECTOR + 8);
 
     testCPU.cFlag(false);
-    CLOCK(8);
+    CLOCK(4 * JR_TAKEN_CYCLES);
     CHECK(testCPU._programCounter == INIT_VECTOR + 15);
 
     testCPU._programCounter = INIT_VECTOR + 10;
@@ -1475,7 +1536,7 @@ TEST_CASE("conditional relative jump") {
     CHECK(testCPU._programCounter == INIT_VECTOR + 12);
 
     testCPU.cFlag(true);
-    CLOCK(8);
+    CLOCK(4 * JR_TAKEN_CYCLES);
     CHECK(testCPU._programCounter == INIT_VECTOR + 21);
 
     testCPU._programCounter = INIT_VECTOR + 14;
@@ -1515,7 +1576,7 @@ TEST_CASE("conditional call") {
     });
 
     testCPU.zFlag(false);
-    CLOCK(12);
+    CLOCK(4 * CALL_CYCLES);
     CHECK(testCPU._programCounter == 0x0102);
     CHECK(testCPU._stackPointer == INIT_STACK_POINTER - 2);
     CHECK(simpleMemory->readLI(testCPU._stackPointer) == INIT_VECTOR + 3);
@@ -1527,7 +1588,7 @@ TEST_CASE("conditional call") {
     CHECK(testCPU._stackPointer == INIT_STACK_POINTER - 2);
 
     testCPU.zFlag(true);
-    CLOCK(12);
+    CLOCK(4 * CALL_CYCLES);
     CHECK(testCPU._programCounter == 0x0506);
     CHECK(testCPU._stackPointer == INIT_STACK_POINTER - 4);
     CHECK(simpleMemory->readLI(testCPU._stackPointer) == INIT_VECTOR + 9);
@@ -1539,7 +1600,7 @@ TEST_CASE("conditional call") {
     CHECK(testCPU._stackPointer == INIT_STACK_POINTER - 4);
 
     testCPU.cFlag(false);
-    CLOCK(12);
+    CLOCK(4 * CALL_CYCLES);
     CHECK(testCPU._programCounter == 0x090A);
     CHECK(testCPU._stackPointer == INIT_STACK_POINTER - 6);
     CHECK(simpleMemory->readLI(testCPU._stackPointer) == INIT_VECTOR + 15);
@@ -1551,7 +1612,7 @@ TEST_CASE("conditional call") {
     CHECK(testCPU._stackPointer == INIT_STACK_POINTER - 6);
 
     testCPU.cFlag(true);
-    CLOCK(12);
+    CLOCK(4 * CALL_CYCLES);
     CHECK(testCPU._programCounter == 0x0D0E);
     CHECK(testCPU._stackPointer == INIT_STACK_POINTER - 8);
     CHECK(simpleMemory->readLI(testCPU._stackPointer) == INIT_VECTOR + 21);
@@ -1588,7 +1649,7 @@ TEST_CASE("return") {
         Opcode::RET,
     });
 
-    CLOCK(20);
+    CLOCK(4 * (CALL_CYCLES + RET_CYCLES));
     CHECK(testCPU._programCounter == INIT_VECTOR + 3);
 }
 
@@ -1605,7 +1666,7 @@ TEST_CASE("conditional return") {
 
     testCPU.cFlag(true);
 
-    CLOCK(20);
+    CLOCK(4 * (CALL_CYCLES + RET_TAKEN_CYCLES));
     CHECK(testCPU._programCounter == INIT_VECTOR + 3);
 
     CLOCK(8); // Should not have tried to return as C is still true
@@ -1625,7 +1686,7 @@ TEST_CASE("return and enable interrupts") {
 
     testCPU._interruptsEnabled = false;
 
-    CLOCK(20);
+    CLOCK(4 * (CALL_CYCLES + RET_CYCLES));
     CHECK(testCPU._programCounter == INIT_VECTOR + 3);
     CHECK(testCPU._interruptsEnabled == true);
 }
@@ -1971,3 +2032,1726 @@ TEST_CASE("reset") {
     CHECK(testCPU._regD == 0xf7);
     CHECK(testCPU._regE == 0xdf);
 }
+
+// Interrupts /////////////////////////////////////////////////////////////////
+
+TEST_CASE("service interrupt") {
+    WITH_CPU_AND_SIMPLE_MEMORY();
+
+    simpleMemory->write(INIT_VECTOR, {
+        Opcode::NOP,
+    });
+
+    simpleMemory->write(IO_IE, INT_VBLANK | INT_TIMER);
+    simpleMemory->write(IO_IF, INT_TIMER);
+
+    CLOCK(4);
+
+    CHECK(testCPU._programCounter == 0x0050);
+    CHECK(testCPU._interruptsEnabled == false);
+    CHECK(simpleMemory->read(IO_IF) == 0x00);
+    CHECK(simpleMemory->readLI(INIT_STACK_POINTER - 2) == INIT_VECTOR);
+}
+
+TEST_CASE("halt until interrupt") {
+    WITH_CPU_AND_SIMPLE_MEMORY();
+
+    simpleMemory->write(INIT_VECTOR, {
+        Opcode::DI,
+        Opcode::HALT,
+        Opcode::INC_A,
+    });
+
+    simpleMemory->write(IO_IE, INT_VBLANK);
+    testCPU._regA = 0;
+
+    CLOCK(64);
+    CHECK(testCPU._isHalted == true);
+    CHECK(testCPU._regA == 0);
+
+    // Interrupts are disabled, so HALT ends without a jump.
+    simpleMemory->write(IO_IF, INT_VBLANK);
+    CLOCK(8);
+    CHECK(testCPU._isHalted == false);
+    CHECK(testCPU._regA == 1);
+}
+
+// Test ROMs //////////////////////////////////////////////////////////////////
+
+// A 32 KiB cartridge with no mapper that runs program from the entry point,
+// flagged as for the CGB if cgb. Anything else goes in after.
+static std::vector<uint8_t> testROM(const std::vector<uint8_t>& program, bool cgb = false) {
+    std::vector<uint8_t> rom(0x8000);
+    rom[CGB_FLAG_ADDRESS] = cgb ? 0x80 : 0x00;
+    std::copy(program.begin(), program.end(), rom.begin() + INIT_VECTOR);
+    return rom;
+}
+
+// Memory Timing //////////////////////////////////////////////////////////////
+
+// Records each write with the number of machine cycles the CPU had run the
+// bus ahead by when it made it.
+class TimedMemory : public SimpleMemory {
+public:
+    struct TimedWrite {
+        int cycle;
+        uint16_t addr;
+        uint8_t value;
+    };
+
+    TimedMemory() : _cycle(0) { }
+
+    using SimpleMemory::write;
+
+    void write(uint16_t addr, uint8_t value) override {
+        _writes.push_back({ _cycle, addr, value });
+        SimpleMemory::write(addr, value);
+    }
+
+    void advanceMachineCycle() override {
+        _cycle++;
+    }
+
+    int _cycle;
+    std::vector<TimedWrite> _writes;
+};
+
+TEST_CASE("pushes write the high byte first") {
+    auto memory = std::make_shared<TimedMemory>();
+    CPU cpu(memory);
+
+    memory->write(INIT_VECTOR, {
+        Opcode::CALL_NN, 0x06, 0x05,
+    });
+
+    for (int i = 0; i < CLOCK_CYCLES_PER_MACHINE_CYCLE; i++) {
+        cpu.clock();
+    }
+
+    CHECK(cpu._programCounter == 0x0506);
+    REQUIRE(memory->_writes.size() == 2);
+    CHECK(memory->_writes[0].addr == INIT_STACK_POINTER - 1);
+    CHECK(memory->_writes[0].value == 0x01);
+    CHECK(memory->_writes[1].addr == INIT_STACK_POINTER - 2);
+    CHECK(memory->_writes[1].value == 0x03);
+}
+
+TEST_CASE("accesses fall on their own machine cycle") {
+    auto memory = std::make_shared<TimedMemory>();
+    CPU cpu(memory);
+    cpu.accurateTiming(true);
+
+    memory->write(INIT_VECTOR, {
+        Opcode::CALL_NN, 0x06, 0x05,
+    });
+    memory->write(0x0506, {
+        Opcode::PUSH_BC,
+        Opcode::RET,
+    });
+    cpu._regB = 0x12;
+    cpu._regC = 0x34;
+
+    auto runMachineCycles = [&](int count) {
+        for (int i = 0; i < CLOCK_CYCLES_PER_MACHINE_CYCLE * count; i++) {
+            cpu.clock();
+        }
+    };
+
+    // CALL: opcode, two operand bytes, an internal cycle, then the push.
+    runMachineCycles(5);
+    CHECK(cpu.atInstructionBoundary() == false);
+    runMachineCycles(1);
+    CHECK(cpu.atInstructionBoundary() == true);
+
+    REQUIRE(memory->_writes.size() == 2);
+    CHECK(memory->_writes[0].cycle == 4);
+    CHECK(memory->_writes[1].cycle == 5);
+
+    // PUSH: opcode, an internal cycle, then the push.
+    memory->_cycle = 0;
+    memory->_writes.clear();
+    runMachineCycles(4);
+    CHECK(cpu.atInstructionBoundary() == true);
+
+    REQUIRE(memory->_writes.size() == 2);
+    CHECK(memory->_writes[0].cycle == 2);
+    CHECK(memory->_writes[1].cycle == 3);
+
+    // RET: opcode, the pop, then an internal cycle.
+    runMachineCycles(3);
+    CHECK(cpu.atInstructionBoundary() == false);
+    runMachineCycles(1);
+    CHECK(cpu.atInstructionBoundary() == true);
+    CHECK(cpu._programCounter == 0x1234);
+}
+
+TEST_CASE("both timings run side by side") {
+    std::shared_ptr<TimedMemory> memories[2] = {
+        std::make_shared<TimedMemory>(),
+        std::make_shared<TimedMemory>(),
+    };
+    CPU fast(memories[0]);
+    CPU accurate(memories[1]);
+    fast.accurateTiming(false);
+    accurate.accurateTiming(true);
+
+    for (auto& memory : memories) {
+        memory->write(INIT_VECTOR, {
+            Opcode::CALL_NN, 0x06, 0x05,
+        });
+    }
+
+    int fastCycles = 0;
+    int accurateCycles = 0;
+    do {
+        for (int i = 0; i < CLOCK_CYCLES_PER_MACHINE_CYCLE; i++) {
+            fast.clock();
+        }
+        fastCycles++;
+    } while (!fast.atInstructionBoundary());
+    do {
+        for (int i = 0; i < CLOCK_CYCLES_PER_MACHINE_CYCLE; i++) {
+            accurate.clock();
+        }
+        accurateCycles++;
+    } while (!accurate.atInstructionBoundary());
+
+    CHECK(fastCycles == 3);
+    CHECK(accurateCycles == 6);
+    CHECK(memories[0]->_cycle == 0);
+    CHECK(memories[1]->_cycle == 5);
+
+    CHECK(fast._programCounter == accurate._programCounter);
+    CHECK(fast._stackPointer == accurate._stackPointer);
+    REQUIRE(memories[0]->_writes.size() == 2);
+    REQUIRE(memories[1]->_writes.size() == 2);
+    for (int i = 0; i < 2; i++) {
+        CHECK(memories[0]->_writes[i].addr == memories[1]->_writes[i].addr);
+        CHECK(memories[0]->_writes[i].value == memories[1]->_writes[i].value);
+    }
+}
+
+TEST_CASE("frames pick the timing once") {
+    // Fills WRAM through a subroutine that uses the stack, so the accurate bus
+    // is run ahead by the CPU inside most instructions.
+    const auto rom = testROM({
+        0x21, 0x00, 0xc0,       // LD HL, 0xc000
+        0x22, 0x3c,             // loop: LD (HL+), A; INC A
+        0xcd, 0x0b, 0x01,       // CALL sub
+        0x18, 0xf9,             // JR loop
+        0x00,
+        0xc5, 0xc1, 0xc9,       // sub: PUSH BC; POP BC; RET
+    });
+
+    for (int accurate = 0; accurate < 2; accurate++) {
+        GameBoy framed(rom);
+        GameBoy stepped(rom);
+        framed.cpu().accurateTiming(accurate != 0);
+        stepped.cpu().accurateTiming(accurate != 0);
+
+        for (int frame = 0; frame < 2; frame++) {
+            framed.runFrame();
+
+            const auto count = stepped.ppu().frameCount();
+            while (stepped.ppu().frameCount() == count) {
+                stepped.step();
+            }
+
+            REQUIRE(framed.machineCycles() == stepped.machineCycles());
+            REQUIRE(framed.stateHash() == stepped.stateHash());
+        }
+
+        CHECK(framed.mmu().read(0xc001) == (uint8_t)(framed.mmu().read(0xc000) + 1));
+    }
+}
+
+// PPU ////////////////////////////////////////////////////////////////////////
+
+#define WITH_MMU() \
+    MMU mmu(std::vector<uint8_t>(0x8000)); \
+    mmu.write(IO_LCDC, 0x91); \
+
+TEST_CASE("ppu mode timing") {
+    WITH_MMU();
+
+    PPU& ppu = mmu.ppu();
+    CHECK(ppu._mode == PPU::OAM_SCAN);
+
+    for (int i = 0; i < OAM_SCAN_DOTS; i++) mmu.clock();
+    CHECK(ppu._mode == PPU::PIXEL_TRANSFER);
+    CHECK(mmu.read(0x8000) == 0xff);
+
+    for (int i = 0; i < PIXEL_TRANSFER_DOTS; i++) mmu.clock();
+    CHECK(ppu._mode == PPU::HBLANK);
+
+    for (int i = OAM_SCAN_DOTS + PIXEL_TRANSFER_DOTS; i < DOTS_PER_LINE; i++) mmu.clock();
+    CHECK(mmu.read(IO_LY) == 1);
+    CHECK(ppu._mode == PPU::OAM_SCAN);
+
+    for (int i = DOTS_PER_LINE; i < DOTS_PER_LINE * SCREEN_HEIGHT; i++) mmu.clock();
+    CHECK(mmu.read(IO_LY) == SCREEN_HEIGHT);
+    CHECK(ppu._mode == PPU::VBLANK);
+    CHECK((mmu.read(IO_IF) & INT_VBLANK) != 0);
+    CHECK(ppu.frameCount() == 1);
+}
+
+TEST_CASE("ppu LYC interrupt") {
+    WITH_MMU();
+
+    mmu.write(IO_LYC, 2);
+    mmu.write(IO_STAT, 0x40);
+
+    for (int i = 0; i < DOTS_PER_LINE * 2 - 1; i++) mmu.clock();
+    CHECK((mmu.read(IO_IF) & INT_LCD_STAT) == 0);
+
+    mmu.clock();
+    CHECK((mmu.read(IO_IF) & INT_LCD_STAT) != 0);
+    CHECK((mmu.read(IO_STAT) & 0x04) != 0);
+}
+
+TEST_CASE("render skip keeps timing") {
+    MMU rendered(std::vector<uint8_t>(0x8000));
+    MMU skipped(std::vector<uint8_t>(0x8000));
+    skipped.ppu().renderInterval(0);
+
+    for (auto mmu : { &rendered, &skipped }) {
+        // Tile 1 solid color 3, drawn at the top left of the background map.
+        for (uint16_t i = 0; i < 16; i++) {
+            mmu->write(0x8010 + i, 0xff);
+        }
+        mmu->write(0x9800, 0x01);
+        mmu->write(IO_STAT, 0x68);
+        mmu->write(IO_LYC, 0x10);
+        mmu->write(IO_LCDC, 0x91);
+    }
+
+    for (int i = 0; i < DOTS_PER_FRAME * 2; i++) {
+        rendered.clock();
+        skipped.clock();
+
+        REQUIRE(rendered.read(IO_LY) == skipped.read(IO_LY));
+        REQUIRE(rendered.read(IO_STAT) == skipped.read(IO_STAT));
+        REQUIRE(rendered.read(IO_IF) == skipped.read(IO_IF));
+    }
+
+    CHECK(rendered.ppu().framebuffer()[0] == 0xff000000);
+    CHECK(skipped.ppu().framebuffer()[0] == 0xffffffff);
+    CHECK(rendered.ppu().frameRendered() == true);
+    CHECK(skipped.ppu().frameRendered() == false);
+}
+
+TEST_CASE("render every Nth frame") {
+    WITH_MMU();
+
+    mmu.ppu().renderInterval(3);
+
+    int renderedFrames = 0;
+    for (int frame = 0; frame < 9; frame++) {
+        const auto count = mmu.ppu().frameCount();
+        while (mmu.ppu().frameCount() == count) {
+            mmu.clock();
+        }
+
+        renderedFrames += mmu.ppu().frameRendered() ? 1 : 0;
+    }
+
+    CHECK(renderedFrames == 3);
+}
+
+// Joypad /////////////////////////////////////////////////////////////////////
+
+TEST_CASE("joypad register") {
+    WITH_MMU();
+
+    mmu.joypad().buttons(Joypad::BUTTON_A | Joypad::BUTTON_DOWN);
+
+    mmu.write(IO_P1, 0x30);
+    CHECK(mmu.read(IO_P1) == 0xff);
+
+    mmu.write(IO_P1, 0x20); // Directions
+    CHECK(mmu.read(IO_P1) == 0xe7);
+
+    mmu.write(IO_P1, 0x10); // Buttons
+    CHECK(mmu.read(IO_P1) == 0xde);
+}
+
+TEST_CASE("joypad interrupt") {
+    WITH_MMU();
+
+    mmu.write(IO_P1, 0x10);
+    mmu.joypad().buttons(Joypad::BUTTON_UP);
+    CHECK((mmu.read(IO_IF) & INT_JOYPAD) == 0);
+
+    mmu.joypad().buttons(Joypad::BUTTON_UP | Joypad::BUTTON_START);
+    CHECK((mmu.read(IO_IF) & INT_JOYPAD) != 0);
+}
+
+// Serial /////////////////////////////////////////////////////////////////////
+
+// Prints "ok" over serial the way test ROMs report results, waiting on SC for
+// each byte to go.
+static std::vector<uint8_t> serialPrintROM() {
+    auto rom = testROM({
+        0x21, 0x00, 0x02,       // LD HL, 0x0200
+        0x2a, 0xb7, 0x28, 0x0e, // next: LD A, (HL+); OR A; JR Z, done
+        0xe0, 0x01,             // LDH (SB), A
+        0x3e, 0x81, 0xe0, 0x02, // LD A, 0x81; LDH (SC), A
+        0xf0, 0x02, 0xcb, 0x7f, // wait: LDH A, (SC); BIT 7, A
+        0x20, 0xfa,             // JR NZ, wait
+        0x18, 0xee,             // JR next
+        0x18, 0xfe,             // done: JR done
+    });
+
+    rom[0x200] = 'o';
+    rom[0x201] = 'k';
+    return rom;
+}
+
+TEST_CASE("serial capture") {
+    const auto rom = serialPrintROM();
+    GameBoy running(rom);
+    GameBoy skipping(rom);
+    skipping.idleLoopSkip(true);
+
+    const auto runningOutput = std::make_shared<SerialBuffer>();
+    const auto skippingOutput = std::make_shared<SerialBuffer>();
+    running.mmu().serial().transport(runningOutput);
+    skipping.mmu().serial().transport(skippingOutput);
+
+    for (int frame = 0; frame < 2; frame++) {
+        running.runFrame();
+        skipping.runFrame();
+
+        REQUIRE(skipping.machineCycles() == running.machineCycles());
+        REQUIRE(skipping.stateHash() == running.stateHash());
+    }
+
+    CHECK(runningOutput->output() == "ok");
+    CHECK(skippingOutput->output() == "ok");
+    CHECK(skipping.idleCyclesSkipped() > 0);
+    CHECK((running.mmu().read(IO_IF) & INT_SERIAL) != 0);
+
+    // Unplugged, bytes still go; they just come back as 0xff.
+    GameBoy unplugged(rom);
+    unplugged.runFrame();
+    CHECK(unplugged.mmu().read(IO_SB) == 0xff);
+}
+
+// Swaps 64 bytes over the link and stores what comes back at 0xc000. The
+// master clocks out 0, 1, 2... and the slave answers 0x80, 0x81, 0x82...
+// Optionally with the LCD off, so only the link bounds skipped idle loops.
+static std::vector<uint8_t> serialExchangeROM(bool master, bool lcdOff = false) {
+    const std::vector<uint8_t> lcdOffProgram = {
+        0xaf, 0xe0, 0x40,             // XOR A; LDH (LCDC), A
+    };
+    const std::vector<uint8_t> masterProgram = {
+        0x21, 0x00, 0xc0, 0x06, 0x00, // LD HL, 0xc000; LD B, 0
+        0x78, 0xe0, 0x01,             // loop: LD A, B; LDH (SB), A
+        0x3e, 0x81, 0xe0, 0x02,       // LD A, 0x81; LDH (SC), A
+        0xf0, 0x02, 0xcb, 0x7f,       // wait: LDH A, (SC); BIT 7, A
+        0x20, 0xfa,                   // JR NZ, wait
+        0xf0, 0x01, 0x22, 0x04,       // LDH A, (SB); LD (HL+), A; INC B
+        0x78, 0xfe, 0x40, 0x20, 0xea, // LD A, B; CP 0x40; JR NZ, loop
+        0x18, 0xfe,                   // JR -2
+    };
+    const std::vector<uint8_t> slaveProgram = {
+        0x21, 0x00, 0xc0, 0x06, 0x00, // LD HL, 0xc000; LD B, 0
+        0x78, 0xf6, 0x80, 0xe0, 0x01, // loop: LD A, B; OR 0x80; LDH (SB), A
+        0x3e, 0x80, 0xe0, 0x02,       // LD A, 0x80; LDH (SC), A
+        0xf0, 0x02, 0xcb, 0x7f,       // wait: LDH A, (SC); BIT 7, A
+        0x20, 0xfa,                   // JR NZ, wait
+        0xf0, 0x01, 0x22, 0x04,       // LDH A, (SB); LD (HL+), A; INC B
+        0x78, 0xfe, 0x40, 0x20, 0xe8, // LD A, B; CP 0x40; JR NZ, loop
+        0x18, 0xfe,                   // JR -2
+    };
+
+    std::vector<uint8_t> program = lcdOff ? lcdOffProgram : std::vector<uint8_t>();
+    const auto& exchange = master ? masterProgram : slaveProgram;
+    program.insert(program.end(), exchange.begin(), exchange.end());
+    return testROM(program);
+}
+
+TEST_CASE("serial pair") {
+    // Whichever machine drives the run, each sees the same bytes at the same
+    // machine cycle.
+    uint64_t hashes[2][2];
+    for (int masterFirst = 0; masterFirst < 2; masterFirst++) {
+        GameBoy master(serialExchangeROM(true));
+        GameBoy slave(serialExchangeROM(false));
+
+        SerialLink::Ptr masterLink, slaveLink;
+        makeSerialPair(masterLink, slaveLink);
+        master.mmu().serial().transport(masterLink);
+        slave.mmu().serial().transport(slaveLink);
+
+        GameBoy& first = masterFirst ? master : slave;
+        GameBoy& second = masterFirst ? slave : master;
+        SerialLink& firstLink = masterFirst ? *masterLink : *slaveLink;
+        SerialLink& secondLink = masterFirst ? *slaveLink : *masterLink;
+
+        for (int frame = 0; frame < 8; frame++) {
+            REQUIRE(runLinkedFrame(first, firstLink, second, secondLink));
+        }
+
+        // Run both to the same point before comparing.
+        while (second.machineCycles() < first.machineCycles()) {
+            second.step();
+        }
+
+        for (int i = 0; i < 0x40; i++) {
+            REQUIRE(master.mmu().read(0xc000 + i) == (0x80 | i));
+            REQUIRE(slave.mmu().read(0xc000 + i) == i);
+        }
+
+        hashes[masterFirst][0] = master.stateHash();
+        hashes[masterFirst][1] = slave.stateHash();
+        CHECK(master.machineCycles() == slave.machineCycles());
+    }
+
+    CHECK(hashes[0][0] == hashes[1][0]);
+    CHECK(hashes[0][1] == hashes[1][1]);
+}
+
+TEST_CASE("serial pair skipping idle loops") {
+    // Both ends wait on the link for most of the run, which skipping must not
+    // jump past: each sync has to land on the same machine cycle either way.
+    for (int lcdOff = 0; lcdOff < 2; lcdOff++) {
+        GameBoy runningMaster(serialExchangeROM(true, lcdOff));
+        GameBoy runningSlave(serialExchangeROM(false, lcdOff));
+        GameBoy skippingMaster(serialExchangeROM(true, lcdOff));
+        GameBoy skippingSlave(serialExchangeROM(false, lcdOff));
+
+        GameBoy* masters[2] = { &runningMaster, &skippingMaster };
+        GameBoy* slaves[2] = { &runningSlave, &skippingSlave };
+        SerialLink::Ptr masterLinks[2], slaveLinks[2];
+
+        for (int skip = 0; skip < 2; skip++) {
+            makeSerialPair(masterLinks[skip], slaveLinks[skip]);
+            masters[skip]->mmu().serial().transport(masterLinks[skip]);
+            slaves[skip]->mmu().serial().transport(slaveLinks[skip]);
+            masters[skip]->idleLoopSkip(skip != 0);
+            slaves[skip]->idleLoopSkip(skip != 0);
+        }
+
+        for (int frame = 0; frame < 8; frame++) {
+            for (int skip = 0; skip < 2; skip++) {
+                REQUIRE(runLinkedFrame(*masters[skip], *masterLinks[skip], *slaves[skip], *slaveLinks[skip]));
+            }
+
+            REQUIRE(masters[1]->machineCycles() == masters[0]->machineCycles());
+            REQUIRE(slaves[1]->machineCycles() == slaves[0]->machineCycles());
+            REQUIRE(masters[1]->stateHash() == masters[0]->stateHash());
+            REQUIRE(slaves[1]->stateHash() == slaves[0]->stateHash());
+        }
+
+        CHECK(masters[1]->idleCyclesSkipped() > 0);
+        CHECK(slaves[1]->idleCyclesSkipped() > 0);
+        for (int i = 0; i < 0x40; i++) {
+            REQUIRE(masters[1]->mmu().read(0xc000 + i) == (0x80 | i));
+        }
+    }
+}
+
+// Conformance ////////////////////////////////////////////////////////////////
+
+TEST_CASE("conformance verdicts") {
+    // Fibonacci registers, then LD B,B.
+    const auto registers = runConformance(testROM({
+        0x06, 0x03, 0x0e, 0x05, 0x16, 0x08, // LD B, 3; LD C, 5; LD D, 8
+        0x1e, 0x0d, 0x26, 0x15, 0x2e, 0x22, // LD E, 13; LD H, 21; LD L, 34
+        0x40, 0x18, 0xfe,                   // LD B, B; JR -2
+    }), 10);
+    CHECK(registers.verdict == VERDICT_PASS);
+    CHECK(registers.detector == "registers");
+
+    const auto failedRegisters = runConformance(testROM({
+        0x3e, 0x42, 0x47, 0x4f, 0x57, 0x5f, 0x67, 0x6f, // LD A, 0x42; LD B..L, A
+        0x40, 0x18, 0xfe,
+    }), 10);
+    CHECK(failedRegisters.verdict == VERDICT_FAIL);
+
+    // Status 0 behind the signature, with a message.
+    const auto signature = runConformance(testROM({
+        0x21, 0x00, 0xa0, 0x36, 0x80, 0x23, // LD HL, 0xa000; LD (HL), 0x80; INC HL
+        0x36, 0xde, 0x23, 0x36, 0xb0, 0x23, // signature
+        0x36, 0x61, 0x23, 0x36, 0x4f, 0x23, // ...; "O"
+        0x36, 0x4b, 0xaf, 0xea, 0x00, 0xa0, // "K"; XOR A; LD (0xa000), A
+        0x18, 0xfe,
+    }), 10);
+    CHECK(signature.verdict == VERDICT_PASS);
+    CHECK(signature.detector == "signature");
+    CHECK(signature.output == "OK");
+
+    auto serialROM = serialPrintROM();
+    const char failed[] = "Failed";
+    std::copy(failed, failed + sizeof(failed), serialROM.begin() + 0x200);
+    const auto serial = runConformance(serialROM, 10);
+    CHECK(serial.verdict == VERDICT_FAIL);
+    CHECK(serial.detector == "serial");
+    CHECK(serial.output == "Failed");
+
+    const auto timeout = runConformance(testROM({ 0x18, 0xfe }), 3);
+    CHECK(timeout.verdict == VERDICT_TIMEOUT);
+    CHECK(timeout.frames == 3);
+}
+
+// Single Step Vectors ////////////////////////////////////////////////////////
+
+TEST_CASE("json reader") {
+    const std::string json = " {\"a\": [1, -2, {\"x\": null}], \"b\": \"s\\\"t\", \"c\": true} ";
+    JsonReader reader(json.data(), json.data() + json.size());
+
+    JsonString key;
+    int64_t value;
+    CHECK(reader.beginObject());
+    CHECK(reader.nextMember(key));
+    CHECK(key == "a");
+    CHECK(reader.beginArray());
+    CHECK(reader.nextElement());
+    CHECK(reader.readInteger(value));
+    CHECK(value == 1);
+    CHECK(reader.nextElement());
+    CHECK(reader.readInteger(value));
+    CHECK(value == -2);
+    CHECK(reader.nextElement());
+    CHECK(reader.skipValue());
+    CHECK_FALSE(reader.nextElement());
+    CHECK(reader.nextMember(key));
+    CHECK(key == "b");
+    CHECK(reader.skipValue());
+    CHECK(reader.nextMember(key));
+    CHECK(key != "b");
+    CHECK(reader.skipValue());
+    CHECK_FALSE(reader.nextMember(key));
+    CHECK(reader.atEnd());
+
+    const std::string broken = "[1, 2";
+    JsonReader brokenReader(broken.data(), broken.data() + broken.size());
+    CHECK(brokenReader.skipValue() == false);
+    CHECK(brokenReader.failed());
+}
+
+TEST_CASE("single step vectors") {
+    // LD B,C; then INC A with the wrong flags expected; then SWAP A.
+    const std::string json = R"([
+        {"name": "41 0000",
+         "initial": {"pc": 256, "sp": 65534, "a": 0, "b": 1, "c": 2, "d": 0, "e": 0, "f": 0, "h": 0, "l": 0,
+                     "ime": 0, "ram": [[256, 65]]},
+         "final": {"pc": 257, "sp": 65534, "a": 0, "b": 2, "c": 2, "d": 0, "e": 0, "f": 0, "h": 0, "l": 0,
+                   "ime": 0, "ram": [[256, 65]]},
+         "cycles": [[256, 65, "r-m"]]},
+        {"name": "3c 0000",
+         "initial": {"pc": 256, "sp": 65534, "a": 15, "b": 0, "c": 0, "d": 0, "e": 0, "f": 0, "h": 0, "l": 0,
+                     "ime": 0, "ram": [[256, 60]]},
+         "final": {"pc": 257, "sp": 65534, "a": 16, "b": 0, "c": 0, "d": 0, "e": 0, "f": 0, "h": 0, "l": 0,
+                   "ime": 0, "ram": [[256, 60]]},
+         "cycles": [[256, 60, "r-m"]]},
+        {"name": "cb 37 0000",
+         "initial": {"pc": 256, "sp": 65534, "a": 18, "b": 0, "c": 0, "d": 0, "e": 0, "f": 0, "h": 0, "l": 0,
+                     "ime": 0, "ram": [[256, 203], [257, 55]]},
+         "final": {"pc": 258, "sp": 65534, "a": 33, "b": 0, "c": 0, "d": 0, "e": 0, "f": 0, "h": 0, "l": 0,
+                   "ime": 0, "ram": [[256, 203], [257, 55]]},
+         "cycles": [[256, 203, "r-m"], [257, 55, "r-m"]]}
+    ])";
+
+    SingleStepRunner runner;
+    std::vector<SingleStepTally> tallies(SINGLE_STEP_OPCODES);
+    CHECK(runner.runFile(json.data(), json.data() + json.size(), tallies));
+
+    CHECK(tallies[Opcode::LD_B_C].passed == 1);
+    CHECK(tallies[Opcode::INC_A].failed == 1);
+    CHECK(tallies[Opcode::INC_A].firstFailure == "3c 0000: f: expected $00, got $20");
+    CHECK(tallies[0x100 + 0x37].passed == 1);
+
+    // A file cut short is malformed, not just short of cases.
+    const std::string truncated = json.substr(0, json.size() / 2);
+    CHECK_FALSE(runner.runFile(truncated.data(), truncated.data() + truncated.size(), tallies));
+}
+
+// Movies /////////////////////////////////////////////////////////////////////
+
+TEST_CASE("hash64") {
+    CHECK(hash64("", 0) == 0xef46db3751d8e999ULL);
+    CHECK(hash64("a", 1) == 0xd24ec4f1a98c6e5bULL);
+    CHECK(hash64("abc", 3) == 0x44bc2cf5ad770999ULL);
+}
+
+// Polls the joypad once a frame and accumulates it into WRAM.
+static std::vector<uint8_t> joypadTestROM() {
+    auto rom = testROM({
+        0x3e, 0x91, 0xe0, 0x40, // LD A, 0x91; LDH (LCDC), A
+        0x3e, 0x01, 0xe0, 0xff, // LD A, 0x01; LDH (IE), A
+        0xfb,                   // EI
+        0x76,                   // HALT
+        0x18, 0xfd,             // JR -3
+    });
+    const uint8_t handler[] = {
+        0x3e, 0x10, 0xe0, 0x00, // LD A, 0x10; LDH (P1), A
+        0xf0, 0x00,             // LDH A, (P1)
+        0x21, 0x00, 0xc0,       // LD HL, 0xc000
+        0x86, 0x77,             // ADD A, (HL); LD (HL), A
+        0xd9,                   // RETI
+    };
+
+    std::copy(handler, handler + sizeof(handler), rom.begin() + 0x40);
+    return rom;
+}
+
+TEST_CASE("movie round trip") {
+    GameBoy gameBoy(joypadTestROM());
+    Movie movie(gameBoy.romHash(), gameBoy.stateHash(), 4);
+
+    for (int i = 0; i < 20; i++) {
+        recordFrame(gameBoy, movie, i < 10 ? Joypad::BUTTON_A : Joypad::BUTTON_START);
+    }
+
+    CHECK(movie._runs.size() == 2);
+    CHECK(movie._checkpoints.size() == 5);
+
+    std::stringstream stream;
+    CHECK(movie.save(stream));
+
+    Movie loaded;
+    CHECK(loaded.load(stream));
+    CHECK(loaded.frameCount() == 20);
+
+    GameBoy replay(joypadTestROM());
+    const auto result = playMovie(replay, loaded);
+    CHECK(result.synced);
+    CHECK(result.framesPlayed == 20);
+    CHECK(replay.stateHash() == gameBoy.stateHash());
+}
+
+TEST_CASE("movie checkpoint interval of 0") {
+    GameBoy gameBoy(joypadTestROM());
+    Movie movie(gameBoy.romHash(), gameBoy.stateHash(), 0);
+    CHECK(movie._checkpointInterval == 1);
+
+    for (int i = 0; i < 3; i++) {
+        recordFrame(gameBoy, movie, 0);
+    }
+
+    CHECK(movie._checkpoints.size() == 3);
+}
+
+TEST_CASE("movie desync") {
+    GameBoy gameBoy(joypadTestROM());
+    Movie movie(gameBoy.romHash(), gameBoy.stateHash(), 4);
+
+    for (int i = 0; i < 20; i++) {
+        recordFrame(gameBoy, movie, Joypad::BUTTON_A);
+    }
+
+    // Same movie, but with input that diverges partway through frame 10.
+    Movie edited(movie._romHash, movie._startStateHash, 4);
+    for (int i = 0; i < 20; i++) {
+        edited.append(i == 9 ? Joypad::BUTTON_B : Joypad::BUTTON_A);
+    }
+    edited._checkpoints = movie._checkpoints;
+
+    GameBoy replay(joypadTestROM());
+    const auto result = playMovie(replay, edited);
+    CHECK(result.synced == false);
+    CHECK(result.lastGoodFrame == 8);
+    CHECK(result.firstBadFrame == 12);
+}
+
+// State Hashing //////////////////////////////////////////////////////////////
+
+TEST_CASE("block hash paths agree") {
+    std::vector<uint8_t> data(1024);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)(i * 131 + (i >> 3));
+    }
+
+    for (size_t length : { 0, 1, 63, 64, 65, 127, 160, 256, 1024 }) {
+        CHECK(blockHash(data.data(), length) == blockHashScalar(data.data(), length));
+    }
+
+    CHECK(blockHash(data.data(), 64) != blockHash(data.data() + 1, 64));
+}
+
+TEST_CASE("incremental state hash") {
+    GameBoy gameBoy(std::vector<uint8_t>(0x8000));
+    StateHasher hasher;
+
+    const auto initial = hasher.hash(gameBoy);
+
+    gameBoy.mmu().write(0xd123, 0x42);
+    const auto written = hasher.hash(gameBoy);
+    CHECK(written.regions[StateHasher::REGION_WRAM] != initial.regions[StateHasher::REGION_WRAM]);
+    CHECK(written.regions[StateHasher::REGION_VRAM] == initial.regions[StateHasher::REGION_VRAM]);
+    CHECK(written.regions[StateHasher::REGION_HRAM] == initial.regions[StateHasher::REGION_HRAM]);
+    CHECK(gameBoy.mmu()._dirtyPages[WRAM_PAGE_BASE + 0x11] == 0);
+
+    // A fresh hasher sees every page; it must agree with the cached one.
+    gameBoy.mmu().markAllDirty();
+    StateHasher fresh;
+    const auto full = fresh.hash(gameBoy);
+    for (int region = 0; region < StateHasher::REGION_COUNT; region++) {
+        CHECK(full.regions[region] == written.regions[region]);
+    }
+}
+
+TEST_CASE("frame hash stream") {
+    StateHasher::FrameHashes hashes;
+    for (int region = 0; region < StateHasher::REGION_COUNT; region++) {
+        hashes.regions[region] = 0x0102030405060708ULL * (region + 1);
+    }
+
+    std::stringstream stream;
+    CHECK(writeFrameHashHeader(stream));
+    CHECK(writeFrameHashes(stream, hashes));
+    CHECK(writeFrameHashes(stream, hashes));
+
+    std::vector<StateHasher::FrameHashes> frames;
+    CHECK(readFrameHashStream(stream, frames));
+    REQUIRE(frames.size() == 2);
+    CHECK(frames[1].regions[StateHasher::REGION_OAM] == hashes.regions[StateHasher::REGION_OAM]);
+}
+
+// Save States ////////////////////////////////////////////////////////////////
+
+TEST_CASE("save state resumes exactly") {
+    GameBoy gameBoy(joypadTestROM());
+    for (int frame = 0; frame < 3; frame++) {
+        gameBoy.mmu().joypad().buttons(Joypad::BUTTON_A);
+        gameBoy.runFrame();
+    }
+
+    // Part way through an instruction and a frame.
+    for (int i = 0; i < 1001; i++) {
+        gameBoy.step();
+    }
+
+    std::vector<uint8_t> state;
+    gameBoy.saveState(state);
+    const uint64_t savedHash = gameBoy.stateHash();
+
+    GameBoy restored(joypadTestROM());
+    REQUIRE(restored.loadState(state));
+    CHECK(restored.stateHash() == savedHash);
+    CHECK(restored.machineCycles() == gameBoy.machineCycles());
+
+    for (int frame = 0; frame < 5; frame++) {
+        gameBoy.mmu().joypad().buttons(Joypad::BUTTON_B);
+        restored.mmu().joypad().buttons(Joypad::BUTTON_B);
+        gameBoy.runFrame();
+        restored.runFrame();
+    }
+
+    CHECK(restored.stateHash() == gameBoy.stateHash());
+    CHECK(restored.machineCycles() == gameBoy.machineCycles());
+    CHECK(memcmp(restored.ppu().framebuffer(), gameBoy.ppu().framebuffer(),
+        SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t)) == 0);
+
+    // And back again.
+    REQUIRE(gameBoy.loadState(state));
+    CHECK(gameBoy.stateHash() == savedHash);
+}
+
+TEST_CASE("save state rejects what doesn't fit") {
+    GameBoy gameBoy(joypadTestROM());
+    gameBoy.runFrame();
+    const uint64_t hash = gameBoy.stateHash();
+
+    std::vector<uint8_t> state;
+    GameBoy(std::vector<uint8_t>(0x8000)).saveState(state);
+    CHECK_FALSE(gameBoy.loadState(state));
+    CHECK(gameBoy.stateHash() == hash);
+
+    state.clear();
+    gameBoy.saveState(state);
+    state.pop_back();
+    CHECK_FALSE(gameBoy.loadState(state));
+
+    state.clear();
+    gameBoy.saveState(state);
+    state[0] ^= 0xff;
+    CHECK_FALSE(gameBoy.loadState(state));
+    CHECK(gameBoy.stateHash() == hash);
+}
+
+// Perf Counters //////////////////////////////////////////////////////////////
+
+TEST_CASE("perf counters") {
+    std::vector<uint8_t> rom(4 * ROM_BANK_SIZE);
+    rom[CARTRIDGE_TYPE_ADDRESS] = 0x01;
+    MMU mmu(rom);
+
+    mmu.read(0x0100);
+    mmu.read(0x4000);
+    mmu.write(0xc000, 0x12);
+    mmu.write(0x2000, 0x02);
+    mmu.write(0x2000, 0x02);
+
+    const auto counters = mmu.counters();
+
+#ifdef GB_PERF_COUNTERS
+    CHECK(counters.reads[BUS_ROM0] == 1);
+    CHECK(counters.reads[BUS_ROMX] == 1);
+    CHECK(counters.writes[BUS_WRAM] == 1);
+    CHECK(counters.writes[BUS_ROM0] == 2);
+    CHECK(counters.bankSwitches == 1);
+
+    mmu.resetCounters();
+    CHECK(mmu.counters().reads[BUS_ROM0] == 0);
+
+    // The emulator's own looks at memory aren't the program's traffic.
+    mmu.peek(0x0100);
+    mmu.peek(IO_IF);
+    CHECK(mmu.counters().reads[BUS_ROM0] == 0);
+    CHECK(mmu.counters().reads[BUS_IO] == 0);
+#else
+    // Compiled out: the snapshot is always empty.
+    CHECK(counters.reads[BUS_ROM0] == 0);
+    CHECK(counters.bankSwitches == 0);
+#endif
+}
+
+TEST_CASE("perf counters opcodes") {
+    WITH_CPU_AND_SIMPLE_MEMORY();
+
+    simpleMemory->write(INIT_VECTOR, {
+        Opcode::NOP,
+        Opcode::NOP,
+        Opcode::INC_A,
+    });
+
+    CLOCK(12);
+
+    const auto counters = testCPU.counters();
+
+#ifdef GB_PERF_COUNTERS
+    CHECK(counters.opcodes[Opcode::NOP] == 2);
+    CHECK(counters.opcodes[Opcode::INC_A] == 1);
+#else
+    CHECK(counters.opcodes[Opcode::NOP] == 0);
+#endif
+}
+
+// Profiler ///////////////////////////////////////////////////////////////////
+
+TEST_CASE("profiler call stacks") {
+    WITH_CPU_AND_SIMPLE_MEMORY();
+
+    Profiler profiler(1);
+    testCPU.profiler(&profiler);
+
+    simpleMemory->write(INIT_VECTOR, {
+        Opcode::CALL_NN, 0x00, 0x02,
+        Opcode::NOP,
+    });
+    simpleMemory->write(0x0200, {
+        Opcode::RST_08,
+        Opcode::RET,
+    });
+    simpleMemory->write(0x0008, {
+        Opcode::RET,
+    });
+
+    // RST takes 4 machine cycles either way.
+    CLOCK(4 * CALL_CYCLES);
+    CHECK(profiler.depth() == 1);
+    CLOCK(4 * 4);
+    CHECK(profiler.depth() == 2);
+    CLOCK(4 * RET_CYCLES);
+    CHECK(profiler.depth() == 1);
+    CLOCK(4 * RET_CYCLES);
+    CHECK(profiler.depth() == 0);
+
+    std::stringstream folded;
+    CHECK(profiler.writeFolded(folded));
+
+    const auto output = folded.str();
+    CHECK(output.find("00:0200;00:0008;00:0008 ") != std::string::npos);
+    CHECK(profiler.sampleCount() == CALL_CYCLES + 4 + 2 * RET_CYCLES);
+
+    testCPU.profiler(nullptr);
+}
+
+TEST_CASE("profiler unwinds by stack pointer") {
+    Profiler profiler;
+
+    profiler.enter(0x0200, 0xfffc);
+    profiler.enter(0x4100, 0xfffa);
+    profiler.enter(0x4200, 0xfff8);
+    CHECK(profiler.depth() == 3);
+
+    // Returning straight to the outermost caller drops everything inside it.
+    profiler.leave(0xfffe);
+    CHECK(profiler.depth() == 0);
+}
+
+// Idle Loops /////////////////////////////////////////////////////////////////
+
+// Counts frames into 0xc000 by polling LY for the start of VBlank, optionally
+// also counting polls in B, which makes the loop do real work.
+static std::vector<uint8_t> pollingTestROM(bool countPolls) {
+    const std::vector<uint8_t> idle = {
+        0x3e, 0x91, 0xe0, 0x40, // LD A, 0x91; LDH (LCDC), A
+        0x21, 0x00, 0xc0,       // LD HL, 0xc000
+        0xf0, 0x44, 0xfe, 0x90, // loop: LDH A, (LY); CP 0x90
+        0x20, 0xfa,             // JR NZ, loop
+        0x34,                   // INC (HL)
+        0xf0, 0x44, 0xfe, 0x90, // wait: LDH A, (LY); CP 0x90
+        0x28, 0xfa,             // JR Z, wait
+        0x18, 0xf1,             // JR loop
+    };
+    const std::vector<uint8_t> busy = {
+        0x3e, 0x91, 0xe0, 0x40, // LD A, 0x91; LDH (LCDC), A
+        0x21, 0x00, 0xc0,       // LD HL, 0xc000
+        0x04,                   // loop: INC B
+        0xf0, 0x44, 0xfe, 0x90, // LDH A, (LY); CP 0x90
+        0x20, 0xf9,             // JR NZ, loop
+        0x34,                   // INC (HL)
+        0xf0, 0x44, 0xfe, 0x90, // wait: LDH A, (LY); CP 0x90
+        0x28, 0xfa,             // JR Z, wait
+        0x18, 0xf0,             // JR loop
+    };
+
+    return testROM(countPolls ? busy : idle);
+}
+
+TEST_CASE("idle loop skip matches running the loop") {
+    for (int countPolls = 0; countPolls < 2; countPolls++) {
+        const auto rom = pollingTestROM(countPolls != 0);
+        GameBoy running(rom);
+        GameBoy skipping(rom);
+        skipping.idleLoopSkip(true);
+
+        for (int frame = 0; frame < 8; frame++) {
+            running.runFrame();
+            skipping.runFrame();
+
+            REQUIRE(skipping.machineCycles() == running.machineCycles());
+            REQUIRE(skipping.stateHash() == running.stateHash());
+        }
+
+        CHECK(skipping.mmu().read(0xc000) >= 7);
+
+        if (countPolls) {
+            // B changes every time round the first loop, so only the wait for
+            // LY to move on from 0x90 is ever skipped.
+            CHECK(skipping.idleCyclesSkipped() > 0);
+            CHECK(skipping.idleCyclesSkipped() < skipping.machineCycles() / 10);
+        } else {
+            CHECK(skipping.idleCyclesSkipped() > skipping.machineCycles() / 2);
+        }
+    }
+}
+
+TEST_CASE("timed frames skip idle loops too") {
+    const auto rom = pollingTestROM(false);
+    GameBoy plain(rom);
+    GameBoy timed(rom);
+    plain.idleLoopSkip(true);
+    timed.idleLoopSkip(true);
+
+    for (int frame = 0; frame < 4; frame++) {
+        FrameCost cost;
+        plain.runFrame();
+        timed.runFrame(cost);
+
+        REQUIRE(timed.machineCycles() == plain.machineCycles());
+        REQUIRE(timed.stateHash() == plain.stateHash());
+    }
+
+    CHECK(timed.idleCyclesSkipped() == plain.idleCyclesSkipped());
+    CHECK(timed.idleCyclesSkipped() > 0);
+}
+
+// Superinstructions //////////////////////////////////////////////////////////
+
+// Copies 64 bytes from ROM to WRAM, waits on LY and counts passes, so that
+// every fused pair the CPU knows about gets run.
+static std::vector<uint8_t> fusionTestROM() {
+    auto rom = testROM({
+        0x3e, 0x91, 0xe0, 0x40, // LD A, 0x91; LDH (LCDC), A
+        0x21, 0x00, 0x02,       // start: LD HL, 0x0200
+        0x11, 0x00, 0xc0,       // LD DE, 0xc000
+        0x06, 0x40,             // LD B, 0x40
+        0x2a, 0x12,             // copy: LD A, (HL+); LD (DE), A
+        0x13, 0x05,             // INC DE; DEC B
+        0x20, 0xfa,             // JR NZ, copy
+        0xf0, 0x44, 0xe6, 0x03, // wait: LDH A, (LY); AND 0x03
+        0xfe, 0x02, 0x20, 0xf8, // CP 0x02; JR NZ, wait
+        0x21, 0x00, 0xc1, 0x34, // LD HL, 0xc100; INC (HL)
+        0xc3, 0x04, 0x01,       // JP start
+    });
+
+    for (int i = 0; i < 0x40; i++) {
+        rom[0x200 + i] = (uint8_t)(i * 7);
+    }
+
+    return rom;
+}
+
+TEST_CASE("fused pairs match unfused execution") {
+    const auto rom = fusionTestROM();
+    GameBoy fused(rom);
+    GameBoy unfused(rom);
+    unfused.cpu().fusion(false);
+
+    for (int frame = 0; frame < 4; frame++) {
+        fused.runFrame();
+        unfused.runFrame();
+
+        REQUIRE(fused.machineCycles() == unfused.machineCycles());
+        REQUIRE(fused.stateHash() == unfused.stateHash());
+    }
+
+#ifdef GB_PERF_COUNTERS
+    // Looking ahead for a pair isn't traffic; fetching its second opcode is.
+    for (int region = 0; region < BUS_REGION_COUNT; region++) {
+        CHECK(fused.counters().bus.reads[region] == unfused.counters().bus.reads[region]);
+    }
+#endif
+
+    CHECK(fused.mmu().read(0xc03f) == (uint8_t)(0x3f * 7));
+    CHECK(fused.mmu().read(0xc100) > 0);
+
+#ifndef GB_ACCURATE_TIMING
+    // The store half of the copy pair is never an instruction of its own when
+    // fused, bar the odd time a PPU event falls inside the load.
+    int fusedStores = 0;
+    int unfusedStores = 0;
+    for (int i = 0; i < 20000; i++) {
+        fused.step();
+        unfused.step();
+        fusedStores += fused.cpu().atInstructionBoundary() && fused.cpu()._programCounter == 0x010d;
+        unfusedStores += unfused.cpu().atInstructionBoundary() && unfused.cpu()._programCounter == 0x010d;
+    }
+
+    CHECK(unfusedStores > 0);
+    CHECK(fusedStores < unfusedStores / 4);
+#endif
+}
+
+// Batches ////////////////////////////////////////////////////////////////////
+
+TEST_CASE("batch lanes run as they would alone") {
+    const auto rom = fusionTestROM();
+    const size_t lanes = 8;
+    BatchEngine batch(rom, lanes);
+
+    // Stagger the lanes so that some share instructions and some don't.
+    for (size_t i = 0; i < lanes; i++) {
+        GameBoy& lane = batch.lane(i);
+        for (size_t step = 0; step < (i / 2) * 1001; step++) {
+            lane.step();
+        }
+        while (!lane.cpu().atInstructionBoundary()) {
+            lane.step();
+        }
+    }
+    batch.reloadRegisters();
+
+    for (int frame = 0; frame < 3; frame++) {
+        batch.runFrame();
+    }
+    batch.flushRegisters();
+
+    // Accurate timing builds only run single cycle instructions across lanes.
+#ifndef GB_ACCURATE_TIMING
+    CHECK(batch.stats().vectorInstructions > batch.stats().scalarInstructions);
+#else
+    CHECK(batch.stats().vectorInstructions > 0);
+#endif
+    CHECK(batch.stats().scalarInstructions > 0);
+
+    // Without fusion, every instruction boundary a lane stops at is one the
+    // reference stops at too.
+    for (size_t i = 0; i < lanes; i++) {
+        GameBoy& lane = batch.lane(i);
+        GameBoy reference(rom);
+        reference.cpu().fusion(false);
+        while (reference.machineCycles() < lane.machineCycles()) {
+            reference.step();
+        }
+
+        REQUIRE(reference.machineCycles() == lane.machineCycles());
+        CHECK(reference.cpu().atInstructionBoundary());
+        CHECK(reference.stateHash() == lane.stateHash());
+        CHECK(lane.ppu().frameCount() >= 3);
+    }
+}
+
+// Vectorised Environments ////////////////////////////////////////////////////
+
+TEST_CASE("vec env steps as separate machines would") {
+    const auto rom = joypadTestROM();
+    const size_t count = 5;
+
+    VecEnvOptions options;
+    options.framesPerStep = 2;
+    options.ramAddresses = { 0xc000, 0xff44 };
+    options.threads = 3;
+
+    VecEnv env(rom, count, options);
+    CHECK(env.threads() == 3);
+    CHECK(env.ramBytes() == 2);
+
+    std::vector<std::unique_ptr<GameBoy>> alone;
+    for (size_t i = 0; i < count; i++) {
+        alone.emplace_back(new GameBoy(rom));
+    }
+
+    std::vector<uint8_t> actions(count);
+    std::vector<uint32_t> observations(count * VEC_ENV_OBSERVATION_PIXELS);
+    std::vector<uint8_t> ram(count * env.ramBytes());
+
+    for (int step = 0; step < 6; step++) {
+        for (size_t i = 0; i < count; i++) {
+            actions[i] = (uint8_t)(1 << ((i + step) % 8));
+        }
+
+        env.step(actions.data(), observations.data(), ram.data());
+
+        for (size_t i = 0; i < count; i++) {
+            alone[i]->mmu().joypad().buttons(actions[i]);
+            alone[i]->runFrame();
+            alone[i]->runFrame();
+
+            REQUIRE(env.env(i).stateHash() == alone[i]->stateHash());
+            CHECK(memcmp(&observations[i * VEC_ENV_OBSERVATION_PIXELS], alone[i]->ppu().framebuffer(),
+                VEC_ENV_OBSERVATION_PIXELS * sizeof(uint32_t)) == 0);
+            CHECK(ram[i * 2] == alone[i]->mmu().read(0xc000));
+            CHECK(ram[i * 2 + 1] == alone[i]->mmu().read(0xff44));
+        }
+    }
+
+    // The machines had different input, so got different sums.
+    CHECK(ram[0] != ram[2]);
+
+    const uint64_t start = GameBoy(rom).stateHash();
+    env.reset(1);
+    CHECK(env.env(1).stateHash() == start);
+    CHECK(env.env(0).stateHash() != start);
+
+    env.reset();
+    env.step(actions.data(), nullptr, nullptr);
+    alone[0].reset(new GameBoy(rom));
+    alone[0]->mmu().joypad().buttons(actions[0]);
+    alone[0]->runFrame();
+    alone[0]->runFrame();
+    CHECK(env.env(0).stateHash() == alone[0]->stateHash());
+}
+
+// Lockstep ///////////////////////////////////////////////////////////////////
+
+TEST_CASE("bus write log") {
+    GameBoy gameBoy(fusionTestROM());
+    std::vector<BusWrite> writes;
+    gameBoy.mmu().writeLog(&writes);
+
+    gameBoy.runFrame();
+    gameBoy.mmu().writeLog(nullptr);
+
+    REQUIRE(writes.size() > 0x40);
+    CHECK(writes[0].addr == 0xff40);
+    CHECK(writes[0].value == 0x91);
+    CHECK(writes[1].addr == 0xc000);
+
+    const auto count = writes.size();
+    gameBoy.runFrame();
+    CHECK(writes.size() == count);
+}
+
+TEST_CASE("lockstep engines agree") {
+    LockstepEngine plain, fast;
+    REQUIRE(lockstepEngine("plain", plain));
+    REQUIRE(lockstepEngine("fast", fast));
+    CHECK_FALSE(lockstepEngine("jit", fast));
+
+    const std::vector<uint8_t> roms[] = { fusionTestROM(), pollingTestROM(false), pollingTestROM(true) };
+    for (const auto& rom : roms) {
+        const auto result = runLockstep(rom, plain, fast, 4);
+        CHECK_FALSE(result.diverged);
+        CHECK(result.report.empty());
+        CHECK(result.frames == 4);
+        CHECK(result.comparisons > 0);
+    }
+}
+
+// Fuzzing ////////////////////////////////////////////////////////////////////
+
+static std::vector<uint8_t> fuzzInput(const std::vector<uint8_t>& program) {
+    // Registers zero, SP 0xfffe, PC 0, IME off.
+    std::vector<uint8_t> input = { 0, 0, 0, 0, 0, 0, 0, 0, 0xfe, 0xff, 0x00, 0x00, 0x00 };
+    input.resize(input.size() + program.size());
+    std::copy(program.begin(), program.end(), input.end() - program.size());
+    return input;
+}
+
+static std::vector<uint16_t> fuzzEdges(FuzzTarget& target, const std::vector<uint8_t>& input) {
+    REQUIRE(target.run(input.data(), input.size()) == FUZZ_OK);
+    std::vector<uint16_t> edges(target.edges(), target.edges() + target.edgeCount());
+    std::sort(edges.begin(), edges.end());
+    return edges;
+}
+
+TEST_CASE("fuzz target runs each input from a clean fork") {
+    const auto writer = fuzzInput({
+        0x3e, 0x55,             // LD A, 0x55
+        0xea, 0x00, 0xc0,       // LD (0xc000), A
+        0x76,                   // HALT
+    });
+    const auto reader = fuzzInput({
+        0xfa, 0x00, 0xc0,       // LD A, (0xc000)
+        0xfe, 0x00,             // CP 0
+        0x28, 0x01,             // JR Z, +1
+        0x3c,                   // INC A
+        0x76,                   // HALT
+    });
+
+    FuzzTarget target;
+    const auto fresh = fuzzEdges(target, reader);
+    CHECK(std::find(fresh.begin(), fresh.end(), 0x2876) != fresh.end());
+
+    // The reader must not see what the writer left in memory.
+    fuzzEdges(target, writer);
+    CHECK(fuzzEdges(target, reader) == fresh);
+
+    // Fused pairs agree with running the halves one at a time.
+    const auto loop = fuzzInput({
+        0x21, 0x00, 0x01,       // LD HL, 0x0100
+        0x11, 0x00, 0xc0,       // LD DE, 0xc000
+        0x06, 0x20,             // LD B, 0x20
+        0x2a, 0x12, 0x13,       // copy: LD A, (HL+); LD (DE), A; INC DE
+        0x05, 0x20, 0xfa,       // DEC B; JR NZ, copy
+        0xfe, 0x07, 0x20, 0xee, // CP 0x07; JR NZ, 0
+        0x76,
+    });
+    CHECK(target.run(loop.data(), loop.size()) == FUZZ_OK);
+    CHECK(target.report().empty());
+
+    // Inputs shorter than the header are still valid.
+    const uint8_t tiny[] = { 0x01 };
+    CHECK(target.run(tiny, sizeof(tiny)) == FUZZ_OK);
+}
+
+// Frame Channels /////////////////////////////////////////////////////////////
+
+TEST_CASE("frame channel publishes rendered frames in place") {
+    // Memory the test owns, as a caller of attach() would provide it.
+    std::vector<uint8_t> memory(sizeof(FrameChannelLayout) + FRAME_CHANNEL_ALIGNMENT);
+    void* aligned = memory.data();
+    size_t space = memory.size();
+    REQUIRE(std::align(FRAME_CHANNEL_ALIGNMENT, sizeof(FrameChannelLayout), aligned, space) != nullptr);
+
+    CHECK(FrameChannel::attach((uint8_t*)aligned + 1, space - 1) == nullptr);
+    const auto channel = FrameChannel::attach(aligned, space);
+    REQUIRE(channel != nullptr);
+    const auto reader = FrameReader::attach(aligned, space);
+    REQUIRE(reader != nullptr);
+
+    FrameView view;
+    CHECK(reader->latest(view) == false);
+
+    GameBoy gameBoy(fusionTestROM());
+    gameBoy.ppu().frameSink(channel);
+    gameBoy.runFrame();
+    gameBoy.runFrame();
+
+    REQUIRE(reader->latest(view) == true);
+    CHECK(reader->published() == channel->published());
+    CHECK(view.frameNumber == gameBoy.ppu().frameCount() - 1);
+    CHECK(view.pixels == gameBoy.ppu().framebuffer());
+
+    std::vector<uint32_t> copy(FRAME_PIXELS);
+    uint64_t frameNumber = 0;
+    REQUIRE(reader->copyLatest(copy.data(), frameNumber) == true);
+    CHECK(frameNumber == view.frameNumber);
+    CHECK(memcmp(copy.data(), view.pixels, copy.size() * sizeof(uint32_t)) == 0);
+
+    // The newest frame survives the next one being composed, but not the
+    // writer coming round to its slot again.
+    gameBoy.runFrame();
+    CHECK(reader->valid(view) == true);
+    gameBoy.runFrame();
+    gameBoy.runFrame();
+    CHECK(reader->valid(view) == false);
+
+    // Taking the sink away keeps the last frame on show.
+    REQUIRE(reader->copyLatest(copy.data(), frameNumber) == true);
+    gameBoy.ppu().frameSink(nullptr);
+    CHECK(memcmp(copy.data(), gameBoy.ppu().framebuffer(), copy.size() * sizeof(uint32_t)) == 0);
+}
+
+TEST_CASE("frame channel over shared memory") {
+    const std::string name = "/gameboy-test-" + std::to_string(getpid());
+
+    auto channel = FrameChannel::create(name);
+    REQUIRE(channel != nullptr);
+    const auto reader = FrameReader::open(name);
+    REQUIRE(reader != nullptr);
+
+    uint32_t* pixels = channel->beginFrame();
+    for (int i = 0; i < FRAME_PIXELS; i++) {
+        pixels[i] = (uint32_t)i;
+    }
+    channel->publishFrame(7);
+
+    FrameView view;
+    REQUIRE(reader->latest(view) == true);
+    CHECK(view.frameNumber == 7);
+    CHECK(view.pixels != pixels);
+    CHECK(view.pixels[FRAME_PIXELS - 1] == FRAME_PIXELS - 1);
+    CHECK(reader->valid(view) == true);
+
+    // The name goes with the writer.
+    channel.reset();
+    CHECK(FrameReader::open(name) == nullptr);
+}
+
+// CGB ////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("cgb banking") {
+    MMU mmu(testROM({}, true));
+    REQUIRE(mmu.cgb());
+
+    mmu.write(0xc000, 0x01);
+    mmu.write(0xd000, 0x11);
+    mmu.write(IO_SVBK, 0x02);
+    CHECK(mmu.read(IO_SVBK) == 0xfa);
+    CHECK(mmu.read(0xd000) == 0x00);
+    mmu.write(0xd000, 0x22);
+    CHECK(mmu.read(0xf000) == 0x22);
+    CHECK(mmu.read(0xc000) == 0x01);
+
+    // Bank 0 selects bank 1, but reads back as written.
+    mmu.write(IO_SVBK, 0x00);
+    CHECK(mmu.read(0xd000) == 0x11);
+    CHECK(mmu.read(IO_SVBK) == 0xf8);
+    mmu.write(IO_SVBK, 0xf9);
+    CHECK(mmu.read(IO_SVBK) == 0xf9);
+    CHECK(mmu.read(0xd000) == 0x11);
+
+    mmu.write(0x8000, 0xaa);
+    mmu.write(IO_VBK, 0x01);
+    CHECK(mmu.read(IO_VBK) == 0xff);
+    CHECK(mmu.read(0x8000) == 0x00);
+    mmu.write(0x8000, 0xbb);
+    CHECK(mmu.ppu()._vram[VRAM_SIZE] == 0xbb);
+    mmu.write(IO_VBK, 0x00);
+    CHECK(mmu.read(0x8000) == 0xaa);
+
+    // A DMG has none of it.
+    MMU dmg(std::vector<uint8_t>(0x8000));
+    dmg.write(0xd000, 0x11);
+    dmg.write(IO_SVBK, 0x02);
+    CHECK(dmg.read(0xd000) == 0x11);
+}
+
+TEST_CASE("cgb palettes") {
+    MMU mmu(testROM({}, true));
+
+    // Palette 1 color 1 is blue, written through auto-increment.
+    mmu.write(IO_BCPS, 0x80 | 10);
+    mmu.write(IO_BCPD, 0x00);
+    mmu.write(IO_BCPD, 0x7c);
+    CHECK(mmu.read(IO_BCPS) == (0xc0 | 12));
+    mmu.write(IO_BCPS, 11);
+    CHECK(mmu.read(IO_BCPD) == 0x7c);
+
+    // Tile 1 is solid color 1. The first map entry uses it with palette 1,
+    // the second is tile 0 with palette 0, which is still white from reset.
+    for (uint16_t i = 0; i < 16; i += 2) {
+        mmu.write(0x8010 + i, 0xff);
+    }
+    mmu.write(0x9800, 0x01);
+    mmu.write(IO_VBK, 0x01);
+    mmu.write(0x9800, 0x01);
+    mmu.write(IO_VBK, 0x00);
+    mmu.write(IO_LCDC, 0x91);
+
+    const auto frame = mmu.ppu().frameCount();
+    while (mmu.ppu().frameCount() == frame) {
+        mmu.clock();
+    }
+
+    CHECK(mmu.ppu().framebuffer()[0] == 0xff0000ff);
+    CHECK(mmu.ppu().framebuffer()[8] == 0xffffffff);
+}
+
+TEST_CASE("cgb double speed") {
+    const std::vector<uint8_t> program = {
+        0x3e, 0x01, 0xe0, 0x4d, // LD A, 0x01; LDH (KEY1), A
+        0x10, 0x00,             // STOP
+        0x18, 0xfe,             // JR -2
+    };
+
+    GameBoy cgb(testROM(program, true));
+    CHECK(cgb.cpu()._regA == CGB_BOOT_A);
+
+    cgb.runFrame();
+    CHECK(cgb.mmu().doubleSpeed());
+    CHECK(cgb.mmu().read(IO_KEY1) == 0xfe);
+    CHECK(cgb.cpu()._isStopped == false);
+
+    // Twice the machine cycles fit in a frame.
+    const auto before = cgb.machineCycles();
+    cgb.runFrame();
+    CHECK(cgb.machineCycles() - before == DOTS_PER_FRAME / 2);
+
+    GameBoy dmg(testROM(program));
+    dmg.runFrame();
+    CHECK(dmg.mmu().doubleSpeed() == false);
+    CHECK(dmg.cpu()._isStopped == true);
+}
+
+// Boot ROM ///////////////////////////////////////////////////////////////////
+
+TEST_CASE("post-boot state") {
+    auto rom = testROM({});
+    rom[0x0104] = 0xce;  // The first byte of the logo.
+    rom[0x014d] = 0x42;  // Header checksum.
+
+    GameBoy dmg(rom);
+    CHECK(dmg.cpu().regAF() == 0x01b0);
+    CHECK(dmg.cpu().regBC() == 0x0013);
+    CHECK(dmg.cpu().regDE() == 0x00d8);
+    CHECK(dmg.cpu().regHL() == 0x014d);
+    CHECK(dmg.cpu()._stackPointer == 0xfffe);
+    CHECK(dmg.cpu()._programCounter == 0x0100);
+    CHECK(dmg.cpu()._interruptsEnabled == false);
+
+    MMU& mmu = dmg.mmu();
+    CHECK(mmu.read(IO_P1) == 0xcf);
+    CHECK(mmu.read(IO_IF) == 0xe1);
+    CHECK(mmu.read(IO_DIV) == 0xab);
+    CHECK(mmu.read(IO_NR52) == 0xf1);
+    CHECK(mmu.read(IO_LCDC) == 0x91);
+    CHECK(mmu.read(IO_BGP) == 0xfc);
+
+    // Each nibble of 0xce, doubled up into two rows of tile 1.
+    CHECK(dmg.ppu()._vram[0x0010] == 0xf0);
+    CHECK(dmg.ppu()._vram[0x0012] == 0xf0);
+    CHECK(dmg.ppu()._vram[0x0014] == 0xfc);
+    CHECK(dmg.ppu()._vram[0x0011] == 0x00);
+    CHECK(dmg.ppu()._vram[0x0190] == 0x3c);
+    CHECK(dmg.ppu()._vram[0x1904] == 0x01);
+    CHECK(dmg.ppu()._vram[0x192f] == 0x18);
+    CHECK(dmg.ppu()._vram[0x1910] == 0x19);
+
+    rom[0x014d] = 0x00;
+    CHECK(GameBoy(rom).cpu()._flags == 0x80);
+
+    GameBoy cgb(testROM({}, true));
+    CHECK(cgb.cpu().regAF() == 0x1180);
+    CHECK(cgb.cpu().regBC() == 0x0000);
+    CHECK(cgb.cpu().regDE() == 0xff56);
+    CHECK(cgb.cpu().regHL() == 0x000d);
+    CHECK(cgb.ppu()._vram[0x0010] == 0x00);
+}
+
+TEST_CASE("boot ROM runs until it unmaps itself") {
+    std::vector<uint8_t> boot(DMG_BOOT_ROM_SIZE);
+    const uint8_t start[] = {
+        0x31, 0xfe, 0xff,       // LD SP, 0xfffe
+        0x3e, 0x42,             // LD A, 0x42
+        0xea, 0x00, 0xc0,       // LD (0xc000), A
+    };
+    const uint8_t end[] = {
+        0x3e, 0x01, 0xe0, 0x50, // LD A, 0x01; LDH (BOOT), A
+    };
+    std::copy(start, start + sizeof(start), boot.begin());
+    std::copy(end, end + sizeof(end), boot.end() - sizeof(end));
+
+    auto rom = testROM({
+        0x3e, 0x99, 0xea, 0x01, 0xc0, // LD A, 0x99; LD (0xc001), A
+        0x18, 0xfe,                   // JR -2
+    }, true);
+    GameBoy cgb(rom);
+    CHECK_FALSE(cgb.bootROM(boot));
+
+    rom[CGB_FLAG_ADDRESS] = 0x00;
+    GameBoy booting(rom);
+    CHECK_FALSE(booting.bootROM(std::vector<uint8_t>(CGB_BOOT_ROM_SIZE)));
+    REQUIRE(booting.bootROM(boot));
+    CHECK(booting.cpu()._programCounter == 0x0000);
+    CHECK(booting.mmu().read(0x0000) == 0x31);
+    CHECK(booting.mmu().read(0x0100) == 0x3e);
+
+    booting.runFrame();
+    CHECK(booting.mmu().read(0xc000) == 0x42);
+    CHECK(booting.mmu().read(0xc001) == 0x99);
+    CHECK(booting.mmu().read(0x0000) == 0x00);
+    CHECK(booting.cpu()._programCounter >= 0x0100);
+
+    // Writing 0xff50 again doesn't bring it back, but a reset does.
+    booting.mmu().write(IO_BOOT, 0x00);
+    CHECK(booting.mmu().read(0x0000) == 0x00);
+    booting.reset();
+    CHECK(booting.mmu().read(0x0000) == 0x31);
+
+    REQUIRE(booting.bootROM({}));
+    CHECK(booting.cpu()._programCounter == 0x0100);
+    CHECK(booting.mmu().read(0x0000) == 0x00);
+}
+
+// Opcode Heat ////////////////////////////////////////////////////////////////
+
+TEST_CASE("opcode handlers") {
+    // Every case of CPU::decodeAndExecute()'s switch, by the handler it calls.
+    // NOP has no handler, and nor do the opcodes the CPU doesn't have.
+    const struct {
+        const char* handler;
+        std::vector<uint8_t> opcodes;
+    } dispatch[] = {
+        { "I_LoadImmediate", {
+            Opcode::LD_A_n, Opcode::LD_B_n, Opcode::LD_C_n, Opcode::LD_D_n, Opcode::LD_E_n,
+            Opcode::LD_H_n, Opcode::LD_L_n } },
+        { "I_TransferRegister", {
+            Opcode::LD_A_A, Opcode::LD_A_B, Opcode::LD_A_C, Opcode::LD_A_D, Opcode::LD_A_E,
+            Opcode::LD_A_H, Opcode::LD_A_L, Opcode::LD_B_A, Opcode::LD_B_B, Opcode::LD_B_C,
+            Opcode::LD_B_D, Opcode::LD_B_E, Opcode::LD_B_H, Opcode::LD_B_L, Opcode::LD_C_A,
+            Opcode::LD_C_B, Opcode::LD_C_C, Opcode::LD_C_D, Opcode::LD_C_E, Opcode::LD_C_H,
+            Opcode::LD_C_L, Opcode::LD_D_A, Opcode::LD_D_B, Opcode::LD_D_C, Opcode::LD_D_D,
+            Opcode::LD_D_E, Opcode::LD_D_H, Opcode::LD_D_L, Opcode::LD_E_A, Opcode::LD_E_B,
+            Opcode::LD_E_C, Opcode::LD_E_D, Opcode::LD_E_E, Opcode::LD_E_H, Opcode::LD_E_L,
+            Opcode::LD_H_A, Opcode::LD_H_B, Opcode::LD_H_C, Opcode::LD_H_D, Opcode::LD_H_E,
+            Opcode::LD_H_H, Opcode::LD_H_L, Opcode::LD_L_A, Opcode::LD_L_B, Opcode::LD_L_C,
+            Opcode::LD_L_D, Opcode::LD_L_E, Opcode::LD_L_H, Opcode::LD_L_L, Opcode::LD_HL_SP } },
+        { "I_LoadAddressIntoRegister", {
+            Opcode::LD_A_aHL, Opcode::LD_B_aHL, Opcode::LD_C_aHL, Opcode::LD_D_aHL,
+            Opcode::LD_E_aHL, Opcode::LD_H_aHL, Opcode::LD_L_aHL, Opcode::LD_A_aBC,
+            Opcode::LD_A_aDE, Opcode::LD_A_aNN, Opcode::LD_A_afC, Opcode::LDD_A_aHL,
+            Opcode::LDI_A_aHL, Opcode::LDH_A_afN } },
+        { "I_StoreToAddress", {
+            Opcode::LD_aHL_A, Opcode::LD_aHL_B, Opcode::LD_aHL_C, Opcode::LD_aHL_D,
+            Opcode::LD_aHL_E, Opcode::LD_aHL_H, Opcode::LD_aHL_L, Opcode::LD_aHL_n,
+            Opcode::LD_aBC_A, Opcode::LD_aDE_A, Opcode::LD_aNN_A, Opcode::LD_afC_A,
+            Opcode::LDD_aHL_A, Opcode::LDI_aHL_A, Opcode::LDH_afN_A } },
+        { "I_LoadImmediate16", {
+            Opcode::LD_BC_NN, Opcode::LD_DE_NN, Opcode::LD_HL_NN, Opcode::LD_SP_NN } },
+        { "I_LoadHLWithSPN", { Opcode::LD_HL_aSPN } },
+        { "I_StoreStackPointer", { Opcode::LD_aNN_SP } },
+        { "I_PushRegister", {
+            Opcode::PUSH_AF, Opcode::PUSH_BC, Opcode::PUSH_DE, Opcode::PUSH_HL } },
+        { "I_PopRegister", { Opcode::POP_AF, Opcode::POP_BC, Opcode::POP_DE, Opcode::POP_HL } },
+        { "I_8BitAdd", {
+            Opcode::ADD_A_A, Opcode::ADD_A_B, Opcode::ADD_A_C, Opcode::ADD_A_D, Opcode::ADD_A_E,
+            Opcode::ADD_A_H, Opcode::ADD_A_L, Opcode::ADD_A_aHL, Opcode::ADD_A_N,
+            Opcode::ADC_A_A, Opcode::ADC_A_B, Opcode::ADC_A_C, Opcode::ADC_A_D, Opcode::ADC_A_E,
+            Opcode::ADC_A_H, Opcode::ADC_A_L, Opcode::ADC_A_aHL, Opcode::ADC_A_N } },
+        { "I_8BitSubtract", {
+            Opcode::SUB_A, Opcode::SUB_B, Opcode::SUB_C, Opcode::SUB_D, Opcode::SUB_E,
+            Opcode::SUB_H, Opcode::SUB_L, Opcode::SUB_aHL, Opcode::SUB_N, Opcode::SBC_A_A,
+            Opcode::SBC_A_B, Opcode::SBC_A_C, Opcode::SBC_A_D, Opcode::SBC_A_E, Opcode::SBC_A_H,
+            Opcode::SBC_A_L, Opcode::SBC_A_aHL, Opcode::SBC_A_N } },
+        { "I_And", {
+            Opcode::AND_A, Opcode::AND_B, Opcode::AND_C, Opcode::AND_D, Opcode::AND_E,
+            Opcode::AND_H, Opcode::AND_L, Opcode::AND_aHL, Opcode::AND_N } },
+        { "I_Or", {
+            Opcode::OR_A, Opcode::OR_B, Opcode::OR_C, Opcode::OR_D, Opcode::OR_E, Opcode::OR_H,
+            Opcode::OR_L, Opcode::OR_aHL, Opcode::OR_N } },
+        { "I_Xor", {
+            Opcode::XOR_A, Opcode::XOR_B, Opcode::XOR_C, Opcode::XOR_D, Opcode::XOR_E,
+            Opcode::XOR_H, Opcode::XOR_L, Opcode::XOR_aHL, Opcode::XOR_N } },
+        { "I_Compare", {
+            Opcode::CP_A, Opcode::CP_B, Opcode::CP_C, Opcode::CP_D, Opcode::CP_E, Opcode::CP_H,
+            Opcode::CP_L, Opcode::CP_aHL, Opcode::CP_N } },
+        { "I_Increment", {
+            Opcode::INC_A, Opcode::INC_B, Opcode::INC_C, Opcode::INC_D, Opcode::INC_E,
+            Opcode::INC_H, Opcode::INC_L, Opcode::INC_aHL } },
+        { "I_Decrement", {
+            Opcode::DEC_A, Opcode::DEC_B, Opcode::DEC_C, Opcode::DEC_D, Opcode::DEC_E,
+            Opcode::DEC_H, Opcode::DEC_L, Opcode::DEC_aHL } },
+        { "I_16BitAdd", {
+            Opcode::ADD_HL_BC, Opcode::ADD_HL_DE, Opcode::ADD_HL_HL, Opcode::ADD_HL_SP } },
+        { "I_AddToSP", { Opcode::ADD_SP_N } },
+        { "I_16BitIncrement", { Opcode::INC_BC, Opcode::INC_DE, Opcode::INC_HL, Opcode::INC_SP } },
+        { "I_16BitDecrement", { Opcode::DEC_BC, Opcode::DEC_DE, Opcode::DEC_HL, Opcode::DEC_SP } },
+        { "I_DecimalAdjust", { Opcode::DAA } },
+        { "I_ComplementA", { Opcode::CPL } },
+        { "I_ComplementCarry", { Opcode::CCF } },
+        { "I_SetCarry", { Opcode::SCF } },
+        { "I_UnconditionalJump", { Opcode::JP_NN } },
+        { "I_ConditionalJump", {
+            Opcode::JP_NZ_NN, Opcode::JP_Z_NN, Opcode::JP_NC_NN, Opcode::JP_C_NN } },
+        { "I_JumpToHL", { Opcode::JP_HL } },
+        { "I_UnconditionalRelativeJump", { Opcode::JR_N } },
+        { "I_ConditionalRelativeJump", {
+            Opcode::JR_NZ_N, Opcode::JR_Z_N, Opcode::JR_NC_N, Opcode::JR_C_N } },
+        { "I_Call", { Opcode::CALL_NN } },
+        { "I_ConditionalCall", {
+            Opcode::CALL_NZ_NN, Opcode::CALL_Z_NN, Opcode::CALL_NC_NN, Opcode::CALL_C_NN } },
+        { "I_RST", {
+            Opcode::RST_00, Opcode::RST_08, Opcode::RST_10, Opcode::RST_18, Opcode::RST_20,
+            Opcode::RST_28, Opcode::RST_30, Opcode::RST_38 } },
+        { "I_Return", { Opcode::RET, Opcode::RETI } },
+        { "I_ConditionalReturn", { Opcode::RET_NZ, Opcode::RET_Z, Opcode::RET_NC, Opcode::RET_C } },
+        { "I_Halt", { Opcode::HALT } },
+        { "I_Stop", { Opcode::STOP } },
+        { "I_SetInterruptEnable", { Opcode::DI, Opcode::EI } },
+        { "I_ExecCBGroup", { Opcode::PREFIX_CB } },
+        { "I_RotateA", { Opcode::RLCA, Opcode::RLA, Opcode::RRCA, Opcode::RRA } },
+    };
+
+    const char* expected[256] = {};
+    for (const auto& entry : dispatch) {
+        for (const auto opcode : entry.opcodes) {
+            REQUIRE(expected[opcode] == nullptr);
+            expected[opcode] = entry.handler;
+        }
+    }
+
+    int handled = 0;
+    for (int opcode = 0; opcode < 256; opcode++) {
+        const char* handler = opcodeHandler((uint8_t)opcode);
+        if (expected[opcode] == nullptr) {
+            CHECK(handler == nullptr);
+            continue;
+        }
+
+        REQUIRE(handler != nullptr);
+        CHECK(std::string(handler) == expected[opcode]);
+        handled++;
+    }
+
+    const uint8_t unused[] = { 0xd3, 0xdb, 0xdd, 0xe3, 0xe4, 0xeb, 0xec, 0xed, 0xf4, 0xfc, 0xfd };
+    CHECK(handled == 256 - 1 - (int)sizeof(unused));
+    CHECK(opcodeHandlers().size() == sizeof(dispatch) / sizeof(dispatch[0]));
+}
+
+TEST_CASE("opcode profile lays out hot and cold handlers") {
+    GameBoy gameBoy(fusionTestROM());
+    OpcodeProfile profile;
+    profile.run(gameBoy, 4);
+
+    CHECK(gameBoy.cpu().fusion());
+    CHECK(profile.count(Opcode::LDI_A_aHL) > 0);
+    CHECK(profile.count(Opcode::LD_aDE_A) == profile.count(Opcode::LDI_A_aHL));
+    CHECK(profile.count(Opcode::DAA) == 0);
+
+    const auto handlers = opcodeHandlers();
+    const auto heat = profile.classify();
+    REQUIRE(heat.size() == handlers.size());
+
+    const auto heatOf = [&](const char* name) {
+        for (size_t i = 0; i < handlers.size(); i++) {
+            if (std::string(handlers[i]) == name) {
+                return heat[i];
+            }
+        }
+
+        return HEAT_NEUTRAL;
+    };
+
+    // The LY polling loop is most of the run.
+    CHECK(heatOf("I_LoadAddressIntoRegister") == HEAT_HOT);
+    CHECK(heatOf("I_ConditionalRelativeJump") == HEAT_HOT);
+    CHECK(heatOf("I_DecimalAdjust") == HEAT_COLD);
+    CHECK(heatOf("I_Stop") == HEAT_COLD);
+
+    std::ostringstream layout;
+    REQUIRE(profile.writeLayout(layout));
+    CHECK(layout.str().find("#define LAYOUT_I_Stop                        OPCODE_COLD") != std::string::npos);
+    CHECK(layout.str().find("#define LAYOUT_I_LoadAddressIntoRegister     OPCODE_HOT") != std::string::npos);
+
+    // An empty profile knows nothing is hot.
+    const auto none = OpcodeProfile().classify();
+    CHECK(std::count(none.begin(), none.end(), HEAT_COLD) == (long)none.size());
+}
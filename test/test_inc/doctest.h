@@ -4005,7 +4005,7 @@ namespace {
         static bool             isSet;
         static struct sigaction oldSigActions[DOCTEST_COUNTOF(signalDefs)];
         static stack_t          oldSigStack;
-        static char             altStackMem[4 * SIGSTKSZ];
+        static char             altStackMem[32768];
 
         static void handleSignal(int sig) {
             const char* name = "<unknown signal>";
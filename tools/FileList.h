@@ -0,0 +1,82 @@
+#ifndef __FileList_h__
+#define __FileList_h__
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Shared by the command line tools that take files and directories.
+
+inline bool endsWith(const std::string& value, const char* suffix) {
+    const size_t length = strlen(suffix);
+    return value.size() >= length && value.compare(value.size() - length, length, suffix) == 0;
+}
+
+/** Adds path to files if it is a file, or every file under it with one of
+ * the suffixes if it is a directory. False if path can't be read.
+ */
+inline bool collectFiles(const std::string& path, std::initializer_list<const char*> suffixes,
+    std::vector<std::string>& files) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        return false;
+    }
+
+    if (!S_ISDIR(info.st_mode)) {
+        files.push_back(path);
+        return true;
+    }
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        return false;
+    }
+
+    while (const dirent* entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+
+        const std::string child = path + "/" + name;
+        if (stat(child.c_str(), &info) != 0) {
+            continue;
+        }
+
+        if (S_ISDIR(info.st_mode)) {
+            collectFiles(child, suffixes, files);
+            continue;
+        }
+
+        for (const char* suffix : suffixes) {
+            if (endsWith(name, suffix)) {
+                files.push_back(child);
+                break;
+            }
+        }
+    }
+
+    closedir(dir);
+    return true;
+}
+
+/** Reads the whole of a file. False if it can't be opened.
+ */
+inline bool readFile(const std::string& path, std::vector<uint8_t>& data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+#endif // __FileList_h__
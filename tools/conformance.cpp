@@ -0,0 +1,187 @@
+#include "Conformance.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FileList.h"
+
+// Runs test ROM suites headlessly, in parallel, and reports a verdict and the
+// host time for each ROM.
+//
+// Directories are searched recursively for .gb and .gbc files. With
+// --baseline, only ROMs that passed in the baseline and no longer do count as
+// failures, so a suite the core doesn't fully pass yet still gives a clean
+// yes/no on whether a change broke anything.
+//
+// Exit status: 0 no failures (or no regressions against the baseline),
+// 1 failures or regressions, 2 bad input.
+
+static void printUsage(const char* program) {
+    std::cerr << "usage: " << program << " <rom or directory>... [options]\n"
+              << "  --jobs N                ROMs run at once (default: one per core)\n"
+              << "  --frames N              give up on a ROM after N frames (default "
+              << DEFAULT_CONFORMANCE_FRAMES << ")\n"
+              << "  --baseline FILE         only report ROMs that passed in FILE and now don't\n"
+              << "  --write-baseline FILE   save this run's verdicts for --baseline\n"
+              << "  --verbose               print what each ROM reported\n";
+}
+
+// One "VERDICT path" line per ROM.
+static bool readBaseline(const char* path, std::map<std::string, std::string>& verdicts) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    std::string verdict, rom;
+    while (file >> verdict && std::getline(file >> std::ws, rom)) {
+        verdicts[rom] = verdict;
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> roms;
+    unsigned long jobs = std::thread::hardware_concurrency();
+    unsigned long frames = DEFAULT_CONFORMANCE_FRAMES;
+    const char* baselinePath = nullptr;
+    const char* writeBaselinePath = nullptr;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc) {
+            writeBaselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        } else if (argv[i][0] == '-') {
+            printUsage(argv[0]);
+            return 2;
+        } else if (!collectFiles(argv[i], { ".gb", ".gbc" }, roms)) {
+            std::cerr << "could not read " << argv[i] << "\n";
+            return 2;
+        }
+    }
+
+    if (roms.empty()) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    std::sort(roms.begin(), roms.end());
+    jobs = std::max(1UL, std::min<unsigned long>(jobs, roms.size()));
+
+    std::map<std::string, std::string> baseline;
+    if (baselinePath && !readBaseline(baselinePath, baseline)) {
+        std::cerr << "could not read " << baselinePath << "\n";
+        return 2;
+    }
+
+    // Workers take the next ROM off a shared counter; each result has its own
+    // slot, so nothing else is shared.
+    std::vector<ConformanceResult> results(roms.size());
+    std::vector<uint8_t> readable(roms.size(), 1);
+    std::atomic<size_t> next(0);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (unsigned long i = 0; i < jobs; i++) {
+        workers.emplace_back([&]() {
+            for (size_t index = next++; index < roms.size(); index = next++) {
+                std::vector<uint8_t> rom;
+                if (!readFile(roms[index], rom)) {
+                    readable[index] = 0;
+                    continue;
+                }
+
+                results[index] = runConformance(rom, (uint32_t)frames);
+            }
+        });
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int counts[3] = { 0, 0, 0 };
+    int regressions = 0;
+    int fixes = 0;
+    double cpuSeconds = 0;
+
+    for (size_t i = 0; i < roms.size(); i++) {
+        if (!readable[i]) {
+            std::cerr << "could not read " << roms[i] << "\n";
+            return 2;
+        }
+
+        const auto& result = results[i];
+        counts[result.verdict]++;
+        cpuSeconds += result.seconds;
+
+        std::string note;
+        const auto previous = baseline.find(roms[i]);
+        if (previous != baseline.end()) {
+            const bool passed = previous->second == verdictName(VERDICT_PASS);
+            if (passed && result.verdict != VERDICT_PASS) {
+                note = "  REGRESSION";
+                regressions++;
+            } else if (!passed && result.verdict == VERDICT_PASS) {
+                note = "  (newly passing)";
+                fixes++;
+            }
+        }
+
+        std::cout << std::left << std::setw(8) << verdictName(result.verdict) << std::right
+                  << std::setw(6) << result.frames << " frames "
+                  << std::fixed << std::setprecision(1) << std::setw(9) << result.seconds * 1000.0 << " ms  "
+                  << std::setw(10) << std::left << result.detector << std::right
+                  << roms[i] << note << "\n";
+
+        if (verbose && !result.output.empty()) {
+            std::cout << result.output << "\n";
+        }
+    }
+
+    std::cout << counts[VERDICT_PASS] << " passed, " << counts[VERDICT_FAIL] << " failed, "
+              << counts[VERDICT_TIMEOUT] << " timed out; "
+              << std::setprecision(2) << wallSeconds << " s wall, " << cpuSeconds << " s across "
+              << jobs << " jobs\n";
+
+    if (writeBaselinePath) {
+        std::ofstream file(writeBaselinePath);
+        for (size_t i = 0; i < roms.size(); i++) {
+            file << verdictName(results[i].verdict) << " " << roms[i] << "\n";
+        }
+
+        if (!file) {
+            std::cerr << "could not write " << writeBaselinePath << "\n";
+            return 2;
+        }
+    }
+
+    if (baselinePath) {
+        std::cout << regressions << " regressions, " << fixes << " newly passing against " << baselinePath << "\n";
+        return regressions > 0 ? 1 : 0;
+    }
+
+    return counts[VERDICT_PASS] == (int)roms.size() ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+#include "FrameChannel.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// Reads frames from a channel a running gameboyEmulator --frame-shm publishes,
+// in place, and reports how many came through each second, how many were
+// missed because a newer one was already in, and how many the writer
+// overwrote while they were being read.
+//
+// Polls without sleeping, as a consumer that wants every frame as soon as it
+// is in would.
+//
+// Exit status: 0 done, 1 torn frames seen, 2 bad input or no channel.
+
+static void printUsage(const char* program) {
+    std::cerr << "usage: " << program << " <name> [options]\n"
+              << "  --seconds N   stop after N seconds (default: when the writer goes quiet for 1 s)\n"
+              << "  --wait N      seconds to wait for the channel to appear (default 5)\n";
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    unsigned long seconds = 0;
+    unsigned long wait = 5;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--wait") == 0 && i + 1 < argc) {
+            wait = strtoul(argv[++i], nullptr, 10);
+        } else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    typedef std::chrono::steady_clock Clock;
+
+    FrameReader::Ptr reader;
+    const auto waitUntil = Clock::now() + std::chrono::seconds(wait);
+    while (!(reader = FrameReader::open(argv[1]))) {
+        if (Clock::now() >= waitUntil) {
+            std::cerr << "no frame channel " << argv[1] << "\n";
+            return 2;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    const auto start = Clock::now();
+    auto lastReport = start;
+    auto lastFrame = start;
+
+    uint64_t seen = reader->published();
+    uint64_t received = 0;
+    uint64_t missed = 0;
+    uint64_t torn = 0;
+    uint64_t reportReceived = 0;
+    uint32_t checksum = 0;
+
+    while (true) {
+        const uint64_t published = reader->published();
+        const auto now = Clock::now();
+
+        if (published != seen) {
+            FrameView view;
+            if (reader->latest(view)) {
+                // Touch every pixel, as a real consumer would.
+                uint32_t sum = 0;
+                for (int i = 0; i < FRAME_PIXELS; i++) {
+                    sum += view.pixels[i];
+                }
+
+                if (reader->valid(view)) {
+                    checksum ^= sum;
+                    received++;
+                } else {
+                    torn++;
+                }
+            }
+
+            missed += published - seen - 1;
+            seen = published;
+            lastFrame = now;
+        } else if (seconds == 0 && now - lastFrame >= std::chrono::seconds(1)) {
+            break;
+        }
+
+        if (now - lastReport >= std::chrono::seconds(1)) {
+            const double elapsed = std::chrono::duration<double>(now - lastReport).count();
+            std::cout << (received - reportReceived) / elapsed << " frames/s, " << missed << " missed, "
+                      << torn << " torn\n";
+            lastReport = now;
+            reportReceived = received;
+
+            if (seconds > 0 && now - start >= std::chrono::seconds(seconds)) {
+                break;
+            }
+        }
+    }
+
+    const double elapsed = std::chrono::duration<double>(lastFrame - start).count();
+    std::cout << received << " frames in " << elapsed << " s, " << missed << " missed, " << torn
+              << " torn, checksum " << std::hex << checksum << std::dec << "\n";
+
+    return torn > 0 ? 1 : 0;
+}
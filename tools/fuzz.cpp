@@ -0,0 +1,326 @@
+#include "Fuzz.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "FileList.h"
+
+// Coverage-guided fuzzing of the CPU, in process, with no instrumented build
+// needed: inputs that run a new pair of opcodes join the corpus and are
+// mutated further.
+//
+// Inputs that make the fused and unfused CPUs disagree are saved to the
+// crash directory. So is the input being run if the process dies, e.g. on a
+// sanitizer report, which makes every failure replayable with --replay.
+//
+// Exit status: 0 nothing found, 1 divergences or replays that diverge, 2 bad
+// input.
+
+static void printUsage(const char* program) {
+    std::cerr << "usage: " << program << " [options]\n"
+              << "       " << program << " --replay <file or directory>...\n"
+              << "  --corpus DIR     seed from DIR and save inputs with new coverage there\n"
+              << "  --crashes DIR    where to save failing inputs (default .)\n"
+              << "  --runs N         stop after N inputs (default: run until stopped)\n"
+              << "  --seconds N      stop after N seconds\n"
+              << "  --seed N         random seed (default 1)\n";
+}
+
+static bool writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char*)data.data(), data.size());
+    return (bool)file;
+}
+
+static std::string inputName(const char* prefix, const std::vector<uint8_t>& data) {
+    // FNV-1a, enough to tell inputs apart.
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const auto byte : data) {
+        hash = (hash ^ byte) * 0x100000001b3ULL;
+    }
+
+    char name[40];
+    snprintf(name, sizeof(name), "%s-%016llx", prefix, (unsigned long long)hash);
+    return name;
+}
+
+// Crash handling ////////////////////////////////////////////////////////////
+
+// The input being run, for the signal handler to save. Everything it touches
+// is set up beforehand, since it can only make async-signal-safe calls.
+static const uint8_t* g_currentInput = nullptr;
+static size_t g_currentSize = 0;
+static char g_crashPath[4096];
+
+static void saveCurrentInput(int signal) {
+    const int fd = open(g_crashPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        if (write(fd, g_currentInput, g_currentSize) < 0) {
+            // Nothing more can be done from here.
+        }
+        close(fd);
+    }
+
+    const char message[] = "fuzz: crashed; input saved\n";
+    if (write(STDERR_FILENO, message, sizeof(message) - 1) < 0) {
+        // Likewise.
+    }
+
+    ::signal(signal, SIG_DFL);
+    raise(signal);
+}
+
+static void installCrashHandler(const std::string& directory) {
+    snprintf(g_crashPath, sizeof(g_crashPath), "%s/crash-last", directory.c_str());
+
+    const int signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+    for (const int signal : signals) {
+        ::signal(signal, saveCurrentInput);
+    }
+}
+
+// Mutation ///////////////////////////////////////////////////////////////////
+
+// Opcodes worth planting: the first halves of fused pairs, branches, stack
+// operations and the ones that touch interrupt state.
+static const uint8_t g_interestingOpcodes[] = {
+    0x2a, 0x12, 0x05, 0x0d, 0x15, 0x20, 0x28, 0x30, 0x38, 0x18, 0xfe, 0xf0, 0xe6,
+    0xc3, 0xcd, 0xc9, 0xd9, 0xc5, 0xf1, 0xf5, 0xe8, 0xf8, 0x76, 0x10, 0xf3, 0xfb,
+    0x27, 0xcb, 0x34, 0x35, 0x08, 0xe0, 0xe2,
+};
+
+static void mutate(std::vector<uint8_t>& input, std::mt19937& random) {
+    const int count = 1 + random() % 4;
+    for (int i = 0; i < count; i++) {
+        const size_t size = input.size();
+        const size_t at = size > 0 ? random() % size : 0;
+
+        switch (random() % 7) {
+            case 0: // Flip a bit.
+                if (size > 0) {
+                    input[at] ^= (uint8_t)(1 << (random() % 8));
+                }
+                break;
+            case 1: // Random byte.
+                if (size > 0) {
+                    input[at] = (uint8_t)random();
+                }
+                break;
+            case 2: // An opcode likely to matter.
+                if (size > 0) {
+                    input[at] = g_interestingOpcodes[random() % sizeof(g_interestingOpcodes)];
+                }
+                break;
+            case 3: // A register or flag in the header.
+                if (size > 0) {
+                    input[random() % (size < FUZZ_HEADER_SIZE ? size : FUZZ_HEADER_SIZE)] = (uint8_t)random();
+                }
+                break;
+            case 4: // Grow.
+                if (size < FUZZ_MAX_INPUT) {
+                    const size_t grow = 1 + random() % 64;
+                    for (size_t j = 0; j < grow && input.size() < FUZZ_MAX_INPUT; j++) {
+                        input.push_back((uint8_t)random());
+                    }
+                }
+                break;
+            case 5: // Shrink.
+                if (size > FUZZ_HEADER_SIZE) {
+                    input.resize(size - 1 - random() % (size - FUZZ_HEADER_SIZE));
+                }
+                break;
+            case 6: // Copy a run of bytes within the input.
+                if (size > 1) {
+                    const size_t from = random() % size;
+                    const size_t length = 1 + random() % 16;
+                    for (size_t j = 0; j < length && from + j < size && at + j < size; j++) {
+                        input[at + j] = input[from + j];
+                    }
+                }
+                break;
+        }
+    }
+}
+
+// Modes //////////////////////////////////////////////////////////////////////
+
+static int replay(const std::vector<std::string>& files) {
+    FuzzTarget target;
+    int divergences = 0;
+
+    for (const auto& path : files) {
+        std::vector<uint8_t> input;
+        if (!readFile(path, input)) {
+            std::cerr << "could not read " << path << "\n";
+            return 2;
+        }
+
+        g_currentInput = input.data();
+        g_currentSize = input.size();
+
+        if (target.run(input.data(), input.size()) == FUZZ_DIVERGED) {
+            std::cout << "DIVERGED " << path << "\n" << target.report();
+            divergences++;
+        } else {
+            std::cout << "OK       " << path << "\n";
+        }
+    }
+
+    return divergences > 0 ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    std::string corpusDirectory;
+    std::string crashDirectory = ".";
+    unsigned long long maxRuns = 0;
+    unsigned long seconds = 0;
+    unsigned long seed = 1;
+    bool replaying = false;
+    std::vector<std::string> replayFiles;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+            corpusDirectory = argv[++i];
+        } else if (strcmp(argv[i], "--crashes") == 0 && i + 1 < argc) {
+            crashDirectory = argv[++i];
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            maxRuns = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--replay") == 0) {
+            replaying = true;
+        } else if (replaying && argv[i][0] != '-') {
+            if (!collectFiles(argv[i], { "" }, replayFiles)) {
+                std::cerr << "could not read " << argv[i] << "\n";
+                return 2;
+            }
+        } else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    installCrashHandler(crashDirectory);
+
+    if (replaying) {
+        if (replayFiles.empty()) {
+            printUsage(argv[0]);
+            return 2;
+        }
+
+        return replay(replayFiles);
+    }
+
+    std::vector<std::vector<uint8_t>> corpus;
+    if (!corpusDirectory.empty()) {
+        std::vector<std::string> files;
+        if (!collectFiles(corpusDirectory, { "" }, files)) {
+            std::cerr << "could not read " << corpusDirectory << "\n";
+            return 2;
+        }
+
+        for (const auto& path : files) {
+            std::vector<uint8_t> input;
+            if (readFile(path, input)) {
+                corpus.push_back(input);
+            }
+        }
+    }
+
+    std::mt19937 random(seed);
+    if (corpus.empty()) {
+        // Registers, then a little code at 0 with the PC pointing at it.
+        std::vector<uint8_t> input(FUZZ_HEADER_SIZE + 256);
+        for (auto& byte : input) {
+            byte = (uint8_t)random();
+        }
+        input[10] = 0;
+        input[11] = 0;
+        corpus.push_back(input);
+    }
+
+    FuzzTarget target;
+    std::vector<uint8_t> seen(FUZZ_COVERAGE_SIZE, 0);
+    size_t edges = 0;
+    unsigned long long runs = 0;
+    int divergences = 0;
+
+    // Credit the seeds with what they already reach.
+    for (const auto& input : corpus) {
+        target.run(input.data(), input.size());
+        for (uint32_t i = 0; i < target.edgeCount(); i++) {
+            edges += !seen[target.edges()[i]];
+            seen[target.edges()[i]] = 1;
+        }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto lastReport = start;
+    std::vector<uint8_t> input;
+
+    while (maxRuns == 0 || runs < maxRuns) {
+        input = corpus[random() % corpus.size()];
+        mutate(input, random);
+
+        g_currentInput = input.data();
+        g_currentSize = input.size();
+        const auto outcome = target.run(input.data(), input.size());
+        runs++;
+
+        bool novel = false;
+        for (uint32_t i = 0; i < target.edgeCount(); i++) {
+            const uint16_t edge = target.edges()[i];
+            if (!seen[edge]) {
+                seen[edge] = 1;
+                edges++;
+                novel = true;
+            }
+        }
+
+        if (novel) {
+            corpus.push_back(input);
+            if (!corpusDirectory.empty()) {
+                writeFile(corpusDirectory + "/" + inputName("input", input), input);
+            }
+        }
+
+        if (outcome == FUZZ_DIVERGED) {
+            const std::string path = crashDirectory + "/" + inputName("diverged", input);
+            std::cout << "divergence saved to " << path << "\n" << target.report();
+            writeFile(path, input);
+            divergences++;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now - lastReport >= std::chrono::seconds(1)) {
+            const double elapsed = std::chrono::duration<double>(now - start).count();
+            std::cout << runs << " runs, " << (unsigned long long)(runs / elapsed) << "/s, "
+                      << corpus.size() << " inputs, " << edges << " opcode pairs, "
+                      << divergences << " divergences\n";
+            lastReport = now;
+
+            if (seconds > 0 && elapsed >= seconds) {
+                break;
+            }
+        }
+    }
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << runs << " runs in " << elapsed << " s, " << corpus.size() << " inputs, " << edges
+              << " opcode pairs, " << divergences << " divergences\n";
+
+    return divergences > 0 ? 1 : 0;
+}
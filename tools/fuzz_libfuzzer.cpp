@@ -0,0 +1,19 @@
+#include "Fuzz.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+// libFuzzer entry point for FuzzTarget, built with ENABLE_LIBFUZZER. The
+// compiler's coverage replaces the opcode pair coverage the standalone fuzz
+// tool uses, and a divergence aborts so libFuzzer saves the input.
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static FuzzTarget target;
+
+    if (target.run(data, size) == FUZZ_DIVERGED) {
+        fputs(target.report().c_str(), stderr);
+        abort();
+    }
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "StateHasher.h"
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// Compares two frame hash streams written by gameboyEmulator --hash-out and
+// reports the first frame, and the regions within it, that differ.
+//
+// Exit status: 0 identical, 1 diverged, 2 bad input.
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " <hashes A> <hashes B>\n";
+        return 2;
+    }
+
+    std::vector<StateHasher::FrameHashes> streams[2];
+    for (int i = 0; i < 2; i++) {
+        std::ifstream file(argv[i + 1], std::ios::binary);
+        if (!file || !readFrameHashStream(file, streams[i])) {
+            std::cerr << "could not read " << argv[i + 1] << "\n";
+            return 2;
+        }
+    }
+
+    const size_t common = streams[0].size() < streams[1].size() ? streams[0].size() : streams[1].size();
+
+    for (size_t frame = 0; frame < common; frame++) {
+        const auto& a = streams[0][frame].regions;
+        const auto& b = streams[1][frame].regions;
+
+        bool diverged = false;
+        for (int region = 0; region < StateHasher::REGION_COUNT; region++) {
+            diverged = diverged || a[region] != b[region];
+        }
+
+        if (!diverged) {
+            continue;
+        }
+
+        std::cout << "first divergence at frame " << frame << ":";
+        for (int region = 0; region < StateHasher::REGION_COUNT; region++) {
+            if (a[region] != b[region]) {
+                std::cout << " " << StateHasher::regionName((StateHasher::Region)region);
+            }
+        }
+        std::cout << "\n";
+
+        return 1;
+    }
+
+    if (streams[0].size() != streams[1].size()) {
+        std::cout << "identical for " << common << " frames, then one stream ends ("
+                  << streams[0].size() << " vs " << streams[1].size() << " frames)\n";
+        return 1;
+    }
+
+    std::cout << "identical for " << common << " frames\n";
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "Lockstep.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FileList.h"
+
+// Runs each ROM on two engines side by side and reports the first point where
+// they disagree, with enough of the machine state to start debugging from.
+//
+// Directories are searched recursively for .gb and .gbc files, which are
+// shared out between worker threads.
+//
+// Exit status: 0 every ROM ran the same on both, 1 divergences, 2 bad input.
+
+static void printUsage(const char* program) {
+    std::cerr << "usage: " << program << " <rom or directory>... [options]\n"
+              << "  --engines A,B     engines to compare: plain, fusion, idle, fast, accurate\n"
+              << "                    (default plain,fast)\n"
+              << "  --jobs N          ROMs run at once (default: one per core)\n"
+              << "  --frames N        frames to run each ROM for (default "
+              << DEFAULT_LOCKSTEP_FRAMES << ")\n";
+}
+
+static bool parseEngines(const std::string& value, LockstepEngine& first, LockstepEngine& second) {
+    const size_t comma = value.find(',');
+    return comma != std::string::npos &&
+        lockstepEngine(value.substr(0, comma), first) &&
+        lockstepEngine(value.substr(comma + 1), second);
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> roms;
+    unsigned long jobs = std::thread::hardware_concurrency();
+    unsigned long frames = DEFAULT_LOCKSTEP_FRAMES;
+    LockstepEngine first, second;
+    parseEngines("plain,fast", first, second);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--engines") == 0 && i + 1 < argc) {
+            if (!parseEngines(argv[++i], first, second)) {
+                printUsage(argv[0]);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = strtoul(argv[++i], nullptr, 10);
+        } else if (argv[i][0] == '-') {
+            printUsage(argv[0]);
+            return 2;
+        } else if (!collectFiles(argv[i], { ".gb", ".gbc" }, roms)) {
+            std::cerr << "could not read " << argv[i] << "\n";
+            return 2;
+        }
+    }
+
+    if (roms.empty()) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    std::sort(roms.begin(), roms.end());
+    jobs = std::max(1UL, std::min<unsigned long>(jobs, roms.size()));
+
+    std::vector<LockstepResult> results(roms.size());
+    std::vector<uint8_t> readable(roms.size(), 1);
+    std::atomic<size_t> next(0);
+
+    std::vector<std::thread> workers;
+    for (unsigned long i = 0; i < jobs; i++) {
+        workers.emplace_back([&]() {
+            for (size_t index = next++; index < roms.size(); index = next++) {
+                std::vector<uint8_t> rom;
+                if (!readFile(roms[index], rom)) {
+                    readable[index] = 0;
+                    continue;
+                }
+
+                results[index] = runLockstep(rom, first, second, (uint32_t)frames);
+            }
+        });
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    int divergences = 0;
+    for (size_t i = 0; i < roms.size(); i++) {
+        if (!readable[i]) {
+            std::cerr << "could not read " << roms[i] << "\n";
+            return 2;
+        }
+
+        const auto& result = results[i];
+        std::cout << std::left << std::setw(9) << (result.diverged ? "DIVERGED" : "SAME") << std::right
+                  << std::setw(6) << result.frames << " frames " << std::setw(10) << result.comparisons
+                  << " matches " << std::fixed << std::setprecision(1) << std::setw(9)
+                  << result.seconds * 1000.0 << " ms  " << roms[i] << "\n";
+
+        if (result.diverged) {
+            divergences++;
+            std::cout << result.report
+                      << "  reproduce: " << argv[0] << " " << roms[i] << " --engines " << first.name << ","
+                      << second.name << " --frames " << result.frames + 1 << "\n";
+        }
+    }
+
+    std::cout << roms.size() - divergences << " of " << roms.size() << " ROMs ran the same on "
+              << first.name << " and " << second.name << "\n";
+
+    return divergences > 0 ? 1 : 0;
+}
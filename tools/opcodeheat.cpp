@@ -0,0 +1,109 @@
+#include "OpcodeHeat.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "FileList.h"
+
+// Counts the opcodes a ROM corpus executes and writes the layout header that
+// OPCODE_LAYOUT builds the CPU with, hot handlers together and cold ones out
+// of line:
+//
+//     opcodeheat roms/ --out layout.h
+//     cmake -DOPCODE_LAYOUT=$PWD/layout.h ..
+//
+// Each ROM runs from power on without input for --frames frames, so games
+// are profiled on their title screens and attract modes.
+
+#define DEFAULT_HEAT_FRAMES 3600
+
+static void printUsage(const char* program) {
+    std::cerr << "usage: " << program << " <rom or directory>... [options]\n"
+              << "  --frames N   frames to run each ROM for (default " << DEFAULT_HEAT_FRAMES << ")\n"
+              << "  --out FILE   write the layout to FILE rather than stdout\n";
+}
+
+// How many opcodes, busiest first, it takes to cover each share of the run.
+static void printCoverage(const OpcodeProfile& profile) {
+    std::vector<uint64_t> counts;
+    for (int opcode = 0; opcode < 256; opcode++) {
+        if (profile.count((uint8_t)opcode) != 0) {
+            counts.push_back(profile.count((uint8_t)opcode));
+        }
+    }
+
+    std::sort(counts.rbegin(), counts.rend());
+
+    const double total = (double)profile.total();
+    std::cerr << counts.size() << " opcodes seen;";
+    for (const double share : { 0.9, 0.95, 0.99 }) {
+        uint64_t covered = 0;
+        size_t needed = 0;
+        while (needed < counts.size() && covered < total * share) {
+            covered += counts[needed++];
+        }
+
+        std::cerr << " " << needed << " cover " << share * 100 << "%";
+    }
+
+    std::cerr << "\n";
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> roms;
+    unsigned long frames = DEFAULT_HEAT_FRAMES;
+    const char* outPath = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (argv[i][0] == '-') {
+            printUsage(argv[0]);
+            return 2;
+        } else if (!collectFiles(argv[i], { ".gb", ".gbc" }, roms)) {
+            std::cerr << "could not read " << argv[i] << "\n";
+            return 2;
+        }
+    }
+
+    if (roms.empty()) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    std::sort(roms.begin(), roms.end());
+
+    OpcodeProfile profile;
+    for (const auto& path : roms) {
+        std::vector<uint8_t> rom;
+        if (!readFile(path, rom)) {
+            std::cerr << "could not read " << path << "\n";
+            return 2;
+        }
+
+        GameBoy gameBoy(rom);
+        profile.run(gameBoy, (uint32_t)frames);
+    }
+
+    std::cerr << roms.size() << " ROMs, " << profile.total() << " instructions\n";
+    printCoverage(profile);
+
+    if (!outPath) {
+        return profile.writeLayout(std::cout) ? 0 : 1;
+    }
+
+    std::ofstream out(outPath);
+    if (!out || !profile.writeLayout(out)) {
+        std::cerr << "could not write " << outPath << "\n";
+        return 1;
+    }
+
+    return 0;
+}
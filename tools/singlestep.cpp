@@ -0,0 +1,152 @@
+#include "SingleStep.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FileList.h"
+
+// Runs SingleStepTests-style JSON vectors against the CPU, one instruction
+// per case, and reports which opcodes don't match.
+//
+// Directories are searched recursively for .json files. Files are shared out
+// between worker threads, each with its own CPU and memory.
+//
+// Exit status: 0 every case passed, 1 mismatches, 2 bad input.
+
+static void printUsage(const char* program) {
+    std::cerr << "usage: " << program << " <file or directory>... [options]\n"
+              << "  --jobs N          files read at once (default: one per core)\n"
+              << "  --ignore-cycles   don't compare machine cycle counts\n"
+              << "  --verbose         list passing opcodes too\n";
+}
+
+// Reads into a buffer reused from file to file.
+static bool readFile(const std::string& path, std::vector<char>& data) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    data.resize(size > 0 ? (size_t)size : 0);
+    const bool ok = size >= 0 && fread(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> files;
+    unsigned long jobs = std::thread::hardware_concurrency();
+    bool checkCycles = true;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--ignore-cycles") == 0) {
+            checkCycles = false;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        } else if (argv[i][0] == '-') {
+            printUsage(argv[0]);
+            return 2;
+        } else if (!collectFiles(argv[i], { ".json" }, files)) {
+            std::cerr << "could not read " << argv[i] << "\n";
+            return 2;
+        }
+    }
+
+    if (files.empty()) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    std::sort(files.begin(), files.end());
+    jobs = std::max(1UL, std::min<unsigned long>(jobs, files.size()));
+
+    // Each worker tallies on its own; the tallies are merged afterwards.
+    std::vector<std::vector<SingleStepTally>> tallies(jobs, std::vector<SingleStepTally>(SINGLE_STEP_OPCODES));
+    std::vector<uint8_t> readable(files.size(), 1);
+    std::atomic<size_t> next(0);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (unsigned long i = 0; i < jobs; i++) {
+        workers.emplace_back([&, i]() {
+            SingleStepRunner runner;
+            runner.checkCycles(checkCycles);
+
+            std::vector<char> data;
+            for (size_t index = next++; index < files.size(); index = next++) {
+                if (!readFile(files[index], data) ||
+                    !runner.runFile(data.data(), data.data() + data.size(), tallies[i])) {
+                    readable[index] = 0;
+                }
+            }
+        });
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!readable[i]) {
+            std::cerr << "could not read " << files[i] << "\n";
+            return 2;
+        }
+    }
+
+    uint64_t cases = 0;
+    uint64_t failures = 0;
+    int failingOpcodes = 0;
+
+    for (int opcode = 0; opcode < SINGLE_STEP_OPCODES; opcode++) {
+        SingleStepTally total = { 0, 0, std::string() };
+        for (const auto& tally : tallies) {
+            total.passed += tally[opcode].passed;
+            total.failed += tally[opcode].failed;
+            if (total.firstFailure.empty()) {
+                total.firstFailure = tally[opcode].firstFailure;
+            }
+        }
+
+        if (total.passed + total.failed == 0) {
+            continue;
+        }
+
+        cases += total.passed + total.failed;
+        failures += total.failed;
+        failingOpcodes += total.failed > 0 ? 1 : 0;
+
+        if (total.failed > 0 || verbose) {
+            char label[8];
+            snprintf(label, sizeof(label), opcode >= 0x100 ? "cb %02x" : "%02x", opcode & 0xff);
+            std::cout << (total.failed > 0 ? "FAIL " : "PASS ") << label << "  "
+                      << total.failed << "/" << total.passed + total.failed << " failed";
+            if (total.failed > 0) {
+                std::cout << "  first: " << total.firstFailure;
+            }
+            std::cout << "\n";
+        }
+    }
+
+    std::cout << cases << " cases, " << failures << " failed across " << failingOpcodes << " opcodes; "
+              << files.size() << " files in " << seconds << " s on " << jobs << " jobs\n";
+
+    return failures > 0 ? 1 : 0;
+}